@@ -25,10 +25,6 @@
     #ifndef _INC_WINDOWS
         #include <windows.h>
     #endif
-#else
-    #ifndef _X11_XUTIL_H_H
-        #include <X11/Xutil.h>
-    #endif
 #endif
 
 /*****************************************************************************/
@@ -96,18 +92,35 @@ extern "C" {
     typedef RECT            II_RECT;        /* rectangle */
     typedef HANDLE          II_HFILE;       /* file handle */
 #else
-    /* X Window System */
-    typedef XImage *        II_HIMAGE;
-    typedef XImage *        II_IMGINFO;
-    typedef Display *       II_DEVICE;
-    typedef void *          II_LPVOID;
-    typedef const void *    II_LPCVOID;
-    typedef const char *    II_CSTR;
-    typedef const wchar_t * II_CWSTR;
-    typedef void *          II_INST;
-    typedef Window          II_WND;
-    typedef XRectangle      II_RECT;
-    typedef void *          II_HFILE;
+    /* memory image (see II_IMAGE below) */
+    typedef struct II_IMAGE *   II_HIMAGE;  /* image handle */
+    typedef struct II_IMAGE *   II_DEVICE;  /* drawing target is an image */
+    typedef void *          II_LPVOID;      /* pointer to void */
+    typedef const void *    II_LPCVOID;     /* pointer to const void */
+    typedef const char *    II_CSTR;        /* pointer to const string */
+    typedef const wchar_t * II_CWSTR;       /* pointer to const wide string */
+    typedef void *          II_INST;        /* instance handle (unused) */
+    typedef void *          II_WND;         /* window (unused) */
+    typedef FILE *          II_HFILE;       /* file handle */
+
+    /* rectangle */
+    typedef struct II_RECT
+    {
+        int32_t left, top, right, bottom;
+    } II_RECT;
+
+    /* image info */
+    /* NOTE: The members are named after the ones of BITMAP. */
+    typedef struct II_IMGINFO
+    {
+        int32_t     bmType;             /* zero */
+        int32_t     bmWidth;            /* width in pixels */
+        int32_t     bmHeight;           /* height in pixels */
+        int32_t     bmWidthBytes;       /* bytes per row */
+        uint16_t    bmPlanes;           /* one */
+        uint16_t    bmBitsPixel;        /* bits per pixel */
+        void *      bmBits;             /* pointer to pixels */
+    } II_IMGINFO;
 #endif
 
 /*****************************************************************************/
@@ -150,10 +163,59 @@ extern "C" {
 
 typedef unsigned int II_FLAGS;
 
+/* NOTE: Each operation has its own range of the bits of II_FLAGS:
+ *       bits 0-7:   animations (II_FLAG_USE_SCREEN, II_FLAG_DEFAULT_PRESENT)
+ *       bits 8-15:  color reduction (II_FLAG_ORDERED_DITHER)
+ *       bits 16-23: flipping (II_FLAG_FLIP_HORIZONTAL, II_FLAG_FLIP_VERTICAL)
+ *       bits 24-31: compositing (II_FLAG_PREMULTIPLIED) */
+
 /* NOTE: II_FLAG_USE_SCREEN indicates the function uses screen image. */
 #define II_FLAG_USE_SCREEN          1
 /* NOTE: II_FLAG_DEFAULT_PRESENT indicates the default image of APNG exists. */
 #define II_FLAG_DEFAULT_PRESENT     2
+/* NOTE: II_FLAG_ORDERED_DITHER makes ii_reduce_colors_ex use the ordered
+ *       dithering instead of Floyd-Steinberg. */
+#define II_FLAG_ORDERED_DITHER      0x100
+/* NOTE: II_FLAG_FLIP_HORIZONTAL and II_FLAG_FLIP_VERTICAL are the directions
+ *       of ii_flip_inplace. */
+#define II_FLAG_FLIP_HORIZONTAL     0x10000
+#define II_FLAG_FLIP_VERTICAL       0x20000
+/* NOTE: II_FLAG_PREMULTIPLIED tells ii_composite the 32bpp source has been
+ *       premultiplied by alpha. */
+#define II_FLAG_PREMULTIPLIED       0x1000000
+
+/*****************************************************************************/
+/* memory */
+
+/* NOTE: ii_alloc returns memory aligned to II_ALIGN bytes. */
+#define II_ALIGN    64
+
+/* allocator */
+typedef struct II_ALLOCATOR
+{
+    void * (IICAPI *alloc_proc)(size_t size, void *user);
+    void   (IICAPI *free_proc)(void *ptr, void *user);
+    void *          user;
+} II_ALLOCATOR;
+
+/* NOTE: The pixels of memory images and the temporary buffers of the
+ *       library come from ii_alloc. By default, ii_alloc reuses the freed
+ *       blocks of a size-class pool up to 64 MiB. A custom allocator of
+ *       ii_set_allocator bypasses the pool. ii_set_allocator(NULL) restores
+ *       it. ii_pool_trim frees the pooled blocks. */
+IMAIO_API void   IIAPI ii_set_allocator(const II_ALLOCATOR *allocator);
+IMAIO_API void * IIAPI ii_alloc(size_t size);
+IMAIO_API void   IIAPI ii_free(void *ptr);
+IMAIO_API void   IIAPI ii_pool_trim(void);
+
+/*****************************************************************************/
+/* SIMD */
+
+/* NOTE: The library uses SSE2 on x86 builds and picks the SSSE3 and AVX2
+ *       code at run time if the CPU has them. ii_set_simd(false) makes it
+ *       use the portable C code only, e.g. to compare the results or the
+ *       speed. The results are the same either way. */
+IMAIO_API void   IIAPI ii_set_simd(bool use_simd);
 
 /*****************************************************************************/
 /* structures */
@@ -180,6 +242,34 @@ typedef struct II_PALETTE
     int         num_colors;
 } II_PALETTE;
 
+/* view (a rectangle of an image without copying the pixels) */
+/* NOTE: The image must outlive its views. Like ii_get_info, info.bmBits
+ *       points to the bottom row and the rows go upward. */
+typedef struct II_VIEW
+{
+    II_IMGINFO  info;       /* size, bpp, stride and pixels of the rectangle */
+    II_HIMAGE   hbm;        /* the image of the pixels and the palette */
+    int         x, y;       /* the position of the rectangle in hbm */
+} II_VIEW;
+
+#ifndef _WIN32
+    /* memory image */
+    /* NOTE: The rows are stored bottom-up as a DIB section. data (the
+     *       bottom row) is II_ALIGN-byte aligned. The rows after it are
+     *       stride bytes apart, so they are only 4-byte aligned. */
+    typedef struct II_IMAGE
+    {
+        int             width;          /* width in pixels */
+        int             height;         /* height in pixels */
+        int             bpp;            /* 1, 4, 8, 24 or 32 */
+        int             stride;         /* bytes per row (4-byte aligned) */
+        II_PALETTE      palette;        /* color table if bpp <= 8 */
+        uint8_t *       data;           /* II_ALIGN-byte aligned pixels */
+        int *           refs;           /* count of images sharing data */
+        int             alpha_state;    /* the cached II_ALPHA_STATE */
+    } II_IMAGE;
+#endif
+
 /* animated gif frame */
 typedef struct II_ANIGIF_FRAME
 {
@@ -253,6 +343,45 @@ typedef struct II_APNG
     float           dpi;
 } II_APNG;
 
+/*****************************************************************************/
+/* streams */
+
+/* NOTE: II_STREAM is the I/O of the *_load_stream and *_save_stream
+ *       functions, which neither close nor free the stream. seek_proc takes
+ *       SEEK_SET, SEEK_CUR or SEEK_END. map_proc is optional; it returns the
+ *       whole contents of a read-only stream without copying. */
+typedef struct II_STREAM
+{
+    size_t  (IICAPI *read_proc)(struct II_STREAM *stream, void *pv, size_t cb);
+    size_t  (IICAPI *write_proc)(struct II_STREAM *stream, const void *pv,
+                                 size_t cb);
+    bool    (IICAPI *seek_proc)(struct II_STREAM *stream, int64_t offset,
+                                int origin);
+    int64_t (IICAPI *tell_proc)(struct II_STREAM *stream);
+    int64_t (IICAPI *size_proc)(struct II_STREAM *stream);
+    const void * (IICAPI *map_proc)(struct II_STREAM *stream, size_t *pcb);
+    void *  user;           /* the FILE or II_MEMORY of the built-in streams */
+} II_STREAM;
+
+IMAIO_API void IIAPI ii_stream_init_file(II_STREAM *stream, FILE *fp);
+IMAIO_API void IIAPI ii_stream_init_mem(II_STREAM *stream, II_MEMORY *memory);
+
+/*****************************************************************************/
+/* memory-mapped files */
+
+/* NOTE: ii_map_file_a/w map a whole file read-only and set m_pb and m_size
+ *       of memory, so ii_stream_init_mem can read it without copying. They
+ *       fail for an empty file or a file of 4 GiB or more. */
+IMAIO_API bool IIAPI ii_map_file_a(II_MEMORY *memory, II_CSTR pszFileName);
+IMAIO_API bool IIAPI ii_map_file_w(II_MEMORY *memory, II_CWSTR pszFileName);
+IMAIO_API void IIAPI ii_unmap_file(II_MEMORY *memory);
+
+#ifdef UNICODE
+    #define ii_map_file ii_map_file_w
+#else
+    #define ii_map_file ii_map_file_a
+#endif
+
 /*****************************************************************************/
 /* bitmap image manipulation */
 
@@ -282,6 +411,14 @@ IMAIO_API II_HIMAGE IIAPI ii_create_32bpp_white(int cx, int cy);
 IMAIO_API II_HIMAGE IIAPI ii_create_32bpp_checker(int cx, int cy);
 
 IMAIO_API II_HIMAGE IIAPI ii_clone(II_HIMAGE hbm);
+/* NOTE: ii_share makes an image that shares the pixels until either image
+ *       is modified (copy on write). The library functions that modify an
+ *       image call ii_make_writable. Call it before writing to the pixels of
+ *       ii_get_info or ii_get_pixels. The frame screens of II_ANIGIF and
+ *       II_APNG may be shared. On Windows, ii_share is ii_clone.
+ *       The sharing is not thread-safe. */
+IMAIO_API II_HIMAGE IIAPI ii_share(II_HIMAGE hbm);
+IMAIO_API bool IIAPI      ii_make_writable(II_HIMAGE hbm);
 IMAIO_API void IIAPI      ii_destroy(II_HIMAGE hbm);
 
 /*
@@ -291,10 +428,30 @@ IMAIO_API II_HIMAGE IIAPI ii_stretched(II_HIMAGE hbm, int cxNew, int cyNew);
 IMAIO_API II_HIMAGE IIAPI ii_stretched_24bpp(II_HIMAGE hbm, int cxNew, int cyNew);
 IMAIO_API II_HIMAGE IIAPI ii_stretched_32bpp(II_HIMAGE hbm, int cxNew, int cyNew);
 
+/* filters of ii_resample */
+typedef enum II_FILTER
+{
+    II_FILTER_BOX,          /* area-averaging (fast, good for thumbnails) */
+    II_FILTER_TRIANGLE,     /* bilinear */
+    II_FILTER_LANCZOS       /* Lanczos-3 (sharp) */
+} II_FILTER;
+
+/* NOTE: ii_resample keeps 32bpp, 24bpp and 8bpp grayscale images in their
+ *       format. Any other image is resampled as 32bpp. A transparent 32bpp
+ *       image is filtered premultiplied, so its transparent pixels become
+ *       black (0, 0, 0, 0). */
+IMAIO_API II_HIMAGE IIAPI
+ii_resample_view(const II_VIEW *view, int cxNew, int cyNew,
+                 II_FILTER filter ii_optional_(II_FILTER_BOX));
+IMAIO_API II_HIMAGE IIAPI
+ii_resample(II_HIMAGE hbm, int cxNew, int cyNew,
+            II_FILTER filter ii_optional_(II_FILTER_BOX));
+
 /*
  * conversion
  */
 IMAIO_API II_HIMAGE IIAPI ii_8bpp(II_HIMAGE hbm, int num_colors ii_optional_(256));
+IMAIO_API II_HIMAGE IIAPI ii_8bpp_ex(II_HIMAGE hbm, int num_colors, II_FLAGS flags);
 IMAIO_API II_HIMAGE IIAPI ii_trans_8bpp(II_HIMAGE hbm, int *pi_trans);
 IMAIO_API II_HIMAGE IIAPI ii_trans_8bpp_from_32bpp(II_HIMAGE hbm32bpp, int *pi_trans);
 IMAIO_API II_HIMAGE IIAPI ii_24bpp(II_HIMAGE hbm);
@@ -304,12 +461,38 @@ IMAIO_API II_HIMAGE IIAPI ii_24bpp_or_32bpp(II_HIMAGE hbm);
 IMAIO_API II_HIMAGE IIAPI ii_grayscale_8bpp(II_HIMAGE hbm);
 IMAIO_API II_HIMAGE IIAPI ii_grayscale_32bpp(II_HIMAGE hbm);
 
+/* the byte order of the pixels of a row */
+typedef enum II_PIXEL_FORMAT
+{
+    II_PIXEL_FORMAT_GRAY8,      /* gray */
+    II_PIXEL_FORMAT_BGR24,      /* B, G, R (24bpp images) */
+    II_PIXEL_FORMAT_RGB24,      /* R, G, B (JPEG, PNG and TIFF rows) */
+    II_PIXEL_FORMAT_BGRA32,     /* B, G, R, A (32bpp images) */
+    II_PIXEL_FORMAT_RGBA32      /* R, G, B, A */
+} II_PIXEL_FORMAT;
+
+/* NOTE: ii_convert_pixels converts the rows of width pixels. The gray is
+ *       (b + g + r) / 3 and the alpha from no alpha is 255. It works in
+ *       place if the destination pixel is not larger than the source's. */
+IMAIO_API bool IIAPI
+ii_convert_pixels(II_PIXEL_FORMAT src_fmt, II_LPCVOID src, int src_stride,
+                  II_PIXEL_FORMAT dst_fmt, II_LPVOID dst, int dst_stride,
+                  int width, int height);
+
 /*
  * rotation or flipping
  */
 IMAIO_API II_HIMAGE IIAPI ii_rotated_32bpp(II_HIMAGE hbmSrc, double angle, bool fGrow);
 IMAIO_API II_HIMAGE IIAPI ii_flipped_horizontal(II_HIMAGE hbmSrc);
 IMAIO_API II_HIMAGE IIAPI ii_flipped_vertical(II_HIMAGE hbmSrc);
+/* NOTE: ii_flip_inplace flips an image of 8bpp, 24bpp or 32bpp without
+ *       allocation. II_FLAG_FLIP_VERTICAL works on any bpp. */
+IMAIO_API bool IIAPI ii_flip_inplace(II_HIMAGE hbm, II_FLAGS flags);
+/* NOTE: ii_transpose swaps x and y. ii_rotate90 rotates by turns * 90 degrees
+ *       counterclockwise, like ii_rotated_32bpp with a positive angle.
+ *       They keep 8bpp, 24bpp and 32bpp images in their format. */
+IMAIO_API II_HIMAGE IIAPI ii_transpose(II_HIMAGE hbmSrc);
+IMAIO_API II_HIMAGE IIAPI ii_rotate90(II_HIMAGE hbmSrc, int turns);
 
 /*
  * getting info
@@ -322,12 +505,34 @@ IMAIO_API int           IIAPI ii_get_height(II_HIMAGE hbm);
 IMAIO_API II_PALETTE *  IIAPI ii_get_palette(II_HIMAGE hbm);
 IMAIO_API bool          IIAPI ii_is_opaque(II_HIMAGE hbm);
 
+/* the opacity of the pixels */
+typedef enum II_ALPHA_STATE
+{
+    II_ALPHA_UNKNOWN,       /* not scanned or invalid */
+    II_ALPHA_OPAQUE,        /* every alpha is 255 (or no alpha channel) */
+    II_ALPHA_BINARY,        /* every alpha is 0 or 255 */
+    II_ALPHA_SEMITRANS      /* some alpha is neither 0 nor 255 */
+} II_ALPHA_STATE;
+
+/* NOTE: A memory image caches its alpha state until ii_make_writable or
+ *       ii_get_info (which hands out the pixels) is called. Get the pixels
+ *       again after ii_get_alpha_state before writing to them, or use
+ *       ii_is_opaque, which scans every time. On Windows,
+ *       ii_get_alpha_state scans the pixels every time. */
+IMAIO_API II_ALPHA_STATE IIAPI ii_get_alpha_state(II_HIMAGE hbm);
+IMAIO_API II_ALPHA_STATE IIAPI ii_view_alpha_state(const II_VIEW *view);
+
 /*
  * drawing
  */
 
 /* for AlphaBlend API and/or layered windows */
-IMAIO_API VOID IIAPI ii_premultiply(II_HIMAGE hbm32bpp);
+IMAIO_API void IIAPI ii_premultiply(II_HIMAGE hbm32bpp);
+/* NOTE: ii_unpremultiply undoes ii_premultiply as far as the rounding allows:
+ *       for a premultiplied pixel p (no color above the alpha), ii_premultiply
+ *       of ii_unpremultiply of p is p again. The colors of the transparent
+ *       pixels become black. */
+IMAIO_API void IIAPI ii_unpremultiply(II_HIMAGE hbm32bpp);
 
 IMAIO_API void IIAPI
 ii_make_opaque(II_HIMAGE hbm32bpp, int x, int y, int cx, int cy);
@@ -336,31 +541,42 @@ IMAIO_API
 void IIAPI ii_draw(
     II_DEVICE hdc, int x, int y,
     II_HIMAGE hbmSrc, int xSrc, int ySrc, int cxSrc, int cySrc,
-    const int *pi_trans ii_optional, BYTE bSCA ii_optional_(255));
+    const int *pi_trans ii_optional, uint8_t bSCA ii_optional_(255));
 IMAIO_API
 void IIAPI ii_draw_center(
     II_DEVICE hdc, int x, int y,
     II_HIMAGE hbmSrc, int xSrc, int ySrc, int cxSrc, int cySrc,
-    const int *pi_trans ii_optional, BYTE bSCA ii_optional_(255));
+    const int *pi_trans ii_optional, uint8_t bSCA ii_optional_(255));
 
 IMAIO_API
 void IIAPI ii_put(
     II_HIMAGE hbm, int x, int y,
     II_HIMAGE hbmSrc, int xSrc, int ySrc, int cxSrc, int cySrc,
-    const int *pi_trans ii_optional, BYTE bSCA ii_optional_(255));
+    const int *pi_trans ii_optional, uint8_t bSCA ii_optional_(255));
 IMAIO_API
 void IIAPI ii_put_center(
     II_HIMAGE hbm, int x, int y,
     II_HIMAGE hbmSrc, int xSrc, int ySrc, int cxSrc, int cySrc,
-    const int *pi_trans ii_optional, BYTE bSCA ii_optional_(255));
+    const int *pi_trans ii_optional, uint8_t bSCA ii_optional_(255));
 
 IMAIO_API void IIAPI
     ii_stamp(II_HIMAGE hbm, int x, int y, II_HIMAGE hbmSrc,
-        const int *pi_trans ii_optional, BYTE bSCA ii_optional_(255));
+        const int *pi_trans ii_optional, uint8_t bSCA ii_optional_(255));
 IMAIO_API void IIAPI
     ii_stamp_center(
         II_HIMAGE hbm, int x, int y, II_HIMAGE hbmSrc,
-        const int *pi_trans ii_optional, BYTE bSCA ii_optional_(255));
+        const int *pi_trans ii_optional, uint8_t bSCA ii_optional_(255));
+
+/* NOTE: ii_composite blends the rectangle of hbmSrc onto the 24bpp or 32bpp
+ *       DIB hbm in place, with the source-over operator. Only the clipped
+ *       rectangle is read. It returns false if hbm is not such a DIB or
+ *       hbmSrc is not a 1, 4, 8, 24 or 32bpp DIB. */
+IMAIO_API bool IIAPI
+ii_composite(
+    II_HIMAGE hbm, int x, int y,
+    II_HIMAGE hbmSrc, int xSrc, int ySrc, int cx, int cy,
+    const int *pi_trans ii_optional, uint8_t bSCA ii_optional_(255),
+    II_FLAGS flags ii_optional);
 /*
  * trimming
  */
@@ -372,11 +588,27 @@ IMAIO_API II_HIMAGE IIAPI
 ii_subimage_8bpp_minus(
     II_HIMAGE hbm, int x, int y, int cx, int cy, int bpp ii_optional_(8));
 
+/*
+ * views
+ */
+IMAIO_API bool IIAPI ii_view_create(II_VIEW *view, II_HIMAGE hbm);
+/* NOTE: (x, y) is the top-left of the rectangle, as in ii_subimage.
+ *       A view of 1bpp or 4bpp must start at a byte boundary. */
+IMAIO_API bool IIAPI
+ii_view_sub(II_VIEW *sub, const II_VIEW *view, int x, int y, int cx, int cy);
+/* NOTE: ii_view_image copies the view into a new image of the same bpp. */
+IMAIO_API II_HIMAGE IIAPI ii_view_image(const II_VIEW *view);
+IMAIO_API void IIAPI
+ii_put_view(II_HIMAGE hbm, int x, int y, const II_VIEW *view,
+            const int *pi_trans ii_optional, uint8_t bSCA ii_optional_(255));
+
 /*****************************************************************************/
 /* screenshot */
 
-IMAIO_API II_HIMAGE IIAPI ii_screenshot(
-    II_WND window ii_optional, const II_RECT *position ii_optional);
+#ifdef _WIN32
+    IMAIO_API II_HIMAGE IIAPI ii_screenshot(
+        II_WND window ii_optional, const II_RECT *position ii_optional);
+#endif
 
 /*****************************************************************************/
 /* colors */
@@ -406,14 +638,57 @@ ii_palette_for_anigif(
 IMAIO_API II_PALETTE * IIAPI
 ii_palette_for_pixels(int num_pixels, const uint32_t *pixels, int num_colors);
 
+/* NOTE: The same seed gives the same palette for the same pixels. */
+IMAIO_API II_PALETTE * IIAPI
+ii_palette_for_pixels_ex(int num_pixels, const uint32_t *pixels,
+                         int num_colors, uint32_t seed ii_optional);
+
 IMAIO_API void IIAPI ii_palette_destroy(II_PALETTE *palette);
 
 IMAIO_API int IIAPI
 ii_color_nearest_index(const II_PALETTE *table, const II_COLOR8 *pcolor);
 
+/* the palette in the planes of blue, green and red for the SIMD search */
+/* NOTE: The planes are padded by the first color up to a multiple of 16. */
+typedef struct II_PALETTE_PLANES
+{
+    int16_t     b[256 + 16];
+    int16_t     g[256 + 16];
+    int16_t     r[256 + 16];
+    int         num_colors;
+} II_PALETTE_PLANES;
+
+IMAIO_API void IIAPI
+ii_palette_planes_init(II_PALETTE_PLANES *planes, const II_PALETTE *table);
+
+/* NOTE: The result is always the same as ii_color_nearest_index. */
+IMAIO_API int IIAPI
+ii_palette_planes_nearest(const II_PALETTE_PLANES *planes,
+                          const II_COLOR8 *pcolor);
+
+/* the inverse color map of a palette for fast ii_color_nearest_index */
+typedef struct II_PALETTE_INDEX II_PALETTE_INDEX;
+
+IMAIO_API II_PALETTE_INDEX * IIAPI
+ii_palette_index_create(const II_PALETTE *table);
+
+/* NOTE: The result is always the same as ii_color_nearest_index. */
+IMAIO_API int IIAPI
+ii_palette_index_nearest(II_PALETTE_INDEX *index, const II_COLOR8 *pcolor);
+
+IMAIO_API void IIAPI ii_palette_index_destroy(II_PALETTE_INDEX *index);
+
 IMAIO_API II_HIMAGE IIAPI ii_reduce_colors(
     II_HIMAGE hbm, const II_PALETTE *table, const int *pi_trans ii_optional);
 
+IMAIO_API II_HIMAGE IIAPI ii_reduce_colors_ex(
+    II_HIMAGE hbm, const II_PALETTE *table, const int *pi_trans,
+    II_FLAGS flags);
+
+IMAIO_API II_HIMAGE IIAPI ii_reduce_colors_by_index(
+    II_HIMAGE hbm, II_PALETTE_INDEX *index, const int *pi_trans ii_optional,
+    II_FLAGS flags ii_optional);
+
 IMAIO_API void IIAPI ii_erase_semitrans(II_HIMAGE hbm);
 
 /*****************************************************************************/
@@ -423,8 +698,15 @@ IMAIO_API II_HIMAGE IIAPI
     ii_alpha_channel_from_32bpp(II_HIMAGE hbm32bpp);
 IMAIO_API II_HIMAGE IIAPI
     ii_add_alpha_channel(II_HIMAGE hbmAlpha, II_HIMAGE hbm);
+/* NOTE: ii_store_alpha_channel ORs the average of the channels of the mask
+ *       into the alpha. The masks other than 1, 4, 8, 24 or 32bpp DIBs are
+ *       converted by ii_32bpp first. */
 IMAIO_API void IIAPI
     ii_store_alpha_channel(II_HIMAGE hbmAlpha, II_HIMAGE hbm32bpp);
+/* NOTE: ii_put_alpha_channel replaces the alpha of the rectangle of hbm32bpp
+ *       at (x, y) with the mask in place. */
+IMAIO_API bool IIAPI
+    ii_put_alpha_channel(II_HIMAGE hbm32bpp, int x, int y, II_HIMAGE hbmAlpha);
 
 /*****************************************************************************/
 /* Windows bitmap */
@@ -440,12 +722,19 @@ ii_bmp_save_w(II_CWSTR pszFileName, II_HIMAGE hbm, float dpi ii_optional);
 IMAIO_API bool IIAPI
 ii_bmp_save_common(II_HFILE hFile, II_HIMAGE hbm, float dpi);
 
+IMAIO_API II_HIMAGE IIAPI
+ii_bmp_load_stream(II_STREAM *stream, float *dpi ii_optional);
+IMAIO_API bool IIAPI
+ii_bmp_save_stream(II_STREAM *stream, II_HIMAGE hbm, float dpi ii_optional);
+
 /* load from resource
  *  ex) II_HIMAGE hbm = ii_bmp_load_res(hInst, MAKEINTRESOURCE(1));
  *      for resource (1 BITMAP "myfile.bmp")
  */
-IMAIO_API II_HIMAGE IIAPI ii_bmp_load_res_a(II_INST hInstance, II_CSTR pszResName);
-IMAIO_API II_HIMAGE IIAPI ii_bmp_load_res_w(II_INST hInstance, II_CWSTR pszResName);
+#ifdef _WIN32
+    IMAIO_API II_HIMAGE IIAPI ii_bmp_load_res_a(II_INST hInstance, II_CSTR pszResName);
+    IMAIO_API II_HIMAGE IIAPI ii_bmp_load_res_w(II_INST hInstance, II_CWSTR pszResName);
+#endif
 
 #ifdef UNICODE
     #define ii_bmp_load ii_bmp_load_w
@@ -463,13 +752,17 @@ IMAIO_API II_HIMAGE IIAPI ii_bmp_load_res_w(II_INST hInstance, II_CWSTR pszResNa
 #ifndef XMD_H
     #define XMD_H
 #endif
-#define HAVE_BOOLEAN
-typedef char ii_jpeg_boolean;
-#undef boolean
-#define boolean ii_jpeg_boolean
+#ifdef _WIN32
+    #define HAVE_BOOLEAN
+    typedef char ii_jpeg_boolean;
+    #undef boolean
+    #define boolean ii_jpeg_boolean
+#endif
 #include "jpeglib.h"
 #include "jerror.h"
-#undef boolean
+#ifdef _WIN32
+    #undef boolean
+#endif
 IMAIO_API II_HIMAGE IIAPI ii_jpg_load_a(II_CSTR pszFileName, float *dpi ii_optional);
 IMAIO_API II_HIMAGE IIAPI ii_jpg_load_w(II_CWSTR pszFileName, float *dpi ii_optional);
 
@@ -483,6 +776,16 @@ ii_jpg_save_w(II_CWSTR pszFileName, II_HIMAGE hbm,
               int quality ii_optional_(100),
               bool progression ii_optional,
               float dpi ii_optional);
+IMAIO_API bool IIAPI
+ii_jpg_save_view_a(II_CSTR pszFileName, const II_VIEW *view,
+                   int quality ii_optional_(100),
+                   bool progression ii_optional,
+                   float dpi ii_optional);
+IMAIO_API bool IIAPI
+ii_jpg_save_view_w(II_CWSTR pszFileName, const II_VIEW *view,
+                   int quality ii_optional_(100),
+                   bool progression ii_optional,
+                   float dpi ii_optional);
 #ifndef __GNUC__
     #ifdef _WIN32
         #pragma comment(lib, "jpeg.lib")
@@ -492,9 +795,11 @@ ii_jpg_save_w(II_CWSTR pszFileName, II_HIMAGE hbm,
 #ifdef UNICODE
     #define ii_jpg_load ii_jpg_load_w
     #define ii_jpg_save ii_jpg_save_w
+    #define ii_jpg_save_view ii_jpg_save_view_w
 #else
     #define ii_jpg_load ii_jpg_load_a
     #define ii_jpg_save ii_jpg_save_a
+    #define ii_jpg_save_view ii_jpg_save_view_a
 #endif
 
 IMAIO_API II_HIMAGE IIAPI ii_jpg_load_common(FILE *fp, float *dpi);
@@ -502,6 +807,22 @@ IMAIO_API II_HIMAGE IIAPI ii_jpg_load_common(FILE *fp, float *dpi);
 IMAIO_API bool IIAPI
 ii_jpg_save_common(FILE *fp, II_HIMAGE hbm,
                    int quality, bool progression, float dpi);
+IMAIO_API bool IIAPI
+ii_jpg_save_view_common(FILE *fp, const II_VIEW *view,
+                        int quality, bool progression, float dpi);
+
+/* NOTE: The JPEG errors make the functions fail instead of exiting. */
+IMAIO_API II_HIMAGE IIAPI
+ii_jpg_load_stream(II_STREAM *stream, float *dpi ii_optional);
+IMAIO_API bool IIAPI
+ii_jpg_save_stream(II_STREAM *stream, II_HIMAGE hbm,
+                   int quality ii_optional_(100),
+                   bool progression ii_optional,
+                   float dpi ii_optional);
+
+/* load from memory */
+IMAIO_API II_HIMAGE IIAPI
+ii_jpg_load_mem(II_LPCVOID pv, uint32_t cb, float *dpi ii_optional);
 
 /*****************************************************************************/
 /* gif */
@@ -535,18 +856,20 @@ ii_gif_load_32bpp_mem(II_LPCVOID pv, uint32_t cb);
  *  ex) II_HIMAGE hbm = ii_gif_load_8bpp_res(hInst, MAKEINTRESOURCE(1), NULL);
  *      for resource (1 GIF "myfile.gif")
  */
-IMAIO_API II_HIMAGE IIAPI
-ii_gif_load_8bpp_res_a(II_INST hInstance, II_CSTR pszResName,
-                       int *pi_trans ii_optional);
-IMAIO_API II_HIMAGE IIAPI
-ii_gif_load_8bpp_res_w(II_INST hInstance, II_CWSTR pszResName,
-                       int *pi_trans ii_optional);
+#ifdef _WIN32
+    IMAIO_API II_HIMAGE IIAPI
+    ii_gif_load_8bpp_res_a(II_INST hInstance, II_CSTR pszResName,
+                           int *pi_trans ii_optional);
+    IMAIO_API II_HIMAGE IIAPI
+    ii_gif_load_8bpp_res_w(II_INST hInstance, II_CWSTR pszResName,
+                           int *pi_trans ii_optional);
 
-IMAIO_API II_HIMAGE IIAPI
-ii_gif_load_32bpp_res_a(II_INST hInstance, II_CSTR pszResName);
+    IMAIO_API II_HIMAGE IIAPI
+    ii_gif_load_32bpp_res_a(II_INST hInstance, II_CSTR pszResName);
 
-IMAIO_API II_HIMAGE IIAPI
-ii_gif_load_32bpp_res_w(II_INST hInstance, II_CWSTR pszResName);
+    IMAIO_API II_HIMAGE IIAPI
+    ii_gif_load_32bpp_res_w(II_INST hInstance, II_CWSTR pszResName);
+#endif
 
 #ifdef UNICODE
     #define ii_gif_load_8bpp ii_gif_load_8bpp_w
@@ -571,6 +894,12 @@ ii_gif_load_8bpp_common(GifFileType *gif, int *pi_trans ii_optional);
 IMAIO_API bool IIAPI ii_gif_save_common(
     GifFileType *gif, II_HIMAGE hbm8bpp, const int *pi_trans ii_optional);
 
+IMAIO_API II_HIMAGE IIAPI
+ii_gif_load_8bpp_stream(II_STREAM *stream, int *pi_trans ii_optional);
+IMAIO_API II_HIMAGE IIAPI ii_gif_load_32bpp_stream(II_STREAM *stream);
+IMAIO_API bool IIAPI ii_gif_save_stream(
+    II_STREAM *stream, II_HIMAGE hbm8bpp, const int *pi_trans ii_optional);
+
 /*****************************************************************************/
 /* animated gif */
 
@@ -588,13 +917,15 @@ ii_anigif_save_w(II_CWSTR pszFileName, II_ANIGIF *anigif);
 IMAIO_API II_ANIGIF * IIAPI ii_anigif_load_mem(
     II_LPCVOID pv, uint32_t cb, II_FLAGS flags);
 
-IMAIO_API II_ANIGIF * IIAPI
-ii_anigif_load_res_a(
-    II_INST hInstance, II_CSTR pszResName, II_FLAGS flags);
+#ifdef _WIN32
+    IMAIO_API II_ANIGIF * IIAPI
+    ii_anigif_load_res_a(
+        II_INST hInstance, II_CSTR pszResName, II_FLAGS flags);
 
-IMAIO_API II_ANIGIF * IIAPI
-ii_anigif_load_res_w(
-    II_INST hInstance, II_CWSTR pszResName, II_FLAGS flags);
+    IMAIO_API II_ANIGIF * IIAPI
+    ii_anigif_load_res_w(
+        II_INST hInstance, II_CWSTR pszResName, II_FLAGS flags);
+#endif
 
 IMAIO_API void IIAPI
 ii_anigif_destroy(II_ANIGIF *anigif);
@@ -614,6 +945,11 @@ ii_anigif_load_common(GifFileType *gif, II_FLAGS flags);
 IMAIO_API bool IIAPI
 ii_anigif_save_common(GifFileType *gif, II_ANIGIF *anigif);
 
+IMAIO_API II_ANIGIF * IIAPI
+ii_anigif_load_stream(II_STREAM *stream, II_FLAGS flags);
+IMAIO_API bool IIAPI
+ii_anigif_save_stream(II_STREAM *stream, II_ANIGIF *anigif);
+
 /*****************************************************************************/
 /* png */
 
@@ -632,6 +968,14 @@ ii_png_save_a(II_CSTR pszFileName, II_HIMAGE hbm, float dpi ii_optional);
 IMAIO_API bool IIAPI
 ii_png_save_w(II_CWSTR pszFileName, II_HIMAGE hbm, float dpi ii_optional);
 
+IMAIO_API bool IIAPI
+ii_png_save_view_a(II_CSTR pszFileName, const II_VIEW *view,
+                   float dpi ii_optional);
+
+IMAIO_API bool IIAPI
+ii_png_save_view_w(II_CWSTR pszFileName, const II_VIEW *view,
+                   float dpi ii_optional);
+
 #ifndef __GNUC__
     #ifdef _WIN32
         #ifdef ZLIB_DLL
@@ -651,24 +995,35 @@ IMAIO_API II_HIMAGE IIAPI ii_png_load_mem(II_LPCVOID pv, uint32_t cb);
  *  ex) II_HIMAGE hbm = ii_png_load_res(hInst, MAKEINTRESOURCE(1));
  *      for resource (1 PNG "myfile.png")
  */
-IMAIO_API II_HIMAGE IIAPI
-ii_png_load_res_a(II_INST hInstance, II_CSTR pszResName);
+#ifdef _WIN32
+    IMAIO_API II_HIMAGE IIAPI
+    ii_png_load_res_a(II_INST hInstance, II_CSTR pszResName);
 
-IMAIO_API II_HIMAGE IIAPI
- ii_png_load_res_w(II_INST hInstance, II_CWSTR pszResName);
+    IMAIO_API II_HIMAGE IIAPI
+    ii_png_load_res_w(II_INST hInstance, II_CWSTR pszResName);
+#endif
 
 #ifdef UNICODE
     #define ii_png_load ii_png_load_w
     #define ii_png_save ii_png_save_w
+    #define ii_png_save_view ii_png_save_view_w
     #define ii_png_load_res ii_png_load_res_w
 #else
     #define ii_png_load ii_png_load_a
     #define ii_png_save ii_png_save_a
+    #define ii_png_save_view ii_png_save_view_a
     #define ii_png_load_res ii_png_load_res_a
 #endif
 
 IMAIO_API II_HIMAGE IIAPI ii_png_load_common(FILE *inf, float *dpi);
 IMAIO_API bool IIAPI ii_png_save_common(FILE *outf, II_HIMAGE hbm, float dpi);
+IMAIO_API bool IIAPI
+ii_png_save_view_common(FILE *outf, const II_VIEW *view, float dpi);
+
+IMAIO_API II_HIMAGE IIAPI
+ii_png_load_stream(II_STREAM *stream, float *dpi ii_optional);
+IMAIO_API bool IIAPI
+ii_png_save_stream(II_STREAM *stream, II_HIMAGE hbm, float dpi ii_optional);
 
 /*****************************************************************************/
 /* animated PNG (APNG) */
@@ -682,13 +1037,15 @@ IMAIO_API bool IIAPI ii_png_save_common(FILE *outf, II_HIMAGE hbm, float dpi);
     ii_apng_load_w(II_CWSTR pszFileName,
                    II_FLAGS flags ii_optional_(II_FLAG_USE_SCREEN));
 
-    IMAIO_API II_APNG * IIAPI
-    ii_apng_load_res_a(II_INST hInstance, II_CSTR pszResName,
-                       II_FLAGS flags ii_optional_(II_FLAG_USE_SCREEN));
+    #ifdef _WIN32
+        IMAIO_API II_APNG * IIAPI
+        ii_apng_load_res_a(II_INST hInstance, II_CSTR pszResName,
+                           II_FLAGS flags ii_optional_(II_FLAG_USE_SCREEN));
 
-    IMAIO_API II_APNG * IIAPI
-    ii_apng_load_res_w(II_INST hInstance, II_CWSTR pszResName,
-                       II_FLAGS flags ii_optional_(II_FLAG_USE_SCREEN));
+        IMAIO_API II_APNG * IIAPI
+        ii_apng_load_res_w(II_INST hInstance, II_CWSTR pszResName,
+                           II_FLAGS flags ii_optional_(II_FLAG_USE_SCREEN));
+    #endif
 
     IMAIO_API II_APNG * IIAPI
     ii_apng_load_mem(II_LPCVOID pv, uint32_t cb,
@@ -702,6 +1059,11 @@ IMAIO_API bool IIAPI ii_png_save_common(FILE *outf, II_HIMAGE hbm, float dpi);
     IMAIO_API II_APNG * IIAPI ii_apng_load_fp(FILE *fp, II_FLAGS flags);
     IMAIO_API bool IIAPI ii_apng_save_fp(FILE *fp, II_APNG *apng);
 
+    IMAIO_API II_APNG * IIAPI
+    ii_apng_load_stream(II_STREAM *stream, II_FLAGS flags);
+    IMAIO_API bool IIAPI
+    ii_apng_save_stream(II_STREAM *stream, II_APNG *apng);
+
     #ifdef UNICODE
         #define ii_apng_load ii_apng_load_w
         #define ii_apng_load_res ii_apng_load_res_w
@@ -742,6 +1104,10 @@ ii_tif_save_a(II_CSTR pszFileName, II_HIMAGE hbm, float dpi ii_optional);
 IMAIO_API bool IIAPI
 ii_tif_save_w(II_CWSTR pszFileName, II_HIMAGE hbm, float dpi ii_optional);
 
+/* load from memory */
+IMAIO_API II_HIMAGE IIAPI
+ii_tif_load_mem(II_LPCVOID pv, uint32_t cb, float *dpi ii_optional);
+
 #ifndef __GNUC__
     #ifdef _WIN32
         #pragma comment(lib, "libtiff.lib")
@@ -759,6 +1125,11 @@ ii_tif_save_w(II_CWSTR pszFileName, II_HIMAGE hbm, float dpi ii_optional);
 IMAIO_API II_HIMAGE IIAPI ii_tif_load_common(TIFF *tif, float *dpi);
 IMAIO_API bool IIAPI ii_tif_save_common(TIFF *tif, II_HIMAGE hbm, float dpi);
 
+IMAIO_API II_HIMAGE IIAPI
+ii_tif_load_stream(II_STREAM *stream, float *dpi ii_optional);
+IMAIO_API bool IIAPI
+ii_tif_save_stream(II_STREAM *stream, II_HIMAGE hbm, float dpi ii_optional);
+
 /*****************************************************************************/
 /* image types */
 
@@ -832,6 +1203,83 @@ IMAIO_API wchar_t *     IIAPI ii_make_filter_w(wchar_t *  pszFilter);
     #define ii_make_filter ii_make_filter_a
 #endif
 
+/*****************************************************************************/
+/* incremental decoding */
+
+/* NOTE: II_DECODER decodes a PNG or JPEG whose bytes arrive piece by piece.
+ *       Only the image and the decoder state are kept, not the input. */
+typedef struct II_DECODER II_DECODER;
+
+/* NOTE: II_DECODER_PROC is called when the rows y .. y + cy - 1 (from the
+ *       top) of ii_decoder_image have been stored. pass is the interlace
+ *       pass of PNG or the output scan of progressive JPEG; a later pass
+ *       stores the rows again in more detail. */
+typedef void (IICAPI *II_DECODER_PROC)(II_DECODER *decoder,
+                                       int y, int cy, int pass, void *user);
+
+/* NOTE: type is II_IMAGE_TYPE_PNG or II_IMAGE_TYPE_JPG. */
+IMAIO_API II_DECODER * IIAPI
+ii_decoder_create(II_IMAGE_TYPE type, II_DECODER_PROC proc ii_optional,
+                  void *user ii_optional);
+
+/* NOTE: ii_decoder_feed returns false on a broken stream. */
+IMAIO_API bool IIAPI
+ii_decoder_feed(II_DECODER *decoder, II_LPCVOID pv, size_t cb);
+
+/* NOTE: The image is NULL until the header has arrived, and it is owned by
+ *       the decoder. */
+IMAIO_API II_HIMAGE IIAPI ii_decoder_image(II_DECODER *decoder);
+
+/* NOTE: ii_decoder_rows returns the fill level of the current pass. */
+IMAIO_API int IIAPI ii_decoder_rows(II_DECODER *decoder, int *pass ii_optional);
+
+IMAIO_API bool IIAPI ii_decoder_done(II_DECODER *decoder);
+IMAIO_API float IIAPI ii_decoder_dpi(II_DECODER *decoder);
+
+/* NOTE: ii_decoder_detach takes the image from the decoder and ends the
+ *       decoding. */
+IMAIO_API II_HIMAGE IIAPI ii_decoder_detach(II_DECODER *decoder);
+
+IMAIO_API void IIAPI ii_decoder_destroy(II_DECODER *decoder);
+
+/*****************************************************************************/
+/* streaming encoding */
+
+/* NOTE: II_ENCODER writes a PNG, JPEG, TIFF or BMP file from rows given from
+ *       the top, so only a strip of the image has to exist at a time. */
+typedef struct II_ENCODER II_ENCODER;
+
+/* NOTE: bpp is 24 or 32 and the rows are in the DIB byte order (B, G, R(, A)).
+ *       quality and progression are for JPEG. */
+IMAIO_API II_ENCODER * IIAPI
+ii_encoder_begin_a(II_CSTR pszFileName, II_IMAGE_TYPE type,
+                   int width, int height, int bpp,
+                   float dpi ii_optional,
+                   int quality ii_optional_(100),
+                   bool progression ii_optional);
+IMAIO_API II_ENCODER * IIAPI
+ii_encoder_begin_w(II_CWSTR pszFileName, II_IMAGE_TYPE type,
+                   int width, int height, int bpp,
+                   float dpi ii_optional,
+                   int quality ii_optional_(100),
+                   bool progression ii_optional);
+
+/* NOTE: stride is the byte offset from a row to the row below it; it is
+ *       negative for the bottom-up rows of a DIB. */
+IMAIO_API bool IIAPI
+ii_encoder_write_rows(II_ENCODER *encoder, II_LPCVOID pvRows, int stride,
+                      int cy);
+
+/* NOTE: ii_encoder_end fails and removes the file unless all the rows have
+ *       been written. */
+IMAIO_API bool IIAPI ii_encoder_end(II_ENCODER *encoder);
+
+#ifdef UNICODE
+    #define ii_encoder_begin ii_encoder_begin_w
+#else
+    #define ii_encoder_begin ii_encoder_begin_a
+#endif
+
 /*****************************************************************************/
 /* C/C++ switching */
 
@@ -0,0 +1,10437 @@
+/*****************************************************************************/
+/* imaio_common.c --- imaio for all platforms                                */
+/* Copyright (C) 2015 katahiromz. All Rights Reserved.                       */
+/*****************************************************************************/
+
+#define IMAIO_BUILDING 1
+
+/* NOTE: The 64-bit off_t of fseeko, ftello and fstat must be chosen before
+ *       the first system header, which imaio.h includes. */
+#if !defined(_WIN32) && !defined(_FILE_OFFSET_BITS)
+    #define _FILE_OFFSET_BITS 64
+#endif
+
+#include "imaio.h"
+
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <math.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+/*****************************************************************************/
+
+#define II_WIDTHBYTES(i) (((i) + 31) / 32 * 4)
+
+#ifndef min
+    #define min(a, b)   (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+    #define max(a, b)   (((a) > (b)) ? (a) : (b))
+#endif
+
+#ifndef M_PI
+    #define M_PI    3.14159265358979323846
+#endif
+
+/*****************************************************************************/
+/* SIMD */
+
+/* NOTE: Define IMAIO_NO_SIMD to build the portable C code only. */
+#ifndef IMAIO_NO_SIMD
+    #if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define II_USE_SSE2 1
+        #include <emmintrin.h>
+    #endif
+    /* NOTE: The AVX2 code is selected at runtime. */
+    #if defined(II_USE_SSE2) && defined(__GNUC__) && \
+        (__GNUC__ >= 5 || defined(__clang__))
+        #define II_USE_AVX2 1
+        #define II_TARGET_AVX2 __attribute__((target("avx2")))
+        /* NOTE: The SSSE3 code is selected at runtime too. */
+        #define II_USE_SSSE3 1
+        #define II_TARGET_SSSE3 __attribute__((target("ssse3")))
+        #include <immintrin.h>
+    #endif
+#endif
+
+/*****************************************************************************/
+/* C/C++ switching */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*****************************************************************************/
+/* file names and strings */
+
+#ifdef _WIN32
+    #define ii_wfopen       _wfopen
+    #define ii_wremove      _wremove
+    #define ii_wopen        _wopen
+    #define ii_close        _close
+    #define ii_tiff_open_w  TIFFOpenW
+#else
+    #define ii_close        close
+    #ifndef S_IREAD
+        #define S_IREAD     S_IRUSR
+    #endif
+    #ifndef S_IWRITE
+        #define S_IWRITE    S_IWUSR
+    #endif
+
+    /* convert a wide string to a malloc'ed multibyte string */
+    static char * IIAPI
+    ii_ansi_from_wide(II_CWSTR pszWide)
+    {
+        size_t len;
+        char *psz;
+
+        len = wcstombs(NULL, pszWide, 0);
+        if (len == (size_t)-1)
+            return NULL;
+        psz = (char *)malloc(len + 1);
+        if (psz)
+            wcstombs(psz, pszWide, len + 1);
+        return psz;
+    }
+
+    static FILE * IIAPI
+    ii_wfopen(II_CWSTR pszFileName, II_CWSTR pszMode)
+    {
+        FILE *fp = NULL;
+        char *pszA, *pszModeA;
+        pszA = ii_ansi_from_wide(pszFileName);
+        pszModeA = ii_ansi_from_wide(pszMode);
+        if (pszA && pszModeA)
+            fp = fopen(pszA, pszModeA);
+        free(pszA);
+        free(pszModeA);
+        return fp;
+    }
+
+    static int IIAPI
+    ii_wremove(II_CWSTR pszFileName)
+    {
+        int ret = -1;
+        char *pszA = ii_ansi_from_wide(pszFileName);
+        if (pszA)
+            ret = remove(pszA);
+        free(pszA);
+        return ret;
+    }
+
+    static int IIAPI
+    ii_wopen(II_CWSTR pszFileName, int flags, ...)
+    {
+        int fd = -1;
+        int mode = 0;
+        va_list va;
+        char *pszA;
+
+        va_start(va, flags);
+        if (flags & O_CREAT)
+            mode = va_arg(va, int);
+        va_end(va);
+
+        pszA = ii_ansi_from_wide(pszFileName);
+        if (pszA)
+            fd = open(pszA, flags, mode);
+        free(pszA);
+        return fd;
+    }
+
+    static TIFF * IIAPI
+    ii_tiff_open_w(II_CWSTR pszFileName, const char *pszMode)
+    {
+        TIFF *tif = NULL;
+        char *pszA = ii_ansi_from_wide(pszFileName);
+        if (pszA)
+            tif = TIFFOpen(pszA, pszMode);
+        free(pszA);
+        return tif;
+    }
+#endif  /* ndef _WIN32 */
+
+/* case-insensitive comparison of ASCII strings */
+static int IIAPI
+ii_strcmpi_a(II_CSTR psz1, II_CSTR psz2)
+{
+    int c1, c2;
+    do
+    {
+        c1 = tolower((unsigned char)*psz1++);
+        c2 = tolower((unsigned char)*psz2++);
+    } while (c1 == c2 && c1 != 0);
+    return c1 - c2;
+}
+
+static int IIAPI
+ii_strcmpi_w(II_CWSTR psz1, II_CWSTR psz2)
+{
+    wint_t c1, c2;
+    do
+    {
+        c1 = towlower(*psz1++);
+        c2 = towlower(*psz2++);
+    } while (c1 == c2 && c1 != 0);
+    return (int)c1 - (int)c2;
+}
+
+/* NOTE: ii_set_simd(false) turns the SIMD code off at run time. */
+static bool s_ii_use_simd = true;
+
+IMAIO_API void IIAPI
+ii_set_simd(bool use_simd)
+{
+    s_ii_use_simd = use_simd;
+}
+
+#ifdef II_USE_SSE2
+    /* may the SSE2 code be used? */
+    static ii_inline bool
+    ii_has_sse2(void)
+    {
+        return s_ii_use_simd;
+    }
+#endif  /* def II_USE_SSE2 */
+
+#ifdef II_USE_AVX2
+    /* does the CPU support AVX2? */
+    static bool
+    ii_has_avx2(void)
+    {
+        static int s_has_avx2 = -1;
+        if (s_has_avx2 == -1)
+        {
+            __builtin_cpu_init();
+            s_has_avx2 = (__builtin_cpu_supports("avx2") ? 1 : 0);
+        }
+        return s_has_avx2 != 0 && s_ii_use_simd;
+    }
+#endif  /* def II_USE_AVX2 */
+
+#ifdef II_USE_SSSE3
+    /* does the CPU support SSSE3? */
+    static bool
+    ii_has_ssse3(void)
+    {
+        static int s_has_ssse3 = -1;
+        if (s_has_ssse3 == -1)
+        {
+            __builtin_cpu_init();
+            s_has_ssse3 = (__builtin_cpu_supports("ssse3") ? 1 : 0);
+        }
+        return s_has_ssse3 != 0 && s_ii_use_simd;
+    }
+#endif  /* def II_USE_SSSE3 */
+
+/*****************************************************************************/
+/* memory */
+
+/* the block header before the aligned memory */
+typedef struct II_BLOCK
+{
+    void *              raw;        /* the memory from the allocator */
+    size_t              size;       /* the usable size */
+    int                 size_class; /* the class of the pool or -1 */
+    II_ALLOCATOR        allocator;  /* the allocator of raw */
+    struct II_BLOCK *   next;       /* the next free block in the pool */
+} II_BLOCK;
+
+/* NOTE: The pool keeps II_POOL_MAX_BLOCKS free blocks per class and
+ *       II_POOL_MAX_BYTES bytes in all. */
+#define II_POOL_MAX_BLOCKS      4
+#define II_POOL_MAX_BYTES       ((size_t)64 * 1024 * 1024)
+/* NOTE: The classes are 256 bytes and four steps per power of two
+ *       (a waste of up to 25%) up to II_POOL_MAX_BYTES (2^26 bytes).
+ *       Bigger blocks are not rounded nor pooled. */
+#define II_POOL_NUM_CLASSES     (1 + 4 * (26 - 8))
+
+static II_BLOCK *   s_ii_pool[II_POOL_NUM_CLASSES];
+static int          s_ii_pool_count[II_POOL_NUM_CLASSES];
+static size_t       s_ii_pool_bytes = 0;
+
+static void * IICAPI
+ii_default_alloc(size_t size, void *user)
+{
+    (void)user;
+    return malloc(size);
+}
+
+static void IICAPI
+ii_default_free(void *ptr, void *user)
+{
+    (void)user;
+    free(ptr);
+}
+
+static II_ALLOCATOR s_ii_allocator = { ii_default_alloc, ii_default_free, NULL };
+static bool s_ii_use_pool = true;
+
+/* NOTE: The lock guards the pool. It is held for a few instructions. */
+#ifdef _WIN32
+    static volatile LONG s_ii_pool_lock = 0;
+    #define II_POOL_LOCK() \
+        while (InterlockedExchange(&s_ii_pool_lock, 1)) Sleep(0)
+    #define II_POOL_UNLOCK()    InterlockedExchange(&s_ii_pool_lock, 0)
+#elif defined(__GNUC__)
+    static volatile int s_ii_pool_lock = 0;
+    #define II_POOL_LOCK() \
+        while (__sync_lock_test_and_set(&s_ii_pool_lock, 1)) { }
+    #define II_POOL_UNLOCK()    __sync_lock_release(&s_ii_pool_lock)
+#else
+    #define II_POOL_LOCK()      /* empty */
+    #define II_POOL_UNLOCK()    /* empty */
+#endif
+
+/* the size class of size, or -1 */
+static int
+ii_pool_class(size_t size, size_t *class_size)
+{
+    size_t base = 256;
+    int index = 0, k;
+
+    *class_size = size;
+    if (size <= base)
+    {
+        *class_size = base;
+        return 0;
+    }
+    while (index + 4 < II_POOL_NUM_CLASSES)
+    {
+        for (k = 1; k <= 4; ++k)
+        {
+            if (size <= base + k * (base >> 2))
+            {
+                *class_size = base + k * (base >> 2);
+                return index + k;
+            }
+        }
+        index += 4;
+        base <<= 1;
+    }
+    assert(size > II_POOL_MAX_BYTES);
+    return -1;
+}
+
+IMAIO_API void IIAPI
+ii_set_allocator(const II_ALLOCATOR *allocator)
+{
+    /* NOTE: The blocks remember their allocator, so they can be freed
+     *       after the allocator is changed. */
+    ii_pool_trim();
+    if (allocator)
+    {
+        s_ii_allocator = *allocator;
+        s_ii_use_pool = false;
+    }
+    else
+    {
+        s_ii_allocator.alloc_proc = ii_default_alloc;
+        s_ii_allocator.free_proc = ii_default_free;
+        s_ii_allocator.user = NULL;
+        s_ii_use_pool = true;
+    }
+}
+
+IMAIO_API void * IIAPI
+ii_alloc(size_t size)
+{
+    II_BLOCK *block;
+    size_t class_size;
+    uint8_t *raw, *aligned;
+    int size_class = -1;
+
+    if (s_ii_use_pool)
+    {
+        size_class = ii_pool_class(size, &class_size);
+        if (size_class != -1)
+        {
+            II_POOL_LOCK();
+            block = s_ii_pool[size_class];
+            if (block)
+            {
+                s_ii_pool[size_class] = block->next;
+                --s_ii_pool_count[size_class];
+                s_ii_pool_bytes -= block->size;
+            }
+            II_POOL_UNLOCK();
+            if (block)
+                return block + 1;
+            size = class_size;
+        }
+    }
+
+    /* NOTE: The header is just before the II_ALIGN-byte aligned memory. */
+    if (size > (size_t)-1 - 2 * II_ALIGN - sizeof(II_BLOCK))
+        return NULL;
+    raw = (uint8_t *)s_ii_allocator.alloc_proc(size + II_ALIGN + sizeof(II_BLOCK),
+                                          s_ii_allocator.user);
+    if (raw == NULL)
+        return NULL;
+    aligned = raw + sizeof(II_BLOCK);
+    aligned += (II_ALIGN - ((size_t)aligned & (II_ALIGN - 1))) & (II_ALIGN - 1);
+
+    block = (II_BLOCK *)aligned - 1;
+    block->raw = raw;
+    block->size = size;
+    block->size_class = size_class;
+    block->allocator = s_ii_allocator;
+    block->next = NULL;
+    return aligned;
+}
+
+IMAIO_API void IIAPI
+ii_free(void *ptr)
+{
+    II_BLOCK *block;
+
+    if (ptr == NULL)
+        return;
+
+    block = (II_BLOCK *)ptr - 1;
+    /* NOTE: While a custom allocator is set, nothing goes to the pool. */
+    if (block->size_class != -1 && s_ii_use_pool)
+    {
+        II_POOL_LOCK();
+        if (s_ii_pool_count[block->size_class] < II_POOL_MAX_BLOCKS &&
+            s_ii_pool_bytes + block->size <= II_POOL_MAX_BYTES)
+        {
+            block->next = s_ii_pool[block->size_class];
+            s_ii_pool[block->size_class] = block;
+            ++s_ii_pool_count[block->size_class];
+            s_ii_pool_bytes += block->size;
+            block = NULL;
+        }
+        II_POOL_UNLOCK();
+        if (block == NULL)
+            return;
+    }
+    block->allocator.free_proc(block->raw, block->allocator.user);
+}
+
+IMAIO_API void IIAPI
+ii_pool_trim(void)
+{
+    II_BLOCK *block, *next;
+    size_t bytes = 0;
+    int i;
+
+    for (i = 0; i < II_POOL_NUM_CLASSES; ++i)
+    {
+        II_POOL_LOCK();
+        block = s_ii_pool[i];
+        s_ii_pool[i] = NULL;
+        s_ii_pool_count[i] = 0;
+        II_POOL_UNLOCK();
+        for (; block; block = next)
+        {
+            next = block->next;
+            bytes += block->size;
+            block->allocator.free_proc(block->raw, block->allocator.user);
+        }
+    }
+
+    II_POOL_LOCK();
+    s_ii_pool_bytes -= bytes;
+    II_POOL_UNLOCK();
+}
+
+/*****************************************************************************/
+/* streams */
+
+/* NOTE: The offsets of files are 64-bit where the C runtime allows it. */
+#if defined(_MSC_VER) || defined(__MINGW32__)
+    #define ii_fseek64(fp, offset, origin)  _fseeki64(fp, offset, origin)
+    #define ii_ftell64(fp)                  _ftelli64(fp)
+#elif !defined(_WIN32)
+    #define ii_fseek64(fp, offset, origin)  fseeko(fp, (off_t)(offset), origin)
+    #define ii_ftell64(fp)                  ((int64_t)ftello(fp))
+#else
+    #define ii_fseek64(fp, offset, origin)  fseek(fp, (long)(offset), origin)
+    #define ii_ftell64(fp)                  ((int64_t)ftell(fp))
+#endif
+
+static size_t IICAPI
+ii_file_read(II_STREAM *stream, void *pv, size_t cb)
+{
+    return fread(pv, 1, cb, (FILE *)stream->user);
+}
+
+static size_t IICAPI
+ii_file_write(II_STREAM *stream, const void *pv, size_t cb)
+{
+    return fwrite(pv, 1, cb, (FILE *)stream->user);
+}
+
+static bool IICAPI
+ii_file_seek(II_STREAM *stream, int64_t offset, int origin)
+{
+    return ii_fseek64((FILE *)stream->user, offset, origin) == 0;
+}
+
+static int64_t IICAPI
+ii_file_tell(II_STREAM *stream)
+{
+    return ii_ftell64((FILE *)stream->user);
+}
+
+static int64_t IICAPI
+ii_file_size(II_STREAM *stream)
+{
+    FILE *fp = (FILE *)stream->user;
+    int64_t pos, size;
+
+    pos = ii_ftell64(fp);
+    if (pos < 0 || ii_fseek64(fp, 0, SEEK_END) != 0)
+        return -1;
+    size = ii_ftell64(fp);
+    ii_fseek64(fp, pos, SEEK_SET);
+    return size;
+}
+
+IMAIO_API void IIAPI
+ii_stream_init_file(II_STREAM *stream, FILE *fp)
+{
+    assert(stream);
+    stream->read_proc = ii_file_read;
+    stream->write_proc = ii_file_write;
+    stream->seek_proc = ii_file_seek;
+    stream->tell_proc = ii_file_tell;
+    stream->size_proc = ii_file_size;
+    stream->map_proc = NULL;
+    stream->user = fp;
+}
+
+static size_t IICAPI
+ii_mem_read(II_STREAM *stream, void *pv, size_t cb)
+{
+    II_MEMORY *memory = (II_MEMORY *)stream->user;
+
+    if (memory->m_i >= memory->m_size)
+        return 0;
+    cb = min(cb, (size_t)(memory->m_size - memory->m_i));
+    memcpy(pv, memory->m_pb + memory->m_i, cb);
+    memory->m_i += (uint32_t)cb;
+    return cb;
+}
+
+/* NOTE: II_MEMORY is read-only. */
+static size_t IICAPI
+ii_mem_write(II_STREAM *stream, const void *pv, size_t cb)
+{
+    (void)stream;
+    (void)pv;
+    (void)cb;
+    return 0;
+}
+
+static bool IICAPI
+ii_mem_seek(II_STREAM *stream, int64_t offset, int origin)
+{
+    II_MEMORY *memory = (II_MEMORY *)stream->user;
+
+    switch (origin)
+    {
+    case SEEK_CUR:
+        offset += memory->m_i;
+        break;
+    case SEEK_END:
+        offset += memory->m_size;
+        break;
+    }
+    if (offset < 0 || offset > (int64_t)memory->m_size)
+        return false;
+    memory->m_i = (uint32_t)offset;
+    return true;
+}
+
+static int64_t IICAPI
+ii_mem_tell(II_STREAM *stream)
+{
+    return ((II_MEMORY *)stream->user)->m_i;
+}
+
+static int64_t IICAPI
+ii_mem_size(II_STREAM *stream)
+{
+    return ((II_MEMORY *)stream->user)->m_size;
+}
+
+static const void * IICAPI
+ii_mem_map(II_STREAM *stream, size_t *pcb)
+{
+    II_MEMORY *memory = (II_MEMORY *)stream->user;
+
+    *pcb = memory->m_size;
+    return memory->m_pb;
+}
+
+IMAIO_API void IIAPI
+ii_stream_init_mem(II_STREAM *stream, II_MEMORY *memory)
+{
+    assert(stream);
+    assert(memory);
+    stream->read_proc = ii_mem_read;
+    stream->write_proc = ii_mem_write;
+    stream->seek_proc = ii_mem_seek;
+    stream->tell_proc = ii_mem_tell;
+    stream->size_proc = ii_mem_size;
+    stream->map_proc = ii_mem_map;
+    stream->user = memory;
+}
+
+/*****************************************************************************/
+/* memory-mapped files */
+
+#ifdef _WIN32
+    static bool
+    ii_map_handle(II_MEMORY *memory, HANDLE hFile)
+    {
+        DWORD dwLow, dwHigh;
+        HANDLE hMapping;
+        LPVOID pv = NULL;
+
+        if (hFile == INVALID_HANDLE_VALUE)
+            return false;
+
+        dwLow = GetFileSize(hFile, &dwHigh);
+        if (dwLow != INVALID_FILE_SIZE && dwLow != 0 && dwHigh == 0)
+        {
+            hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0,
+                                         NULL);
+            if (hMapping)
+            {
+                pv = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(hMapping);
+            }
+        }
+        CloseHandle(hFile);
+
+        if (pv == NULL)
+            return false;
+        memory->m_pb = (const uint8_t *)pv;
+        memory->m_i = 0;
+        memory->m_size = dwLow;
+        return true;
+    }
+
+    IMAIO_API bool IIAPI
+    ii_map_file_a(II_MEMORY *memory, II_CSTR pszFileName)
+    {
+        assert(memory);
+        return ii_map_handle(memory,
+            CreateFileA(pszFileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+    }
+
+    IMAIO_API bool IIAPI
+    ii_map_file_w(II_MEMORY *memory, II_CWSTR pszFileName)
+    {
+        assert(memory);
+        return ii_map_handle(memory,
+            CreateFileW(pszFileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+    }
+
+    IMAIO_API void IIAPI
+    ii_unmap_file(II_MEMORY *memory)
+    {
+        assert(memory);
+        if (memory->m_pb)
+            UnmapViewOfFile(memory->m_pb);
+        memory->m_pb = NULL;
+        memory->m_size = 0;
+    }
+#else   /* ndef _WIN32 */
+    static bool
+    ii_map_fd(II_MEMORY *memory, int fd)
+    {
+        struct stat st;
+        void *pv = MAP_FAILED;
+
+        if (fd == -1)
+            return false;
+
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > 0 && (uint64_t)st.st_size <= 0xFFFFFFFF)
+        {
+            pv = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+                      fd, 0);
+        }
+        close(fd);
+
+        if (pv == MAP_FAILED)
+            return false;
+        memory->m_pb = (const uint8_t *)pv;
+        memory->m_i = 0;
+        memory->m_size = (uint32_t)st.st_size;
+        return true;
+    }
+
+    IMAIO_API bool IIAPI
+    ii_map_file_a(II_MEMORY *memory, II_CSTR pszFileName)
+    {
+        assert(memory);
+        return ii_map_fd(memory, open(pszFileName, O_RDONLY));
+    }
+
+    IMAIO_API bool IIAPI
+    ii_map_file_w(II_MEMORY *memory, II_CWSTR pszFileName)
+    {
+        assert(memory);
+        return ii_map_fd(memory, ii_wopen(pszFileName, O_RDONLY));
+    }
+
+    IMAIO_API void IIAPI
+    ii_unmap_file(II_MEMORY *memory)
+    {
+        assert(memory);
+        if (memory->m_pb)
+            munmap((void *)memory->m_pb, memory->m_size);
+        memory->m_pb = NULL;
+        memory->m_size = 0;
+    }
+#endif  /* ndef _WIN32 */
+
+/*****************************************************************************/
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_8bpp_solid(int cx, int cy, const II_PALETTE *table, int iColorIndex)
+{
+    II_HIMAGE hbmNew;
+    II_IMGINFO bm;
+
+    assert(table);
+    hbmNew = ii_create(cx, cy, 8, table);
+    assert(hbmNew);
+    if (hbmNew)
+    {
+        ii_get_info(hbmNew, &bm);
+        memset(bm.bmBits, (uint8_t)iColorIndex, bm.bmWidthBytes * cy);
+    }
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_8bpp_grayscale(int cx, int cy)
+{
+    II_PALETTE *table;
+    int i;
+    II_HIMAGE hbmNew;
+
+    table = ii_palette_create(256, NULL);
+    if (table == NULL)
+        return NULL;
+
+    for (i = 0; i < 256; ++i)
+    {
+        table->colors[i].value[0] = (uint8_t)i;
+        table->colors[i].value[1] = (uint8_t)i;
+        table->colors[i].value[2] = (uint8_t)i;
+    }
+
+    hbmNew = ii_create(cx, cy, 8, table);
+    ii_palette_destroy(table);
+
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_24bpp(int cx, int cy)
+{
+    II_HIMAGE hbmNew;
+    hbmNew = ii_create(cx, cy, 24, NULL);
+    assert(hbmNew);
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_24bpp_solid(int cx, int cy, const II_COLOR8 *color)
+{
+    II_HIMAGE hbmNew;
+    uint8_t *pbBits;
+    II_IMGINFO bm;
+    int x, y;
+
+    hbmNew = ii_create(cx, cy, 24, NULL);
+    assert(hbmNew);
+    if (hbmNew)
+    {
+        ii_get_info(hbmNew, &bm);
+        pbBits = (uint8_t *)bm.bmBits;
+        for (y = 0; y < cy; ++y)
+        {
+            for (x = 0; x < cx; ++x)
+            {
+                pbBits[x * 3 + y * bm.bmWidthBytes + 0] = color->value[0];
+                pbBits[x * 3 + y * bm.bmWidthBytes + 1] = color->value[1];
+                pbBits[x * 3 + y * bm.bmWidthBytes + 2] = color->value[2];
+            }
+        }
+    }
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_32bpp(int cx, int cy)
+{
+    II_HIMAGE hbm;
+
+    assert(cx > 0);
+    assert(cy > 0);
+    hbm = ii_create(cx, cy, 32, NULL);
+    assert(hbm);
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_32bpp_trans(int cx, int cy)
+{
+    II_HIMAGE hbm;
+    II_IMGINFO bm;
+    uint32_t cb;
+
+    assert(cx > 0);
+    assert(cy > 0);
+    hbm = ii_create(cx, cy, 32, NULL);
+    assert(hbm);
+    if (hbm == NULL)
+        return hbm;
+
+    ii_get_info(hbm, &bm);
+    cb = bm.bmWidthBytes * bm.bmHeight;
+    memset(bm.bmBits, 0, cb);
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_32bpp_solid(int cx, int cy, const II_COLOR8 *color)
+{
+    II_HIMAGE hbmNew;
+    II_IMGINFO bm;
+    uint32_t dw, cdw;
+    uint32_t *pdw;
+
+    hbmNew = ii_create(cx, cy, 32, NULL);
+    assert(hbmNew);
+    if (hbmNew)
+    {
+        ii_get_info(hbmNew, &bm);
+        pdw = (uint32_t *)bm.bmBits;
+        cdw = cx * cy;
+        while (cdw--)
+        {
+            dw = color->value[3];
+            dw <<= 8;
+            dw |= color->value[2];
+            dw <<= 8;
+            dw |= color->value[1];
+            dw <<= 8;
+            dw |= color->value[0];
+            *pdw++ = dw;
+        }
+    }
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_24bpp_black(int cx, int cy)
+{
+    II_HIMAGE hbm;
+    II_IMGINFO bm;
+    uint32_t cb;
+
+    assert(cx > 0);
+    assert(cy > 0);
+    hbm = ii_create_24bpp(cx, cy);
+    if (hbm == NULL)
+        return hbm;
+
+    ii_get_info(hbm, &bm);
+    cb = bm.bmWidthBytes * bm.bmHeight;
+    memset(bm.bmBits, 0, cb);
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_32bpp_black_opaque(int cx, int cy)
+{
+    II_HIMAGE hbm;
+    II_IMGINFO bm;
+    uint8_t *pb;
+    uint32_t cb, i;
+
+    assert(cx > 0);
+    assert(cy > 0);
+    hbm = ii_create_32bpp(cx, cy);
+    if (hbm == NULL)
+        return hbm;
+
+    ii_get_info(hbm, &bm);
+    cb = bm.bmWidthBytes * bm.bmHeight;
+    pb = (uint8_t *)bm.bmBits;
+    for (i = 0; i < cb; i += 4)
+    {
+        pb++; pb++; pb++;
+        *pb++ = 0xFF;
+    }
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_24bpp_white(int cx, int cy)
+{
+    II_HIMAGE hbm;
+    II_IMGINFO bm;
+    uint32_t cb;
+
+    assert(cx > 0);
+    assert(cy > 0);
+    hbm = ii_create_24bpp(cx, cy);
+    if (hbm == NULL)
+        return hbm;
+
+    ii_get_info(hbm, &bm);
+    cb = bm.bmWidthBytes * bm.bmHeight;
+    memset(bm.bmBits, 0xFF, cb);
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_32bpp_white(int cx, int cy)
+{
+    II_HIMAGE hbm;
+    II_IMGINFO bm;
+    uint32_t cb;
+
+    assert(cx > 0);
+    assert(cy > 0);
+    hbm = ii_create_32bpp(cx, cy);
+    if (hbm == NULL)
+        return hbm;
+
+    ii_get_info(hbm, &bm);
+    cb = bm.bmWidthBytes * bm.bmHeight;
+    memset(bm.bmBits, 0xFF, cb);
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_24bpp_checker(int cx, int cy)
+{
+    II_HIMAGE hbm;
+    II_IMGINFO bm;
+    uint8_t *pbBits, *pb;
+    int x, y;
+
+    assert(cx > 0);
+    assert(cy > 0);
+    hbm = ii_create_24bpp(cx, cy);
+    if (hbm == NULL)
+        return hbm;
+    ii_get_info(hbm, &bm);
+    pbBits = (uint8_t *)bm.bmBits;
+    for (y = 0; y < cy; y++)
+    {
+        pb = &pbBits[y * bm.bmWidthBytes];
+        for (x = 0; x < cx; x++)
+        {
+            if (((x >> 3) & 1) ^ (((bm.bmHeight - y - 1) >> 3) & 1))
+                pb[x * 3 + 0] = pb[x * 3 + 1] = pb[x * 3 + 2] = 0x88;
+            else
+                pb[x * 3 + 0] = pb[x * 3 + 1] = pb[x * 3 + 2] = 0xFF;
+        }
+    }
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create_32bpp_checker(int cx, int cy)
+{
+    II_HIMAGE hbm;
+    II_IMGINFO bm;
+    uint8_t *pbBits, *pb;
+    int x, y;
+
+    assert(cx > 0);
+    assert(cy > 0);
+    hbm = ii_create_32bpp(cx, cy);
+    if (hbm == NULL)
+        return hbm;
+    ii_get_info(hbm, &bm);
+
+    pbBits = (uint8_t *)bm.bmBits;
+    for (y = 0; y < cy; y++)
+    {
+        pb = &pbBits[y * bm.bmWidthBytes];
+        for (x = 0; x < cx; x++)
+        {
+            if (((x >> 3) & 1) ^ (((bm.bmHeight - y - 1) >> 3) & 1))
+                pb[(x << 2) + 0] = pb[(x << 2) + 1] = pb[(x << 2) + 2] = 0x88;
+            else
+                pb[(x << 2) + 0] = pb[(x << 2) + 1] = pb[(x << 2) + 2] = 0xFF;
+            pb[(x << 2) + 3] = 0xFF;
+        }
+    }
+    return hbm;
+}
+
+/*****************************************************************************/
+/* views */
+
+/* read a pixel as 0xAARRGGBB */
+/* NOTE: The images of 1, 4, 8, 24 and 32 bpp can be read. */
+static ii_inline uint32_t
+ii_read_pixel_32bpp(const II_IMGINFO *bm, const II_PALETTE *table,
+                    const uint8_t *pb, int x)
+{
+    const II_COLOR8 *color;
+    int i;
+
+    switch (bm->bmBitsPixel)
+    {
+    case 32:
+        return ((const uint32_t *)pb)[x];
+    case 24:
+        pb += x * 3;
+        return 0xFF000000 | pb[0] | (pb[1] << 8) | ((uint32_t)pb[2] << 16);
+    case 8:
+        i = pb[x];
+        break;
+    case 4:
+        i = (pb[x >> 1] >> ((x & 1) ? 0 : 4)) & 0x0F;
+        break;
+    case 1:
+        i = (pb[x >> 3] >> (7 - (x & 7))) & 0x01;
+        break;
+    default:
+        assert(0);
+        return 0xFF000000;
+    }
+    if (table == NULL || i >= table->num_colors)
+        return 0xFF000000;
+    color = &table->colors[i];
+    return 0xFF000000 | color->value[0] | (color->value[1] << 8) |
+           ((uint32_t)color->value[2] << 16);
+}
+
+/* read a row of pixels as 0xAARRGGBB */
+static void
+ii_read_row_32bpp(const II_IMGINFO *bm, const II_PALETTE *table, int y,
+                  uint32_t *row)
+{
+    const uint8_t *pb;
+    int x;
+
+    pb = (const uint8_t *)bm->bmBits + y * bm->bmWidthBytes;
+    if (bm->bmBitsPixel == 32)
+    {
+        memcpy(row, pb, bm->bmWidth * sizeof(uint32_t));
+        return;
+    }
+    for (x = 0; x < bm->bmWidth; ++x)
+        row[x] = ii_read_pixel_32bpp(bm, table, pb, x);
+}
+
+/* can ii_read_pixel_32bpp read the pixels of the bpp? */
+static ii_inline bool
+ii_is_readable_bpp(int bpp)
+{
+    return bpp == 1 || bpp == 4 || bpp == 8 || bpp == 24 || bpp == 32;
+}
+
+/* NOTE: ii_view_32bpp makes a 32bpp copy of the image of a view that
+ *       ii_read_pixel_32bpp cannot read (e.g. a 16bpp DIB) and the view of
+ *       the same rectangle of it in view32. */
+static II_HIMAGE
+ii_view_32bpp(II_VIEW *view32, const II_VIEW *view)
+{
+    II_HIMAGE hbm32bpp;
+
+    hbm32bpp = ii_32bpp(view->hbm);
+    if (hbm32bpp == NULL)
+        return NULL;
+    if (!ii_view_create(view32, hbm32bpp) ||
+        !ii_view_sub(view32, view32, view->x, view->y,
+                     view->info.bmWidth, view->info.bmHeight))
+    {
+        ii_destroy(hbm32bpp);
+        return NULL;
+    }
+    return hbm32bpp;
+}
+
+/*****************************************************************************/
+/* pixel formats */
+
+/* NOTE: The gray is the average of the colors: (b + g + r) / 3, so the
+ *       conversions from and to 8bpp ignore swap. */
+
+/* convert the pixels [ix, cx) of a row, swapping R and B if swap */
+typedef void (*II_CONVERT_ROW_PROC)(uint8_t *dst, const uint8_t *src,
+                                    int ix, int cx, bool swap);
+
+static void
+ii_convert_row_8to24(uint8_t *dst, const uint8_t *src, int ix, int cx,
+                     bool swap)
+{
+    (void)swap;
+    for (dst += ix * 3; ix < cx; ++ix, dst += 3)
+        dst[0] = dst[1] = dst[2] = src[ix];
+}
+
+static void
+ii_convert_row_8to32(uint8_t *dst, const uint8_t *src, int ix, int cx,
+                     bool swap)
+{
+    (void)swap;
+    for (dst += ix * 4; ix < cx; ++ix, dst += 4)
+    {
+        dst[0] = dst[1] = dst[2] = src[ix];
+        dst[3] = 0xFF;
+    }
+}
+
+static void
+ii_convert_row_24to8(uint8_t *dst, const uint8_t *src, int ix, int cx,
+                     bool swap)
+{
+    (void)swap;
+    for (src += ix * 3; ix < cx; ++ix, src += 3)
+        dst[ix] = (uint8_t)((src[0] + src[1] + src[2]) / 3);
+}
+
+static void
+ii_convert_row_32to8(uint8_t *dst, const uint8_t *src, int ix, int cx,
+                     bool swap)
+{
+    (void)swap;
+    for (src += ix * 4; ix < cx; ++ix, src += 4)
+        dst[ix] = (uint8_t)((src[0] + src[1] + src[2]) / 3);
+}
+
+static void
+ii_convert_row_24to24(uint8_t *dst, const uint8_t *src, int ix, int cx,
+                      bool swap)
+{
+    uint8_t b;
+
+    if (!swap)
+    {
+        memmove(dst + ix * 3, src + ix * 3, (cx - ix) * 3);
+        return;
+    }
+    for (src += ix * 3, dst += ix * 3; ix < cx; ++ix, src += 3, dst += 3)
+    {
+        b = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = b;
+    }
+}
+
+static void
+ii_convert_row_24to32(uint8_t *dst, const uint8_t *src, int ix, int cx,
+                      bool swap)
+{
+    int i0 = (swap ? 2 : 0), i2 = (swap ? 0 : 2);
+
+    for (src += ix * 3, dst += ix * 4; ix < cx; ++ix, src += 3, dst += 4)
+    {
+        dst[0] = src[i0];
+        dst[1] = src[1];
+        dst[2] = src[i2];
+        dst[3] = 0xFF;
+    }
+}
+
+static void
+ii_convert_row_32to24(uint8_t *dst, const uint8_t *src, int ix, int cx,
+                      bool swap)
+{
+    int i0 = (swap ? 2 : 0), i2 = (swap ? 0 : 2);
+    uint8_t b, g, r;
+
+    for (src += ix * 4, dst += ix * 3; ix < cx; ++ix, src += 4, dst += 3)
+    {
+        b = src[i0];
+        g = src[1];
+        r = src[i2];
+        dst[0] = b;
+        dst[1] = g;
+        dst[2] = r;
+    }
+}
+
+static void
+ii_convert_row_32to32(uint8_t *dst, const uint8_t *src, int ix, int cx,
+                      bool swap)
+{
+    uint8_t b;
+
+    if (!swap)
+    {
+        memmove(dst + ix * 4, src + ix * 4, (cx - ix) * 4);
+        return;
+    }
+    for (src += ix * 4, dst += ix * 4; ix < cx; ++ix, src += 4, dst += 4)
+    {
+        b = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = b;
+        dst[3] = src[3];
+    }
+}
+
+#ifdef II_USE_SSE2
+    /* NOTE: x / 3 is (x * 0xAAAB) >> 17 for x <= 765. */
+    static void
+    ii_convert_row_32to8_sse2(uint8_t *dst, const uint8_t *src, int ix, int cx,
+                              bool swap)
+    {
+        const __m128i low = _mm_set1_epi32(0xFF);
+        const __m128i k3 = _mm_set1_epi16((short)0xAAAB);
+        __m128i v, sum[4];
+        int i;
+
+        for (; ix + 16 <= cx; ix += 16)
+        {
+            for (i = 0; i < 4; ++i)
+            {
+                v = _mm_loadu_si128((const __m128i *)&src[(ix + i * 4) * 4]);
+                sum[i] = _mm_add_epi32(_mm_and_si128(v, low),
+                    _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(v, 8), low),
+                                  _mm_and_si128(_mm_srli_epi32(v, 16), low)));
+                sum[i] = _mm_srli_epi32(_mm_mulhi_epu16(sum[i], k3), 1);
+            }
+            _mm_storeu_si128((__m128i *)&dst[ix],
+                _mm_packus_epi16(_mm_packs_epi32(sum[0], sum[1]),
+                                 _mm_packs_epi32(sum[2], sum[3])));
+        }
+        ii_convert_row_32to8(dst, src, ix, cx, swap);
+    }
+#endif  /* def II_USE_SSE2 */
+
+#ifdef II_USE_SSSE3
+    /* NOTE: The 24-bit kernels work on 4 pixels in 16 bytes. They read or
+     *       write 4 bytes more, so the loops stop 2 pixels before the end. */
+
+    static II_TARGET_SSSE3 void
+    ii_convert_row_8to24_ssse3(uint8_t *dst, const uint8_t *src, int ix,
+                               int cx, bool swap)
+    {
+        const __m128i m0 = _mm_setr_epi8(
+            0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+        const __m128i m1 = _mm_setr_epi8(
+            5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+        const __m128i m2 = _mm_setr_epi8(
+            10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+        __m128i v;
+
+        for (; ix + 16 <= cx; ix += 16)
+        {
+            v = _mm_loadu_si128((const __m128i *)&src[ix]);
+            _mm_storeu_si128((__m128i *)&dst[ix * 3], _mm_shuffle_epi8(v, m0));
+            _mm_storeu_si128((__m128i *)&dst[ix * 3 + 16],
+                             _mm_shuffle_epi8(v, m1));
+            _mm_storeu_si128((__m128i *)&dst[ix * 3 + 32],
+                             _mm_shuffle_epi8(v, m2));
+        }
+        ii_convert_row_8to24(dst, src, ix, cx, swap);
+    }
+
+    static II_TARGET_SSSE3 void
+    ii_convert_row_8to32_ssse3(uint8_t *dst, const uint8_t *src, int ix,
+                               int cx, bool swap)
+    {
+        const __m128i alphas = _mm_set1_epi32((int)0xFF000000);
+        __m128i v, m;
+        int i;
+
+        for (; ix + 16 <= cx; ix += 16)
+        {
+            v = _mm_loadu_si128((const __m128i *)&src[ix]);
+            for (i = 0; i < 4; ++i)
+            {
+                m = _mm_setr_epi8(
+                    i * 4, i * 4, i * 4, -1,
+                    i * 4 + 1, i * 4 + 1, i * 4 + 1, -1,
+                    i * 4 + 2, i * 4 + 2, i * 4 + 2, -1,
+                    i * 4 + 3, i * 4 + 3, i * 4 + 3, -1);
+                _mm_storeu_si128((__m128i *)&dst[(ix + i * 4) * 4],
+                    _mm_or_si128(_mm_shuffle_epi8(v, m), alphas));
+            }
+        }
+        ii_convert_row_8to32(dst, src, ix, cx, swap);
+    }
+
+    static II_TARGET_SSSE3 void
+    ii_convert_row_24to24_ssse3(uint8_t *dst, const uint8_t *src, int ix,
+                                int cx, bool swap)
+    {
+        /* NOTE: The last 4 bytes are kept to work in place. */
+        const __m128i m = _mm_setr_epi8(
+            2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+        __m128i v;
+
+        for (; swap && ix + 6 <= cx; ix += 4)
+        {
+            v = _mm_loadu_si128((const __m128i *)&src[ix * 3]);
+            _mm_storeu_si128((__m128i *)&dst[ix * 3], _mm_shuffle_epi8(v, m));
+        }
+        ii_convert_row_24to24(dst, src, ix, cx, swap);
+    }
+
+    static II_TARGET_SSSE3 void
+    ii_convert_row_24to32_ssse3(uint8_t *dst, const uint8_t *src, int ix,
+                                int cx, bool swap)
+    {
+        const __m128i m = (swap ?
+            _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1,
+                          8, 7, 6, -1, 11, 10, 9, -1) :
+            _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                          6, 7, 8, -1, 9, 10, 11, -1));
+        const __m128i alphas = _mm_set1_epi32((int)0xFF000000);
+        __m128i v;
+
+        for (; ix + 6 <= cx; ix += 4)
+        {
+            v = _mm_loadu_si128((const __m128i *)&src[ix * 3]);
+            _mm_storeu_si128((__m128i *)&dst[ix * 4],
+                             _mm_or_si128(_mm_shuffle_epi8(v, m), alphas));
+        }
+        ii_convert_row_24to32(dst, src, ix, cx, swap);
+    }
+
+    static II_TARGET_SSSE3 void
+    ii_convert_row_32to24_ssse3(uint8_t *dst, const uint8_t *src, int ix,
+                                int cx, bool swap)
+    {
+        const __m128i m = (swap ?
+            _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                          -1, -1, -1, -1) :
+            _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                          -1, -1, -1, -1));
+        __m128i v;
+
+        for (; ix + 6 <= cx; ix += 4)
+        {
+            v = _mm_loadu_si128((const __m128i *)&src[ix * 4]);
+            _mm_storeu_si128((__m128i *)&dst[ix * 3], _mm_shuffle_epi8(v, m));
+        }
+        ii_convert_row_32to24(dst, src, ix, cx, swap);
+    }
+
+    static II_TARGET_SSSE3 void
+    ii_convert_row_32to32_ssse3(uint8_t *dst, const uint8_t *src, int ix,
+                                int cx, bool swap)
+    {
+        const __m128i m = _mm_setr_epi8(
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        __m128i v;
+
+        for (; swap && ix + 4 <= cx; ix += 4)
+        {
+            v = _mm_loadu_si128((const __m128i *)&src[ix * 4]);
+            _mm_storeu_si128((__m128i *)&dst[ix * 4], _mm_shuffle_epi8(v, m));
+        }
+        ii_convert_row_32to32(dst, src, ix, cx, swap);
+    }
+#endif  /* def II_USE_SSSE3 */
+
+#ifdef II_USE_AVX2
+    /* the sums of 8 pixels of the bytes picked by the shuffle */
+    static ii_inline II_TARGET_AVX2 __m256i
+    ii_average_pixels8_avx2(__m256i v, __m256i shuffle)
+    {
+        const __m256i ones8 = _mm256_set1_epi8(1);
+        const __m256i ones16 = _mm256_set1_epi16(1);
+        const __m256i k3 = _mm256_set1_epi16((short)0xAAAB);
+
+        /* NOTE: The shuffle makes the dwords of B, G, R and zero. */
+        v = _mm256_shuffle_epi8(v, shuffle);
+        v = _mm256_madd_epi16(_mm256_maddubs_epi16(v, ones8), ones16);
+        return _mm256_srli_epi32(_mm256_mulhi_epu16(v, k3), 1);
+    }
+
+    /* pack the dwords of 32 pixels to the bytes */
+    static ii_inline II_TARGET_AVX2 __m256i
+    ii_pack_pixels32_avx2(__m256i v0, __m256i v1, __m256i v2, __m256i v3)
+    {
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        v0 = _mm256_packus_epi16(_mm256_packs_epi32(v0, v1),
+                                 _mm256_packs_epi32(v2, v3));
+        return _mm256_permutevar8x32_epi32(v0, order);
+    }
+
+    static II_TARGET_AVX2 void
+    ii_convert_row_32to8_avx2(uint8_t *dst, const uint8_t *src, int ix,
+                              int cx, bool swap)
+    {
+        const __m256i shuffle = _mm256_setr_epi8(
+            0, 1, 2, -1, 4, 5, 6, -1, 8, 9, 10, -1, 12, 13, 14, -1,
+            0, 1, 2, -1, 4, 5, 6, -1, 8, 9, 10, -1, 12, 13, 14, -1);
+        __m256i sum[4];
+        int i;
+
+        for (; ix + 32 <= cx; ix += 32)
+        {
+            for (i = 0; i < 4; ++i)
+            {
+                sum[i] = ii_average_pixels8_avx2(_mm256_loadu_si256(
+                    (const __m256i *)&src[(ix + i * 8) * 4]), shuffle);
+            }
+            _mm256_storeu_si256((__m256i *)&dst[ix],
+                ii_pack_pixels32_avx2(sum[0], sum[1], sum[2], sum[3]));
+        }
+        ii_convert_row_32to8_sse2(dst, src, ix, cx, swap);
+    }
+
+    static II_TARGET_AVX2 void
+    ii_convert_row_24to8_avx2(uint8_t *dst, const uint8_t *src, int ix,
+                              int cx, bool swap)
+    {
+        const __m256i shuffle = _mm256_setr_epi8(
+            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        __m256i sum[4];
+        int i, j;
+
+        /* NOTE: The last 16 bytes read end 4 bytes after the 32 pixels. */
+        for (; ix + 34 <= cx; ix += 32)
+        {
+            for (i = 0; i < 4; ++i)
+            {
+                j = (ix + i * 8) * 3;
+                sum[i] = ii_average_pixels8_avx2(_mm256_inserti128_si256(
+                    _mm256_castsi128_si256(
+                        _mm_loadu_si128((const __m128i *)&src[j])),
+                    _mm_loadu_si128((const __m128i *)&src[j + 12]), 1),
+                    shuffle);
+            }
+            _mm256_storeu_si256((__m256i *)&dst[ix],
+                ii_pack_pixels32_avx2(sum[0], sum[1], sum[2], sum[3]));
+        }
+        ii_convert_row_24to8(dst, src, ix, cx, swap);
+    }
+
+    static II_TARGET_AVX2 void
+    ii_convert_row_32to32_avx2(uint8_t *dst, const uint8_t *src, int ix,
+                               int cx, bool swap)
+    {
+        const __m256i m = _mm256_setr_epi8(
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        __m256i v;
+
+        for (; swap && ix + 8 <= cx; ix += 8)
+        {
+            v = _mm256_loadu_si256((const __m256i *)&src[ix * 4]);
+            _mm256_storeu_si256((__m256i *)&dst[ix * 4],
+                                _mm256_shuffle_epi8(v, m));
+        }
+        ii_convert_row_32to32(dst, src, ix, cx, swap);
+    }
+#endif  /* def II_USE_AVX2 */
+
+/* the best proc to convert the pixels of the bytes */
+static II_CONVERT_ROW_PROC
+ii_convert_row_proc(int src_bytes, int dst_bytes)
+{
+    II_CONVERT_ROW_PROC proc = NULL;
+
+    switch (src_bytes)
+    {
+    case 1:
+        if (dst_bytes == 3)
+            proc = ii_convert_row_8to24;
+        else if (dst_bytes == 4)
+            proc = ii_convert_row_8to32;
+#ifdef II_USE_SSSE3
+        if (ii_has_ssse3())
+        {
+            if (dst_bytes == 3)
+                proc = ii_convert_row_8to24_ssse3;
+            else if (dst_bytes == 4)
+                proc = ii_convert_row_8to32_ssse3;
+        }
+#endif
+        break;
+    case 3:
+        if (dst_bytes == 1)
+            proc = ii_convert_row_24to8;
+        else if (dst_bytes == 3)
+            proc = ii_convert_row_24to24;
+        else if (dst_bytes == 4)
+            proc = ii_convert_row_24to32;
+#ifdef II_USE_SSSE3
+        if (ii_has_ssse3())
+        {
+            if (dst_bytes == 3)
+                proc = ii_convert_row_24to24_ssse3;
+            else if (dst_bytes == 4)
+                proc = ii_convert_row_24to32_ssse3;
+        }
+#endif
+#ifdef II_USE_AVX2
+        if (ii_has_avx2() && dst_bytes == 1)
+            proc = ii_convert_row_24to8_avx2;
+#endif
+        break;
+    case 4:
+        if (dst_bytes == 1)
+            proc = ii_convert_row_32to8;
+        else if (dst_bytes == 3)
+            proc = ii_convert_row_32to24;
+        else if (dst_bytes == 4)
+            proc = ii_convert_row_32to32;
+#ifdef II_USE_SSE2
+        if (ii_has_sse2() && dst_bytes == 1)
+            proc = ii_convert_row_32to8_sse2;
+#endif
+#ifdef II_USE_SSSE3
+        if (ii_has_ssse3())
+        {
+            if (dst_bytes == 3)
+                proc = ii_convert_row_32to24_ssse3;
+            else if (dst_bytes == 4)
+                proc = ii_convert_row_32to32_ssse3;
+        }
+#endif
+#ifdef II_USE_AVX2
+        if (ii_has_avx2())
+        {
+            if (dst_bytes == 1)
+                proc = ii_convert_row_32to8_avx2;
+            else if (dst_bytes == 4)
+                proc = ii_convert_row_32to32_avx2;
+        }
+#endif
+        break;
+    }
+    return proc;
+}
+
+/* the bytes of a pixel of the format or zero */
+static int
+ii_pixel_format_bytes(II_PIXEL_FORMAT fmt)
+{
+    switch (fmt)
+    {
+    case II_PIXEL_FORMAT_GRAY8:     return 1;
+    case II_PIXEL_FORMAT_BGR24:     return 3;
+    case II_PIXEL_FORMAT_RGB24:     return 3;
+    case II_PIXEL_FORMAT_BGRA32:    return 4;
+    case II_PIXEL_FORMAT_RGBA32:    return 4;
+    }
+    return 0;
+}
+
+IMAIO_API bool IIAPI
+ii_convert_pixels(II_PIXEL_FORMAT src_fmt, II_LPCVOID src, int src_stride,
+                  II_PIXEL_FORMAT dst_fmt, II_LPVOID dst, int dst_stride,
+                  int width, int height)
+{
+    II_CONVERT_ROW_PROC proc;
+    const uint8_t *pbSrc;
+    uint8_t *pbDest;
+    int src_bytes, dst_bytes, y;
+    bool swap;
+
+    src_bytes = ii_pixel_format_bytes(src_fmt);
+    dst_bytes = ii_pixel_format_bytes(dst_fmt);
+    if (src_bytes == 0 || dst_bytes == 0 || width < 0 || height < 0)
+        return false;
+
+    /* NOTE: The gray has no order of the colors. */
+    swap = (src_bytes > 1 && dst_bytes > 1 &&
+            (src_fmt == II_PIXEL_FORMAT_RGB24 ||
+             src_fmt == II_PIXEL_FORMAT_RGBA32) !=
+            (dst_fmt == II_PIXEL_FORMAT_RGB24 ||
+             dst_fmt == II_PIXEL_FORMAT_RGBA32));
+
+    proc = ii_convert_row_proc(src_bytes, dst_bytes);
+    pbSrc = (const uint8_t *)src;
+    pbDest = (uint8_t *)dst;
+    for (y = 0; y < height; ++y)
+    {
+        if (proc)
+            proc(pbDest, pbSrc, 0, width, swap);
+        else if (pbDest != pbSrc)
+            memmove(pbDest, pbSrc, width);
+        pbSrc += src_stride;
+        pbDest += dst_stride;
+    }
+    return true;
+}
+
+IMAIO_API bool IIAPI
+ii_view_create(II_VIEW *view, II_HIMAGE hbm)
+{
+    assert(view);
+    if (!ii_get_info(hbm, &view->info) || view->info.bmBits == NULL)
+        return false;
+
+    view->hbm = hbm;
+    view->x = view->y = 0;
+    return true;
+}
+
+IMAIO_API bool IIAPI
+ii_view_sub(II_VIEW *sub, const II_VIEW *view, int x, int y, int cx, int cy)
+{
+    II_VIEW temp;
+
+    assert(sub);
+    assert(view);
+    if (x < 0 || y < 0 || cx <= 0 || cy <= 0 ||
+        x + cx > view->info.bmWidth || y + cy > view->info.bmHeight)
+    {
+        return false;
+    }
+    /* NOTE: A view of 1bpp or 4bpp must start at a byte. */
+    if ((x * view->info.bmBitsPixel) & 7)
+        return false;
+
+    /* NOTE: The rows are bottom-up. sub may be view. */
+    temp = *view;
+    temp.info.bmBits = (uint8_t *)view->info.bmBits +
+        (view->info.bmHeight - y - cy) * view->info.bmWidthBytes +
+        ((x * view->info.bmBitsPixel) >> 3);
+    temp.info.bmWidth = cx;
+    temp.info.bmHeight = cy;
+    temp.x = view->x + x;
+    temp.y = view->y + y;
+    *sub = temp;
+    return true;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_view_image(const II_VIEW *view)
+{
+    II_HIMAGE hbmNew;
+    II_IMGINFO bmNew;
+    II_PALETTE *table = NULL;
+    int y, cb, n;
+
+    assert(view);
+    if (view->info.bmBitsPixel <= 8)
+    {
+        table = ii_get_palette(view->hbm);
+        n = (1 << view->info.bmBitsPixel);
+        if (table && n < table->num_colors)
+            table->num_colors = n;
+    }
+    hbmNew = ii_create(view->info.bmWidth, view->info.bmHeight,
+                       view->info.bmBitsPixel, table);
+    ii_palette_destroy(table);
+    if (hbmNew == NULL)
+        return NULL;
+
+    /* copy the rows straight */
+    ii_get_info(hbmNew, &bmNew);
+    cb = (view->info.bmWidth * view->info.bmBitsPixel + 7) >> 3;
+    for (y = 0; y < view->info.bmHeight; ++y)
+    {
+        memcpy((uint8_t *)bmNew.bmBits + y * bmNew.bmWidthBytes,
+               (const uint8_t *)view->info.bmBits + y * view->info.bmWidthBytes,
+               cb);
+    }
+    return hbmNew;
+}
+
+IMAIO_API void IIAPI
+ii_put_view(II_HIMAGE hbm, int x, int y, const II_VIEW *view,
+            const int *pi_trans, uint8_t bSCA)
+{
+    assert(view);
+    ii_put(hbm, x, y, view->hbm, view->x, view->y,
+           view->info.bmWidth, view->info.bmHeight, pi_trans, bSCA);
+}
+
+/*****************************************************************************/
+
+IMAIO_API II_HIMAGE IIAPI
+ii_subimage_8bpp_minus(II_HIMAGE hbm, int x, int y, int cx, int cy, int bpp)
+{
+    II_HIMAGE hbmNew;
+    II_PALETTE *table;
+    II_VIEW view;
+    int n;
+
+    assert(hbm);
+    assert(0 < bpp && bpp <= 8);
+    if (ii_view_create(&view, hbm) &&
+        ii_view_sub(&view, &view, x, y, cx, cy) &&
+        view.info.bmBitsPixel == bpp)
+    {
+        return ii_view_image(&view);
+    }
+
+    table = ii_get_palette(hbm);
+    if (table)
+    {
+        n = (1 << bpp);
+        if (n < table->num_colors)
+            table->num_colors = n;
+    }
+
+    hbmNew = ii_create(cx, cy, bpp, table);
+    assert(hbmNew);
+    ii_palette_destroy(table);
+
+    ii_put(hbmNew, 0, 0, hbm, x, y, cx, cy, NULL, 255);
+
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_subimage_24bpp(II_HIMAGE hbm, int x, int y, int cx, int cy)
+{
+    II_HIMAGE hbmNew;
+    II_VIEW view;
+
+    assert(hbm);
+    if (ii_view_create(&view, hbm) &&
+        ii_view_sub(&view, &view, x, y, cx, cy) &&
+        view.info.bmBitsPixel == 24)
+    {
+        return ii_view_image(&view);
+    }
+
+    hbmNew = ii_create_24bpp(cx, cy);
+    ii_put(hbmNew, 0, 0, hbm, x, y, cx, cy, NULL, 255);
+
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_subimage_32bpp(II_HIMAGE hbm, int x, int y, int cx, int cy)
+{
+    II_HIMAGE hbmNew, hbmSrc;
+    II_IMGINFO bm, bmNew;
+    int x0, x1, y0, y1, yy;
+    uint8_t *pbSrc, *pbNew;
+
+    assert(hbm);
+    if (!ii_get_info(hbm, &bm))
+        return NULL;
+
+    if (bm.bmBitsPixel != 32)
+    {
+        hbmSrc = ii_32bpp(hbm);
+        if (hbmSrc == NULL)
+            return NULL;
+        hbmNew = ii_subimage_32bpp(hbmSrc, x, y, cx, cy);
+        ii_destroy(hbmSrc);
+        return hbmNew;
+    }
+
+    hbmNew = ii_create_32bpp(cx, cy);
+    if (hbmNew == NULL)
+        return NULL;
+    ii_get_info(hbmNew, &bmNew);
+
+    /* copy the rows straight (no blending) */
+    x0 = (x < 0) ? 0 : x;
+    y0 = (y < 0) ? 0 : y;
+    x1 = min(x + cx, (int)bm.bmWidth);
+    y1 = min(y + cy, (int)bm.bmHeight);
+    for (yy = y0; yy < y1 && x0 < x1; ++yy)
+    {
+        pbSrc = (uint8_t *)bm.bmBits;
+        pbSrc += (bm.bmHeight - 1 - yy) * bm.bmWidthBytes + (x0 << 2);
+        pbNew = (uint8_t *)bmNew.bmBits;
+        pbNew += (cy - 1 - (yy - y)) * bmNew.bmWidthBytes + ((x0 - x) << 2);
+        memcpy(pbNew, pbSrc, (x1 - x0) << 2);
+    }
+
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_subimage(II_HIMAGE hbm, int x, int y, int cx, int cy)
+{
+    II_HIMAGE hbmNew;
+    II_IMGINFO bm;
+
+    if (!ii_get_info(hbm, &bm))
+        return NULL;
+
+    switch (bm.bmBitsPixel)
+    {
+    case 32:
+        hbmNew = ii_subimage_32bpp(hbm, x, y, cx, cy);
+        break;
+    case 24:
+        hbmNew = ii_subimage_24bpp(hbm, x, y, cx, cy);
+        break;
+    default:
+        hbmNew = ii_subimage_8bpp_minus(hbm, x, y, cx, cy, bm.bmBitsPixel);
+    }
+    assert(hbmNew);
+    return hbmNew;
+}
+
+IMAIO_API uint32_t IIAPI
+ii_get_bpp(II_HIMAGE hbm)
+{
+    II_IMGINFO bm;
+    assert(hbm);
+    if (ii_get_info(hbm, &bm))
+        return bm.bmBitsPixel;
+    return 0;
+}
+
+IMAIO_API uint8_t * IIAPI
+ii_get_pixels(II_HIMAGE hbm)
+{
+    II_IMGINFO bm;
+    assert(hbm);
+    if (ii_get_info(hbm, &bm))
+        return (uint8_t *)bm.bmBits;
+    return NULL;
+}
+
+IMAIO_API int IIAPI
+ii_get_width(II_HIMAGE hbm)
+{
+    II_IMGINFO bm;
+    assert(hbm);
+    if (ii_get_info(hbm, &bm))
+        return bm.bmWidth;
+    return 0;
+}
+
+IMAIO_API int IIAPI
+ii_get_height(II_HIMAGE hbm)
+{
+    II_IMGINFO bm;
+    assert(hbm);
+    if (ii_get_info(hbm, &bm))
+        return bm.bmHeight;
+    return 0;
+}
+
+/*****************************************************************************/
+/* alpha scans */
+
+/* the bits of the alpha found by ii_scan_alpha_row */
+#define II_ALPHA_FOUND_CLEAR    1   /* not 255 */
+#define II_ALPHA_FOUND_SEMI     2   /* neither 0 nor 255 */
+
+/* scan the alpha of a row of BGRA pixels until a semi-transparent one */
+typedef int (*II_SCAN_ALPHA_ROW_PROC)(const uint32_t *pdw, int ix, int cx);
+
+static int
+ii_scan_alpha_row(const uint32_t *pdw, int ix, int cx)
+{
+    int found = 0;
+    uint32_t alpha;
+
+    for (; ix < cx; ++ix)
+    {
+        alpha = pdw[ix] >> 24;
+        if (alpha != 255)
+        {
+            if (alpha != 0)
+                return II_ALPHA_FOUND_CLEAR | II_ALPHA_FOUND_SEMI;
+            found = II_ALPHA_FOUND_CLEAR;
+        }
+    }
+    return found;
+}
+
+/* set zero to the alpha other than 255 of a row of BGRA pixels */
+typedef void (*II_ERASE_ROW_PROC)(uint32_t *pdw, int ix, int cx);
+
+static void
+ii_erase_semitrans_row(uint32_t *pdw, int ix, int cx)
+{
+    for (; ix < cx; ++ix)
+    {
+        if ((pdw[ix] >> 24) != 255)
+            pdw[ix] &= 0x00FFFFFF;
+    }
+}
+
+/* store the alpha of a row of BGRA pixels to the bytes */
+typedef void (*II_EXTRACT_ALPHA_ROW_PROC)(uint8_t *pb, const uint32_t *pdw,
+                                          int ix, int cx);
+
+static void
+ii_extract_alpha_row(uint8_t *pb, const uint32_t *pdw, int ix, int cx)
+{
+    for (; ix < cx; ++ix)
+        pb[ix] = (uint8_t)(pdw[ix] >> 24);
+}
+
+#ifdef II_USE_SSE2
+    static int
+    ii_scan_alpha_row_sse2(const uint32_t *pdw, int ix, int cx)
+    {
+        const __m128i alphas = _mm_set1_epi32((int)0xFF000000);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i a, opaque, clear, semi;
+        int i, found = 0;
+
+        for (; ix + 16 <= cx; ix += 16)
+        {
+            /* NOTE: 16 pixels are tested by a movemask. */
+            clear = semi = zero;
+            for (i = ix; i < ix + 16; i += 4)
+            {
+                a = _mm_and_si128(
+                    _mm_loadu_si128((const __m128i *)&pdw[i]), alphas);
+                opaque = _mm_cmpeq_epi32(a, alphas);
+                a = _mm_cmpeq_epi32(a, zero);
+                clear = _mm_or_si128(clear, a);
+                semi = _mm_or_si128(semi, _mm_cmpeq_epi32(
+                    _mm_or_si128(opaque, a), zero));
+            }
+            if (_mm_movemask_epi8(semi))
+                return II_ALPHA_FOUND_CLEAR | II_ALPHA_FOUND_SEMI;
+            if (_mm_movemask_epi8(clear))
+                found = II_ALPHA_FOUND_CLEAR;
+        }
+        return found | ii_scan_alpha_row(pdw, ix, cx);
+    }
+
+    static void
+    ii_erase_semitrans_row_sse2(uint32_t *pdw, int ix, int cx)
+    {
+        const __m128i alphas = _mm_set1_epi32((int)0xFF000000);
+        const __m128i colors = _mm_set1_epi32(0x00FFFFFF);
+        __m128i v, keep;
+
+        for (; ix + 4 <= cx; ix += 4)
+        {
+            v = _mm_loadu_si128((const __m128i *)&pdw[ix]);
+            keep = _mm_cmpeq_epi32(_mm_and_si128(v, alphas), alphas);
+            if (_mm_movemask_epi8(keep) == 0xFFFF)
+                continue;
+            v = _mm_and_si128(v, _mm_or_si128(keep, colors));
+            _mm_storeu_si128((__m128i *)&pdw[ix], v);
+        }
+        ii_erase_semitrans_row(pdw, ix, cx);
+    }
+
+    static void
+    ii_extract_alpha_row_sse2(uint8_t *pb, const uint32_t *pdw,
+                              int ix, int cx)
+    {
+        __m128i v0, v1, v2, v3;
+
+        for (; ix + 16 <= cx; ix += 16)
+        {
+            v0 = _mm_srli_epi32(
+                _mm_loadu_si128((const __m128i *)&pdw[ix]), 24);
+            v1 = _mm_srli_epi32(
+                _mm_loadu_si128((const __m128i *)&pdw[ix + 4]), 24);
+            v2 = _mm_srli_epi32(
+                _mm_loadu_si128((const __m128i *)&pdw[ix + 8]), 24);
+            v3 = _mm_srli_epi32(
+                _mm_loadu_si128((const __m128i *)&pdw[ix + 12]), 24);
+            _mm_storeu_si128((__m128i *)&pb[ix],
+                _mm_packus_epi16(_mm_packs_epi32(v0, v1),
+                                 _mm_packs_epi32(v2, v3)));
+        }
+        ii_extract_alpha_row(pb, pdw, ix, cx);
+    }
+#endif  /* def II_USE_SSE2 */
+
+#ifdef II_USE_AVX2
+    static II_TARGET_AVX2 int
+    ii_scan_alpha_row_avx2(const uint32_t *pdw, int ix, int cx)
+    {
+        const __m256i alphas = _mm256_set1_epi32((int)0xFF000000);
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i a, opaque, clear, semi;
+        int i, found = 0;
+
+        for (; ix + 32 <= cx; ix += 32)
+        {
+            /* NOTE: 32 pixels are tested by a movemask. */
+            clear = semi = zero;
+            for (i = ix; i < ix + 32; i += 8)
+            {
+                a = _mm256_and_si256(
+                    _mm256_loadu_si256((const __m256i *)&pdw[i]), alphas);
+                opaque = _mm256_cmpeq_epi32(a, alphas);
+                a = _mm256_cmpeq_epi32(a, zero);
+                clear = _mm256_or_si256(clear, a);
+                semi = _mm256_or_si256(semi, _mm256_cmpeq_epi32(
+                    _mm256_or_si256(opaque, a), zero));
+            }
+            if (_mm256_movemask_epi8(semi))
+                return II_ALPHA_FOUND_CLEAR | II_ALPHA_FOUND_SEMI;
+            if (_mm256_movemask_epi8(clear))
+                found = II_ALPHA_FOUND_CLEAR;
+        }
+        return found | ii_scan_alpha_row_sse2(pdw, ix, cx);
+    }
+
+    static II_TARGET_AVX2 void
+    ii_erase_semitrans_row_avx2(uint32_t *pdw, int ix, int cx)
+    {
+        const __m256i alphas = _mm256_set1_epi32((int)0xFF000000);
+        const __m256i colors = _mm256_set1_epi32(0x00FFFFFF);
+        __m256i v, keep;
+
+        for (; ix + 8 <= cx; ix += 8)
+        {
+            v = _mm256_loadu_si256((const __m256i *)&pdw[ix]);
+            keep = _mm256_cmpeq_epi32(_mm256_and_si256(v, alphas), alphas);
+            if (_mm256_movemask_epi8(keep) == -1)
+                continue;
+            v = _mm256_and_si256(v, _mm256_or_si256(keep, colors));
+            _mm256_storeu_si256((__m256i *)&pdw[ix], v);
+        }
+        ii_erase_semitrans_row_sse2(pdw, ix, cx);
+    }
+
+    static II_TARGET_AVX2 void
+    ii_extract_alpha_row_avx2(uint8_t *pb, const uint32_t *pdw,
+                              int ix, int cx)
+    {
+        /* NOTE: The packs work in the 128-bit lanes. */
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        __m256i v0, v1, v2, v3;
+
+        for (; ix + 32 <= cx; ix += 32)
+        {
+            v0 = _mm256_srli_epi32(
+                _mm256_loadu_si256((const __m256i *)&pdw[ix]), 24);
+            v1 = _mm256_srli_epi32(
+                _mm256_loadu_si256((const __m256i *)&pdw[ix + 8]), 24);
+            v2 = _mm256_srli_epi32(
+                _mm256_loadu_si256((const __m256i *)&pdw[ix + 16]), 24);
+            v3 = _mm256_srli_epi32(
+                _mm256_loadu_si256((const __m256i *)&pdw[ix + 24]), 24);
+            v0 = _mm256_packus_epi16(_mm256_packs_epi32(v0, v1),
+                                     _mm256_packs_epi32(v2, v3));
+            _mm256_storeu_si256((__m256i *)&pb[ix],
+                                _mm256_permutevar8x32_epi32(v0, order));
+        }
+        ii_extract_alpha_row_sse2(pb, pdw, ix, cx);
+    }
+#endif  /* def II_USE_AVX2 */
+
+IMAIO_API II_ALPHA_STATE IIAPI
+ii_view_alpha_state(const II_VIEW *view)
+{
+    II_SCAN_ALPHA_ROW_PROC proc;
+    const uint8_t *pb;
+    int y, found;
+
+    assert(view);
+    if (view->info.bmBitsPixel != 32)
+        return II_ALPHA_OPAQUE;
+
+    proc = ii_scan_alpha_row;
+#ifdef II_USE_SSE2
+    if (ii_has_sse2())
+        proc = ii_scan_alpha_row_sse2;
+#endif
+#ifdef II_USE_AVX2
+    if (ii_has_avx2())
+        proc = ii_scan_alpha_row_avx2;
+#endif
+
+    found = 0;
+    pb = (const uint8_t *)view->info.bmBits;
+    for (y = 0; y < view->info.bmHeight; ++y)
+    {
+        found |= proc((const uint32_t *)pb, 0, view->info.bmWidth);
+        if (found & II_ALPHA_FOUND_SEMI)
+            return II_ALPHA_SEMITRANS;
+        pb += view->info.bmWidthBytes;
+    }
+    return (found ? II_ALPHA_BINARY : II_ALPHA_OPAQUE);
+}
+
+/* NOTE: ii_is_opaque and ii_erase_semitrans scan the pixels every time,
+ *       because the caller may have written them through bmBits since the
+ *       alpha state was cached. */
+IMAIO_API bool IIAPI
+ii_is_opaque(II_HIMAGE hbm)
+{
+    II_IMGINFO bm;
+    II_VIEW view;
+
+    assert(hbm);
+    if (!ii_get_info(hbm, &bm))
+        return false;
+    if (bm.bmBitsPixel <= 24)
+        return true;
+    if (!ii_view_create(&view, hbm))
+        return false;
+    return ii_view_alpha_state(&view) == II_ALPHA_OPAQUE;
+}
+
+IMAIO_API void IIAPI
+ii_erase_semitrans(II_HIMAGE hbm)
+{
+    II_ERASE_ROW_PROC proc;
+    uint8_t *pb;
+    II_IMGINFO bm;
+    II_VIEW view;
+    int y;
+
+    assert(hbm);
+    if (!ii_get_info(hbm, &bm) || bm.bmBitsPixel <= 24)
+        return;
+    /* nothing to erase */
+    if (!ii_view_create(&view, hbm) ||
+        ii_view_alpha_state(&view) != II_ALPHA_SEMITRANS)
+    {
+        return;
+    }
+    if (!ii_make_writable(hbm))
+        return;
+    ii_get_info(hbm, &bm);
+
+    proc = ii_erase_semitrans_row;
+#ifdef II_USE_SSE2
+    if (ii_has_sse2())
+        proc = ii_erase_semitrans_row_sse2;
+#endif
+#ifdef II_USE_AVX2
+    if (ii_has_avx2())
+        proc = ii_erase_semitrans_row_avx2;
+#endif
+
+    pb = (uint8_t *)bm.bmBits;
+    for (y = 0; y < bm.bmHeight; ++y)
+    {
+        proc((uint32_t *)pb, 0, bm.bmWidth);
+        pb += bm.bmWidthBytes;
+    }
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_stretched(II_HIMAGE hbm, int cxNew, int cyNew)
+{
+    II_IMGINFO bm;
+
+    assert(hbm);
+    if (!ii_get_info(hbm, &bm))
+        return NULL;
+
+    if (bm.bmBitsPixel <= 24)
+        return ii_stretched_24bpp(hbm, cxNew, cyNew);
+    else
+        return ii_stretched_32bpp(hbm, cxNew, cyNew);
+}
+
+/* a channel of the bilinear interpolation of c00, c10, c01 and c11 */
+/* NOTE: The weights ex0 + ex1 and ey0 + ey1 are 256. */
+#define II_BILINEAR_CHANNEL(shift) \
+    (((ey0 * ((ex0 * ((c00 >> (shift)) & 0xFF) + \
+               ex1 * ((c10 >> (shift)) & 0xFF)) >> 8) + \
+       ey1 * ((ex0 * ((c01 >> (shift)) & 0xFF) + \
+               ex1 * ((c11 >> (shift)) & 0xFF)) >> 8)) >> 8) << (shift))
+
+/* the columns of ii_stretched_32bpp */
+typedef struct II_STRETCH_COLUMNS
+{
+    uint64_t *  w0;             /* weights of x0 repeated in four uint16_t */
+    uint64_t *  w1;             /* weights of x1 repeated in four uint16_t */
+    int32_t *   x0;             /* source columns */
+    int32_t *   x1;             /* source columns (right) */
+} II_STRETCH_COLUMNS;
+/* NOTE: The weights of a column are in 0..256 and the sum is 256. */
+
+typedef void (*II_STRETCH_ROW_PROC)(
+    uint32_t *pdwNew, const uint32_t *pdw0, const uint32_t *pdw1,
+    const II_STRETCH_COLUMNS *columns, int ix, int cx,
+    uint32_t ey0, uint32_t ey1);
+
+static void
+ii_stretch_row_32bpp(
+    uint32_t *pdwNew, const uint32_t *pdw0, const uint32_t *pdw1,
+    const II_STRETCH_COLUMNS *columns, int ix, int cx,
+    uint32_t ey0, uint32_t ey1)
+{
+    uint32_t c00, c01, c10, c11, ex0, ex1;
+
+    for (; ix < cx; ++ix)
+    {
+        ex0 = (uint32_t)(columns->w0[ix] & 0xFFFF);
+        ex1 = (uint32_t)(columns->w1[ix] & 0xFFFF);
+        c00 = pdw0[columns->x0[ix]];
+        c10 = pdw0[columns->x1[ix]];
+        c01 = pdw1[columns->x0[ix]];
+        c11 = pdw1[columns->x1[ix]];
+        pdwNew[ix] = II_BILINEAR_CHANNEL(0) | II_BILINEAR_CHANNEL(8) |
+                     II_BILINEAR_CHANNEL(16) | II_BILINEAR_CHANNEL(24);
+    }
+}
+
+#ifdef II_USE_SSE2
+    /* two pixels of BGRA in eight uint16_t */
+    #define II_SSE2_PIXELS2(pdw, i0, i1) \
+        _mm_unpacklo_epi8( \
+            _mm_set_epi32(0, 0, (int)(pdw)[i1], (int)(pdw)[i0]), zero)
+
+    static void
+    ii_stretch_row_32bpp_sse2(
+        uint32_t *pdwNew, const uint32_t *pdw0, const uint32_t *pdw1,
+        const II_STRETCH_COLUMNS *columns, int ix, int cx,
+        uint32_t ey0, uint32_t ey1)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i vey0 = _mm_set1_epi16((short)ey0);
+        const __m128i vey1 = _mm_set1_epi16((short)ey1);
+        const int32_t *x0 = columns->x0, *x1 = columns->x1;
+        __m128i ex0, ex1, h0, h1, v;
+
+        for (; ix + 2 <= cx; ix += 2)
+        {
+            ex0 = _mm_loadu_si128((const __m128i *)&columns->w0[ix]);
+            ex1 = _mm_loadu_si128((const __m128i *)&columns->w1[ix]);
+            h0 = _mm_add_epi16(
+                _mm_mullo_epi16(II_SSE2_PIXELS2(pdw0, x0[ix], x0[ix + 1]), ex0),
+                _mm_mullo_epi16(II_SSE2_PIXELS2(pdw0, x1[ix], x1[ix + 1]), ex1));
+            h1 = _mm_add_epi16(
+                _mm_mullo_epi16(II_SSE2_PIXELS2(pdw1, x0[ix], x0[ix + 1]), ex0),
+                _mm_mullo_epi16(II_SSE2_PIXELS2(pdw1, x1[ix], x1[ix + 1]), ex1));
+            h0 = _mm_srli_epi16(h0, 8);
+            h1 = _mm_srli_epi16(h1, 8);
+            v = _mm_add_epi16(_mm_mullo_epi16(h0, vey0),
+                              _mm_mullo_epi16(h1, vey1));
+            v = _mm_srli_epi16(v, 8);
+            _mm_storel_epi64((__m128i *)&pdwNew[ix], _mm_packus_epi16(v, v));
+        }
+        ii_stretch_row_32bpp(pdwNew, pdw0, pdw1, columns, ix, cx, ey0, ey1);
+    }
+    #undef II_SSE2_PIXELS2
+#endif  /* def II_USE_SSE2 */
+
+#ifdef II_USE_AVX2
+    /* four pixels of BGRA in sixteen uint16_t */
+    #define II_AVX2_PIXELS4(pdw, i0, i1, i2, i3) \
+        _mm256_cvtepu8_epi16(_mm_set_epi32( \
+            (int)(pdw)[i3], (int)(pdw)[i2], (int)(pdw)[i1], (int)(pdw)[i0]))
+
+    static II_TARGET_AVX2 void
+    ii_stretch_row_32bpp_avx2(
+        uint32_t *pdwNew, const uint32_t *pdw0, const uint32_t *pdw1,
+        const II_STRETCH_COLUMNS *columns, int ix, int cx,
+        uint32_t ey0, uint32_t ey1)
+    {
+        const __m256i vey0 = _mm256_set1_epi16((short)ey0);
+        const __m256i vey1 = _mm256_set1_epi16((short)ey1);
+        const int32_t *x0 = columns->x0, *x1 = columns->x1;
+        __m256i ex0, ex1, h0, h1, v;
+
+        for (; ix + 4 <= cx; ix += 4)
+        {
+            ex0 = _mm256_loadu_si256((const __m256i *)&columns->w0[ix]);
+            ex1 = _mm256_loadu_si256((const __m256i *)&columns->w1[ix]);
+            h0 = _mm256_add_epi16(
+                _mm256_mullo_epi16(II_AVX2_PIXELS4(pdw0,
+                    x0[ix], x0[ix + 1], x0[ix + 2], x0[ix + 3]), ex0),
+                _mm256_mullo_epi16(II_AVX2_PIXELS4(pdw0,
+                    x1[ix], x1[ix + 1], x1[ix + 2], x1[ix + 3]), ex1));
+            h1 = _mm256_add_epi16(
+                _mm256_mullo_epi16(II_AVX2_PIXELS4(pdw1,
+                    x0[ix], x0[ix + 1], x0[ix + 2], x0[ix + 3]), ex0),
+                _mm256_mullo_epi16(II_AVX2_PIXELS4(pdw1,
+                    x1[ix], x1[ix + 1], x1[ix + 2], x1[ix + 3]), ex1));
+            h0 = _mm256_srli_epi16(h0, 8);
+            h1 = _mm256_srli_epi16(h1, 8);
+            v = _mm256_add_epi16(_mm256_mullo_epi16(h0, vey0),
+                                 _mm256_mullo_epi16(h1, vey1));
+            v = _mm256_srli_epi16(v, 8);
+            /* packus works per 128-bit lane; gather the two low halves */
+            v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+            _mm_storeu_si128((__m128i *)&pdwNew[ix],
+                             _mm256_castsi256_si128(v));
+        }
+        ii_stretch_row_32bpp(pdwNew, pdw0, pdw1, columns, ix, cx, ey0, ey1);
+    }
+    #undef II_AVX2_PIXELS4
+#endif  /* def II_USE_AVX2 */
+
+IMAIO_API II_HIMAGE IIAPI
+ii_stretched_32bpp(II_HIMAGE hbm, int cxNew, int cyNew)
+{
+    II_IMGINFO bm, bmNew;
+    II_HIMAGE hbmNew, hbm32bpp;
+    II_STRETCH_COLUMNS columns;
+    II_STRETCH_ROW_PROC proc;
+    uint8_t *pbNewBits, *pbBits;
+    int32_t nWidthBytes, nWidthBytesNew;
+    int ix, iy, y0, y1;
+    uint64_t pos;
+    uint32_t ex1, ey0, ey1;
+
+    assert(cxNew > 0);
+    assert(cyNew > 0);
+    if (!ii_get_info(hbm, &bm))
+        return NULL;
+
+    if (bm.bmBitsPixel == 32)
+        hbm32bpp = hbm;
+    else
+        hbm32bpp = ii_32bpp(hbm);
+    if (hbm32bpp == NULL)
+        return NULL;
+
+    ii_get_info(hbm32bpp, &bm);
+    pbBits = (uint8_t *)bm.bmBits;
+    nWidthBytes = bm.bmWidthBytes;
+
+    /* precompute the source columns and the weights */
+    /* NOTE: The positions are exact to 1/256 pixel even on large scaling. */
+    columns.w0 = (uint64_t *)ii_alloc(cxNew * (2 * sizeof(uint64_t) +
+                                                2 * sizeof(int32_t)));
+    hbmNew = NULL;
+    if (columns.w0)
+        hbmNew = ii_create_32bpp(cxNew, cyNew);
+    if (hbmNew)
+    {
+        columns.w1 = columns.w0 + cxNew;
+        columns.x0 = (int32_t *)(columns.w1 + cxNew);
+        columns.x1 = columns.x0 + cxNew;
+        for (ix = 0; ix < cxNew; ix++)
+        {
+            pos = ((uint64_t)ix * bm.bmWidth << 8) / cxNew;
+            columns.x0[ix] = (int32_t)(pos >> 8);
+            columns.x1[ix] = min(columns.x0[ix] + 1, (int)bm.bmWidth - 1);
+            ex1 = (uint32_t)(pos & 0xFF);
+            columns.w1[ix] = ex1 * UINT64_C(0x0001000100010001);
+            columns.w0[ix] = (0x100 - ex1) * UINT64_C(0x0001000100010001);
+        }
+
+        proc = ii_stretch_row_32bpp;
+#ifdef II_USE_SSE2
+        if (ii_has_sse2())
+            proc = ii_stretch_row_32bpp_sse2;
+#endif
+#ifdef II_USE_AVX2
+        if (ii_has_avx2())
+            proc = ii_stretch_row_32bpp_avx2;
+#endif
+
+        ii_get_info(hbmNew, &bmNew);
+        pbNewBits = (uint8_t *)bmNew.bmBits;
+        nWidthBytesNew = bmNew.bmWidthBytes;
+        for (iy = 0; iy < cyNew; iy++)
+        {
+            pos = ((uint64_t)iy * bm.bmHeight << 8) / cyNew;
+            y0 = (int)(pos >> 8);
+            y1 = min(y0 + 1, (int)bm.bmHeight - 1);
+            ey1 = (uint32_t)(pos & 0xFF);
+            ey0 = 0x100 - ey1;
+            proc((uint32_t *)(pbNewBits + iy * nWidthBytesNew),
+                 (const uint32_t *)(pbBits + y0 * nWidthBytes),
+                 (const uint32_t *)(pbBits + y1 * nWidthBytes),
+                 &columns, 0, cxNew, ey0, ey1);
+        }
+    }
+    ii_free(columns.w0);
+
+    if (hbm32bpp != hbm)
+        ii_destroy(hbm32bpp);
+    return hbmNew;
+}
+
+/*****************************************************************************/
+/* premultiplied alpha */
+
+/* NOTE: ii_premultiply rounds down: c' = c * alpha / 255. ii_unpremultiply
+ *       rounds up: c = (c' * 255 + alpha - 1) / alpha, the least c that
+ *       premultiplies to c'. Premultiplying it again gives back c' for every
+ *       c' <= alpha; the c that ii_premultiply rounded down are lost. */
+
+/* the number of pixels of a block checked for the opaque */
+#define II_OPAQUE_BLOCK     16
+
+/* premultiply or unpremultiply a row of BGRA pixels */
+typedef void (*II_ALPHA_ROW_PROC)(uint32_t *pdw, int ix, int cx,
+                                  const float *reciprocals);
+
+static void
+ii_premultiply_row(uint32_t *pdw, int ix, int cx, const float *reciprocals)
+{
+    uint8_t *pb;
+    uint32_t alpha;
+
+    (void)reciprocals;
+    for (; ix < cx; ++ix)
+    {
+        pb = (uint8_t *)&pdw[ix];
+        alpha = pb[3];
+        if (alpha == 255)
+            continue;
+        pb[0] = (uint8_t)((uint32_t)pb[0] * alpha / 255);
+        pb[1] = (uint8_t)((uint32_t)pb[1] * alpha / 255);
+        pb[2] = (uint8_t)((uint32_t)pb[2] * alpha / 255);
+    }
+}
+
+static void
+ii_unpremultiply_row(uint32_t *pdw, int ix, int cx, const float *reciprocals)
+{
+    uint8_t *pb;
+    uint32_t alpha;
+
+    (void)reciprocals;
+    for (; ix < cx; ++ix)
+    {
+        pb = (uint8_t *)&pdw[ix];
+        alpha = pb[3];
+        if (alpha == 255)
+            continue;
+        if (alpha == 0)
+        {
+            pdw[ix] = 0;
+            continue;
+        }
+        pb[0] = (uint8_t)min(255, (pb[0] * 255 + alpha - 1) / alpha);
+        pb[1] = (uint8_t)min(255, (pb[1] * 255 + alpha - 1) / alpha);
+        pb[2] = (uint8_t)min(255, (pb[2] * 255 + alpha - 1) / alpha);
+    }
+}
+
+#ifdef II_USE_SSE2
+    /* premultiply two pixels of 16-bit channels */
+    static ii_inline __m128i
+    ii_premultiply_pixels2_sse2(__m128i s)
+    {
+        const __m128i amask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+        const __m128i k255 = _mm_set1_epi16(255);
+        const __m128i k8081 = _mm_set1_epi16((short)0x8081);
+        __m128i m;
+
+        /* NOTE: The alpha is multiplied by 255 to keep it. */
+        m = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+        m = _mm_or_si128(_mm_andnot_si128(amask, m),
+                         _mm_and_si128(amask, k255));
+        /* x / 255 rounded down for the unsigned 16-bit x */
+        return _mm_srli_epi16(
+            _mm_mulhi_epu16(_mm_mullo_epi16(s, m), k8081), 7);
+    }
+
+    /* whether the 16 pixels are opaque */
+    static ii_inline bool
+    ii_opaque_block_sse2(const uint32_t *pdw)
+    {
+        const __m128i alphas = _mm_set1_epi32((int)0xFF000000);
+        __m128i v;
+
+        v = _mm_and_si128(_mm_loadu_si128((const __m128i *)&pdw[0]),
+                          _mm_loadu_si128((const __m128i *)&pdw[4]));
+        v = _mm_and_si128(v, _mm_loadu_si128((const __m128i *)&pdw[8]));
+        v = _mm_and_si128(v, _mm_loadu_si128((const __m128i *)&pdw[12]));
+        v = _mm_cmpeq_epi32(_mm_and_si128(v, alphas), alphas);
+        return _mm_movemask_epi8(v) == 0xFFFF;
+    }
+
+    static void
+    ii_premultiply_row_sse2(uint32_t *pdw, int ix, int cx,
+                            const float *reciprocals)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i v;
+        int i;
+
+        for (; ix + II_OPAQUE_BLOCK <= cx; ix += II_OPAQUE_BLOCK)
+        {
+            if (ii_opaque_block_sse2(&pdw[ix]))
+                continue;
+            for (i = ix; i < ix + II_OPAQUE_BLOCK; i += 4)
+            {
+                v = _mm_loadu_si128((const __m128i *)&pdw[i]);
+                v = _mm_packus_epi16(
+                    ii_premultiply_pixels2_sse2(_mm_unpacklo_epi8(v, zero)),
+                    ii_premultiply_pixels2_sse2(_mm_unpackhi_epi8(v, zero)));
+                _mm_storeu_si128((__m128i *)&pdw[i], v);
+            }
+        }
+        ii_premultiply_row(pdw, ix, cx, reciprocals);
+    }
+
+    /* unpremultiply a pixel of 32-bit channels */
+    static ii_inline __m128i
+    ii_unpremultiply_pixel_sse2(__m128i v, const float *reciprocals)
+    {
+        const __m128i amask = _mm_set_epi32(-1, 0, 0, 0);
+        __m128i a, m;
+
+        a = _mm_shuffle_epi32(v, 0xFF);
+        /* c * 255 + alpha - 1 and the alpha */
+        m = _mm_sub_epi32(_mm_add_epi32(_mm_slli_epi32(v, 8), a),
+                          _mm_add_epi32(v, _mm_set1_epi32(1)));
+        /* NOTE: The reciprocal of zero is zero. */
+        m = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(m),
+            _mm_set1_ps(reciprocals[_mm_cvtsi128_si32(a)])));
+        return _mm_or_si128(_mm_andnot_si128(amask, m),
+                            _mm_and_si128(amask, a));
+    }
+
+    static void
+    ii_unpremultiply_row_sse2(uint32_t *pdw, int ix, int cx,
+                              const float *reciprocals)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i v, lo, hi;
+        int i;
+
+        for (; ix + II_OPAQUE_BLOCK <= cx; ix += II_OPAQUE_BLOCK)
+        {
+            if (ii_opaque_block_sse2(&pdw[ix]))
+                continue;
+            for (i = ix; i < ix + II_OPAQUE_BLOCK; i += 4)
+            {
+                v = _mm_loadu_si128((const __m128i *)&pdw[i]);
+                lo = _mm_unpacklo_epi8(v, zero);
+                hi = _mm_unpackhi_epi8(v, zero);
+                /* NOTE: packs and packus saturate the colors above alpha. */
+                lo = _mm_packs_epi32(
+                    ii_unpremultiply_pixel_sse2(_mm_unpacklo_epi16(lo, zero),
+                                                reciprocals),
+                    ii_unpremultiply_pixel_sse2(_mm_unpackhi_epi16(lo, zero),
+                                                reciprocals));
+                hi = _mm_packs_epi32(
+                    ii_unpremultiply_pixel_sse2(_mm_unpacklo_epi16(hi, zero),
+                                                reciprocals),
+                    ii_unpremultiply_pixel_sse2(_mm_unpackhi_epi16(hi, zero),
+                                                reciprocals));
+                _mm_storeu_si128((__m128i *)&pdw[i],
+                                 _mm_packus_epi16(lo, hi));
+            }
+        }
+        ii_unpremultiply_row(pdw, ix, cx, reciprocals);
+    }
+#endif  /* def II_USE_SSE2 */
+
+#ifdef II_USE_AVX2
+    static ii_inline II_TARGET_AVX2 __m256i
+    ii_premultiply_pixels4_avx2(__m256i s)
+    {
+        const __m256i amask = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0,
+                                               -1, 0, 0, 0, -1, 0, 0, 0);
+        const __m256i k255 = _mm256_set1_epi16(255);
+        const __m256i k8081 = _mm256_set1_epi16((short)0x8081);
+        __m256i m;
+
+        m = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xFF), 0xFF);
+        m = _mm256_or_si256(_mm256_andnot_si256(amask, m),
+                            _mm256_and_si256(amask, k255));
+        return _mm256_srli_epi16(
+            _mm256_mulhi_epu16(_mm256_mullo_epi16(s, m), k8081), 7);
+    }
+
+    static II_TARGET_AVX2 void
+    ii_premultiply_row_avx2(uint32_t *pdw, int ix, int cx,
+                            const float *reciprocals)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i alphas = _mm256_set1_epi32((int)0xFF000000);
+        __m256i v0, v1;
+
+        for (; ix + II_OPAQUE_BLOCK <= cx; ix += II_OPAQUE_BLOCK)
+        {
+            v0 = _mm256_loadu_si256((const __m256i *)&pdw[ix]);
+            v1 = _mm256_loadu_si256((const __m256i *)&pdw[ix + 8]);
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(
+                    _mm256_and_si256(_mm256_and_si256(v0, v1), alphas),
+                    alphas)) == -1)
+            {
+                continue;
+            }
+            v0 = _mm256_packus_epi16(
+                ii_premultiply_pixels4_avx2(_mm256_unpacklo_epi8(v0, zero)),
+                ii_premultiply_pixels4_avx2(_mm256_unpackhi_epi8(v0, zero)));
+            v1 = _mm256_packus_epi16(
+                ii_premultiply_pixels4_avx2(_mm256_unpacklo_epi8(v1, zero)),
+                ii_premultiply_pixels4_avx2(_mm256_unpackhi_epi8(v1, zero)));
+            _mm256_storeu_si256((__m256i *)&pdw[ix], v0);
+            _mm256_storeu_si256((__m256i *)&pdw[ix + 8], v1);
+        }
+        ii_premultiply_row(pdw, ix, cx, reciprocals);
+    }
+#endif  /* def II_USE_AVX2 */
+
+/* the best proc to premultiply or unpremultiply and its reciprocals */
+static II_ALPHA_ROW_PROC
+ii_alpha_row_proc(bool premultiply, float *reciprocals)
+{
+    II_ALPHA_ROW_PROC proc;
+    int a;
+
+    if (premultiply)
+    {
+        proc = ii_premultiply_row;
+#ifdef II_USE_SSE2
+        if (ii_has_sse2())
+            proc = ii_premultiply_row_sse2;
+#endif
+#ifdef II_USE_AVX2
+        if (ii_has_avx2())
+            proc = ii_premultiply_row_avx2;
+#endif
+    }
+    else
+    {
+        /* NOTE: 1 / alpha is rounded up a little. */
+        reciprocals[0] = 0;
+        for (a = 1; a < 256; ++a)
+            reciprocals[a] = (float)((1.0 + 1.0 / 4194304) / a);
+        proc = ii_unpremultiply_row;
+#ifdef II_USE_SSE2
+        if (ii_has_sse2())
+            proc = ii_unpremultiply_row_sse2;
+#endif
+    }
+    return proc;
+}
+
+static void
+ii_alpha_rows(II_HIMAGE hbm32bpp, bool premultiply)
+{
+    II_IMGINFO bm;
+    II_ALPHA_ROW_PROC proc;
+    float reciprocals[256];
+    uint8_t *pb;
+    int y;
+
+    if (!ii_make_writable(hbm32bpp))
+        return;
+    ii_get_info(hbm32bpp, &bm);
+    if (bm.bmBitsPixel != 32)
+        return;
+
+    proc = ii_alpha_row_proc(premultiply, reciprocals);
+    pb = (uint8_t *)bm.bmBits;
+    for (y = 0; y < bm.bmHeight; ++y)
+    {
+        proc((uint32_t *)pb, 0, bm.bmWidth, reciprocals);
+        pb += bm.bmWidthBytes;
+    }
+}
+
+IMAIO_API void IIAPI
+ii_premultiply(II_HIMAGE hbm32bpp)
+{
+    ii_alpha_rows(hbm32bpp, true);
+}
+
+IMAIO_API void IIAPI
+ii_unpremultiply(II_HIMAGE hbm32bpp)
+{
+    ii_alpha_rows(hbm32bpp, false);
+}
+
+/*****************************************************************************/
+/* resampling */
+
+/* NOTE: The weights are fixed point numbers of II_RESAMPLE_BITS bits. */
+#define II_RESAMPLE_BITS    14
+#define II_RESAMPLE_ONE     (1 << II_RESAMPLE_BITS)
+/* NOTE: The horizontal pass drops II_RESAMPLE_SHIFT bits of precision. */
+#define II_RESAMPLE_SHIFT   6
+
+/* the contributions of the source pixels to the destination pixels */
+typedef struct II_RESAMPLE_CONTRIB
+{
+    int32_t *   first;          /* first source pixel */
+    int32_t *   count;          /* number of source pixels */
+    int32_t *   weights;        /* max_count weights per destination pixel */
+    int         max_count;      /* maximum of count (before trimming) */
+} II_RESAMPLE_CONTRIB;
+
+static double
+ii_resample_sinc(double x)
+{
+    if (x == 0.0)
+        return 1.0;
+    x *= 3.14159265358979323846;
+    return sin(x) / x;
+}
+
+/* the weight of the source pixel j to the destination pixel at center */
+static double
+ii_resample_weight(II_FILTER filter, int j, double center, double width)
+{
+    double x, lo, hi;
+
+    switch (filter)
+    {
+    case II_FILTER_TRIANGLE:
+        x = fabs((j - center) / width);
+        return (x < 1.0) ? 1.0 - x : 0.0;
+
+    case II_FILTER_LANCZOS:
+        x = (j - center) / width;
+        if (x <= -3.0 || 3.0 <= x)
+            return 0.0;
+        return ii_resample_sinc(x) * ii_resample_sinc(x / 3);
+
+    default:
+        /* the area of the source pixel covered by the destination pixel */
+        lo = center - width / 2;
+        hi = center + width / 2;
+        if (lo < j - 0.5)
+            lo = j - 0.5;
+        if (hi > j + 0.5)
+            hi = j + 0.5;
+        return (lo < hi) ? hi - lo : 0.0;
+    }
+}
+
+static double
+ii_resample_support(II_FILTER filter)
+{
+    switch (filter)
+    {
+    case II_FILTER_TRIANGLE:    return 1.0;
+    case II_FILTER_LANCZOS:     return 3.0;
+    default:                    return 0.5;
+    }
+}
+
+static void
+ii_resample_contrib_free(II_RESAMPLE_CONTRIB *contrib)
+{
+    free(contrib->first);
+    contrib->first = NULL;
+}
+
+/* precompute the contributions of src pixels to dst pixels */
+static bool
+ii_resample_contrib_init(II_RESAMPLE_CONTRIB *contrib, int src, int dst,
+                         II_FILTER filter)
+{
+    double scale, width, support, center, total;
+    double dw[64], *pdw;
+    int32_t *pw;
+    int i, j, k, first, last, sum, kmax;
+
+    scale = (double)src / dst;
+    /* NOTE: On reduction, the filter is widened to cover the source. */
+    width = (scale > 1.0) ? scale : 1.0;
+    support = ii_resample_support(filter) * width;
+    contrib->max_count = min((int)ceil(2 * support) + 3, src);
+
+    contrib->first = (int32_t *)malloc(
+        dst * (2 + contrib->max_count) * sizeof(int32_t));
+    pdw = dw;
+    if (contrib->max_count > (int)(sizeof(dw) / sizeof(dw[0])))
+        pdw = (double *)malloc(contrib->max_count * sizeof(double));
+    if (contrib->first == NULL || pdw == NULL)
+    {
+        ii_resample_contrib_free(contrib);
+        if (pdw != dw)
+            free(pdw);
+        return false;
+    }
+    contrib->count = contrib->first + dst;
+    contrib->weights = contrib->count + dst;
+
+    for (i = 0; i < dst; ++i)
+    {
+        center = (i + 0.5) * scale - 0.5;
+        first = (int)floor(center - support);
+        last = (int)ceil(center + support);
+        if (first < 0)
+            first = 0;
+        if (last > src - 1)
+            last = src - 1;
+        assert(last - first + 1 <= contrib->max_count);
+
+        total = 0;
+        for (j = first; j <= last; ++j)
+        {
+            pdw[j - first] = ii_resample_weight(filter, j, center, width);
+            total += pdw[j - first];
+        }
+
+        /* quantize the weights so that their sum is exactly one */
+        pw = contrib->weights + i * contrib->max_count;
+        sum = 0;
+        kmax = 0;
+        for (k = 0; k <= last - first; ++k)
+        {
+            if (total != 0)
+                pw[k] = (int32_t)floor(pdw[k] / total * II_RESAMPLE_ONE + 0.5);
+            else
+                pw[k] = 0;
+            sum += pw[k];
+            if (pw[k] > pw[kmax])
+                kmax = k;
+        }
+        pw[kmax] += II_RESAMPLE_ONE - sum;
+
+        /* trim the zero weights */
+        k = 0;
+        while (k < last - first && pw[k] == 0)
+            ++k;
+        while (last > first + k && pw[last - first] == 0)
+            --last;
+        if (k > 0)
+            memmove(pw, pw + k, (last - first - k + 1) * sizeof(int32_t));
+        contrib->first[i] = first + k;
+        contrib->count[i] = last - first - k + 1;
+    }
+
+    if (pdw != dw)
+        free(pdw);
+    return true;
+}
+
+/* the horizontal pass */
+static void
+ii_resample_row(int32_t *row, const uint8_t *pb,
+                const II_RESAMPLE_CONTRIB *contrib, int cx, int channels)
+{
+    const int32_t *pw;
+    const uint8_t *p;
+    int32_t s0, s1, s2, s3;
+    int x, k, n;
+
+    pw = contrib->weights;
+    switch (channels)
+    {
+    case 4:
+        for (x = 0; x < cx; ++x)
+        {
+            p = pb + contrib->first[x] * 4;
+            n = contrib->count[x];
+            s0 = s1 = s2 = s3 = 1 << (II_RESAMPLE_SHIFT - 1);
+            for (k = 0; k < n; ++k)
+            {
+                s0 += pw[k] * p[0];
+                s1 += pw[k] * p[1];
+                s2 += pw[k] * p[2];
+                s3 += pw[k] * p[3];
+                p += 4;
+            }
+            row[0] = s0 >> II_RESAMPLE_SHIFT;
+            row[1] = s1 >> II_RESAMPLE_SHIFT;
+            row[2] = s2 >> II_RESAMPLE_SHIFT;
+            row[3] = s3 >> II_RESAMPLE_SHIFT;
+            row += 4;
+            pw += contrib->max_count;
+        }
+        break;
+
+    case 3:
+        for (x = 0; x < cx; ++x)
+        {
+            p = pb + contrib->first[x] * 3;
+            n = contrib->count[x];
+            s0 = s1 = s2 = 1 << (II_RESAMPLE_SHIFT - 1);
+            for (k = 0; k < n; ++k)
+            {
+                s0 += pw[k] * p[0];
+                s1 += pw[k] * p[1];
+                s2 += pw[k] * p[2];
+                p += 3;
+            }
+            row[0] = s0 >> II_RESAMPLE_SHIFT;
+            row[1] = s1 >> II_RESAMPLE_SHIFT;
+            row[2] = s2 >> II_RESAMPLE_SHIFT;
+            row += 3;
+            pw += contrib->max_count;
+        }
+        break;
+
+    default:
+        for (x = 0; x < cx; ++x)
+        {
+            p = pb + contrib->first[x];
+            n = contrib->count[x];
+            s0 = 1 << (II_RESAMPLE_SHIFT - 1);
+            for (k = 0; k < n; ++k)
+                s0 += pw[k] * p[k];
+            row[x] = s0 >> II_RESAMPLE_SHIFT;
+            pw += contrib->max_count;
+        }
+        break;
+    }
+}
+
+/* is it an 8bpp image of ii_create_8bpp_grayscale? */
+static bool
+ii_is_grayscale_8bpp(II_HIMAGE hbm)
+{
+    II_PALETTE *table;
+    bool ret;
+    int i;
+
+    table = ii_get_palette(hbm);
+    if (table == NULL)
+        return false;
+
+    ret = (table->num_colors == 256);
+    for (i = 0; ret && i < 256; ++i)
+    {
+        ret = (table->colors[i].value[0] == i &&
+               table->colors[i].value[1] == i &&
+               table->colors[i].value[2] == i);
+    }
+    ii_palette_destroy(table);
+    return ret;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_resample_view(const II_VIEW *view, int cxNew, int cyNew, II_FILTER filter)
+{
+    II_IMGINFO bm, bmNew;
+    II_HIMAGE hbmNew;
+    II_RESAMPLE_CONTRIB horz, vert;
+    II_PALETTE *table;
+    II_ALPHA_ROW_PROC premultiply, unpremultiply;
+    float reciprocals[256];
+    int32_t *rows, *acc, *row;
+    uint32_t *line;
+    const int32_t *pw;
+    const uint8_t *pbBits, *pbSrc;
+    uint8_t *pbNewBits, *pb;
+    int channels, num, ix, iy, y, y_next, k, n, value;
+
+    assert(view);
+    assert(cxNew > 0);
+    assert(cyNew > 0);
+    if (!ii_is_readable_bpp(view->info.bmBitsPixel))
+    {
+        II_VIEW view32;
+        II_HIMAGE hbm32bpp = ii_view_32bpp(&view32, view);
+        if (hbm32bpp == NULL)
+            return NULL;
+        hbmNew = ii_resample_view(&view32, cxNew, cyNew, filter);
+        ii_destroy(hbm32bpp);
+        return hbmNew;
+    }
+    bm = view->info;
+    pbBits = (const uint8_t *)bm.bmBits;
+
+    hbmNew = NULL;
+    rows = NULL;
+    line = NULL;
+    table = NULL;
+    horz.first = vert.first = NULL;
+    premultiply = unpremultiply = NULL;
+
+    /* NOTE: The other formats are read as 32bpp one row at a time. */
+    /* NOTE: The transparent pixels are filtered premultiplied, so that
+     *       their colors do not bleed into the edges. */
+    if (bm.bmBitsPixel == 32 && ii_view_alpha_state(view) != II_ALPHA_OPAQUE)
+    {
+        channels = 4;
+        premultiply = ii_alpha_row_proc(true, NULL);
+        unpremultiply = ii_alpha_row_proc(false, reciprocals);
+        line = (uint32_t *)ii_alloc(bm.bmWidth * sizeof(uint32_t));
+        if (line == NULL)
+            goto cleanup;
+    }
+    else if (bm.bmBitsPixel == 32)
+        channels = 4;
+    else if (bm.bmBitsPixel == 24)
+        channels = 3;
+    else if (bm.bmBitsPixel == 8 && ii_is_grayscale_8bpp(view->hbm))
+        channels = 1;
+    else
+    {
+        channels = 4;
+        table = ii_get_palette(view->hbm);
+        line = (uint32_t *)ii_alloc(bm.bmWidth * sizeof(uint32_t));
+        if (line == NULL)
+            goto cleanup;
+    }
+
+    if (!ii_resample_contrib_init(&horz, bm.bmWidth, cxNew, filter) ||
+        !ii_resample_contrib_init(&vert, bm.bmHeight, cyNew, filter))
+    {
+        goto cleanup;
+    }
+
+    /* the horizontally filtered rows are cached in a ring of rows */
+    num = cxNew * channels;
+    rows = (int32_t *)ii_alloc((vert.max_count + 1) * num * sizeof(int32_t));
+    if (rows == NULL)
+        goto cleanup;
+    acc = rows + vert.max_count * num;
+
+    switch (channels)
+    {
+    case 4:     hbmNew = ii_create_32bpp(cxNew, cyNew); break;
+    case 3:     hbmNew = ii_create_24bpp(cxNew, cyNew); break;
+    default:    hbmNew = ii_create_8bpp_grayscale(cxNew, cyNew); break;
+    }
+    if (hbmNew == NULL)
+        goto cleanup;
+
+    ii_get_info(hbmNew, &bmNew);
+    pbNewBits = (uint8_t *)bmNew.bmBits;
+    y_next = 0;
+    pw = vert.weights;
+    for (iy = 0; iy < cyNew; ++iy)
+    {
+        y = vert.first[iy];
+        n = vert.count[iy];
+
+        /* NOTE: Each source row is filtered horizontally only once. */
+        for (; y_next < y + n; ++y_next)
+        {
+            pbSrc = pbBits + y_next * bm.bmWidthBytes;
+            if (premultiply)
+            {
+                memcpy(line, pbSrc, bm.bmWidth * sizeof(uint32_t));
+                premultiply(line, 0, bm.bmWidth, NULL);
+                pbSrc = (const uint8_t *)line;
+            }
+            else if (line)
+            {
+                ii_read_row_32bpp(&bm, table, y_next, line);
+                pbSrc = (const uint8_t *)line;
+            }
+            ii_resample_row(rows + (y_next % vert.max_count) * num,
+                            pbSrc, &horz, cxNew, channels);
+        }
+
+        /* the vertical pass */
+        for (ix = 0; ix < num; ++ix)
+            acc[ix] = 1 << (2 * II_RESAMPLE_BITS - II_RESAMPLE_SHIFT - 1);
+        for (k = 0; k < n; ++k)
+        {
+            row = rows + ((y + k) % vert.max_count) * num;
+            for (ix = 0; ix < num; ++ix)
+                acc[ix] += pw[k] * row[ix];
+        }
+        pw += vert.max_count;
+
+        pb = pbNewBits + iy * bmNew.bmWidthBytes;
+        for (ix = 0; ix < num; ++ix)
+        {
+            value = acc[ix] >> (2 * II_RESAMPLE_BITS - II_RESAMPLE_SHIFT);
+            pb[ix] = (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+        if (unpremultiply)
+        {
+            /* NOTE: The ringing of the filter may make a color over alpha. */
+            for (ix = 0; ix < num; ix += 4)
+            {
+                pb[ix + 0] = min(pb[ix + 0], pb[ix + 3]);
+                pb[ix + 1] = min(pb[ix + 1], pb[ix + 3]);
+                pb[ix + 2] = min(pb[ix + 2], pb[ix + 3]);
+            }
+            unpremultiply((uint32_t *)pb, 0, cxNew, reciprocals);
+        }
+    }
+
+cleanup:
+    ii_free(rows);
+    ii_free(line);
+    ii_palette_destroy(table);
+    ii_resample_contrib_free(&horz);
+    ii_resample_contrib_free(&vert);
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_resample(II_HIMAGE hbm, int cxNew, int cyNew, II_FILTER filter)
+{
+    II_VIEW view;
+
+    if (!ii_view_create(&view, hbm))
+        return NULL;
+    return ii_resample_view(&view, cxNew, cyNew, filter);
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_32bpp_from_trans_8bpp(II_HIMAGE hbm8bpp, const int *pi_trans)
+{
+    II_HIMAGE hbmNew;
+    II_IMGINFO bm, bmNew;
+    uint8_t *pb, *pbNew;
+    int x, y;
+
+    assert(hbm8bpp);
+    if (pi_trans == NULL || *pi_trans == -1)
+    {
+        return ii_32bpp(hbm8bpp);
+    }
+
+    hbmNew = ii_32bpp(hbm8bpp);
+    if (hbmNew)
+    {
+        ii_get_info(hbm8bpp, &bm);
+        pb = (uint8_t *)bm.bmBits;
+        if (bm.bmBitsPixel != 8)
+        {
+            /* not 8bpp */
+            ii_destroy(hbmNew);
+            return NULL;
+        }
+
+        ii_get_info(hbmNew, &bmNew);
+        pbNew = (uint8_t *)bmNew.bmBits;
+        for (y = 0; y < bm.bmHeight; ++y)
+        {
+            for (x = 0; x < bm.bmWidth; ++x)
+            {
+                if (pb[x + y * bm.bmWidthBytes] == *pi_trans)
+                {
+                    pbNew[((x + y * bm.bmWidth) << 2) + 3] = 0;
+                }
+            }
+        }
+    }
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_24bpp_or_32bpp(II_HIMAGE hbm)
+{
+    II_IMGINFO bm;
+
+    if (ii_get_info(hbm, &bm))
+    {
+        if (bm.bmBitsPixel == 32)
+            return ii_clone(hbm);
+        else
+            return ii_24bpp(hbm);
+    }
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_grayscale_8bpp(II_HIMAGE hbm)
+{
+    II_IMGINFO bm, bmNew;
+    II_HIMAGE hbmNew, hbm32bpp = NULL;
+
+    if (!ii_get_info(hbm, &bm))
+        return NULL;
+
+    /* NOTE: The other than 24bpp and 32bpp are converted to 32bpp. */
+    if ((bm.bmBitsPixel != 24 && bm.bmBitsPixel != 32) || bm.bmBits == NULL)
+    {
+        hbm32bpp = ii_32bpp(hbm);
+        if (hbm32bpp == NULL)
+            return NULL;
+        ii_get_info(hbm32bpp, &bm);
+    }
+
+    hbmNew = ii_create_8bpp_grayscale(bm.bmWidth, bm.bmHeight);
+    if (hbmNew)
+    {
+        ii_get_info(hbmNew, &bmNew);
+        ii_convert_pixels(bm.bmBitsPixel == 24 ? II_PIXEL_FORMAT_BGR24 :
+                                                 II_PIXEL_FORMAT_BGRA32,
+                          bm.bmBits, bm.bmWidthBytes,
+                          II_PIXEL_FORMAT_GRAY8,
+                          bmNew.bmBits, bmNew.bmWidthBytes,
+                          bm.bmWidth, bm.bmHeight);
+    }
+    if (hbm32bpp)
+        ii_destroy(hbm32bpp);
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_grayscale_32bpp(II_HIMAGE hbm)
+{
+    II_IMGINFO bm;
+    II_HIMAGE hbmNew;
+    uint8_t *line;
+    uint32_t *pdw;
+    int x, y;
+
+    if (!ii_get_info(hbm, &bm))
+        return NULL;
+
+    hbmNew = ii_32bpp(hbm);
+    if (hbmNew)
+    {
+        ii_get_info(hbmNew, &bm);
+        line = (uint8_t *)ii_alloc(bm.bmWidth);
+        if (line == NULL)
+        {
+            ii_destroy(hbmNew);
+            return NULL;
+        }
+
+        pdw = (uint32_t *)bm.bmBits;
+        for (y = 0; y < bm.bmHeight; ++y)
+        {
+            ii_convert_pixels(II_PIXEL_FORMAT_BGRA32, pdw, 0,
+                              II_PIXEL_FORMAT_GRAY8, line, 0, bm.bmWidth, 1);
+            for (x = 0; x < bm.bmWidth; ++x)
+                pdw[x] = (pdw[x] & 0xFF000000) | (line[x] * 0x010101);
+            pdw += bm.bmWidth;
+        }
+        ii_free(line);
+    }
+    return hbmNew;
+}
+
+IMAIO_API uint8_t IIAPI
+ii_bound(int value)
+{
+    if (value > 255)
+        return 255;
+    if (value < 0)
+        return 0;
+    return value;
+}
+
+/* three bytes */
+typedef struct II_TRIBYTE
+{
+    uint8_t value[3];
+} II_TRIBYTE;
+
+/* the size of a block of the transposition */
+#define II_TRANSPOSE_TILE   32
+
+/* transpose the columns [x0, x1) of the rows [y0, y1) */
+static void
+ii_transpose_scalar(const uint8_t *src, ptrdiff_t src_stride,
+                    uint8_t *dst, ptrdiff_t dst_stride,
+                    int x0, int x1, int y0, int y1, int bpp)
+{
+    uint8_t *pb;
+    int x, y;
+
+    for (x = x0; x < x1; ++x)
+    {
+        pb = dst + x * dst_stride;
+        switch (bpp)
+        {
+        case 32:
+            for (y = y0; y < y1; ++y)
+                ((uint32_t *)pb)[y] = ((const uint32_t *)(src + y * src_stride))[x];
+            break;
+        case 24:
+            for (y = y0; y < y1; ++y)
+                ((II_TRIBYTE *)pb)[y] = ((const II_TRIBYTE *)(src + y * src_stride))[x];
+            break;
+        default:
+            for (y = y0; y < y1; ++y)
+                pb[y] = src[y * src_stride + x];
+            break;
+        }
+    }
+}
+
+#ifdef II_USE_SSE2
+    static ii_inline void
+    ii_transpose_4x4_sse2(const uint8_t *src, ptrdiff_t src_stride,
+                          uint8_t *dst, ptrdiff_t dst_stride)
+    {
+        __m128i r0, r1, r2, r3, t0, t1, t2, t3;
+
+        r0 = _mm_loadu_si128((const __m128i *)src);
+        r1 = _mm_loadu_si128((const __m128i *)(src + src_stride));
+        r2 = _mm_loadu_si128((const __m128i *)(src + 2 * src_stride));
+        r3 = _mm_loadu_si128((const __m128i *)(src + 3 * src_stride));
+        t0 = _mm_unpacklo_epi32(r0, r1);
+        t1 = _mm_unpacklo_epi32(r2, r3);
+        t2 = _mm_unpackhi_epi32(r0, r1);
+        t3 = _mm_unpackhi_epi32(r2, r3);
+        _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *)(dst + dst_stride), _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *)(dst + 2 * dst_stride), _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i *)(dst + 3 * dst_stride), _mm_unpackhi_epi64(t2, t3));
+    }
+
+    static ii_inline void
+    ii_transpose_8x8_sse2(const uint8_t *src, ptrdiff_t src_stride,
+                          uint8_t *dst, ptrdiff_t dst_stride)
+    {
+        __m128i a0, a1, a2, a3, b0, b1, b2, b3, c;
+
+        #define II_LOAD8(i) \
+            _mm_loadl_epi64((const __m128i *)(src + (i) * src_stride))
+        a0 = _mm_unpacklo_epi8(II_LOAD8(0), II_LOAD8(1));
+        a1 = _mm_unpacklo_epi8(II_LOAD8(2), II_LOAD8(3));
+        a2 = _mm_unpacklo_epi8(II_LOAD8(4), II_LOAD8(5));
+        a3 = _mm_unpacklo_epi8(II_LOAD8(6), II_LOAD8(7));
+        #undef II_LOAD8
+        b0 = _mm_unpacklo_epi16(a0, a1);
+        b1 = _mm_unpackhi_epi16(a0, a1);
+        b2 = _mm_unpacklo_epi16(a2, a3);
+        b3 = _mm_unpackhi_epi16(a2, a3);
+
+        /* each register has two columns */
+        #define II_STORE16(i, value) \
+            c = (value); \
+            _mm_storel_epi64((__m128i *)(dst + (i) * dst_stride), c); \
+            _mm_storel_epi64((__m128i *)(dst + ((i) + 1) * dst_stride), \
+                             _mm_srli_si128(c, 8))
+        II_STORE16(0, _mm_unpacklo_epi32(b0, b2));
+        II_STORE16(2, _mm_unpackhi_epi32(b0, b2));
+        II_STORE16(4, _mm_unpacklo_epi32(b1, b3));
+        II_STORE16(6, _mm_unpackhi_epi32(b1, b3));
+        #undef II_STORE16
+    }
+#endif  /* def II_USE_SSE2 */
+
+/* the row x of dst gets the column x of src (cx by cy pixels) */
+/* NOTE: The strides can be negative to reverse the rows. */
+static void
+ii_transpose_bits(const uint8_t *src, ptrdiff_t src_stride,
+                  uint8_t *dst, ptrdiff_t dst_stride,
+                  int cx, int cy, int bpp)
+{
+    int bx, by, x, x_end, y_end;
+#ifdef II_USE_SSE2
+    int y, step = (bpp == 32) ? 4 : ((bpp == 8) ? 8 : 0);
+
+    if (!ii_has_sse2())
+        step = 0;
+#endif
+
+    /* NOTE: The blocks keep the source columns in the cache. */
+    for (by = 0; by < cy; by += II_TRANSPOSE_TILE)
+    {
+        y_end = min(by + II_TRANSPOSE_TILE, cy);
+        for (bx = 0; bx < cx; bx += II_TRANSPOSE_TILE)
+        {
+            x_end = min(bx + II_TRANSPOSE_TILE, cx);
+            x = bx;
+#ifdef II_USE_SSE2
+            for (; step && x + step <= x_end; x += step)
+            {
+                for (y = by; y + step <= y_end; y += step)
+                {
+                    if (bpp == 32)
+                    {
+                        ii_transpose_4x4_sse2(src + y * src_stride + (x << 2),
+                                              src_stride,
+                                              dst + x * dst_stride + (y << 2),
+                                              dst_stride);
+                    }
+                    else
+                    {
+                        ii_transpose_8x8_sse2(src + y * src_stride + x,
+                                              src_stride,
+                                              dst + x * dst_stride + y,
+                                              dst_stride);
+                    }
+                }
+                ii_transpose_scalar(src, src_stride, dst, dst_stride,
+                                    x, x + step, y, y_end, bpp);
+            }
+#endif
+            ii_transpose_scalar(src, src_stride, dst, dst_stride,
+                                x, x_end, by, y_end, bpp);
+        }
+    }
+}
+
+/* reverse the pixels of a row of 8bpp, 24bpp or 32bpp */
+static void
+ii_reverse_row(uint8_t *row, int width, int bpp)
+{
+    int i = 0, j = width - 1;
+    uint32_t dw;
+    uint8_t b;
+    II_TRIBYTE tribytes;
+#ifdef II_USE_SSE2
+    __m128i lo, hi;
+#endif
+
+    switch (bpp)
+    {
+    case 32:
+#ifdef II_USE_SSE2
+        for (; ii_has_sse2() && i + 4 <= j - 3; i += 4, j -= 4)
+        {
+            lo = _mm_loadu_si128((const __m128i *)(row + (i << 2)));
+            hi = _mm_loadu_si128((const __m128i *)(row + ((j - 3) << 2)));
+            _mm_storeu_si128((__m128i *)(row + (i << 2)),
+                             _mm_shuffle_epi32(hi, _MM_SHUFFLE(0, 1, 2, 3)));
+            _mm_storeu_si128((__m128i *)(row + ((j - 3) << 2)),
+                             _mm_shuffle_epi32(lo, _MM_SHUFFLE(0, 1, 2, 3)));
+        }
+#endif
+        for (; i < j; ++i, --j)
+        {
+            dw = ((uint32_t *)row)[i];
+            ((uint32_t *)row)[i] = ((uint32_t *)row)[j];
+            ((uint32_t *)row)[j] = dw;
+        }
+        break;
+    case 24:
+        for (; i < j; ++i, --j)
+        {
+            tribytes = ((II_TRIBYTE *)row)[i];
+            ((II_TRIBYTE *)row)[i] = ((II_TRIBYTE *)row)[j];
+            ((II_TRIBYTE *)row)[j] = tribytes;
+        }
+        break;
+    default:
+#ifdef II_USE_SSE2
+        #define II_REVERSE16(x) \
+            (x = _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 1, 2, 3)), \
+             x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1)), \
+             x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1)), \
+             _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)))
+        for (; ii_has_sse2() && i + 16 <= j - 15; i += 16, j -= 16)
+        {
+            lo = _mm_loadu_si128((const __m128i *)(row + i));
+            hi = _mm_loadu_si128((const __m128i *)(row + j - 15));
+            _mm_storeu_si128((__m128i *)(row + i), II_REVERSE16(hi));
+            _mm_storeu_si128((__m128i *)(row + j - 15), II_REVERSE16(lo));
+        }
+        #undef II_REVERSE16
+#endif
+        for (; i < j; ++i, --j)
+        {
+            b = row[i];
+            row[i] = row[j];
+            row[j] = b;
+        }
+        break;
+    }
+}
+
+/* transpose bm into bmNew, reversing the rows of either */
+static void
+ii_transpose_image(const II_IMGINFO *bm, const II_IMGINFO *bmNew,
+                   bool fReverseSrc, bool fReverseDst)
+{
+    const uint8_t *src = (const uint8_t *)bm->bmBits;
+    uint8_t *dst = (uint8_t *)bmNew->bmBits;
+    ptrdiff_t src_stride = bm->bmWidthBytes, dst_stride = bmNew->bmWidthBytes;
+
+    assert(bm->bmWidth == bmNew->bmHeight && bm->bmHeight == bmNew->bmWidth);
+    if (fReverseSrc)
+    {
+        src += (bm->bmHeight - 1) * src_stride;
+        src_stride = -src_stride;
+    }
+    if (fReverseDst)
+    {
+        dst += (bmNew->bmHeight - 1) * dst_stride;
+        dst_stride = -dst_stride;
+    }
+    ii_transpose_bits(src, src_stride, dst, dst_stride,
+                      bm->bmWidth, bm->bmHeight, bm->bmBitsPixel);
+}
+
+/* the samples of a rotated row */
+#define II_ROTATE_CHUNK     64
+
+typedef struct II_ROTATE_SAMPLES
+{
+    uint32_t    c00[II_ROTATE_CHUNK];   /* (x0, y0) */
+    uint32_t    c10[II_ROTATE_CHUNK];   /* (x1, y0) */
+    uint32_t    c01[II_ROTATE_CHUNK];   /* (x0, y1) */
+    uint32_t    c11[II_ROTATE_CHUNK];   /* (x1, y1) */
+    uint64_t    wx0[II_ROTATE_CHUNK];   /* weights repeated in four uint16_t */
+    uint64_t    wx1[II_ROTATE_CHUNK];
+    uint64_t    wy0[II_ROTATE_CHUNK];
+    uint64_t    wy1[II_ROTATE_CHUNK];
+} II_ROTATE_SAMPLES;
+
+/* NOTE: The bilinear weights of the rotation have 8 bits, as those of
+ *       ii_stretched_32bpp, so that the SIMD blends fit in 16-bit lanes.
+ *       The position between the pixels is rounded to the nearest 1/256
+ *       and a channel may be one level lower than with 16-bit weights. */
+typedef void (*II_ROTATE_BLEND_PROC)(
+    uint32_t *pdw, const II_ROTATE_SAMPLES *samples, int i, int n);
+
+static void
+ii_rotate_blend(uint32_t *pdw, const II_ROTATE_SAMPLES *samples, int i, int n)
+{
+    uint32_t c00, c01, c10, c11, ex0, ex1, ey0, ey1;
+
+    for (; i < n; ++i)
+    {
+        c00 = samples->c00[i];
+        c10 = samples->c10[i];
+        c01 = samples->c01[i];
+        c11 = samples->c11[i];
+        ex0 = (uint32_t)(samples->wx0[i] & 0xFFFF);
+        ex1 = (uint32_t)(samples->wx1[i] & 0xFFFF);
+        ey0 = (uint32_t)(samples->wy0[i] & 0xFFFF);
+        ey1 = (uint32_t)(samples->wy1[i] & 0xFFFF);
+        pdw[i] = II_BILINEAR_CHANNEL(0) | II_BILINEAR_CHANNEL(8) |
+                 II_BILINEAR_CHANNEL(16) | II_BILINEAR_CHANNEL(24);
+    }
+}
+
+#ifdef II_USE_SSE2
+    /* bilinear of two pixels in eight uint16_t */
+    #define II_SSE2_BILINEAR2(c00, c10, c01, c11, ex0, ex1, ey0, ey1) \
+        _mm_srli_epi16(_mm_add_epi16( \
+            _mm_mullo_epi16(_mm_srli_epi16(_mm_add_epi16( \
+                _mm_mullo_epi16(c00, ex0), _mm_mullo_epi16(c10, ex1)), 8), \
+                ey0), \
+            _mm_mullo_epi16(_mm_srli_epi16(_mm_add_epi16( \
+                _mm_mullo_epi16(c01, ex0), _mm_mullo_epi16(c11, ex1)), 8), \
+                ey1)), 8)
+
+    static void
+    ii_rotate_blend_sse2(uint32_t *pdw, const II_ROTATE_SAMPLES *samples,
+                         int i, int n)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i c00, c10, c01, c11, lo, hi;
+
+        /* four pixels at once */
+        for (; i + 4 <= n; i += 4)
+        {
+            c00 = _mm_loadu_si128((const __m128i *)&samples->c00[i]);
+            c10 = _mm_loadu_si128((const __m128i *)&samples->c10[i]);
+            c01 = _mm_loadu_si128((const __m128i *)&samples->c01[i]);
+            c11 = _mm_loadu_si128((const __m128i *)&samples->c11[i]);
+            lo = II_SSE2_BILINEAR2(
+                _mm_unpacklo_epi8(c00, zero), _mm_unpacklo_epi8(c10, zero),
+                _mm_unpacklo_epi8(c01, zero), _mm_unpacklo_epi8(c11, zero),
+                _mm_loadu_si128((const __m128i *)&samples->wx0[i]),
+                _mm_loadu_si128((const __m128i *)&samples->wx1[i]),
+                _mm_loadu_si128((const __m128i *)&samples->wy0[i]),
+                _mm_loadu_si128((const __m128i *)&samples->wy1[i]));
+            hi = II_SSE2_BILINEAR2(
+                _mm_unpackhi_epi8(c00, zero), _mm_unpackhi_epi8(c10, zero),
+                _mm_unpackhi_epi8(c01, zero), _mm_unpackhi_epi8(c11, zero),
+                _mm_loadu_si128((const __m128i *)&samples->wx0[i + 2]),
+                _mm_loadu_si128((const __m128i *)&samples->wx1[i + 2]),
+                _mm_loadu_si128((const __m128i *)&samples->wy0[i + 2]),
+                _mm_loadu_si128((const __m128i *)&samples->wy1[i + 2]));
+            _mm_storeu_si128((__m128i *)&pdw[i], _mm_packus_epi16(lo, hi));
+        }
+        ii_rotate_blend(pdw, samples, i, n);
+    }
+    #undef II_SSE2_BILINEAR2
+#endif  /* def II_USE_SSE2 */
+
+#ifdef II_USE_AVX2
+    static II_TARGET_AVX2 void
+    ii_rotate_blend_avx2(uint32_t *pdw, const II_ROTATE_SAMPLES *samples,
+                         int i, int n)
+    {
+        __m256i c00, c10, c01, c11, ex0, ex1, ey0, ey1, h0, h1, v;
+
+        /* four pixels at once */
+        for (; i + 4 <= n; i += 4)
+        {
+            c00 = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128((const __m128i *)&samples->c00[i]));
+            c10 = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128((const __m128i *)&samples->c10[i]));
+            c01 = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128((const __m128i *)&samples->c01[i]));
+            c11 = _mm256_cvtepu8_epi16(
+                _mm_loadu_si128((const __m128i *)&samples->c11[i]));
+            ex0 = _mm256_loadu_si256((const __m256i *)&samples->wx0[i]);
+            ex1 = _mm256_loadu_si256((const __m256i *)&samples->wx1[i]);
+            ey0 = _mm256_loadu_si256((const __m256i *)&samples->wy0[i]);
+            ey1 = _mm256_loadu_si256((const __m256i *)&samples->wy1[i]);
+            h0 = _mm256_srli_epi16(_mm256_add_epi16(
+                _mm256_mullo_epi16(c00, ex0), _mm256_mullo_epi16(c10, ex1)), 8);
+            h1 = _mm256_srli_epi16(_mm256_add_epi16(
+                _mm256_mullo_epi16(c01, ex0), _mm256_mullo_epi16(c11, ex1)), 8);
+            v = _mm256_srli_epi16(_mm256_add_epi16(
+                _mm256_mullo_epi16(h0, ey0), _mm256_mullo_epi16(h1, ey1)), 8);
+            /* packus works per 128-bit lane; gather the two low halves */
+            v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+            _mm_storeu_si128((__m128i *)&pdw[i], _mm256_castsi256_si128(v));
+        }
+        ii_rotate_blend(pdw, samples, i, n);
+    }
+#endif  /* def II_USE_AVX2 */
+
+/* narrow [*lo, *hi) to the m where 0 <= p0 + m * dp < (n << 32) */
+static void
+ii_rotate_clip(double *lo, double *hi, int64_t p0, int64_t dp, int n)
+{
+    double a, b, t;
+
+    if (dp == 0)
+    {
+        if (p0 < 0 || p0 >= ((int64_t)n << 32))
+            *hi = *lo;
+        return;
+    }
+
+    a = -(double)p0 / (double)dp;
+    b = ((double)n * 4294967296.0 - (double)p0) / (double)dp;
+    if (dp < 0)
+    {
+        t = a;
+        a = b;
+        b = t;
+    }
+    if (*lo < a)
+        *lo = a;
+    if (*hi > b)
+        *hi = b;
+}
+
+/* is the source pixel of the destination pixel m in the source? */
+static ii_inline bool
+ii_rotate_is_inside(int64_t x0, int64_t dx, int64_t y0, int64_t dy,
+                    int w, int h, int m)
+{
+    int64_t x = x0 + m * dx, y = y0 + m * dy;
+    return (0 <= x && x < ((int64_t)w << 32) &&
+            0 <= y && y < ((int64_t)h << 32));
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_rotated_32bpp(II_HIMAGE hbmSrc, double angle, bool fGrow)
+{
+    II_HIMAGE hbm, hbm32bpp;
+    II_IMGINFO bm, bmNew;
+    II_ROTATE_SAMPLES *samples;
+    II_ROTATE_BLEND_PROC proc;
+    uint8_t *pbBits;
+    const uint8_t *row0, *row1;
+    uint32_t *pdw;
+    int32_t widthbytes;
+    int64_t x0, y0, dx, dy, x, y;
+    double cost, sint, quarter, lo, hi;
+    int cx, cy, mx, my, start, end, i, n, ix0, ix1, iy0, iy1, turns;
+    uint32_t ex1, ey1;
+
+    if (!ii_get_info(hbmSrc, &bm))
+        return NULL;
+
+    /* the multiples of 90 degrees are exact */
+    quarter = floor(angle / (M_PI / 2) + 0.5);
+    turns = -1;
+    if (fabs(angle / (M_PI / 2) - quarter) < 1e-12)
+    {
+        turns = (int)fmod(quarter, 4.0);
+        if (turns < 0)
+            turns += 4;
+    }
+    switch (turns)
+    {
+    case 0:     cost = 1;   sint = 0;   break;
+    case 1:     cost = 0;   sint = 1;   break;
+    case 2:     cost = -1;  sint = 0;   break;
+    case 3:     cost = 0;   sint = -1;  break;
+    default:    cost = cos(angle); sint = sin(angle); break;
+    }
+
+    if (fGrow)
+    {
+        cx = (int)(fabs(bm.bmWidth * cost) + fabs(bm.bmHeight * sint) + 0.5);
+        cy = (int)(fabs(bm.bmWidth * sint) + fabs(bm.bmHeight * cost) + 0.5);
+    }
+    else
+    {
+        cx = bm.bmWidth;
+        cy = bm.bmHeight;
+    }
+
+    if (bm.bmBitsPixel == 32)
+        hbm32bpp = hbmSrc;
+    else
+        hbm32bpp = ii_32bpp(hbmSrc);
+    if (hbm32bpp == NULL)
+        return NULL;
+
+    samples = (II_ROTATE_SAMPLES *)ii_alloc(sizeof(II_ROTATE_SAMPLES));
+    hbm = NULL;
+    if (samples)
+        hbm = ii_create_32bpp(cx, cy);
+    if (hbm == NULL)
+    {
+        ii_free(samples);
+        if (hbm32bpp != hbmSrc)
+            ii_destroy(hbm32bpp);
+        return NULL;
+    }
+
+    ii_get_info(hbm32bpp, &bm);
+    pbBits = ii_get_pixels(hbm);
+    widthbytes = (cx << 2);
+
+    if (turns == 0 && cx == bm.bmWidth && cy == bm.bmHeight)
+    {
+        for (my = 0; my < cy; ++my)
+        {
+            memcpy(pbBits + my * widthbytes,
+                   (const uint8_t *)bm.bmBits + my * bm.bmWidthBytes,
+                   widthbytes);
+        }
+    }
+    else if (turns == 2 && cx == bm.bmWidth && cy == bm.bmHeight)
+    {
+        /* reverse the rows and the pixels */
+        for (my = 0; my < cy; ++my)
+        {
+            memcpy(pbBits + my * widthbytes,
+                   (const uint8_t *)bm.bmBits + (cy - 1 - my) * bm.bmWidthBytes,
+                   widthbytes);
+            ii_reverse_row(pbBits + my * widthbytes, cx, 32);
+        }
+    }
+    else if ((turns == 1 || turns == 3) &&
+             cx == bm.bmHeight && cy == bm.bmWidth)
+    {
+        ii_get_info(hbm, &bmNew);
+        ii_transpose_image(&bm, &bmNew, turns == 1, turns == 3);
+    }
+    else
+    {
+        proc = ii_rotate_blend;
+#ifdef II_USE_SSE2
+        if (ii_has_sse2())
+            proc = ii_rotate_blend_sse2;
+#endif
+#ifdef II_USE_AVX2
+        if (ii_has_avx2())
+            proc = ii_rotate_blend_avx2;
+#endif
+
+        /* NOTE: The source positions are fixed point numbers of 32.32.
+         *       The start of each row is computed exactly. */
+        dx = (int64_t)floor(cost * 4294967296.0 + 0.5);
+        dy = (int64_t)floor(-sint * 4294967296.0 + 0.5);
+        for (my = 0; my < cy; ++my)
+        {
+            pdw = (uint32_t *)(pbBits + my * widthbytes);
+            x0 = (int64_t)floor((-(cx - 1) / 2.0 * cost +
+                                 (my - (cy - 1) / 2.0) * sint +
+                                 (bm.bmWidth - 1) / 2.0) * 4294967296.0 + 0.5);
+            y0 = (int64_t)floor(((cx - 1) / 2.0 * sint +
+                                 (my - (cy - 1) / 2.0) * cost +
+                                 (bm.bmHeight - 1) / 2.0) * 4294967296.0 + 0.5);
+
+            /* NOTE: The half of 1/256 rounds the positions to the nearest
+             *       weights. A position just off a pixel takes the pixel. */
+            x0 += INT64_C(0x800000);
+            y0 += INT64_C(0x800000);
+
+            /* the span of the row inside the source */
+            lo = 0;
+            hi = cx;
+            ii_rotate_clip(&lo, &hi, x0, dx, bm.bmWidth);
+            ii_rotate_clip(&lo, &hi, y0, dy, bm.bmHeight);
+            start = (lo <= 0) ? 0 : ((lo >= cx) ? cx : (int)ceil(lo));
+            end = (hi <= start) ? start : ((hi >= cx) ? cx : (int)ceil(hi));
+            while (start < end &&
+                   !ii_rotate_is_inside(x0, dx, y0, dy,
+                                        bm.bmWidth, bm.bmHeight, start))
+            {
+                ++start;
+            }
+            while (end > start &&
+                   !ii_rotate_is_inside(x0, dx, y0, dy,
+                                        bm.bmWidth, bm.bmHeight, end - 1))
+            {
+                --end;
+            }
+            while (start > 0 &&
+                   ii_rotate_is_inside(x0, dx, y0, dy,
+                                       bm.bmWidth, bm.bmHeight, start - 1))
+            {
+                --start;
+            }
+            while (end < cx &&
+                   ii_rotate_is_inside(x0, dx, y0, dy,
+                                       bm.bmWidth, bm.bmHeight, end))
+            {
+                ++end;
+            }
+            if (end < start)
+                end = start;
+
+            memset(pdw, 0, start * sizeof(uint32_t));
+            memset(pdw + end, 0, (cx - end) * sizeof(uint32_t));
+
+            x = x0 + start * dx;
+            y = y0 + start * dy;
+            for (mx = start; mx < end; mx += n)
+            {
+                n = min(II_ROTATE_CHUNK, end - mx);
+                for (i = 0; i < n; ++i)
+                {
+                    ix0 = (int)(x >> 32);
+                    iy0 = (int)(y >> 32);
+                    ix1 = min(ix0 + 1, (int)bm.bmWidth - 1);
+                    iy1 = min(iy0 + 1, (int)bm.bmHeight - 1);
+                    row0 = (const uint8_t *)bm.bmBits + iy0 * bm.bmWidthBytes;
+                    row1 = (const uint8_t *)bm.bmBits + iy1 * bm.bmWidthBytes;
+                    samples->c00[i] = ((const uint32_t *)row0)[ix0];
+                    samples->c10[i] = ((const uint32_t *)row0)[ix1];
+                    samples->c01[i] = ((const uint32_t *)row1)[ix0];
+                    samples->c11[i] = ((const uint32_t *)row1)[ix1];
+                    ex1 = (uint32_t)(x >> 24) & 0xFF;
+                    ey1 = (uint32_t)(y >> 24) & 0xFF;
+                    samples->wx0[i] = (0x100 - ex1) * UINT64_C(0x0001000100010001);
+                    samples->wx1[i] = ex1 * UINT64_C(0x0001000100010001);
+                    samples->wy0[i] = (0x100 - ey1) * UINT64_C(0x0001000100010001);
+                    samples->wy1[i] = ey1 * UINT64_C(0x0001000100010001);
+                    x += dx;
+                    y += dy;
+                }
+                proc(pdw + mx, samples, 0, n);
+            }
+        }
+    }
+
+    ii_free(samples);
+    if (hbm32bpp != hbmSrc)
+        ii_destroy(hbm32bpp);
+    return hbm;
+}
+
+IMAIO_API bool IIAPI
+ii_flip_inplace(II_HIMAGE hbm, II_FLAGS flags)
+{
+    II_IMGINFO bm;
+    uint8_t *pb0, *pb1, buf[256];
+    int y, i, n;
+
+    if (!ii_get_info(hbm, &bm))
+        return false;
+    if ((flags & II_FLAG_FLIP_HORIZONTAL) && bm.bmBitsPixel != 8 &&
+        bm.bmBitsPixel != 24 && bm.bmBitsPixel != 32)
+    {
+        return false;
+    }
+    if (!ii_make_writable(hbm))
+        return false;
+    ii_get_info(hbm, &bm);
+
+    if (flags & II_FLAG_FLIP_HORIZONTAL)
+    {
+        for (y = 0; y < bm.bmHeight; ++y)
+        {
+            ii_reverse_row((uint8_t *)bm.bmBits + y * bm.bmWidthBytes,
+                           bm.bmWidth, bm.bmBitsPixel);
+        }
+    }
+
+    if (flags & II_FLAG_FLIP_VERTICAL)
+    {
+        /* swap the rows through a small buffer */
+        for (y = 0; y < (bm.bmHeight >> 1); ++y)
+        {
+            pb0 = (uint8_t *)bm.bmBits + y * bm.bmWidthBytes;
+            pb1 = (uint8_t *)bm.bmBits + (bm.bmHeight - 1 - y) * bm.bmWidthBytes;
+            for (i = 0; i < bm.bmWidthBytes; i += n)
+            {
+                n = min((int)sizeof(buf), (int)bm.bmWidthBytes - i);
+                memcpy(buf, pb0 + i, n);
+                memmove(pb0 + i, pb1 + i, n);
+                memcpy(pb1 + i, buf, n);
+            }
+        }
+    }
+
+    return true;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_flipped_horizontal(II_HIMAGE hbmSrc)
+{
+    II_HIMAGE hbmNew;
+
+    assert(hbmSrc);
+    hbmNew = ii_24bpp_or_32bpp(hbmSrc);
+    if (hbmNew)
+        ii_flip_inplace(hbmNew, II_FLAG_FLIP_HORIZONTAL);
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_flipped_vertical(II_HIMAGE hbmSrc)
+{
+    II_HIMAGE hbmNew;
+
+    assert(hbmSrc);
+    hbmNew = ii_24bpp_or_32bpp(hbmSrc);
+    if (hbmNew)
+        ii_flip_inplace(hbmNew, II_FLAG_FLIP_VERTICAL);
+    return hbmNew;
+}
+
+/* the transposition of the memory rows of ii_transpose or ii_rotate90 */
+static II_HIMAGE
+ii_transposed_common(II_HIMAGE hbmSrc, bool fReverseSrc, bool fReverseDst)
+{
+    II_HIMAGE hbmNew, hbmTemp;
+    II_IMGINFO bm, bmNew;
+    II_PALETTE *table = NULL;
+
+    if (!ii_get_info(hbmSrc, &bm))
+        return NULL;
+
+    if (bm.bmBitsPixel != 8 && bm.bmBitsPixel != 24 && bm.bmBitsPixel != 32)
+    {
+        hbmTemp = ii_24bpp_or_32bpp(hbmSrc);
+        if (hbmTemp == NULL)
+            return NULL;
+        hbmNew = ii_transposed_common(hbmTemp, fReverseSrc, fReverseDst);
+        ii_destroy(hbmTemp);
+        return hbmNew;
+    }
+
+    if (bm.bmBitsPixel == 8)
+        table = ii_get_palette(hbmSrc);
+    hbmNew = ii_create(bm.bmHeight, bm.bmWidth, bm.bmBitsPixel, table);
+    ii_palette_destroy(table);
+    if (hbmNew == NULL)
+        return NULL;
+
+    ii_get_info(hbmNew, &bmNew);
+    ii_transpose_image(&bm, &bmNew, fReverseSrc, fReverseDst);
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_transpose(II_HIMAGE hbmSrc)
+{
+    /* NOTE: The rows are bottom-up, so the main diagonal of the image is
+     *       the other diagonal of the memory. */
+    return ii_transposed_common(hbmSrc, true, true);
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_rotate90(II_HIMAGE hbmSrc, int turns)
+{
+    II_HIMAGE hbmNew;
+
+    turns %= 4;
+    if (turns < 0)
+        turns += 4;
+
+    switch (turns)
+    {
+    case 1:
+        return ii_transposed_common(hbmSrc, true, false);
+    case 3:
+        return ii_transposed_common(hbmSrc, false, true);
+    default:
+        if (ii_get_bpp(hbmSrc) == 8)
+            hbmNew = ii_clone(hbmSrc);
+        else
+            hbmNew = ii_24bpp_or_32bpp(hbmSrc);
+        if (hbmNew && turns == 2)
+        {
+            ii_flip_inplace(hbmNew,
+                            II_FLAG_FLIP_HORIZONTAL | II_FLAG_FLIP_VERTICAL);
+        }
+        return hbmNew;
+    }
+}
+
+IMAIO_API void IIAPI
+ii_make_opaque(II_HIMAGE hbm32bpp, int x, int y, int cx, int cy)
+{
+    II_IMGINFO bm;
+    uint32_t dw;
+    uint32_t *pdw;
+    int xx, yy;
+
+    if (!ii_make_writable(hbm32bpp) ||
+        !ii_get_info(hbm32bpp, &bm) || bm.bmBitsPixel != 32)
+    {
+        return;
+    }
+
+    pdw = (uint32_t *)bm.bmBits;
+    for (yy = y; yy < y + cy; ++yy)
+    {
+        for (xx = x; xx < x + cx; ++xx)
+        {
+            dw = pdw[xx + yy * cx];
+            dw |= 0xFF000000;
+            pdw[xx + yy * cx] = dw;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* compositing */
+
+/* NOTE: The blending is exact as ii_premultiply and AlphaBlend with
+ *       AC_SRC_ALPHA in the integers: for each channel v of the source,
+ *       v' = v * bSCA / 255 and dest = v' + dest * (255 - alpha') / 255. */
+
+/* blend a row of BGRA pixels onto a row of BGRA pixels */
+typedef void (*II_BLEND_ROW_PROC)(uint32_t *pdwDest, const uint32_t *pdwSrc,
+                                  int ix, int cx, uint8_t bSCA,
+                                  bool premultiplied);
+
+static void
+ii_blend_row(uint32_t *pdwDest, const uint32_t *pdwSrc, int ix, int cx,
+             uint8_t bSCA, bool premultiplied)
+{
+    const uint8_t *src;
+    uint8_t *dest;
+    uint32_t b, g, r, a, inv;
+
+    for (; ix < cx; ++ix)
+    {
+        src = (const uint8_t *)&pdwSrc[ix];
+        dest = (uint8_t *)&pdwDest[ix];
+        b = src[0];
+        g = src[1];
+        r = src[2];
+        a = src[3];
+        if (!premultiplied)
+        {
+            b = b * a / 255;
+            g = g * a / 255;
+            r = r * a / 255;
+        }
+        if (bSCA != 255)
+        {
+            b = b * bSCA / 255;
+            g = g * bSCA / 255;
+            r = r * bSCA / 255;
+            a = a * bSCA / 255;
+        }
+        inv = 255 - a;
+        dest[0] = (uint8_t)(b + dest[0] * inv / 255);
+        dest[1] = (uint8_t)(g + dest[1] * inv / 255);
+        dest[2] = (uint8_t)(r + dest[2] * inv / 255);
+        dest[3] = (uint8_t)(a + dest[3] * inv / 255);
+    }
+}
+
+#ifdef II_USE_SSE2
+    /* x / 255 rounded down for the unsigned 16-bit x */
+    #define II_SSE2_DIV255(x) \
+        _mm_srli_epi16(_mm_mulhi_epu16((x), k8081), 7)
+    /* the alpha of each pixel in the four channels */
+    #define II_SSE2_ALPHA4(x) \
+        _mm_shufflehi_epi16(_mm_shufflelo_epi16((x), 0xFF), 0xFF)
+
+    static ii_inline __m128i
+    ii_blend_pixels2_sse2(__m128i s, __m128i d, __m128i sca,
+                          bool premultiplied, bool scaled)
+    {
+        const __m128i k255 = _mm_set1_epi16(255);
+        const __m128i k8081 = _mm_set1_epi16((short)0x8081);
+
+        if (!premultiplied)
+            s = ii_premultiply_pixels2_sse2(s);
+        if (scaled)
+            s = II_SSE2_DIV255(_mm_mullo_epi16(s, sca));
+        d = _mm_mullo_epi16(d, _mm_sub_epi16(k255, II_SSE2_ALPHA4(s)));
+        return _mm_add_epi16(s, II_SSE2_DIV255(d));
+    }
+
+    static void
+    ii_blend_row_sse2(uint32_t *pdwDest, const uint32_t *pdwSrc,
+                      int ix, int cx, uint8_t bSCA, bool premultiplied)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i alphas = _mm_set1_epi32((int)0xFF000000);
+        const __m128i sca = _mm_set1_epi16(bSCA);
+        const bool scaled = (bSCA != 255);
+        __m128i s, d, a;
+        int mask;
+
+        for (; ix + 4 <= cx; ix += 4)
+        {
+            s = _mm_loadu_si128((const __m128i *)&pdwSrc[ix]);
+            if (!scaled)
+            {
+                /* the opaque pixels replace and the clear ones keep */
+                a = _mm_and_si128(s, alphas);
+                mask = _mm_movemask_epi8(_mm_cmpeq_epi32(a, alphas));
+                if (mask == 0xFFFF)
+                {
+                    _mm_storeu_si128((__m128i *)&pdwDest[ix], s);
+                    continue;
+                }
+                mask = _mm_movemask_epi8(_mm_cmpeq_epi32(
+                    premultiplied ? s : a, zero));
+                if (mask == 0xFFFF)
+                    continue;
+            }
+            d = _mm_loadu_si128((const __m128i *)&pdwDest[ix]);
+            d = _mm_packus_epi16(
+                ii_blend_pixels2_sse2(_mm_unpacklo_epi8(s, zero),
+                                      _mm_unpacklo_epi8(d, zero),
+                                      sca, premultiplied, scaled),
+                ii_blend_pixels2_sse2(_mm_unpackhi_epi8(s, zero),
+                                      _mm_unpackhi_epi8(d, zero),
+                                      sca, premultiplied, scaled));
+            _mm_storeu_si128((__m128i *)&pdwDest[ix], d);
+        }
+        ii_blend_row(pdwDest, pdwSrc, ix, cx, bSCA, premultiplied);
+    }
+    #undef II_SSE2_ALPHA4
+    #undef II_SSE2_DIV255
+#endif  /* def II_USE_SSE2 */
+
+#ifdef II_USE_AVX2
+    #define II_AVX2_DIV255(x) \
+        _mm256_srli_epi16(_mm256_mulhi_epu16((x), k8081), 7)
+    #define II_AVX2_ALPHA4(x) \
+        _mm256_shufflehi_epi16(_mm256_shufflelo_epi16((x), 0xFF), 0xFF)
+
+    static ii_inline II_TARGET_AVX2 __m256i
+    ii_blend_pixels4_avx2(__m256i s, __m256i d, __m256i sca,
+                          bool premultiplied, bool scaled)
+    {
+        const __m256i k255 = _mm256_set1_epi16(255);
+        const __m256i k8081 = _mm256_set1_epi16((short)0x8081);
+
+        if (!premultiplied)
+            s = ii_premultiply_pixels4_avx2(s);
+        if (scaled)
+            s = II_AVX2_DIV255(_mm256_mullo_epi16(s, sca));
+        d = _mm256_mullo_epi16(d, _mm256_sub_epi16(k255, II_AVX2_ALPHA4(s)));
+        return _mm256_add_epi16(s, II_AVX2_DIV255(d));
+    }
+
+    static II_TARGET_AVX2 void
+    ii_blend_row_avx2(uint32_t *pdwDest, const uint32_t *pdwSrc,
+                      int ix, int cx, uint8_t bSCA, bool premultiplied)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i alphas = _mm256_set1_epi32((int)0xFF000000);
+        const __m256i sca = _mm256_set1_epi16(bSCA);
+        const bool scaled = (bSCA != 255);
+        __m256i s, d, a;
+
+        for (; ix + 8 <= cx; ix += 8)
+        {
+            s = _mm256_loadu_si256((const __m256i *)&pdwSrc[ix]);
+            if (!scaled)
+            {
+                a = _mm256_and_si256(s, alphas);
+                if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, alphas)) == -1)
+                {
+                    _mm256_storeu_si256((__m256i *)&pdwDest[ix], s);
+                    continue;
+                }
+                if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(
+                        premultiplied ? s : a, zero)) == -1)
+                {
+                    continue;
+                }
+            }
+            /* NOTE: unpack and packus work per 128-bit lane alike. */
+            d = _mm256_loadu_si256((const __m256i *)&pdwDest[ix]);
+            d = _mm256_packus_epi16(
+                ii_blend_pixels4_avx2(_mm256_unpacklo_epi8(s, zero),
+                                      _mm256_unpacklo_epi8(d, zero),
+                                      sca, premultiplied, scaled),
+                ii_blend_pixels4_avx2(_mm256_unpackhi_epi8(s, zero),
+                                      _mm256_unpackhi_epi8(d, zero),
+                                      sca, premultiplied, scaled));
+            _mm256_storeu_si256((__m256i *)&pdwDest[ix], d);
+        }
+        ii_blend_row_sse2(pdwDest, pdwSrc, ix, cx, bSCA, premultiplied);
+    }
+    #undef II_AVX2_ALPHA4
+    #undef II_AVX2_DIV255
+#endif  /* def II_USE_AVX2 */
+
+IMAIO_API bool IIAPI
+ii_composite(
+    II_HIMAGE hbm, int x, int y,
+    II_HIMAGE hbmSrc, int xSrc, int ySrc, int cx, int cy,
+    const int *pi_trans, uint8_t bSCA, II_FLAGS flags)
+{
+    II_IMGINFO bm, bmSrc;
+    II_PALETTE *table;
+    II_BLEND_ROW_PROC proc;
+    uint32_t lut[256];
+    uint32_t *pdwBuf, *pdwSrc, *pdwDest;
+    const uint8_t *pbSrc, *pb;
+    uint8_t *pbDest;
+    bool premultiplied;
+    int i, ix, iy;
+
+    if (!ii_get_info(hbm, &bm) || bm.bmBits == NULL ||
+        (bm.bmBitsPixel != 24 && bm.bmBitsPixel != 32))
+    {
+        return false;
+    }
+    if (!ii_get_info(hbmSrc, &bmSrc) || bmSrc.bmBits == NULL ||
+        !ii_is_readable_bpp(bmSrc.bmBitsPixel) || !ii_make_writable(hbm))
+    {
+        return false;
+    }
+    /* NOTE: ii_make_writable may have copied the shared pixels. */
+    ii_get_info(hbm, &bm);
+
+    /* clipping */
+    if (xSrc < 0) { x -= xSrc; cx += xSrc; xSrc = 0; }
+    if (ySrc < 0) { y -= ySrc; cy += ySrc; ySrc = 0; }
+    if (x < 0) { xSrc -= x; cx += x; x = 0; }
+    if (y < 0) { ySrc -= y; cy += y; y = 0; }
+    cx = min(cx, min(bmSrc.bmWidth - xSrc, bm.bmWidth - x));
+    cy = min(cy, min(bmSrc.bmHeight - ySrc, bm.bmHeight - y));
+    if (cx <= 0 || cy <= 0)
+        return true;
+
+    /* NOTE: The indexes map to the premultiplied colors. */
+    if (bmSrc.bmBitsPixel <= 8)
+    {
+        table = ii_get_palette(hbmSrc);
+        for (i = 0; i < 256; ++i)
+            lut[i] = 0xFF000000;
+        for (i = 0; table && i < table->num_colors && i < 256; ++i)
+        {
+            lut[i] = 0xFF000000 | table->colors[i].value[0] |
+                     (table->colors[i].value[1] << 8) |
+                     ((uint32_t)table->colors[i].value[2] << 16);
+        }
+        ii_palette_destroy(table);
+        if (pi_trans && *pi_trans >= 0 && *pi_trans < 256)
+            lut[*pi_trans] = 0;
+    }
+
+    /* the rows of the source and the destination other than 32bpp */
+    pdwBuf = (uint32_t *)ii_alloc(2 * cx * sizeof(uint32_t));
+    if (pdwBuf == NULL)
+        return false;
+
+    proc = ii_blend_row;
+#ifdef II_USE_SSE2
+    if (ii_has_sse2())
+        proc = ii_blend_row_sse2;
+#endif
+#ifdef II_USE_AVX2
+    if (ii_has_avx2())
+        proc = ii_blend_row_avx2;
+#endif
+
+    for (iy = 0; iy < cy; ++iy)
+    {
+        pbSrc = (const uint8_t *)bmSrc.bmBits +
+                (bmSrc.bmHeight - 1 - (ySrc + iy)) * bmSrc.bmWidthBytes;
+        pbDest = (uint8_t *)bm.bmBits +
+                 (bm.bmHeight - 1 - (y + iy)) * bm.bmWidthBytes;
+
+        premultiplied = true;
+        pdwSrc = pdwBuf;
+        switch (bmSrc.bmBitsPixel)
+        {
+        case 32:
+            pdwSrc = (uint32_t *)pbSrc + xSrc;
+            premultiplied = ((flags & II_FLAG_PREMULTIPLIED) != 0);
+            break;
+        case 24:
+            pb = pbSrc + xSrc * 3;
+            for (ix = 0; ix < cx; ++ix, pb += 3)
+            {
+                pdwBuf[ix] = 0xFF000000 | pb[0] | (pb[1] << 8) |
+                             ((uint32_t)pb[2] << 16);
+            }
+            break;
+        case 8:
+            pb = pbSrc + xSrc;
+            for (ix = 0; ix < cx; ++ix)
+                pdwBuf[ix] = lut[pb[ix]];
+            break;
+        case 4:
+            for (ix = 0; ix < cx; ++ix)
+            {
+                i = xSrc + ix;
+                pdwBuf[ix] = lut[(pbSrc[i >> 1] >> ((i & 1) ? 0 : 4)) & 0x0F];
+            }
+            break;
+        case 1:
+            for (ix = 0; ix < cx; ++ix)
+            {
+                i = xSrc + ix;
+                pdwBuf[ix] = lut[(pbSrc[i >> 3] >> (7 - (i & 7))) & 0x01];
+            }
+            break;
+        default:
+            assert(0);
+            break;
+        }
+
+        if (bm.bmBitsPixel == 32)
+        {
+            proc((uint32_t *)pbDest + x, pdwSrc, 0, cx, bSCA, premultiplied);
+            continue;
+        }
+
+        /* NOTE: The 24bpp row is blended in 32bpp. */
+        pdwDest = pdwBuf + cx;
+        pb = pbDest + x * 3;
+        for (ix = 0; ix < cx; ++ix, pb += 3)
+            pdwDest[ix] = pb[0] | (pb[1] << 8) | ((uint32_t)pb[2] << 16);
+        proc(pdwDest, pdwSrc, 0, cx, bSCA, premultiplied);
+        for (ix = 0; ix < cx; ++ix)
+        {
+            pbDest[(x + ix) * 3 + 0] = (uint8_t)pdwDest[ix];
+            pbDest[(x + ix) * 3 + 1] = (uint8_t)(pdwDest[ix] >> 8);
+            pbDest[(x + ix) * 3 + 2] = (uint8_t)(pdwDest[ix] >> 16);
+        }
+    }
+
+    ii_free(pdwBuf);
+    return true;
+}
+
+IMAIO_API void IIAPI
+ii_draw_center(
+    II_DEVICE hdc, int x, int y,
+    II_HIMAGE hbmSrc, int xSrc, int ySrc, int cxSrc, int cySrc,
+    const int *pi_trans, uint8_t bSCA)
+{
+    x -= cxSrc / 2;
+    y -= cySrc / 2;
+
+    ii_draw(hdc, x, y, hbmSrc, xSrc, ySrc, cxSrc, cySrc, pi_trans, bSCA);
+}
+
+IMAIO_API void IIAPI
+ii_put_center(
+    II_HIMAGE hbm, int x, int y,
+    II_HIMAGE hbmSrc, int xSrc, int ySrc, int cxSrc, int cySrc,
+    const int *pi_trans, uint8_t bSCA)
+{
+    x -= cxSrc / 2;
+    y -= cySrc / 2;
+
+    ii_put(hbm, x, y, hbmSrc, xSrc, ySrc, cxSrc, cySrc, pi_trans, bSCA);
+}
+
+IMAIO_API void IIAPI
+ii_stamp(II_HIMAGE hbm, int x, int y, II_HIMAGE hbmSrc,
+         const int *pi_trans, uint8_t bSCA)
+{
+    II_IMGINFO bmSrc;
+    ii_get_info(hbmSrc, &bmSrc);
+    ii_put(hbm, x, y, hbmSrc, 0, 0, bmSrc.bmWidth, bmSrc.bmHeight,
+           pi_trans, bSCA);
+}
+
+IMAIO_API void IIAPI
+ii_stamp_center(
+    II_HIMAGE hbm, int x, int y, II_HIMAGE hbmSrc,
+    const int *pi_trans, uint8_t bSCA)
+{
+    II_IMGINFO bmSrc;
+    ii_get_info(hbmSrc, &bmSrc);
+    ii_put_center(
+        hbm, x, y, hbmSrc, 0, 0, bmSrc.bmWidth, bmSrc.bmHeight,
+        pi_trans, bSCA);
+}
+
+/*****************************************************************************/
+/* colors */
+
+IMAIO_API int32_t IIAPI
+ii_color_distance(const II_COLOR8 *c1, const II_COLOR8 *c2)
+{
+    int32_t diff, sum = 0;
+    diff = c1->value[0] - c2->value[0];
+    sum += diff * diff;
+    diff = c1->value[1] - c2->value[1];
+    sum += diff * diff;
+    diff = c1->value[2] - c2->value[2];
+    sum += diff * diff;
+    return sum;
+}
+
+IMAIO_API int32_t IIAPI
+ii_color_distance_alpha(const II_COLOR8 *c1, const II_COLOR8 *c2)
+{
+    int32_t diff, sum = 0;
+    diff = c1->value[0] - c2->value[0];
+    sum += diff * diff;
+    diff = c1->value[1] - c2->value[1];
+    sum += diff * diff;
+    diff = c1->value[2] - c2->value[2];
+    sum += diff * diff;
+    diff = c1->value[3] - c2->value[3];
+    sum += diff * diff;
+    return sum;
+}
+
+IMAIO_API II_PALETTE * IIAPI
+ii_palette_create(int num_colors, const II_COLOR8 *colors)
+{
+    II_PALETTE *table;
+    table = (II_PALETTE *)calloc(sizeof(II_PALETTE), 1);
+    if (table == NULL)
+        return NULL;
+
+    table->num_colors = num_colors;
+    if (colors)
+        memcpy(table->colors, colors, sizeof(II_COLOR8) * num_colors);
+    return table;
+}
+
+IMAIO_API II_PALETTE * IIAPI
+ii_palette_fixed(bool web_safe)
+{
+    II_PALETTE *    table;
+    int i = 0, j, rr, gg, bb;
+
+    table = (II_PALETTE *)calloc(sizeof(II_PALETTE), 1);
+    if (table == NULL)
+        return NULL;
+    for (rr = 0; rr <= 0xFF; rr += 0x33)
+    {
+        for (gg = 0; gg <= 0xFF; gg += 0x33)
+        {
+            for (bb = 0; bb <= 0xFF; bb += 0x33)
+            {
+                table->colors[i].value[0] = bb;
+                table->colors[i].value[1] = gg;
+                table->colors[i].value[2] = rr;
+                ++i;
+            }
+        }
+    }
+    assert(i == 216);
+    if (!web_safe)
+    {
+        for (j = 0; j < 40; ++j, ++i)
+        {
+            table->colors[i].value[0] = j * 0xFF / 40;
+            table->colors[i].value[1] = j * 0xFF / 40;
+            table->colors[i].value[2] = j * 0xFF / 40;
+        }
+    }
+    table->num_colors = i;
+    assert(i == 216 || i == 256);
+    return table;
+}
+
+IMAIO_API void IIAPI
+ii_palette_destroy(II_PALETTE *palette)
+{
+    free(palette);
+}
+
+/*****************************************************************************/
+/* k-means */
+
+/* entry of k-means */
+typedef struct II_KMEANS_ENTRY
+{
+    II_COLOR8   true_color;
+    II_COLOR8   trimmed_color;
+    int32_t     count;
+    int32_t     i_cluster;
+} II_KMEANS_ENTRY;
+
+/* cluster of k-means */
+typedef struct II_KMEANS_CLUSTER
+{
+    II_COLOR32 centroid;
+    int         count;
+} II_KMEANS_CLUSTER;
+
+/* maximum number of clusters */
+#define II_KMEANS_MAX_CLUSTER 256
+
+/* the k-means structure */
+typedef struct II_KMEANS
+{
+    II_KMEANS_ENTRY *   entries;
+    int                 num_entries;
+    II_KMEANS_CLUSTER   clusters[II_KMEANS_MAX_CLUSTER];
+} II_KMEANS;
+
+/* trim a color */
+IMAIO_API II_COLOR8 IIAPI
+ii_color_trim(II_COLOR8 color)
+{
+    II_COLOR8 trimmed_color;
+    trimmed_color.value[0] = (color.value[0] & 0xF8);
+    trimmed_color.value[1] = (color.value[1] & 0xF8);
+    trimmed_color.value[2] = (color.value[2] & 0xF8);
+    trimmed_color.value[3] = 0;
+    return trimmed_color;
+}
+
+/* a bin of the 15-bit (5:5:5) color histogram */
+typedef struct II_KMEANS_BIN
+{
+    uint32_t    count;
+    uint32_t    low[3];     /* sum of the lower three bits of each channel */
+} II_KMEANS_BIN;
+
+#define II_KMEANS_NUM_BINS  (1 << 15)
+
+/* the index of the bin of a 0x00RRGGBB color */
+#define II_KMEANS_BIN_INDEX(dw) \
+    ((((dw) >> 3) & 0x1F) | (((dw) >> 6) & 0x3E0) | (((dw) >> 9) & 0x7C00))
+
+/* store the weighted colors of pixels to the k-means structure */
+static bool IIAPI
+ii_kmeans_add_pixels(II_KMEANS *kms, int num_pixels, const uint32_t *pixels)
+{
+    II_KMEANS_BIN *bins, *bin;
+    II_KMEANS_ENTRY *entry;
+    uint32_t dw, count;
+    int i, k, num_entries;
+
+    bins = (II_KMEANS_BIN *)calloc(II_KMEANS_NUM_BINS, sizeof(II_KMEANS_BIN));
+    if (bins == NULL)
+        return false;
+
+    /* make the histogram in one pass */
+    num_entries = 0;
+    for (i = 0; i < num_pixels; ++i)
+    {
+        dw = pixels[i];
+        bin = &bins[II_KMEANS_BIN_INDEX(dw)];
+        if (bin->count++ == 0)
+            ++num_entries;
+        bin->low[0] += (dw >> 0) & 0x07;
+        bin->low[1] += (dw >> 8) & 0x07;
+        bin->low[2] += (dw >> 16) & 0x07;
+    }
+
+    /* NOTE: The true color of an entry is the average color of the bin. */
+    kms->entries = (II_KMEANS_ENTRY *)malloc(
+        (num_entries ? num_entries : 1) * sizeof(II_KMEANS_ENTRY));
+    if (kms->entries == NULL)
+    {
+        free(bins);
+        return false;
+    }
+    entry = kms->entries;
+    for (i = 0; i < II_KMEANS_NUM_BINS; ++i)
+    {
+        count = bins[i].count;
+        if (count == 0)
+            continue;
+
+        entry->trimmed_color.value[0] = (uint8_t)((i & 0x1F) << 3);
+        entry->trimmed_color.value[1] = (uint8_t)(((i >> 5) & 0x1F) << 3);
+        entry->trimmed_color.value[2] = (uint8_t)(((i >> 10) & 0x1F) << 3);
+        entry->trimmed_color.value[3] = 0;
+        entry->true_color = entry->trimmed_color;
+        for (k = 0; k < 3; ++k)
+        {
+            entry->true_color.value[k] |=
+                (uint8_t)((bins[i].low[k] + count / 2) / count);
+        }
+        entry->count = (int32_t)count;
+        entry->i_cluster = 0;
+        ++entry;
+    }
+    kms->num_entries = num_entries;
+
+    free(bins);
+    return true;
+}
+
+/* the pseudo-random numbers of k-means (xorshift32) */
+static ii_inline uint32_t
+ii_kmeans_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/* pick an entry with the probability proportional to weights[i] */
+static int
+ii_kmeans_pick(const double *weights, int num_entries, double total,
+               uint32_t *state)
+{
+    double r;
+    int i;
+
+    /* a uniform number in [0, total) of 53 bits */
+    r = (ii_kmeans_random(state) >> 5) * 67108864.0;
+    r += ii_kmeans_random(state) >> 6;
+    r *= total / 9007199254740992.0;
+
+    for (i = 0; i < num_entries - 1; ++i)
+    {
+        if (r < weights[i])
+            break;
+        r -= weights[i];
+    }
+    return i;
+}
+
+/* choose the initial centroids by k-means++ */
+/* NOTE: The same seed and pixels give the same centroids. */
+static bool IIAPI
+ii_kmeans_seed(II_KMEANS *kms, int num_colors, uint32_t seed)
+{
+    double *weights, d, diff, total;
+    const II_KMEANS_ENTRY *entry;
+    uint32_t state;
+    int i, j, k;
+
+    weights = (double *)malloc((kms->num_entries + 1) * sizeof(double));
+    if (weights == NULL)
+        return false;
+
+    state = seed * 2654435761U + 0x9E3779B9;
+    if (state == 0)
+        state = 1;
+
+    /* the first centroid is weighted by count only */
+    total = 0;
+    for (i = 0; i < kms->num_entries; ++i)
+    {
+        weights[i] = kms->entries[i].count;
+        total += weights[i];
+    }
+
+    for (j = 0; j < num_colors; ++j)
+    {
+        if (total > 0)
+        {
+            i = ii_kmeans_pick(weights, kms->num_entries, total, &state);
+            for (k = 0; k < 3; ++k)
+            {
+                kms->clusters[j].centroid.value[k] =
+                    kms->entries[i].true_color.value[k];
+            }
+        }
+        else
+        {
+            /* no more distinct colors */
+            kms->clusters[j] = kms->clusters[0];
+            continue;
+        }
+
+        /* weight by count times squared distance to the nearest centroid */
+        total = 0;
+        for (i = 0; i < kms->num_entries; ++i)
+        {
+            entry = &kms->entries[i];
+            d = 0;
+            for (k = 0; k < 3; ++k)
+            {
+                diff = entry->true_color.value[k] -
+                       kms->clusters[j].centroid.value[k];
+                d += diff * diff;
+            }
+            d *= entry->count;
+            if (j == 0 || d < weights[i])
+                weights[i] = d;
+            total += weights[i];
+        }
+    }
+
+    free(weights);
+    return true;
+}
+
+/* maximum number of iterations of k-means */
+#define II_KMEANS_MAX_ITERATIONS    64
+
+/* the state of k-means between iterations */
+typedef struct II_KMEANS_STATE
+{
+    double      centers[II_KMEANS_MAX_CLUSTER][3];
+    double      half[II_KMEANS_MAX_CLUSTER];    /* half distance to nearest */
+    double *    upper;      /* upper bound of distance to own center */
+    double *    lower;      /* lower bound of distance to other centers */
+    int         num_colors;
+} II_KMEANS_STATE;
+
+/* get squared distance */
+static ii_inline double
+ii_kmeans_distance2(const II_KMEANS_ENTRY *entry, const double *center)
+{
+    double diff, sum;
+    diff = entry->true_color.value[0] - center[0];
+    sum = diff * diff;
+    diff = entry->true_color.value[1] - center[1];
+    sum += diff * diff;
+    diff = entry->true_color.value[2] - center[2];
+    sum += diff * diff;
+    return sum;
+}
+
+/* assign an entry to the nearest cluster. returns 1 if changed */
+/* NOTE: This is the bound pruning of Hamerly's algorithm. */
+static int
+ii_kmeans_assign(II_KMEANS_STATE *state, II_KMEANS_ENTRY *entry, int i,
+                 bool full)
+{
+    int j, j1, i_cluster;
+    double d, d1, d2, bound;
+
+    i_cluster = entry->i_cluster;
+    if (!full)
+    {
+        bound = state->half[i_cluster];
+        if (bound < state->lower[i])
+            bound = state->lower[i];
+        if (state->upper[i] <= bound)
+            return 0;
+
+        /* tighten the upper bound */
+        state->upper[i] = sqrt(ii_kmeans_distance2(
+            entry, state->centers[i_cluster]));
+        if (state->upper[i] <= bound)
+            return 0;
+    }
+
+    /* find the nearest and the second nearest */
+    d1 = d2 = 1e30;
+    j1 = 0;
+    for (j = 0; j < state->num_colors; ++j)
+    {
+        d = ii_kmeans_distance2(entry, state->centers[j]);
+        if (d < d1)
+        {
+            d2 = d1;
+            d1 = d;
+            j1 = j;
+        }
+        else if (d < d2)
+        {
+            d2 = d;
+        }
+    }
+    state->upper[i] = sqrt(d1);
+    state->lower[i] = sqrt(d2);
+    entry->i_cluster = j1;
+    return (full || j1 != i_cluster);
+}
+
+/* do the k-means */
+static bool IIAPI
+ii_kmeans(II_KMEANS *kms, int num_colors)
+{
+    II_KMEANS_STATE *state;
+    II_KMEANS_ENTRY *entry;
+    double sums[II_KMEANS_MAX_CLUSTER][3], weights[II_KMEANS_MAX_CLUSTER];
+    double moved[II_KMEANS_MAX_CLUSTER];
+    double d, max_moved, max_moved2;
+    int i, j, k, m, j_max, changed;
+
+    assert(num_colors > 0);
+    if (num_colors > 256)
+        num_colors = 256;
+
+    state = (II_KMEANS_STATE *)malloc(sizeof(II_KMEANS_STATE));
+    if (state == NULL)
+        return false;
+    state->upper = (double *)malloc(
+        (kms->num_entries + 1) * 2 * sizeof(double));
+    if (state->upper == NULL)
+    {
+        free(state);
+        return false;
+    }
+    state->lower = state->upper + kms->num_entries;
+    state->num_colors = num_colors;
+
+    for (j = 0; j < num_colors; ++j)
+    {
+        for (k = 0; k < 3; ++k)
+            state->centers[j][k] = kms->clusters[j].centroid.value[k];
+    }
+
+    for (m = 0; m < II_KMEANS_MAX_ITERATIONS; ++m)
+    {
+        /* half the distance from each center to the nearest center */
+        for (j = 0; j < num_colors; ++j)
+            state->half[j] = 1e30;
+        for (j = 0; j < num_colors; ++j)
+        {
+            for (i = j + 1; i < num_colors; ++i)
+            {
+                d = 0;
+                for (k = 0; k < 3; ++k)
+                {
+                    d += (state->centers[j][k] - state->centers[i][k]) *
+                         (state->centers[j][k] - state->centers[i][k]);
+                }
+                d = sqrt(d) / 2;
+                if (d < state->half[j])
+                    state->half[j] = d;
+                if (d < state->half[i])
+                    state->half[i] = d;
+            }
+        }
+
+        /* assign the entries */
+        /* NOTE: Build with OpenMP to assign the entries in parallel. */
+        changed = 0;
+#ifdef _OPENMP
+        #pragma omp parallel for reduction(+:changed) schedule(static)
+#endif
+        for (i = 0; i < kms->num_entries; ++i)
+        {
+            changed += ii_kmeans_assign(state, &kms->entries[i], i, m == 0);
+        }
+        if (changed == 0)
+            break;
+
+        /* accumulate the centroids in one pass */
+        memset(sums, 0, sizeof(sums));
+        memset(weights, 0, sizeof(weights));
+        for (i = 0; i < kms->num_entries; ++i)
+        {
+            entry = &kms->entries[i];
+            j = entry->i_cluster;
+            for (k = 0; k < 3; ++k)
+                sums[j][k] += (double)entry->true_color.value[k] * entry->count;
+            weights[j] += entry->count;
+        }
+
+        /* move the centers */
+        max_moved = max_moved2 = 0;
+        j_max = 0;
+        for (j = 0; j < num_colors; ++j)
+        {
+            moved[j] = 0;
+            if (weights[j] == 0)
+                continue;   /* an empty cluster stays */
+            for (k = 0; k < 3; ++k)
+            {
+                d = sums[j][k] / weights[j] - state->centers[j][k];
+                moved[j] += d * d;
+                state->centers[j][k] = sums[j][k] / weights[j];
+            }
+            moved[j] = sqrt(moved[j]);
+            if (moved[j] > max_moved)
+            {
+                max_moved2 = max_moved;
+                max_moved = moved[j];
+                j_max = j;
+            }
+            else if (moved[j] > max_moved2)
+            {
+                max_moved2 = moved[j];
+            }
+        }
+
+        /* update the bounds */
+        for (i = 0; i < kms->num_entries; ++i)
+        {
+            j = kms->entries[i].i_cluster;
+            state->upper[i] += moved[j];
+            state->lower[i] -= (j == j_max) ? max_moved2 : max_moved;
+        }
+    }
+
+    for (j = 0; j < num_colors; ++j)
+    {
+        for (k = 0; k < 3; ++k)
+        {
+            kms->clusters[j].centroid.value[k] =
+                (int32_t)(state->centers[j][k] + 0.5);
+        }
+    }
+
+    free(state->upper);
+    free(state);
+    return true;
+}
+
+/*****************************************************************************/
+/* colors */
+
+IMAIO_API II_PALETTE * IIAPI
+ii_palette_for_pixels(int num_pixels, const uint32_t *pixels, int num_colors)
+{
+    return ii_palette_for_pixels_ex(num_pixels, pixels, num_colors, 0);
+}
+
+IMAIO_API II_PALETTE * IIAPI
+ii_palette_for_pixels_ex(int num_pixels, const uint32_t *pixels,
+                         int num_colors, uint32_t seed)
+{
+    int i;
+    uint32_t dw;
+    II_PALETTE *table;
+    II_KMEANS kms;
+
+    if (num_colors < 0 || 256 < num_colors)
+        num_colors = 256;
+    
+    if (num_pixels <= 1)
+    {
+        if (num_pixels == 1)
+            dw = *pixels;
+        else
+            dw = 0;
+        table = (II_PALETTE *)calloc(sizeof(II_PALETTE), 1);
+        table->num_colors = 2;
+        table->colors[0].value[0] = (uint8_t)(dw >> 0);
+        table->colors[0].value[1] = (uint8_t)(dw >> 8);
+        table->colors[0].value[2] = (uint8_t)(dw >> 16);
+        table->colors[1].value[0] = 0xFF;
+        table->colors[1].value[1] = 0xFF;
+        table->colors[1].value[2] = 0xFF;
+        return table;
+    }
+
+    /* initialize the k-means structure */
+    memset(&kms, 0, sizeof(kms));
+
+    /* store colors to the k-means structure */
+    if (!ii_kmeans_add_pixels(&kms, num_pixels, pixels))
+        return NULL;
+
+    /* choose the initial centroids */
+    if (!ii_kmeans_seed(&kms, num_colors, seed))
+    {
+        free(kms.entries);
+        return NULL;
+    }
+
+    /* just do it */
+    if (!ii_kmeans(&kms, num_colors))
+    {
+        free(kms.entries);
+        return NULL;
+    }
+
+    /* store colors to table */
+    table = (II_PALETTE *)calloc(sizeof(II_PALETTE), 1);
+    if (table)
+    {
+        table->num_colors = num_colors;
+        for (i = 0; i < num_colors; ++i)
+        {
+            table->colors[i].value[0] =
+                (uint8_t)kms.clusters[i].centroid.value[0];
+            table->colors[i].value[1] =
+                (uint8_t)kms.clusters[i].centroid.value[1];
+            table->colors[i].value[2] =
+                (uint8_t)kms.clusters[i].centroid.value[2];
+        }
+    }
+
+    /* release allocated memory */
+    free(kms.entries);
+
+    return table;
+}
+
+IMAIO_API II_PALETTE * IIAPI
+ii_palette_optimized(II_HIMAGE hbm, int num_colors)
+{
+    II_HIMAGE hbm32bpp;
+    II_IMGINFO bm;
+    uint32_t *pdw;
+    uint32_t dw, cdw;
+    uint32_t *pixels;
+    int num_pixels;
+    II_PALETTE *table = NULL;
+
+    if (num_colors < 0 || 256 < num_colors)
+        num_colors = 256;
+
+    if (!ii_get_info(hbm, &bm))
+        return NULL;
+
+    /* NOTE: The histogram of k-means is cheap. All pixels are used. */
+    if (bm.bmBitsPixel == 32)
+        hbm32bpp = hbm;
+    else
+        hbm32bpp = ii_32bpp(hbm);
+    if (hbm32bpp)
+    {
+        /* get pixels */
+        ii_get_info(hbm32bpp, &bm);
+        pdw = (uint32_t *)bm.bmBits;
+        cdw = bm.bmWidth * bm.bmHeight;
+        pixels = calloc(sizeof(uint32_t), cdw);
+        if (pixels)
+        {
+            num_pixels = 0;
+            while (cdw--)
+            {
+                dw = *pdw++;
+                if (dw >> 24)
+                {
+                    pixels[num_pixels++] = (dw & 0xFFFFFF);
+                }
+            }
+
+            table = ii_palette_for_pixels(num_pixels, pixels, num_colors);
+
+            free(pixels);
+        }
+
+        if (hbm32bpp != hbm)
+            ii_destroy(hbm32bpp);
+    }
+
+    return table;
+}
+
+IMAIO_API void IIAPI 
+ii_palette_shrink(II_PALETTE *table, const int *pi_trans)
+{
+    int i;
+    for (i = table->num_colors - 1; i > 0; --i)
+    {
+        II_COLOR8 *pcolor1 = &table->colors[i];
+        II_COLOR8 *pcolor2 = &table->colors[i - 1];
+        if (pcolor1->value[0] == pcolor2->value[0] &&
+            pcolor1->value[1] == pcolor2->value[1] &&
+            pcolor1->value[2] == pcolor2->value[2])
+        {
+            if (pi_trans && i == *pi_trans)
+                break;
+            --table->num_colors;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+IMAIO_API II_PALETTE * IIAPI 
+ii_palette_for_anigif(II_ANIGIF *anigif, int32_t num_colors)
+{
+    II_HIMAGE hbm, hbmNew;
+    II_IMGINFO bm;
+    uint32_t *pdw;
+    uint32_t dw, cdw;
+    uint32_t *pixels, *all_pixels, *new_all_pixels;
+    int num_pixels, num_all_pixels;
+    II_PALETTE *table;
+    int i;
+
+    if (num_colors < 0 || 256 < num_colors)
+        num_colors = 256;
+
+    all_pixels = NULL;
+    num_all_pixels = 0;
+
+    assert(anigif->frames);
+    if (anigif->frames == NULL)
+        return NULL;
+
+    for (i = 0; i < anigif->num_frames; ++i)
+    {
+        hbm = anigif->frames[i].hbmScreen;
+        if (hbm == NULL)
+            continue;
+
+        if (!ii_get_info(hbm, &bm))
+            return NULL;
+
+        assert(bm.bmBitsPixel == 32);
+
+        /* get smaller one */
+        if (bm.bmWidth > 256)
+            bm.bmWidth = 256;
+        if (bm.bmHeight > 256)
+            bm.bmHeight = 256;
+        hbmNew = ii_stretched_32bpp(hbm, bm.bmWidth, bm.bmHeight);
+        if (hbmNew)
+        {
+            /* get pixels */
+            ii_get_info(hbmNew, &bm);
+            assert(bm.bmBitsPixel == 32);
+
+            pdw = (uint32_t *)bm.bmBits;
+            cdw = bm.bmWidth * bm.bmHeight;
+            num_pixels = 0;
+            pixels = (uint32_t *)calloc(sizeof(uint32_t), cdw);
+            if (pixels)
+            {
+                while (cdw--)
+                {
+                    dw = *pdw++;
+                    if (dw >> 24)
+                    {
+                        pixels[num_pixels++] = (dw & 0xFFFFFF);
+                    }
+                }
+            }
+            ii_destroy(hbmNew);
+
+            if (pixels == NULL)
+            {
+                free(all_pixels);
+                return NULL;
+            }
+
+            new_all_pixels =
+                (uint32_t *)realloc(all_pixels,
+                    (num_all_pixels + num_pixels) * sizeof(uint32_t));
+            if (new_all_pixels == NULL)
+            {
+                free(pixels);
+                free(all_pixels);
+                return NULL;
+            }
+            all_pixels = new_all_pixels;
+
+            memcpy(all_pixels + num_all_pixels, pixels,
+                       num_pixels * sizeof(uint32_t));
+            num_all_pixels += num_pixels;
+
+            free(pixels);
+        }
+    }
+
+    table = ii_palette_for_pixels(num_all_pixels, all_pixels, num_colors);
+    assert(table);
+    free(all_pixels);
+    return table;
+}
+
+/* the inverse color map of a palette */
+
+/* NOTE: The color space is divided into 32 * 32 * 32 cells. Each cell has
+ *       the list of the palette entries that can be the nearest to a color
+ *       in the cell. The lists are built on demand. */
+/* NOTE: Only the first num_search entries are searched. The entries after
+ *       them (e.g. the transparent entry of GIF) are for the image only. */
+#define II_PALETTE_INDEX_CELLS  (32 * 32 * 32)
+
+struct II_PALETTE_INDEX
+{
+    II_PALETTE  palette;
+    int         num_search;
+    int32_t     first[II_PALETTE_INDEX_CELLS];  /* -1 if not built yet */
+    uint16_t    count[II_PALETTE_INDEX_CELLS];
+    uint8_t *   candidates;
+    int         num_candidates;
+    int         max_candidates;
+};
+
+IMAIO_API II_PALETTE_INDEX * IIAPI
+ii_palette_index_create(const II_PALETTE *table)
+{
+    II_PALETTE_INDEX *index;
+
+    assert(table);
+    index = (II_PALETTE_INDEX *)calloc(1, sizeof(II_PALETTE_INDEX));
+    if (index)
+    {
+        index->palette = *table;
+        index->num_search = table->num_colors;
+        memset(index->first, 0xFF, sizeof(index->first));
+    }
+    return index;
+}
+
+IMAIO_API void IIAPI
+ii_palette_index_destroy(II_PALETTE_INDEX *index)
+{
+    if (index)
+    {
+        free(index->candidates);
+        free(index);
+    }
+}
+
+/* build the candidates of a cell */
+static bool
+ii_palette_index_build(II_PALETTE_INDEX *index, int cell)
+{
+    int32_t lo[3], hi[3], dmin[256], dmax, d0, d1, limit;
+    const II_COLOR8 *color;
+    uint8_t *candidates;
+    int i, k, n;
+
+    lo[0] = (cell & 0x1F) << 3;
+    lo[1] = ((cell >> 5) & 0x1F) << 3;
+    lo[2] = ((cell >> 10) & 0x1F) << 3;
+    for (k = 0; k < 3; ++k)
+        hi[k] = lo[k] + 7;
+
+    /* the entries farther than the nearest farthest entry are useless */
+    limit = 0x7FFFFFFF;
+    for (i = 0; i < index->num_search; ++i)
+    {
+        color = &index->palette.colors[i];
+        dmin[i] = dmax = 0;
+        for (k = 0; k < 3; ++k)
+        {
+            d0 = color->value[k] - lo[k];
+            d1 = color->value[k] - hi[k];
+            if (d0 < 0)
+                dmin[i] += d0 * d0;
+            else if (d1 > 0)
+                dmin[i] += d1 * d1;
+            dmax += max(d0 * d0, d1 * d1);
+        }
+        if (dmax < limit)
+            limit = dmax;
+    }
+
+    n = 0;
+    for (i = 0; i < index->num_search; ++i)
+    {
+        if (dmin[i] <= limit)
+            ++n;
+    }
+
+    if (index->num_candidates + n > index->max_candidates)
+    {
+        k = index->max_candidates * 2 + n + 4096;
+        candidates = (uint8_t *)realloc(index->candidates, k);
+        if (candidates == NULL)
+            return false;
+        index->candidates = candidates;
+        index->max_candidates = k;
+    }
+
+    /* NOTE: The candidates are in the order of the palette. */
+    candidates = index->candidates + index->num_candidates;
+    for (i = 0; i < index->num_search; ++i)
+    {
+        if (dmin[i] <= limit)
+            *candidates++ = (uint8_t)i;
+    }
+    index->first[cell] = index->num_candidates;
+    index->count[cell] = (uint16_t)n;
+    index->num_candidates += n;
+    return true;
+}
+
+IMAIO_API int IIAPI
+ii_palette_index_nearest(II_PALETTE_INDEX *index, const II_COLOR8 *pcolor)
+{
+    int i, i_near, cell, n;
+    int32_t norm, norm_near, k_value[3];
+    const II_COLOR8 *color;
+    const uint8_t *candidates;
+
+    assert(index);
+    if (index->num_search <= 1)
+        return 0;
+
+    cell = (pcolor->value[0] >> 3) | ((pcolor->value[1] >> 3) << 5) |
+           ((pcolor->value[2] >> 3) << 10);
+    if (index->first[cell] < 0 && !ii_palette_index_build(index, cell))
+    {
+        II_PALETTE table = index->palette;
+        table.num_colors = index->num_search;
+        return ii_color_nearest_index(&table, pcolor);
+    }
+
+    candidates = index->candidates + index->first[cell];
+    n = index->count[cell];
+    i_near = candidates[0];
+    norm_near = 255 * 255 * 3 + 1;
+    for (i = 0; i < n; ++i)
+    {
+        color = &index->palette.colors[candidates[i]];
+        k_value[0] = (int)color->value[0] - pcolor->value[0];
+        k_value[1] = (int)color->value[1] - pcolor->value[1];
+        k_value[2] = (int)color->value[2] - pcolor->value[2];
+        norm = k_value[0] * k_value[0] +
+               k_value[1] * k_value[1] +
+               k_value[2] * k_value[2];
+        if (norm < norm_near)
+        {
+            i_near = candidates[i];
+            norm_near = norm;
+            if (norm == 0)
+                break;
+        }
+    }
+    return i_near;
+}
+
+IMAIO_API II_HIMAGE IIAPI 
+ii_reduce_colors(
+    II_HIMAGE hbm,
+    const II_PALETTE *table,
+    const int *pi_trans)
+{
+    return ii_reduce_colors_ex(hbm, table, pi_trans, 0);
+}
+
+IMAIO_API II_HIMAGE IIAPI 
+ii_reduce_colors_ex(
+    II_HIMAGE hbm,
+    const II_PALETTE *table,
+    const int *pi_trans,
+    II_FLAGS flags)
+{
+    II_PALETTE_INDEX *index;
+    II_HIMAGE hbm8bpp;
+
+    assert(table);
+    index = ii_palette_index_create(table);
+    if (index == NULL)
+        return NULL;
+
+    hbm8bpp = ii_reduce_colors_by_index(hbm, index, pi_trans, flags);
+    ii_palette_index_destroy(index);
+    return hbm8bpp;
+}
+
+/* Floyd-Steinberg dithering in serpentine order */
+static bool
+ii_dither_floyd_steinberg(
+    const II_IMGINFO *bm, const II_PALETTE *table, II_IMGINFO *bm8bpp,
+    II_PALETTE_INDEX *pindex, const int *pi_trans)
+{
+    const II_COLOR8 *entry;
+    II_COLOR8 color;
+    uint32_t *row, dw;
+    int16_t *err0, *err1, *err;
+    int16_t *pe0, *pe1;
+    uint8_t *pb8bpp;
+    int x, y, k, dx, index, value, diff, width;
+    bool trans;
+
+    /* a row of pixels and two rows of errors (multiplied by 16) */
+    /* NOTE: The errors have a margin of one pixel on both sides. */
+    width = bm->bmWidth;
+    row = (uint32_t *)ii_alloc(width * sizeof(uint32_t) +
+                             2 * (width + 2) * 3 * sizeof(int16_t));
+    if (row == NULL)
+        return false;
+    err0 = (int16_t *)(row + width);
+    err1 = err0 + (width + 2) * 3;
+    memset(err0, 0, 2 * (width + 2) * 3 * sizeof(int16_t));
+    trans = (pi_trans && *pi_trans != -1);
+
+    for (y = 0; y < bm->bmHeight; ++y)
+    {
+        ii_read_row_32bpp(bm, table, y, row);
+        pb8bpp = (uint8_t *)bm8bpp->bmBits + y * bm8bpp->bmWidthBytes;
+
+        if (y & 1)
+        {
+            x = width - 1;
+            dx = -1;
+        }
+        else
+        {
+            x = 0;
+            dx = 1;
+        }
+        for (; 0 <= x && x < width; x += dx)
+        {
+            dw = row[x];
+            pe0 = &err0[(x + 1) * 3];
+            pe1 = &err1[(x + 1) * 3];
+            if ((dw >> 24) == 0 && trans)
+            {
+                pb8bpp[x] = (uint8_t)*pi_trans;
+                continue;
+            }
+
+            for (k = 0; k < 3; ++k)
+            {
+                /* NOTE: The bias keeps the shifted value positive. */
+                value = (int)((dw >> (k * 8)) & 0xFF) +
+                        ((pe0[k] + 8 + 0x10000) >> 4) - 0x1000;
+                color.value[k] = (uint8_t)(
+                    value < 0 ? 0 : (value > 255 ? 255 : value));
+            }
+            color.value[3] = 0xFF;
+
+            index = ii_palette_index_nearest(pindex, &color);
+            pb8bpp[x] = (uint8_t)index;
+            entry = &pindex->palette.colors[index];
+
+            for (k = 0; k < 3; ++k)
+            {
+                diff = (int)color.value[k] - (int)entry->value[k];
+                pe0[dx * 3 + k] += (int16_t)(diff * 7);
+                pe1[-dx * 3 + k] += (int16_t)(diff * 3);
+                pe1[k] += (int16_t)(diff * 5);
+                pe1[dx * 3 + k] += (int16_t)diff;
+            }
+        }
+
+        /* the next row */
+        err = err0;
+        err0 = err1;
+        err1 = err;
+        memset(err1, 0, (width + 2) * 3 * sizeof(int16_t));
+    }
+
+    ii_free(row);
+    return true;
+}
+
+/* the 8x8 Bayer matrix */
+static const uint8_t ii_bayer8x8[8][8] =
+{
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+/* a row of the ordered dithering */
+static void
+ii_dither_ordered_row(
+    const II_IMGINFO *bm, const II_PALETTE *table, II_IMGINFO *bm8bpp,
+    II_PALETTE_INDEX *pindex, const II_PALETTE_PLANES *planes,
+    const int *pi_trans, int spread, int y)
+{
+    const uint8_t *pb;
+    uint8_t *pb8bpp;
+    II_COLOR8 color;
+    uint32_t dw;
+    int x, k, value, offset;
+
+    pb = (const uint8_t *)bm->bmBits + y * bm->bmWidthBytes;
+    pb8bpp = (uint8_t *)bm8bpp->bmBits + y * bm8bpp->bmWidthBytes;
+    for (x = 0; x < bm->bmWidth; ++x)
+    {
+        dw = ii_read_pixel_32bpp(bm, table, pb, x);
+        if ((dw >> 24) == 0 && pi_trans && *pi_trans != -1)
+        {
+            pb8bpp[x] = (uint8_t)*pi_trans;
+            continue;
+        }
+
+        /* the threshold in -spread / 2 ... spread / 2 */
+        offset = (ii_bayer8x8[y & 7][x & 7] * 2 - 63) * spread / 128;
+        for (k = 0; k < 3; ++k)
+        {
+            value = (int)((dw >> (k * 8)) & 0xFF) + offset;
+            color.value[k] = (uint8_t)(
+                value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+        color.value[3] = 0xFF;
+
+        if (planes)
+            pb8bpp[x] = (uint8_t)ii_palette_planes_nearest(planes, &color);
+        else
+            pb8bpp[x] = (uint8_t)ii_palette_index_nearest(pindex, &color);
+    }
+}
+
+/* ordered dithering */
+/* NOTE: The rows are independent. Build with OpenMP to do them in
+ *       parallel. */
+static bool
+ii_dither_ordered(
+    const II_IMGINFO *bm, const II_PALETTE *table, II_IMGINFO *bm8bpp,
+    II_PALETTE_INDEX *pindex, const int *pi_trans)
+{
+    II_PALETTE_PLANES *planes = NULL;
+    int y, spread, num_colors;
+#ifdef _OPENMP
+    II_PALETTE search;
+#endif
+
+    /* the spread is the typical distance of the palette colors */
+    num_colors = pindex->num_search;
+    if (num_colors < 2)
+        num_colors = 2;
+    spread = (int)(256 / pow(num_colors, 1.0 / 3));
+
+#ifdef _OPENMP
+    /* NOTE: The index builds its cells lazily, so it is not thread-safe. */
+    planes = (II_PALETTE_PLANES *)ii_alloc(sizeof(II_PALETTE_PLANES));
+    if (planes == NULL)
+        return false;
+    search = pindex->palette;
+    search.num_colors = pindex->num_search;
+    ii_palette_planes_init(planes, &search);
+    #pragma omp parallel for schedule(static)
+#endif
+    for (y = 0; y < bm->bmHeight; ++y)
+    {
+        ii_dither_ordered_row(bm, table, bm8bpp, pindex, planes,
+                              pi_trans, spread, y);
+    }
+
+    ii_free(planes);
+    return true;
+}
+
+IMAIO_API II_HIMAGE IIAPI 
+ii_reduce_colors_by_index(
+    II_HIMAGE hbm,
+    II_PALETTE_INDEX *pindex,
+    const int *pi_trans,
+    II_FLAGS flags)
+{
+    II_IMGINFO bm, bm8bpp;
+    II_HIMAGE hbm8bpp, hbmSrc;
+    II_PALETTE *table;
+    bool ok;
+
+    assert(pindex);
+    if (!ii_get_info(hbm, &bm))
+        return NULL;
+
+    /* read the source directly if possible */
+    hbmSrc = hbm;
+    if (bm.bmBitsPixel != 1 && bm.bmBitsPixel != 4 &&
+        bm.bmBitsPixel != 8 && bm.bmBitsPixel != 24 &&
+        bm.bmBitsPixel != 32)
+    {
+        hbmSrc = ii_32bpp(hbm);
+        if (hbmSrc == NULL)
+            return NULL;
+        ii_get_info(hbmSrc, &bm);
+    }
+    table = NULL;
+    if (bm.bmBitsPixel <= 8)
+        table = ii_get_palette(hbmSrc);
+
+    hbm8bpp = ii_create(bm.bmWidth, bm.bmHeight, 8, &pindex->palette);
+    if (hbm8bpp)
+    {
+        ii_get_info(hbm8bpp, &bm8bpp);
+        if (flags & II_FLAG_ORDERED_DITHER)
+            ok = ii_dither_ordered(&bm, table, &bm8bpp, pindex, pi_trans);
+        else
+            ok = ii_dither_floyd_steinberg(&bm, table, &bm8bpp, pindex,
+                                           pi_trans);
+        if (!ok)
+        {
+            ii_destroy(hbm8bpp);
+            hbm8bpp = NULL;
+        }
+    }
+
+    if (table)
+        ii_palette_destroy(table);
+    if (hbmSrc != hbm)
+        ii_destroy(hbmSrc);
+    return hbm8bpp;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_alpha_channel_from_32bpp(II_HIMAGE hbm32bpp)
+{
+    II_IMGINFO bm, bm8bpp;
+    II_EXTRACT_ALPHA_ROW_PROC proc;
+    II_HIMAGE hbm8bpp;
+    const uint8_t *pbSrc;
+    uint8_t *pb;
+    int y;
+
+    if (!ii_get_info(hbm32bpp, &bm))
+        return NULL;
+
+    hbm8bpp = ii_create_8bpp_grayscale(bm.bmWidth, bm.bmHeight);
+    if (hbm8bpp)
+    {
+        ii_get_info(hbm8bpp, &bm8bpp);
+        pb = (uint8_t *)bm8bpp.bmBits;
+        if (bm.bmBitsPixel == 32)
+        {
+            proc = ii_extract_alpha_row;
+#ifdef II_USE_SSE2
+            if (ii_has_sse2())
+                proc = ii_extract_alpha_row_sse2;
+#endif
+#ifdef II_USE_AVX2
+            if (ii_has_avx2())
+                proc = ii_extract_alpha_row_avx2;
+#endif
+            pbSrc = (const uint8_t *)bm.bmBits;
+            for (y = 0; y < bm.bmHeight; ++y)
+            {
+                proc(pb, (const uint32_t *)pbSrc, 0, bm.bmWidth);
+                pbSrc += bm.bmWidthBytes;
+                pb += bm8bpp.bmWidthBytes;
+            }
+        }
+        else
+        {
+            memset(pb, 0xFF, bm8bpp.bmWidthBytes * bm8bpp.bmHeight);
+        }
+    }
+    return hbm8bpp;
+}
+
+/* store the alpha bytes to a row of BGRA pixels */
+typedef void (*II_APPLY_ALPHA_ROW_PROC)(uint32_t *pdw, const uint8_t *pb,
+                                        int ix, int cx, bool replace);
+
+static void
+ii_apply_alpha_row(uint32_t *pdw, const uint8_t *pb, int ix, int cx,
+                   bool replace)
+{
+    for (; ix < cx; ++ix)
+    {
+        if (replace)
+            pdw[ix] &= 0x00FFFFFF;
+        pdw[ix] |= (uint32_t)pb[ix] << 24;
+    }
+}
+
+#ifdef II_USE_SSE2
+    static void
+    ii_apply_alpha_row_sse2(uint32_t *pdw, const uint8_t *pb, int ix, int cx,
+                            bool replace)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i colors = _mm_set1_epi32(replace ? 0x00FFFFFF : -1);
+        __m128i a, lo, hi, v[4];
+        int i;
+
+        for (; ix + 16 <= cx; ix += 16)
+        {
+            /* the bytes to the tops of the dwords */
+            a = _mm_loadu_si128((const __m128i *)&pb[ix]);
+            lo = _mm_unpacklo_epi8(zero, a);
+            hi = _mm_unpackhi_epi8(zero, a);
+            v[0] = _mm_unpacklo_epi16(zero, lo);
+            v[1] = _mm_unpackhi_epi16(zero, lo);
+            v[2] = _mm_unpacklo_epi16(zero, hi);
+            v[3] = _mm_unpackhi_epi16(zero, hi);
+            for (i = 0; i < 4; ++i)
+            {
+                a = _mm_loadu_si128((const __m128i *)&pdw[ix + i * 4]);
+                a = _mm_or_si128(_mm_and_si128(a, colors), v[i]);
+                _mm_storeu_si128((__m128i *)&pdw[ix + i * 4], a);
+            }
+        }
+        ii_apply_alpha_row(pdw, pb, ix, cx, replace);
+    }
+#endif  /* def II_USE_SSE2 */
+
+/* store the mask to the alpha of the rectangle at (x, y) */
+static bool
+ii_merge_alpha_channel(II_HIMAGE hbm32bpp, int x, int y, II_HIMAGE hbmAlpha,
+                       bool replace)
+{
+    II_IMGINFO bm, bmAlpha;
+    II_HIMAGE hbmAlpha32bpp;
+    II_PALETTE *table;
+    II_CONVERT_ROW_PROC average;
+    II_APPLY_ALPHA_ROW_PROC apply;
+    uint8_t lut[256];
+    uint8_t *pbLine;
+    const uint8_t *pbSrc, *pb;
+    uint8_t *pbDest;
+    int i, ix, iy, xSrc, ySrc, cx, cy;
+    bool gray, ok;
+
+    if (!ii_get_info(hbm32bpp, &bm) || bm.bmBitsPixel != 32)
+        return false;
+    if (!ii_get_info(hbmAlpha, &bmAlpha))
+        return false;
+    if (bmAlpha.bmBits == NULL || !ii_is_readable_bpp(bmAlpha.bmBitsPixel))
+    {
+        /* NOTE: DDBs and other bpps (e.g. 16bpp) are read in 32bpp. */
+        ok = false;
+        hbmAlpha32bpp = ii_32bpp(hbmAlpha);
+        if (hbmAlpha32bpp && ii_get_info(hbmAlpha32bpp, &bmAlpha) &&
+            bmAlpha.bmBits)
+        {
+            ok = ii_merge_alpha_channel(hbm32bpp, x, y, hbmAlpha32bpp,
+                                        replace);
+        }
+        if (hbmAlpha32bpp)
+            ii_destroy(hbmAlpha32bpp);
+        return ok;
+    }
+    if (!ii_make_writable(hbm32bpp))
+        return false;
+    ii_get_info(hbm32bpp, &bm);
+
+    /* clipping */
+    xSrc = ySrc = 0;
+    cx = bmAlpha.bmWidth;
+    cy = bmAlpha.bmHeight;
+    if (x < 0) { xSrc -= x; cx += x; x = 0; }
+    if (y < 0) { ySrc -= y; cy += y; y = 0; }
+    cx = min(cx, bm.bmWidth - x);
+    cy = min(cy, bm.bmHeight - y);
+    if (cx <= 0 || cy <= 0)
+        return true;
+
+    /* NOTE: The indexes map to the averages of the colors. */
+    gray = false;
+    if (bmAlpha.bmBitsPixel <= 8)
+    {
+        memset(lut, 0xFF, sizeof(lut));
+        table = ii_get_palette(hbmAlpha);
+        gray = (table != NULL && table->num_colors == 256);
+        for (i = 0; table && i < table->num_colors && i < 256; ++i)
+        {
+            lut[i] = (uint8_t)((table->colors[i].value[0] +
+                                table->colors[i].value[1] +
+                                table->colors[i].value[2]) / 3);
+            gray = gray && (lut[i] == i);
+        }
+        ii_palette_destroy(table);
+    }
+
+    pbLine = (uint8_t *)ii_alloc(cx);
+    if (pbLine == NULL)
+        return false;
+
+    average = ii_convert_row_proc(bmAlpha.bmBitsPixel / 8, 1);
+    apply = ii_apply_alpha_row;
+#ifdef II_USE_SSE2
+    if (ii_has_sse2())
+        apply = ii_apply_alpha_row_sse2;
+#endif
+
+    for (iy = 0; iy < cy; ++iy)
+    {
+        pbSrc = (const uint8_t *)bmAlpha.bmBits +
+                (bmAlpha.bmHeight - 1 - (ySrc + iy)) * bmAlpha.bmWidthBytes;
+        pbDest = (uint8_t *)bm.bmBits +
+                 (bm.bmHeight - 1 - (y + iy)) * bm.bmWidthBytes;
+
+        pb = pbLine;
+        switch (bmAlpha.bmBitsPixel)
+        {
+        case 32:
+            average(pbLine, pbSrc + xSrc * 4, 0, cx, false);
+            break;
+        case 24:
+            average(pbLine, pbSrc + xSrc * 3, 0, cx, false);
+            break;
+        case 8:
+            if (gray)
+            {
+                pb = pbSrc + xSrc;
+                break;
+            }
+            for (ix = 0; ix < cx; ++ix)
+                pbLine[ix] = lut[pbSrc[xSrc + ix]];
+            break;
+        case 4:
+            for (ix = 0; ix < cx; ++ix)
+            {
+                i = xSrc + ix;
+                pbLine[ix] = lut[(pbSrc[i >> 1] >> ((i & 1) ? 0 : 4)) & 0x0F];
+            }
+            break;
+        case 1:
+            for (ix = 0; ix < cx; ++ix)
+            {
+                i = xSrc + ix;
+                pbLine[ix] = lut[(pbSrc[i >> 3] >> (7 - (i & 7))) & 0x01];
+            }
+            break;
+        default:
+            assert(0);
+            break;
+        }
+        apply((uint32_t *)pbDest + x, pb, 0, cx, replace);
+    }
+
+    ii_free(pbLine);
+    return true;
+}
+
+IMAIO_API void IIAPI
+ii_store_alpha_channel(II_HIMAGE hbmAlpha, II_HIMAGE hbm32bpp)
+{
+    assert(hbmAlpha);
+    assert(hbm32bpp);
+    ii_merge_alpha_channel(hbm32bpp, 0, 0, hbmAlpha, false);
+}
+
+IMAIO_API bool IIAPI
+ii_put_alpha_channel(II_HIMAGE hbm32bpp, int x, int y, II_HIMAGE hbmAlpha)
+{
+    assert(hbm32bpp);
+    assert(hbmAlpha);
+    return ii_merge_alpha_channel(hbm32bpp, x, y, hbmAlpha, true);
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_add_alpha_channel(II_HIMAGE hbmAlpha, II_HIMAGE hbm)
+{
+    II_HIMAGE hbm32bpp;
+
+    hbm32bpp = ii_32bpp(hbm);
+    if (hbm32bpp == NULL)
+        return NULL;
+
+    ii_store_alpha_channel(hbmAlpha, hbm32bpp);
+    return hbm32bpp;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_8bpp(II_HIMAGE hbm, int num_colors)
+{
+    return ii_8bpp_ex(hbm, num_colors, 0);
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_8bpp_ex(II_HIMAGE hbm, int num_colors, II_FLAGS flags)
+{
+    II_HIMAGE hbmNew = NULL;
+    II_PALETTE *table = ii_palette_optimized(hbm, num_colors);
+    if (table)
+    {
+        hbmNew = ii_reduce_colors_ex(hbm, table, NULL, flags);
+        free(table);
+    }
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_trans_8bpp(II_HIMAGE hbm, int *pi_trans)
+{
+    II_HIMAGE hbm8bpp, hbm32bpp;
+    hbm32bpp = ii_32bpp(hbm);
+    hbm8bpp = ii_trans_8bpp_from_32bpp(hbm32bpp, pi_trans);
+    ii_destroy(hbm32bpp);
+    return hbm8bpp;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_trans_8bpp_from_32bpp(II_HIMAGE hbm32bpp, int *pi_trans)
+{
+    II_PALETTE *table;
+    II_IMGINFO bm32bpp, bm8bpp;
+    uint8_t *pb;
+    uint32_t *pdw;
+    uint32_t dw;
+    int x, y;
+    II_HIMAGE hbm8bpp = NULL;
+
+    if (pi_trans)
+        table = ii_palette_optimized(hbm32bpp, 255);
+    else
+        table = ii_palette_optimized(hbm32bpp, 256);
+
+    if (table)
+    {
+        if (pi_trans)
+        {
+            *pi_trans = table->num_colors;
+            table->num_colors++;
+        }
+        hbm8bpp = ii_reduce_colors(hbm32bpp, table, pi_trans);
+        free(table);
+        if (hbm8bpp && pi_trans)
+        {
+            ii_get_info(hbm8bpp, &bm8bpp);
+            pb = (uint8_t *)bm8bpp.bmBits;
+            ii_get_info(hbm32bpp, &bm32bpp);
+            pdw = (uint32_t *)bm32bpp.bmBits;
+            for (y = 0; y < bm32bpp.bmHeight; ++y)
+            {
+                for (x = 0; x < bm32bpp.bmWidth; ++x)
+                {
+                    dw = *pdw++;
+                    if ((dw >> 24) == 0)
+                    {
+                        pb[x + y * bm8bpp.bmWidthBytes] = (uint8_t)*pi_trans;
+                    }
+                }
+            }
+        }
+    }
+    return hbm8bpp;
+}
+
+IMAIO_API int IIAPI
+ii_color_nearest_index(const II_PALETTE *table, const II_COLOR8 *pcolor)
+{
+    int i, i_near;
+    int32_t norm, norm_near, i_value[3], k_value[3];
+#ifdef II_USE_SSE2
+    II_PALETTE_PLANES planes;
+#endif
+
+    assert(table);
+    if (table == NULL)
+        return 0;
+
+#ifdef II_USE_SSE2
+    if (ii_has_sse2() && table->num_colors > 16)
+    {
+        ii_palette_planes_init(&planes, table);
+        return ii_palette_planes_nearest(&planes, pcolor);
+    }
+#endif
+
+    i_value[0] = pcolor->value[0];
+    i_value[1] = pcolor->value[1];
+    i_value[2] = pcolor->value[2];
+
+    i_near = 0;
+    norm_near = 255 * 255 * 3 + 1;
+    for (i = 0; i < table->num_colors; ++i)
+    {
+        k_value[0] = (int)table->colors[i].value[0] - i_value[0];
+        k_value[1] = (int)table->colors[i].value[1] - i_value[1];
+        k_value[2] = (int)table->colors[i].value[2] - i_value[2];
+        norm = k_value[0] * k_value[0] +
+               k_value[1] * k_value[1] +
+               k_value[2] * k_value[2];
+        if (norm < norm_near)
+        {
+            i_near = i;
+            norm_near = norm;
+            if (norm == 0)
+                break;
+        }
+    }
+
+    assert(0 <= i_near && i_near < table->num_colors);
+    return i_near;
+}
+
+IMAIO_API void IIAPI
+ii_palette_planes_init(II_PALETTE_PLANES *planes, const II_PALETTE *table)
+{
+    int i, n;
+
+    assert(planes);
+    assert(table);
+    n = table->num_colors;
+    i = 0;
+#ifdef II_USE_SSE2
+    {
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        __m128i c0, c1;
+        for (; ii_has_sse2() && i + 8 <= n; i += 8)
+        {
+            c0 = _mm_loadu_si128((const __m128i *)&table->colors[i]);
+            c1 = _mm_loadu_si128((const __m128i *)&table->colors[i + 4]);
+            _mm_storeu_si128((__m128i *)&planes->b[i], _mm_packs_epi32(
+                _mm_and_si128(c0, mask), _mm_and_si128(c1, mask)));
+            _mm_storeu_si128((__m128i *)&planes->g[i], _mm_packs_epi32(
+                _mm_and_si128(_mm_srli_epi32(c0, 8), mask),
+                _mm_and_si128(_mm_srli_epi32(c1, 8), mask)));
+            _mm_storeu_si128((__m128i *)&planes->r[i], _mm_packs_epi32(
+                _mm_and_si128(_mm_srli_epi32(c0, 16), mask),
+                _mm_and_si128(_mm_srli_epi32(c1, 16), mask)));
+        }
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        planes->b[i] = table->colors[i].value[0];
+        planes->g[i] = table->colors[i].value[1];
+        planes->r[i] = table->colors[i].value[2];
+    }
+    /* NOTE: A copy of the first color never wins over the first color. */
+    for (; i < ((n + 15) & ~15); ++i)
+    {
+        planes->b[i] = planes->b[0];
+        planes->g[i] = planes->g[0];
+        planes->r[i] = planes->r[0];
+    }
+    planes->num_colors = n;
+}
+
+/* NOTE: The SIMD code finds the minimum of (distance << 8) | index, that is,
+ *       the first nearest color as ii_color_nearest_index does. */
+
+#ifdef II_USE_SSE2
+    static int
+    ii_palette_planes_nearest_sse2(const II_PALETTE_PLANES *planes,
+                                   const II_COLOR8 *pcolor)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i four = _mm_set1_epi32(4);
+        const __m128i vb = _mm_set1_epi16(pcolor->value[0]);
+        const __m128i vg = _mm_set1_epi16(pcolor->value[1]);
+        const __m128i vr = _mm_set1_epi16(pcolor->value[2]);
+        __m128i db, dg, dr, x, y, key, mask, best, index;
+        int i;
+
+        best = _mm_set1_epi32(0x7FFFFFFF);
+        index = _mm_setr_epi32(0, 1, 2, 3);
+        for (i = 0; i < planes->num_colors; i += 8)
+        {
+            db = _mm_sub_epi16(
+                _mm_loadu_si128((const __m128i *)&planes->b[i]), vb);
+            dg = _mm_sub_epi16(
+                _mm_loadu_si128((const __m128i *)&planes->g[i]), vg);
+            dr = _mm_sub_epi16(
+                _mm_loadu_si128((const __m128i *)&planes->r[i]), vr);
+
+            /* colors i to i + 3 */
+            x = _mm_unpacklo_epi16(db, dg);
+            y = _mm_unpacklo_epi16(dr, zero);
+            key = _mm_add_epi32(_mm_madd_epi16(x, x), _mm_madd_epi16(y, y));
+            key = _mm_or_si128(_mm_slli_epi32(key, 8), index);
+            mask = _mm_cmpgt_epi32(best, key);
+            best = _mm_or_si128(_mm_and_si128(mask, key),
+                                _mm_andnot_si128(mask, best));
+            index = _mm_add_epi32(index, four);
+
+            /* colors i + 4 to i + 7 */
+            x = _mm_unpackhi_epi16(db, dg);
+            y = _mm_unpackhi_epi16(dr, zero);
+            key = _mm_add_epi32(_mm_madd_epi16(x, x), _mm_madd_epi16(y, y));
+            key = _mm_or_si128(_mm_slli_epi32(key, 8), index);
+            mask = _mm_cmpgt_epi32(best, key);
+            best = _mm_or_si128(_mm_and_si128(mask, key),
+                                _mm_andnot_si128(mask, best));
+            index = _mm_add_epi32(index, four);
+        }
+
+        /* the minimum of four */
+        key = _mm_shuffle_epi32(best, _MM_SHUFFLE(1, 0, 3, 2));
+        mask = _mm_cmpgt_epi32(best, key);
+        best = _mm_or_si128(_mm_and_si128(mask, key),
+                            _mm_andnot_si128(mask, best));
+        key = _mm_shuffle_epi32(best, _MM_SHUFFLE(2, 3, 0, 1));
+        mask = _mm_cmpgt_epi32(best, key);
+        best = _mm_or_si128(_mm_and_si128(mask, key),
+                            _mm_andnot_si128(mask, best));
+        return _mm_cvtsi128_si32(best) & 0xFF;
+    }
+#endif  /* def II_USE_SSE2 */
+
+#ifdef II_USE_AVX2
+    static II_TARGET_AVX2 int
+    ii_palette_planes_nearest_avx2(const II_PALETTE_PLANES *planes,
+                                   const II_COLOR8 *pcolor)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i sixteen = _mm256_set1_epi32(16);
+        const __m256i vb = _mm256_set1_epi16(pcolor->value[0]);
+        const __m256i vg = _mm256_set1_epi16(pcolor->value[1]);
+        const __m256i vr = _mm256_set1_epi16(pcolor->value[2]);
+        __m256i db, dg, dr, x, y, key, best, index_lo, index_hi;
+        __m128i best4;
+        int i;
+
+        /* unpack works per 128-bit lane */
+        best = _mm256_set1_epi32(0x7FFFFFFF);
+        index_lo = _mm256_setr_epi32(0, 1, 2, 3, 8, 9, 10, 11);
+        index_hi = _mm256_setr_epi32(4, 5, 6, 7, 12, 13, 14, 15);
+        for (i = 0; i < planes->num_colors; i += 16)
+        {
+            db = _mm256_sub_epi16(
+                _mm256_loadu_si256((const __m256i *)&planes->b[i]), vb);
+            dg = _mm256_sub_epi16(
+                _mm256_loadu_si256((const __m256i *)&planes->g[i]), vg);
+            dr = _mm256_sub_epi16(
+                _mm256_loadu_si256((const __m256i *)&planes->r[i]), vr);
+
+            x = _mm256_unpacklo_epi16(db, dg);
+            y = _mm256_unpacklo_epi16(dr, zero);
+            key = _mm256_add_epi32(_mm256_madd_epi16(x, x),
+                                   _mm256_madd_epi16(y, y));
+            key = _mm256_or_si256(_mm256_slli_epi32(key, 8), index_lo);
+            best = _mm256_min_epi32(best, key);
+
+            x = _mm256_unpackhi_epi16(db, dg);
+            y = _mm256_unpackhi_epi16(dr, zero);
+            key = _mm256_add_epi32(_mm256_madd_epi16(x, x),
+                                   _mm256_madd_epi16(y, y));
+            key = _mm256_or_si256(_mm256_slli_epi32(key, 8), index_hi);
+            best = _mm256_min_epi32(best, key);
+
+            index_lo = _mm256_add_epi32(index_lo, sixteen);
+            index_hi = _mm256_add_epi32(index_hi, sixteen);
+        }
+
+        /* the minimum of eight */
+        best4 = _mm_min_epi32(_mm256_castsi256_si128(best),
+                              _mm256_extracti128_si256(best, 1));
+        best4 = _mm_min_epi32(best4,
+            _mm_shuffle_epi32(best4, _MM_SHUFFLE(1, 0, 3, 2)));
+        best4 = _mm_min_epi32(best4,
+            _mm_shuffle_epi32(best4, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(best4) & 0xFF;
+    }
+#endif  /* def II_USE_AVX2 */
+
+IMAIO_API int IIAPI
+ii_palette_planes_nearest(const II_PALETTE_PLANES *planes,
+                          const II_COLOR8 *pcolor)
+{
+    int i, i_near;
+    int32_t norm, norm_near, k_value[3];
+
+    assert(planes);
+    if (planes->num_colors <= 0)
+        return 0;
+
+#ifdef II_USE_AVX2
+    if (ii_has_avx2())
+        return ii_palette_planes_nearest_avx2(planes, pcolor);
+#endif
+#ifdef II_USE_SSE2
+    if (ii_has_sse2())
+        return ii_palette_planes_nearest_sse2(planes, pcolor);
+#endif
+    i_near = 0;
+    norm_near = 255 * 255 * 3 + 1;
+    for (i = 0; i < planes->num_colors; ++i)
+    {
+        k_value[0] = planes->b[i] - pcolor->value[0];
+        k_value[1] = planes->g[i] - pcolor->value[1];
+        k_value[2] = planes->r[i] - pcolor->value[2];
+        norm = k_value[0] * k_value[0] +
+               k_value[1] * k_value[1] +
+               k_value[2] * k_value[2];
+        if (norm < norm_near)
+        {
+            i_near = i;
+            norm_near = norm;
+            if (norm == 0)
+                break;
+        }
+    }
+    return i_near;
+}
+
+/*****************************************************************************/
+
+#ifdef _WIN32
+    #define II_JPEG_BOOLEAN ii_jpeg_boolean
+#else
+    #define II_JPEG_BOOLEAN boolean
+#endif
+
+/* NOTE: II_JPG_ERROR makes libjpeg errors longjmp instead of exit. */
+typedef struct II_JPG_ERROR
+{
+    struct jpeg_error_mgr   pub;
+    jmp_buf                 jmp;
+} II_JPG_ERROR;
+
+static void IICAPI
+ii_jpg_error_exit(j_common_ptr cinfo)
+{
+    longjmp(((II_JPG_ERROR *)cinfo->err)->jmp, 1);
+}
+
+#define II_JPG_BUFFER_SIZE  4096
+
+/* the source manager reading from II_STREAM */
+typedef struct II_JPG_SOURCE
+{
+    struct jpeg_source_mgr  pub;
+    II_STREAM *             stream;
+    JOCTET                  buffer[II_JPG_BUFFER_SIZE];
+} II_JPG_SOURCE;
+
+static void IICAPI
+ii_jpg_init_source(j_decompress_ptr cinfo)
+{
+    (void)cinfo;
+}
+
+static II_JPEG_BOOLEAN IICAPI
+ii_jpg_fill_input_buffer(j_decompress_ptr cinfo)
+{
+    static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+    II_JPG_SOURCE *src = (II_JPG_SOURCE *)cinfo->src;
+    size_t cb = 0;
+
+    if (src->stream)
+        cb = src->stream->read_proc(src->stream, src->buffer,
+                                    II_JPG_BUFFER_SIZE);
+    if (cb == 0)
+    {
+        /* NOTE: A truncated file ends with a fake EOI as jdatasrc.c does. */
+        WARNMS(cinfo, JWRN_JPEG_EOF);
+        src->pub.next_input_byte = eoi;
+        src->pub.bytes_in_buffer = 2;
+        return TRUE;
+    }
+    src->pub.next_input_byte = src->buffer;
+    src->pub.bytes_in_buffer = cb;
+    return TRUE;
+}
+
+static void IICAPI
+ii_jpg_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+    II_JPG_SOURCE *src = (II_JPG_SOURCE *)cinfo->src;
+
+    if (num_bytes <= 0)
+        return;
+    while (num_bytes > (long)src->pub.bytes_in_buffer)
+    {
+        num_bytes -= (long)src->pub.bytes_in_buffer;
+        ii_jpg_fill_input_buffer(cinfo);
+    }
+    src->pub.next_input_byte += num_bytes;
+    src->pub.bytes_in_buffer -= num_bytes;
+}
+
+static void IICAPI
+ii_jpg_term_source(j_decompress_ptr cinfo)
+{
+    (void)cinfo;
+}
+
+/* NOTE: A mapped stream is decoded in place without the buffer. */
+static void
+ii_jpg_stream_src(j_decompress_ptr cinfo, II_JPG_SOURCE *src,
+                  II_STREAM *stream)
+{
+    const void *pv = NULL;
+    size_t cb = 0;
+
+    src->pub.init_source = ii_jpg_init_source;
+    src->pub.fill_input_buffer = ii_jpg_fill_input_buffer;
+    src->pub.skip_input_data = ii_jpg_skip_input_data;
+    src->pub.resync_to_restart = jpeg_resync_to_restart;
+    src->pub.term_source = ii_jpg_term_source;
+    src->stream = stream;
+    if (stream->map_proc)
+        pv = stream->map_proc(stream, &cb);
+    if (pv)
+    {
+        src->pub.next_input_byte = (const JOCTET *)pv;
+        src->pub.bytes_in_buffer = cb;
+        src->stream = NULL;
+    }
+    else
+    {
+        src->pub.next_input_byte = NULL;
+        src->pub.bytes_in_buffer = 0;
+    }
+    cinfo->src = &src->pub;
+}
+
+/* the destination manager writing to II_STREAM */
+typedef struct II_JPG_DEST
+{
+    struct jpeg_destination_mgr pub;
+    II_STREAM *                 stream;
+    JOCTET                      buffer[II_JPG_BUFFER_SIZE];
+} II_JPG_DEST;
+
+static void IICAPI
+ii_jpg_init_destination(j_compress_ptr cinfo)
+{
+    II_JPG_DEST *dest = (II_JPG_DEST *)cinfo->dest;
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = II_JPG_BUFFER_SIZE;
+}
+
+static II_JPEG_BOOLEAN IICAPI
+ii_jpg_empty_output_buffer(j_compress_ptr cinfo)
+{
+    II_JPG_DEST *dest = (II_JPG_DEST *)cinfo->dest;
+    if (dest->stream->write_proc(dest->stream, dest->buffer,
+                                 II_JPG_BUFFER_SIZE) != II_JPG_BUFFER_SIZE)
+    {
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+    }
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = II_JPG_BUFFER_SIZE;
+    return TRUE;
+}
+
+static void IICAPI
+ii_jpg_term_destination(j_compress_ptr cinfo)
+{
+    II_JPG_DEST *dest = (II_JPG_DEST *)cinfo->dest;
+    size_t cb = II_JPG_BUFFER_SIZE - dest->pub.free_in_buffer;
+    if (cb && dest->stream->write_proc(dest->stream, dest->buffer, cb) != cb)
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+}
+
+static void
+ii_jpg_stream_dest(j_compress_ptr cinfo, II_JPG_DEST *dest, II_STREAM *stream)
+{
+    dest->pub.init_destination = ii_jpg_init_destination;
+    dest->pub.empty_output_buffer = ii_jpg_empty_output_buffer;
+    dest->pub.term_destination = ii_jpg_term_destination;
+    dest->stream = stream;
+    cinfo->dest = &dest->pub;
+}
+
+static float
+ii_jpg_get_dpi(j_decompress_ptr decomp)
+{
+    switch (decomp->density_unit)
+    {
+    case 1: /* dots/inch */
+        return decomp->X_density;
+
+    case 2: /* dots/cm */
+        return (float)(decomp->X_density * 2.54);
+
+    default:
+        return 0.0;
+    }
+}
+
+/* NOTE: Stores a gray or RGB scanline into a 24bpp DIB row. */
+static bool
+ii_jpg_store_row(uint8_t *pb, JSAMPROW src, int width, int components)
+{
+    if (components == 1)
+        return ii_convert_pixels(II_PIXEL_FORMAT_GRAY8, src, 0,
+                                 II_PIXEL_FORMAT_BGR24, pb, 0, width, 1);
+    if (components == 3)
+        return ii_convert_pixels(II_PIXEL_FORMAT_RGB24, src, 0,
+                                 II_PIXEL_FORMAT_BGR24, pb, 0, width, 1);
+    return false;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_jpg_load_stream(II_STREAM *stream, float *dpi)
+{
+    struct jpeg_decompress_struct decomp;
+    II_JPG_ERROR jerror;
+    II_JPG_SOURCE src;
+    II_IMGINFO bm;
+    uint8_t *pb;
+    II_HIMAGE volatile hbm = NULL;
+    JSAMPARRAY buffer;
+
+    assert(stream);
+    if (stream == NULL)
+        return NULL;
+
+    memset(&decomp, 0, sizeof(decomp));
+    decomp.err = jpeg_std_error(&jerror.pub);
+    jerror.pub.error_exit = ii_jpg_error_exit;
+    if (setjmp(jerror.jmp))
+    {
+        jpeg_destroy_decompress(&decomp);
+        if (hbm)
+            ii_destroy(hbm);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&decomp);
+    ii_jpg_stream_src(&decomp, &src, stream);
+
+    jpeg_read_header(&decomp, true);
+    jpeg_start_decompress(&decomp);
+
+    if (dpi)
+        *dpi = ii_jpg_get_dpi(&decomp);
+
+    buffer = (*decomp.mem->alloc_sarray)((j_common_ptr)&decomp, JPOOL_IMAGE,
+        decomp.output_width * decomp.out_color_components, 1);
+
+    hbm = ii_create_24bpp(decomp.output_width, decomp.output_height);
+    if (hbm == NULL)
+    {
+        jpeg_destroy_decompress(&decomp);
+        return NULL;
+    }
+    ii_get_info(hbm, &bm);
+
+    pb = (uint8_t *)bm.bmBits + bm.bmWidthBytes * bm.bmHeight;
+    while (decomp.output_scanline < decomp.output_height)
+    {
+        pb -= bm.bmWidthBytes;
+        jpeg_read_scanlines(&decomp, buffer, 1);
+
+        if (!ii_jpg_store_row(pb, buffer[0], decomp.output_width,
+                              decomp.out_color_components))
+        {
+            jpeg_destroy_decompress(&decomp);
+            ii_destroy(hbm);
+            return NULL;
+        }
+    }
+
+    jpeg_finish_decompress(&decomp);
+    jpeg_destroy_decompress(&decomp);
+
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_jpg_load_common(FILE *fp, float *dpi)
+{
+    II_STREAM stream;
+    II_HIMAGE hbm;
+
+    assert(fp);
+    if (fp == NULL)
+        return NULL;
+
+    ii_stream_init_file(&stream, fp);
+    hbm = ii_jpg_load_stream(&stream, dpi);
+    fclose(fp);
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_jpg_load_mem(II_LPCVOID pv, uint32_t cb, float *dpi)
+{
+    II_STREAM stream;
+    II_MEMORY memory;
+
+    memory.m_pb = (const uint8_t *)pv;
+    memory.m_i = 0;
+    memory.m_size = cb;
+
+    ii_stream_init_mem(&stream, &memory);
+    return ii_jpg_load_stream(&stream, dpi);
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_jpg_load_a(II_CSTR pszFileName, float *dpi)
+{
+    FILE *fp;
+    fp = fopen(pszFileName, "rb");
+    if (fp)
+        return ii_jpg_load_common(fp, dpi);
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_jpg_load_w(II_CWSTR pszFileName, float *dpi)
+{
+    FILE *fp;
+    fp = ii_wfopen(pszFileName, L"rb");
+    if (fp)
+        return ii_jpg_load_common(fp, dpi);
+    return NULL;
+}
+
+static bool
+ii_jpg_save_view_stream(II_STREAM *stream, const II_VIEW *view,
+                        int quality, bool progression, float dpi)
+{
+    const II_IMGINFO *bm;
+    struct jpeg_compress_struct comp;
+    II_JPG_ERROR jerror;
+    II_JPG_DEST dest;
+    JSAMPLE * image_buffer;
+    II_PALETTE *table = NULL;
+    uint32_t *line = NULL;
+    bool f;
+
+    assert(view);
+    if (!ii_is_readable_bpp(view->info.bmBitsPixel))
+    {
+        II_VIEW view32;
+        II_HIMAGE hbm32bpp = ii_view_32bpp(&view32, view);
+        if (hbm32bpp == NULL)
+            return false;
+        f = ii_jpg_save_view_stream(stream, &view32, quality, progression,
+                                    dpi);
+        ii_destroy(hbm32bpp);
+        return f;
+    }
+    bm = &view->info;
+
+    /* NOTE: The rows other than 24bpp are read as 32bpp. */
+    if (bm->bmBitsPixel != 24 && bm->bmBitsPixel != 32)
+    {
+        table = ii_get_palette(view->hbm);
+        line = (uint32_t *)ii_alloc(bm->bmWidth * sizeof(uint32_t));
+    }
+    image_buffer = (JSAMPLE *)ii_alloc(bm->bmWidth * 3);
+
+    memset(&comp, 0, sizeof(comp));
+    comp.err = jpeg_std_error(&jerror.pub);
+    jerror.pub.error_exit = ii_jpg_error_exit;
+    if (image_buffer == NULL || (line == NULL && bm->bmBitsPixel != 24 &&
+                                 bm->bmBitsPixel != 32))
+    {
+        f = false;
+    }
+    else if (setjmp(jerror.jmp))
+    {
+        jpeg_destroy_compress(&comp);
+        f = false;
+    }
+    else
+    {
+        jpeg_create_compress(&comp);
+        ii_jpg_stream_dest(&comp, &dest, stream);
+
+        comp.image_width  = bm->bmWidth;
+        comp.image_height = bm->bmHeight;
+        comp.input_components = 3;
+        comp.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&comp);
+        if (dpi != 0.0)
+        {
+            comp.density_unit = 1; /* dots/inch */
+            comp.X_density = (UINT16)(dpi + 0.5);
+            comp.Y_density = (UINT16)(dpi + 0.5);
+        }
+        jpeg_set_quality(&comp, quality, true);
+        if (progression)
+            jpeg_simple_progression(&comp);
+
+        jpeg_start_compress(&comp, true);
+        {
+            int y, step;
+            const uint8_t *src;
+            for (y = 0; y < bm->bmHeight; y++)
+            {
+                src = (const uint8_t *)bm->bmBits +
+                      (bm->bmHeight - y - 1) * bm->bmWidthBytes;
+                step = (bm->bmBitsPixel == 24 ? 3 : 4);
+                if (line)
+                {
+                    ii_read_row_32bpp(bm, table, bm->bmHeight - y - 1, line);
+                    src = (const uint8_t *)line;
+                }
+                ii_convert_pixels(step == 3 ? II_PIXEL_FORMAT_BGR24 :
+                                              II_PIXEL_FORMAT_BGRA32,
+                                  src, 0, II_PIXEL_FORMAT_RGB24,
+                                  image_buffer, 0, bm->bmWidth, 1);
+                jpeg_write_scanlines(&comp, &image_buffer, 1);
+            }
+        }
+        jpeg_finish_compress(&comp);
+        jpeg_destroy_compress(&comp);
+        f = true;
+    }
+
+    ii_free(image_buffer);
+    ii_free(line);
+    ii_palette_destroy(table);
+    return f;
+}
+
+IMAIO_API bool IIAPI
+ii_jpg_save_view_common(FILE *fp, const II_VIEW *view,
+                        int quality, bool progression, float dpi)
+{
+    II_STREAM stream;
+    bool f;
+
+    if (fp == NULL)
+        return false;
+
+    ii_stream_init_file(&stream, fp);
+    f = ii_jpg_save_view_stream(&stream, view, quality, progression, dpi);
+    if (fclose(fp) != 0)
+        f = false;
+    return f;
+}
+
+IMAIO_API bool IIAPI
+ii_jpg_save_stream(II_STREAM *stream, II_HIMAGE hbm,
+                   int quality, bool progression, float dpi)
+{
+    II_VIEW view;
+
+    assert(stream);
+    if (!ii_view_create(&view, hbm))
+        return false;
+    return ii_jpg_save_view_stream(stream, &view, quality, progression, dpi);
+}
+
+IMAIO_API bool IIAPI
+ii_jpg_save_common(FILE *fp, II_HIMAGE hbm,
+                   int quality, bool progression, float dpi)
+{
+    II_VIEW view;
+
+    if (fp == NULL)
+        return false;
+
+    if (!ii_view_create(&view, hbm))
+    {
+        fclose(fp);
+        return false;
+    }
+    return ii_jpg_save_view_common(fp, &view, quality, progression, dpi);
+}
+
+IMAIO_API bool IIAPI
+ii_jpg_save_a(II_CSTR pszFileName, II_HIMAGE hbm,
+              int quality, bool progression, float dpi)
+{
+    FILE *fp;
+    fp = fopen(pszFileName, "wb");
+    if (fp)
+    {
+        if (ii_jpg_save_common(fp, hbm, quality, progression, dpi))
+            return true;
+        remove(pszFileName);
+    }
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_jpg_save_w(II_CWSTR pszFileName, II_HIMAGE hbm,
+              int quality, bool progression, float dpi)
+{
+    FILE *fp;
+    fp = ii_wfopen(pszFileName, L"wb");
+    if (fp)
+    {
+        if (ii_jpg_save_common(fp, hbm, quality, progression, dpi))
+            return true;
+        ii_wremove(pszFileName);
+    }
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_jpg_save_view_a(II_CSTR pszFileName, const II_VIEW *view,
+                   int quality, bool progression, float dpi)
+{
+    FILE *fp;
+    fp = fopen(pszFileName, "wb");
+    if (fp)
+    {
+        if (ii_jpg_save_view_common(fp, view, quality, progression, dpi))
+            return true;
+        remove(pszFileName);
+    }
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_jpg_save_view_w(II_CWSTR pszFileName, const II_VIEW *view,
+                   int quality, bool progression, float dpi)
+{
+    FILE *fp;
+    fp = ii_wfopen(pszFileName, L"wb");
+    if (fp)
+    {
+        if (ii_jpg_save_view_common(fp, view, quality, progression, dpi))
+            return true;
+        ii_wremove(pszFileName);
+    }
+    return false;
+}
+
+/*****************************************************************************/
+
+IMAIO_API void IIAPI
+ii_gif_uninterlace(GifByteType *bits, int width, int height)
+{
+    int i, j, k;
+    GifByteType *new_bits = malloc(width * height);
+    if (new_bits == NULL)
+        return;
+    k = 0;
+    for (i = 0; i < 4; i++)
+    {
+        static int InterlacedOffset[] = { 0, 4, 2, 1 };
+        static int InterlacedJumps[] = { 8, 8, 4, 2 };
+        for (j = InterlacedOffset[i]; j < height; j += InterlacedJumps[i])
+        {
+            memcpy(&new_bits[j * width], &bits[k * width], width);
+        }
+    }
+    memcpy(bits, new_bits, width * height);
+    free(new_bits);
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_gif_load_8bpp_common(GifFileType *gif, int *pi_trans/* = NULL*/)
+{
+    GifRowType *ScreenBuffer;
+    int i, j, Size;
+    int top, left, Width, Height;
+    GifRecordType RecordType;
+    ColorMapObject *ColorMap;
+    II_PALETTE table;
+    II_IMGINFO bm;
+    uint8_t *pbBits;
+    II_HIMAGE hbm;
+    int width, height;
+
+    if (pi_trans)
+        *pi_trans = -1;
+
+    ScreenBuffer = (GifRowType *)calloc(gif->SHeight, sizeof(GifRowType));
+    if (ScreenBuffer == NULL)
+    {
+        DGifCloseFile(gif, NULL);
+        return NULL;
+    }
+
+    Size = gif->SWidth * sizeof(GifPixelType);
+    for (i = 0; i < gif->SHeight; i++)
+    {
+        ScreenBuffer[i] = (GifRowType) malloc(Size);
+        for (j = 0; j < gif->SWidth; j++)
+            ScreenBuffer[i][j] = gif->SBackGroundColor;
+    }
+
+    do
+    {
+        DGifGetRecordType(gif, &RecordType);
+        switch (RecordType)
+        {
+        case IMAGE_DESC_RECORD_TYPE:
+            DGifGetImageDesc(gif);
+
+            top = gif->Image.Top;
+            left = gif->Image.Left;
+            Width = gif->Image.Width;
+            Height = gif->Image.Height;
+
+            if (gif->Image.Interlace)
+            {
+                for (i = 0; i < 4; i++)
+                {
+                    static int InterlacedOffset[] = { 0, 4, 2, 1 };
+                    static int InterlacedJumps[] = { 8, 8, 4, 2 };
+                    for (j = top + InterlacedOffset[i]; j < top + Height;
+                         j += InterlacedJumps[i])
+                    {
+                        DGifGetLine(gif, &ScreenBuffer[j][left], Width);
+                    }
+                }
+            }
+            else
+            {
+                j = top;
+                for (i = 0; i < Height; i++)
+                {
+                    DGifGetLine(gif, &ScreenBuffer[j++][left], Width);
+                }
+            }
+            goto hell;
+
+        case EXTENSION_RECORD_TYPE:
+            {
+                GifByteType *Extension;
+                int ExtCode;
+                DGifGetExtension(gif, &ExtCode, &Extension);
+                while (Extension != NULL)
+                {
+                    if (ExtCode == GRAPHICS_EXT_FUNC_CODE)
+                    {
+                        /* WORD Delay = Extension[2] | (Extension[3] << 8); */
+                        if (Extension[1] & 1)
+                        {
+                            if (pi_trans)
+                                *pi_trans = Extension[4];
+                        }
+                    }
+                    DGifGetExtensionNext(gif, &Extension);
+                }
+            }
+            break;
+
+        default:
+            break;
+        }
+    } while (RecordType != TERMINATE_RECORD_TYPE);
+
+hell:
+    if (gif->Image.ColorMap)
+        ColorMap = gif->Image.ColorMap;
+    else
+        ColorMap = gif->SColorMap;
+
+    assert(ColorMap);
+
+    memset(&table, 0, sizeof(table));
+    table.num_colors = ColorMap ? ColorMap->ColorCount : 0;
+    for (i = 0; i < table.num_colors; ++i)
+    {
+        table.colors[i].value[0] = ColorMap->Colors[i].Blue;
+        table.colors[i].value[1] = ColorMap->Colors[i].Green;
+        table.colors[i].value[2] = ColorMap->Colors[i].Red;
+    }
+
+    width = gif->SWidth;
+    height = gif->SHeight;
+    DGifCloseFile(gif, NULL);
+
+    hbm = ii_create(width, height, 8, table.num_colors ? &table : NULL);
+    if (hbm)
+    {
+        ii_get_info(hbm, &bm);
+        pbBits = (uint8_t *)bm.bmBits;
+        for (i = 0; i < height; i++)
+        {
+            GifRowType row = ScreenBuffer[i];
+            for (j = 0; j < width; j++)
+            {
+                int y = height - i - 1;
+                pbBits[y * bm.bmWidthBytes + j] = row[j];
+            }
+        }
+    }
+
+    for (i = 0; i < height; i++)
+    {
+        free(ScreenBuffer[i]);
+    }
+    free(ScreenBuffer);
+
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_gif_load_8bpp_a(II_CSTR pszFileName, int *pi_trans/* = NULL*/)
+{
+    GifFileType *gif = DGifOpenFileName(pszFileName, NULL);
+    if (gif)
+        return ii_gif_load_8bpp_common(gif, pi_trans);
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_gif_load_8bpp_w(II_CWSTR pszFileName, int *pi_trans/* = NULL*/)
+{
+    GifFileType *gif;
+    int fd;
+
+    fd = ii_wopen(pszFileName, O_RDONLY);
+    if (fd != -1) {
+        gif = DGifOpenFileHandle(fd, NULL);
+        if (gif)
+            return ii_gif_load_8bpp_common(gif, pi_trans);
+        ii_close(fd);
+    }
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_gif_load_32bpp_a(II_CSTR pszFileName)
+{
+    int i_trans;
+    II_HIMAGE hbm8bpp, hbm32bpp;
+    assert(pszFileName);
+    hbm8bpp = ii_gif_load_8bpp_a(pszFileName, &i_trans);
+    assert(hbm8bpp);
+    if (hbm8bpp)
+    {
+        hbm32bpp = ii_32bpp_from_trans_8bpp(hbm8bpp, &i_trans);
+        assert(hbm32bpp);
+        ii_destroy(hbm8bpp);
+        return hbm32bpp;
+    }
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_gif_load_32bpp_w(II_CWSTR pszFileName)
+{
+    int i_trans;
+    II_HIMAGE hbm8bpp, hbm32bpp;
+    assert(pszFileName);
+    hbm8bpp = ii_gif_load_8bpp_w(pszFileName, &i_trans);
+    assert(hbm8bpp);
+    if (hbm8bpp)
+    {
+        hbm32bpp = ii_32bpp_from_trans_8bpp(hbm8bpp, &i_trans);
+        assert(hbm32bpp);
+        ii_destroy(hbm8bpp);
+        return hbm32bpp;
+    }
+    return NULL;
+}
+
+static int IICAPI
+ii_gif_stream_read(GifFileType *gif, GifByteType *bytes, int length)
+{
+    II_STREAM *stream;
+    assert(gif);
+    stream = (II_STREAM *)gif->UserData;
+    assert(stream);
+    assert(bytes);
+    return (int)stream->read_proc(stream, bytes, length);
+}
+
+static int IICAPI
+ii_gif_stream_write(GifFileType *gif, const GifByteType *bytes, int length)
+{
+    II_STREAM *stream;
+    assert(gif);
+    stream = (II_STREAM *)gif->UserData;
+    assert(stream);
+    assert(bytes);
+    return (int)stream->write_proc(stream, bytes, length);
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_gif_load_8bpp_stream(II_STREAM *stream, int *pi_trans)
+{
+    GifFileType *gif;
+
+    assert(stream);
+    gif = DGifOpen(stream, ii_gif_stream_read, NULL);
+    if (gif)
+        return ii_gif_load_8bpp_common(gif, pi_trans);
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_gif_load_32bpp_stream(II_STREAM *stream)
+{
+    int i_trans;
+    II_HIMAGE hbm8bpp, hbm32bpp;
+    hbm8bpp = ii_gif_load_8bpp_stream(stream, &i_trans);
+    if (hbm8bpp)
+    {
+        hbm32bpp = ii_32bpp_from_trans_8bpp(hbm8bpp, &i_trans);
+        ii_destroy(hbm8bpp);
+        return hbm32bpp;
+    }
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_gif_load_8bpp_mem(II_LPCVOID pv, uint32_t cb, int *pi_trans)
+{
+    II_STREAM stream;
+    II_MEMORY memory;
+
+    memory.m_pb = (const uint8_t *)pv;
+    memory.m_i = 0;
+    memory.m_size = cb;
+
+    ii_stream_init_mem(&stream, &memory);
+    return ii_gif_load_8bpp_stream(&stream, pi_trans);
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_gif_load_32bpp_mem(II_LPCVOID pv, uint32_t cb)
+{
+    II_STREAM stream;
+    II_MEMORY memory;
+
+    memory.m_pb = (const uint8_t *)pv;
+    memory.m_i = 0;
+    memory.m_size = cb;
+
+    ii_stream_init_mem(&stream, &memory);
+    return ii_gif_load_32bpp_stream(&stream);
+}
+
+IMAIO_API bool IIAPI 
+ii_gif_save_common(GifFileType *gif, II_HIMAGE hbm8bpp, const int *pi_trans)
+{
+    II_IMGINFO bm;
+    II_PALETTE *table;
+    uint8_t *pbBits;
+    int nColorCount;
+    ColorMapObject cm;
+    GifColorType colors[256];
+    int i;
+    GifPixelType* ScanLines;
+
+    if (!ii_get_info(hbm8bpp, &bm) || bm.bmBitsPixel != 8)
+    {
+        assert(0);
+        EGifCloseFile(gif, NULL);
+        return false;
+    }
+    pbBits = (uint8_t *)bm.bmBits;
+    assert(pbBits);
+
+    ScanLines = (GifPixelType*)calloc(sizeof(GifPixelType), bm.bmWidth);
+    if (ScanLines == NULL)
+    {
+        EGifCloseFile(gif, NULL);
+        return false;
+    }
+
+    table = ii_get_palette(hbm8bpp);
+    nColorCount = table ? table->num_colors : 0;
+
+    cm.ColorCount = nColorCount;
+    cm.BitsPerPixel = 8;
+    cm.Colors = colors;
+    for (i = 0; i < nColorCount; i++)
+    {
+        cm.Colors[i].Blue = table->colors[i].value[0];
+        cm.Colors[i].Green = table->colors[i].value[1];
+        cm.Colors[i].Red = table->colors[i].value[2];
+    }
+    ii_palette_destroy(table);
+
+    EGifPutScreenDesc(gif, bm.bmWidth, bm.bmHeight, 256, 0, &cm);
+    if (pi_trans && *pi_trans != -1)
+    {
+        uint8_t extension[4];
+        extension[0] = 1;   /* enable transparency */
+        extension[1] = 0;   /* no delay */
+        extension[2] = 0;   /* no delay */
+        extension[3] = (uint8_t)*pi_trans;     /* tranparent index */
+        EGifPutExtension(gif, GRAPHICS_EXT_FUNC_CODE, 4, extension);
+    }
+    EGifPutImageDesc(gif, 0, 0, bm.bmWidth, bm.bmHeight, false, NULL);
+    for (i = 0; i < bm.bmHeight; i++)
+    {
+        int y = bm.bmHeight - i - 1;
+        EGifPutLine(gif, &pbBits[y * bm.bmWidthBytes], bm.bmWidth);
+    }
+
+    EGifCloseFile(gif, NULL);
+    free(ScanLines);
+
+    return true;
+}
+
+IMAIO_API bool IIAPI
+ii_gif_save_a(II_CSTR pszFileName, II_HIMAGE hbm8bpp, const int *pi_trans)
+{
+    GifFileType *gif;
+
+    gif = EGifOpenFileName(pszFileName, false, NULL);
+    assert(gif);
+    if (gif)
+    {
+        if (ii_gif_save_common(gif, hbm8bpp, pi_trans))
+        {
+            return true;
+        }
+        remove(pszFileName);
+    }
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_gif_save_w(II_CWSTR pszFileName, II_HIMAGE hbm8bpp, const int *pi_trans)
+{
+    GifFileType *gif = NULL;
+    int fd = ii_wopen(pszFileName, O_WRONLY | O_CREAT | O_TRUNC, S_IREAD | S_IWRITE);
+    if (fd != -1)
+    {
+        gif = EGifOpenFileHandle(fd, NULL);
+        if (gif == NULL)
+            ii_close(fd);
+    }
+    assert(gif);
+    if (gif)
+    {
+        if (ii_gif_save_common(gif, hbm8bpp, pi_trans))
+        {
+            return true;
+        }
+        ii_wremove(pszFileName);
+    }
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_gif_save_stream(II_STREAM *stream, II_HIMAGE hbm8bpp, const int *pi_trans)
+{
+    GifFileType *gif;
+
+    assert(stream);
+    gif = EGifOpen(stream, ii_gif_stream_write, NULL);
+    if (gif)
+        return ii_gif_save_common(gif, hbm8bpp, pi_trans);
+    return false;
+}
+
+/*****************************************************************************/
+
+IMAIO_API II_ANIGIF * IIAPI
+ii_anigif_load_common(GifFileType *gif, II_FLAGS flags)
+{
+    ColorMapObject *cm;
+    II_PALETTE *palette;
+    II_ANIGIF *anigif;
+    int i, k, n, x, y;
+    int ret;
+    SavedImage *image;
+    II_ANIGIF_FRAME *frame;
+
+    assert(gif);
+    if (gif == NULL)
+    {
+        return NULL;
+    }
+    ret = DGifSlurp(gif);
+    if (ret == GIF_ERROR)
+        return NULL;
+
+    anigif = (II_ANIGIF *)calloc(sizeof(II_ANIGIF), 1);
+    if (anigif == NULL)
+    {
+        DGifCloseFile(gif, NULL);
+        return NULL;
+    }
+
+    if (flags & II_FLAG_USE_SCREEN)
+        anigif->flags = II_FLAG_USE_SCREEN;
+    else
+        anigif->flags = 0;
+    anigif->width = gif->SWidth;
+    anigif->height = gif->SHeight;
+    anigif->num_frames = gif->ImageCount;
+    anigif->iBackground = gif->SBackGroundColor;
+
+    anigif->frames =
+        (II_ANIGIF_FRAME *)
+            calloc(sizeof(II_ANIGIF_FRAME), anigif->num_frames);
+    if (anigif->frames == NULL)
+    {
+        ii_anigif_destroy(anigif);
+        DGifCloseFile(gif, NULL);
+        return NULL;
+    }
+
+    cm = gif->SColorMap;
+    if (cm)
+    {
+        palette = (II_PALETTE *)calloc(sizeof(II_PALETTE), 1);
+        if (palette == NULL)
+        {
+            ii_anigif_destroy(anigif);
+            DGifCloseFile(gif, NULL);
+            return NULL;
+        }
+        palette->num_colors = cm->ColorCount;
+        for (i = 0; i < cm->ColorCount; ++i)
+        {
+            palette->colors[i].value[0] = cm->Colors[i].Blue;
+            palette->colors[i].value[1] = cm->Colors[i].Green;
+            palette->colors[i].value[2] = cm->Colors[i].Red;
+        }
+        anigif->global_palette = palette;
+    }
+    else
+    {
+        anigif->global_palette = NULL;
+    }
+
+    for (i = 0; i < anigif->num_frames; ++i)
+    {
+        image = &(gif->SavedImages[i]);
+        frame = &anigif->frames[i];
+
+        frame->x = image->ImageDesc.Left;
+        frame->y = image->ImageDesc.Top;
+        frame->width = image->ImageDesc.Width;
+        frame->height = image->ImageDesc.Height;
+        frame->iTransparent = -1;
+        frame->disposal = 0;
+        frame->delay = 0;
+        if (image->ImageDesc.ColorMap)
+        {
+            cm = image->ImageDesc.ColorMap;
+            frame->local_palette =
+                (II_PALETTE *)calloc(sizeof(II_PALETTE), 1);
+            if (frame->local_palette == NULL)
+            {
+                ii_anigif_destroy(anigif);
+                DGifCloseFile(gif, NULL);
+                return NULL;
+            }
+            palette = frame->local_palette;
+            palette->num_colors = cm->ColorCount;
+            for (n = 0; n < cm->ColorCount; ++n)
+            {
+                palette->colors[n].value[0] = cm->Colors[n].Blue;
+                palette->colors[n].value[1] = cm->Colors[n].Green;
+                palette->colors[n].value[2] = cm->Colors[n].Red;
+            }
+        }
+        for (k = 0; k < image->ExtensionBlockCount; ++k)
+        {
+            ExtensionBlock *block = &image->ExtensionBlocks[k];
+            switch (block->Function)
+            {
+            case GRAPHICS_EXT_FUNC_CODE:
+                if (block->ByteCount >= 4)
+                {
+                    n = block->Bytes[0];
+                    if (n & 1)
+                        frame->iTransparent = block->Bytes[3];
+                    frame->disposal = ((n >> 2) & 0x07);
+                    frame->delay = 10 *
+                        (block->Bytes[1] | (block->Bytes[2] << 8));
+                }
+                break;
+            case APPLICATION_EXT_FUNC_CODE:
+                if (block->ByteCount == 11)
+                {
+                    if (memcmp(block->Bytes, "NETSCAPE2.0", 11) == 0)
+                    {
+                        if (i + 1 < image->ExtensionBlockCount)
+                        {
+                            ++block;
+                            if (block->ByteCount == 3 && (block->Bytes[0] & 7) == 1)
+                            {
+                                anigif->loop_count =
+                                    ((block->Bytes[1] & 0xFF) |
+                                        ((block->Bytes[2] & 0xFF) << 8));
+                            }
+                        }
+                    }
+                }
+                break;
+            }
+        }
+
+        if (frame->local_palette)
+            palette = frame->local_palette;
+        else
+            palette = anigif->global_palette;
+        frame->hbmPart = ii_create(frame->width, frame->height, 8, palette);
+        assert(frame->hbmPart);
+        if (frame->hbmPart == NULL)
+        {
+            ii_anigif_destroy(anigif);
+            DGifCloseFile(gif, NULL);
+            return NULL;
+        }
+        {
+            II_IMGINFO bm;
+            uint8_t *pb;
+
+            ii_get_info(frame->hbmPart, &bm);
+            pb = (uint8_t *)bm.bmBits;
+            if (image->ImageDesc.Interlace)
+            {
+                ii_gif_uninterlace(
+                    image->RasterBits, frame->width, frame->height);
+            }
+            for (y = 0; y < frame->height; ++y)
+            {
+                for (x = 0; x < frame->width; ++x)
+                {
+                    pb[x + (bm.bmHeight - y - 1) * bm.bmWidthBytes] =
+                       image->RasterBits[x + y * frame->width];
+                }
+            }
+        }
+    }
+
+    /* realize 32bpp */
+    if (flags & II_FLAG_USE_SCREEN)
+    {
+        II_HIMAGE hbmScreen;
+        II_IMGINFO bmScreen;
+        II_ANIGIF_FRAME *old_frame;
+
+        /* create screen */
+        hbmScreen = ii_create_32bpp_trans(anigif->width, anigif->height);
+        if (hbmScreen == NULL)
+        {
+            ii_anigif_destroy(anigif);
+            DGifCloseFile(gif, NULL);
+            return NULL;
+        }
+        ii_get_info(hbmScreen, &bmScreen);
+
+        /* realize */
+        old_frame = NULL;
+        for (i = 0; i < anigif->num_frames; ++i)
+        {
+            frame = &anigif->frames[i];
+
+            ii_stamp(hbmScreen, frame->x, frame->y, frame->hbmPart,
+                     &frame->iTransparent, 255);
+            if (frame->hbmScreen)
+                ii_destroy(frame->hbmScreen);
+            frame->hbmScreen = ii_share(hbmScreen);
+            assert(hbmScreen);
+            assert(frame->hbmScreen);
+
+            switch (frame->disposal)
+            {
+            case 2:
+                if (frame->local_palette)
+                    palette = frame->local_palette;
+                else
+                    palette = anigif->global_palette;
+                if (anigif->iBackground != -1 && ii_make_writable(hbmScreen))
+                {
+                    int xx, yy;
+                    uint32_t *pdw;
+                    uint32_t dw;
+
+                    ii_get_info(hbmScreen, &bmScreen);
+                    dw = *(uint32_t *)(&palette->colors[anigif->iBackground]);
+                    dw &= 0xFFFFFF;
+                    pdw = (uint32_t *)bmScreen.bmBits;
+
+                    for (yy = frame->y; yy < frame->y + frame->height; ++yy)
+                    {
+                        for (xx = frame->x; xx < frame->x + frame->width; ++xx)
+                        {
+                            pdw[xx + yy * frame->width] = dw;
+                        }
+                    }
+                }
+                break;
+            case 3:
+                if (old_frame)
+                {
+                    ii_destroy(hbmScreen);
+                    hbmScreen = ii_share(old_frame->hbmScreen);
+                    ii_get_info(hbmScreen, &bmScreen);
+                }
+                break;
+            }
+
+            old_frame = frame;
+        }
+
+        ii_destroy(hbmScreen);
+    }
+
+    DGifCloseFile(gif, NULL);
+    return anigif;
+}
+
+IMAIO_API II_ANIGIF * IIAPI
+ii_anigif_load_a(II_CSTR pszFileName, II_FLAGS flags)
+{
+    GifFileType *gif = DGifOpenFileName(pszFileName, NULL);
+    if (gif)
+        return ii_anigif_load_common(gif, flags);
+    return NULL;
+}
+
+IMAIO_API II_ANIGIF * IIAPI
+ii_anigif_load_w(II_CWSTR pszFileName, II_FLAGS flags)
+{
+    GifFileType *gif;
+    int fd;
+
+    fd = ii_wopen(pszFileName, O_RDONLY);
+    if (fd != -1) {
+        gif = DGifOpenFileHandle(fd, NULL);
+        if (gif)
+            return ii_anigif_load_common(gif, flags);
+        ii_close(fd);
+    }
+    return NULL;
+}
+
+IMAIO_API bool IIAPI
+ii_anigif_save_common(GifFileType *gif, II_ANIGIF *anigif)
+{
+    int i, k;
+    II_PALETTE *palette;
+    GifColorType colors[256];
+    int ret, iTransparent;
+    II_COLOR8 bg_color;
+
+    assert(gif);
+    assert(anigif);
+
+    if (gif == NULL)
+    {
+        return false;
+    }
+    if (anigif == NULL)
+    {
+        EGifCloseFile(gif, NULL);
+        return false;
+    }
+
+    assert(anigif->width > 0);
+    assert(anigif->height > 0);
+    assert(anigif->num_frames > 0);
+    if (anigif->iBackground < 0 || 256 <= anigif->iBackground)
+        anigif->iBackground = 0;
+
+    /* initialize basic info */
+    gif->SWidth = anigif->width;
+    gif->SHeight = anigif->height;
+    gif->SColorResolution = 8;
+    gif->SBackGroundColor = anigif->iBackground;
+    gif->ImageCount = anigif->num_frames;
+    gif->SavedImages =
+        (SavedImage *)calloc(anigif->num_frames, sizeof(SavedImage));
+    if (gif->SavedImages == NULL)
+    {
+        EGifCloseFile(gif, NULL);
+        return false;
+    }
+
+    palette = anigif->global_palette;
+    if (palette && anigif->iBackground < palette->num_colors)
+    {
+        bg_color = palette->colors[anigif->iBackground];
+    }
+    else
+    {
+        memset(&bg_color, 0, sizeof(bg_color));
+    }
+
+    /* realize 8bpp */
+    if (anigif->flags & II_FLAG_USE_SCREEN)
+    {
+        II_HIMAGE hbm8bpp;
+        II_PALETTE_INDEX *index = NULL;
+        iTransparent = -1;
+        if (anigif->global_palette == NULL)
+        {
+            bool fulfilled = true;
+            for (i = 0; i < anigif->num_frames; ++i)
+            {
+                if (anigif->frames[i].local_palette == NULL)
+                {
+                    fulfilled = false;
+                }
+            }
+            if (!fulfilled)
+            {
+                palette = ii_palette_for_anigif(anigif, 255);
+                assert(palette);
+                if (palette == NULL)
+                {
+                    EGifCloseFile(gif, NULL);
+                    return false;
+                }
+                iTransparent = palette->num_colors;
+                palette->num_colors++;
+                anigif->global_palette = palette;
+            }
+        }
+        /* NOTE: The frames share the inverse color map of global palette. */
+        if (anigif->global_palette)
+        {
+            index = ii_palette_index_create(anigif->global_palette);
+            if (index == NULL)
+            {
+                EGifCloseFile(gif, NULL);
+                return false;
+            }
+            /* the opaque pixels don't take the transparent entry */
+            if (iTransparent != -1)
+                index->num_search = iTransparent;
+        }
+        for (i = 0; i < anigif->num_frames; ++i)
+        {
+            II_IMGINFO info;
+            II_ANIGIF_FRAME *frame = &(anigif->frames[i]);
+            if (frame->hbmPart)
+            {
+                ii_destroy(frame->hbmPart);
+                frame->hbmPart = NULL;
+            }
+            if (frame->hbmScreen == NULL)
+                continue;
+
+            ii_get_info(frame->hbmScreen, &info);
+            if (info.bmWidth != frame->width ||
+                info.bmHeight != frame->height)
+            {
+                frame->x = 0;
+                frame->y = 0;
+                frame->width = info.bmWidth;
+                frame->height = info.bmHeight;
+            }
+
+            if (iTransparent != -1)
+                frame->iTransparent = iTransparent;
+
+            if (frame->local_palette)
+            {
+                hbm8bpp = ii_reduce_colors(
+                    frame->hbmScreen, frame->local_palette,
+                    &frame->iTransparent);
+            }
+            else
+            {
+                hbm8bpp = ii_reduce_colors_by_index(
+                    frame->hbmScreen, index, &frame->iTransparent, 0);
+            }
+            assert(hbm8bpp);
+            if (hbm8bpp == NULL)
+            {
+                ii_palette_index_destroy(index);
+                EGifCloseFile(gif, NULL);
+                return false;
+            }
+            frame->hbmPart = hbm8bpp;
+        }
+        ii_palette_index_destroy(index);
+    }
+
+    /* global palette */
+    if (anigif->global_palette)
+    {
+        palette = anigif->global_palette;
+        for (i = 0; i < palette->num_colors; ++i)
+        {
+            II_COLOR8 *pcolor = &palette->colors[i];
+            colors[i].Red = pcolor->value[2];
+            colors[i].Green = pcolor->value[1];
+            colors[i].Blue = pcolor->value[0];
+        }
+        gif->SColorMap = GifMakeMapObject(palette->num_colors, colors);
+        if (gif->SColorMap == NULL)
+        {
+            EGifCloseFile(gif, NULL);
+            return false;
+        }
+    }
+    else
+    {
+        gif->SColorMap = NULL;
+    }
+
+    for (i = 0; i < anigif->num_frames; ++i)
+    {
+        II_ANIGIF_FRAME *frame = &(anigif->frames[i]);
+        SavedImage *image = &(gif->SavedImages[i]);
+
+        /* frame info */
+        image->ImageDesc.Left = frame->x;
+        image->ImageDesc.Top = frame->y;
+        image->ImageDesc.Width = frame->width;
+        image->ImageDesc.Height = frame->height;
+        image->ImageDesc.Interlace = false;
+
+        /* local palette */
+        if (frame->local_palette)
+        {
+            palette = frame->local_palette;
+            for (k = 0; k < palette->num_colors; ++k)
+            {
+                II_COLOR8 *pcolor = &palette->colors[k];
+                colors[k].Red = pcolor->value[2];
+                colors[k].Green = pcolor->value[1];
+                colors[k].Blue = pcolor->value[0];
+            }
+            image->ImageDesc.ColorMap =
+                GifMakeMapObject(palette->num_colors, colors);
+            if (image->ImageDesc.ColorMap == NULL)
+            {
+                EGifCloseFile(gif, NULL);
+                return false;
+            }
+        }
+
+        /* extension */
+        if (image->ExtensionBlocks)
+        {
+            GifFreeExtensions(
+                &image->ExtensionBlockCount, &image->ExtensionBlocks);
+        }
+        if (i == 0 && anigif->loop_count)
+        {
+            /* APPLICATION_EXT_FUNC_CODE */
+            uint8_t params[3];
+
+            GifAddExtensionBlock(
+                &image->ExtensionBlockCount, &image->ExtensionBlocks,
+                APPLICATION_EXT_FUNC_CODE, 11, (uint8_t *)"NETSCAPE2.0");
+
+            params[0] = 1;
+            params[1] = (uint8_t)(anigif->loop_count);
+            params[2] = (uint8_t)(anigif->loop_count >> 8);
+            GifAddExtensionBlock(
+                &image->ExtensionBlockCount, &image->ExtensionBlocks,
+                0, 3, params);
+        }
+        {
+            /* GRAPHICS_EXT_FUNC_CODE */
+            uint8_t extension[4];
+            uint16_t delay = frame->delay / 10;
+            extension[0] = (uint8_t)(frame->iTransparent != -1);
+            extension[0] |= (uint8_t)((frame->disposal & 0x07) << 2);
+            extension[1] = (uint8_t)delay;
+            extension[2] = (uint8_t)(delay >> 8);
+            extension[3] = (uint8_t)frame->iTransparent;
+            GifAddExtensionBlock(
+                &image->ExtensionBlockCount, &image->ExtensionBlocks,
+                GRAPHICS_EXT_FUNC_CODE, 4, extension);
+        }
+
+        /* image bits */
+        if (frame->hbmPart == NULL)
+        {
+            free(image->RasterBits);
+            image->RasterBits = NULL;
+            assert(0);
+        }
+        else
+        {
+            II_IMGINFO bm;
+            uint8_t *pb;
+            int x, y;
+            uint8_t b;
+
+            ii_get_info(frame->hbmPart, &bm);
+            pb = (uint8_t *)bm.bmBits;
+
+            /* allocate bits */
+            free(image->RasterBits);
+            image->RasterBits = (uint8_t *)malloc(bm.bmWidth * bm.bmHeight);
+            if (image->RasterBits == NULL)
+            {
+                EGifCloseFile(gif, NULL);
+                return false;
+            }
+
+            /* store bits */
+            k = 0;
+            for (y = 0; y < bm.bmHeight; ++y)
+            {
+                for (x = 0; x < bm.bmWidth; ++x)
+                {
+                    b = pb[x + (bm.bmHeight - y - 1) * bm.bmWidthBytes];
+                    image->RasterBits[k++] = b;
+                }
+            }
+        }
+    }
+
+    ret = EGifSpew(gif);
+    assert(ret != GIF_ERROR);
+
+    if (ret == GIF_ERROR)
+        EGifCloseFile(gif, NULL);
+
+    return ret != GIF_ERROR;
+}
+
+IMAIO_API bool IIAPI
+ii_anigif_save_a(II_CSTR pszFileName, II_ANIGIF *anigif)
+{
+    GifFileType *gif;
+
+    assert(anigif);
+    gif = EGifOpenFileName(pszFileName, false, NULL);
+    assert(gif);
+    if (gif)
+    {
+        if (ii_anigif_save_common(gif, anigif))
+        {
+            return true;
+        }
+    }
+    remove(pszFileName);
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_anigif_save_w(II_CWSTR pszFileName, II_ANIGIF *anigif)
+{
+    GifFileType *gif = NULL;
+    int fd = ii_wopen(pszFileName, O_WRONLY | O_CREAT | O_TRUNC, S_IREAD | S_IWRITE);
+    if (fd != -1)
+    {
+        gif = EGifOpenFileHandle(fd, NULL);
+        if (gif == NULL)
+            ii_close(fd);
+    }
+    assert(gif);
+    assert(anigif);
+    if (gif)
+    {
+        if (ii_anigif_save_common(gif, anigif))
+        {
+            return true;
+        }
+    }
+    ii_wremove(pszFileName);
+    return false;
+}
+
+IMAIO_API II_ANIGIF * IIAPI
+ii_anigif_load_stream(II_STREAM *stream, II_FLAGS flags)
+{
+    GifFileType *gif;
+
+    assert(stream);
+    gif = DGifOpen(stream, ii_gif_stream_read, NULL);
+    if (gif)
+        return ii_anigif_load_common(gif, flags);
+    return NULL;
+}
+
+IMAIO_API II_ANIGIF * IIAPI
+ii_anigif_load_mem(II_LPCVOID pv, uint32_t cb, II_FLAGS flags)
+{
+    II_STREAM stream;
+    II_MEMORY memory;
+
+    memory.m_pb = (const uint8_t *)pv;
+    memory.m_i = 0;
+    memory.m_size = cb;
+
+    ii_stream_init_mem(&stream, &memory);
+    return ii_anigif_load_stream(&stream, flags);
+}
+
+IMAIO_API bool IIAPI
+ii_anigif_save_stream(II_STREAM *stream, II_ANIGIF *anigif)
+{
+    GifFileType *gif;
+
+    assert(stream);
+    assert(anigif);
+    gif = EGifOpen(stream, ii_gif_stream_write, NULL);
+    if (gif)
+        return ii_anigif_save_common(gif, anigif);
+    return false;
+}
+
+IMAIO_API void IIAPI
+ii_anigif_destroy(II_ANIGIF *anigif)
+{
+    int i;
+    II_ANIGIF_FRAME *frame;
+
+    if (anigif)
+    {
+        if (anigif->frames)
+        {
+            for (i = 0; i < anigif->num_frames; ++i)
+            {
+                frame = &anigif->frames[i];
+                if (frame->hbmPart)
+                {
+                    ii_destroy(frame->hbmPart);
+                    frame->hbmPart = NULL;
+                }
+                if (frame->hbmScreen)
+                {
+                    ii_destroy(frame->hbmScreen);
+                    frame->hbmScreen = NULL;
+                }
+                if (frame->local_palette)
+                {
+                    ii_palette_destroy(frame->local_palette);
+                    frame->local_palette = NULL;
+                }
+            }
+            free(anigif->frames);
+            anigif->frames = NULL;
+        }
+        if (anigif->global_palette)
+        {
+            ii_palette_destroy(anigif->global_palette);
+            anigif->global_palette = NULL;
+        }
+        free(anigif);
+    }
+}
+
+/*****************************************************************************/
+
+/* NOTE: Points rows[0 .. height-1] at the DIB rows of hbm, top row first. */
+static void
+ii_png_image_rows(png_bytepp rows, II_HIMAGE hbm)
+{
+    II_IMGINFO bm;
+    uint8_t *pb;
+    int y;
+
+    ii_get_info(hbm, &bm);
+    pb = (uint8_t *)bm.bmBits + (bm.bmHeight - 1) * bm.bmWidthBytes;
+    for (y = 0; y < bm.bmHeight; ++y)
+    {
+        rows[y] = pb;
+        pb -= bm.bmWidthBytes;
+    }
+}
+
+/* NOTE: The transforms to 24bpp or 32bpp BGR(A) rows. */
+static void
+ii_png_set_transforms(png_structp png, png_infop info)
+{
+    double          gamma;
+
+    png_set_expand(png);
+    if (png_get_valid(png, info, PNG_INFO_tRNS))
+        png_set_tRNS_to_alpha(png);
+    png_set_strip_16(png);
+    png_set_gray_to_rgb(png);
+    png_set_palette_to_rgb(png);
+    png_set_bgr(png);
+    png_set_packing(png);
+    png_set_interlace_handling(png);
+    if (png_get_gAMA(png, info, &gamma))
+        png_set_gamma(png, 2.2, gamma);
+    else
+        png_set_gamma(png, 2.2, 0.45455);
+}
+
+static float
+ii_png_get_dpi(png_structp png, png_infop info)
+{
+    png_uint_32     res_x, res_y;
+    int             unit_type;
+
+    if (png_get_pHYs(png, info, &res_x, &res_y, &unit_type))
+    {
+        if (unit_type == PNG_RESOLUTION_METER)
+            return (float)(res_x * 2.54 / 100.0);
+    }
+    return 0.0;
+}
+
+/* NOTE: Decodes the image after png_read_info straight into a new DIB. */
+static II_HIMAGE
+ii_png_read_image(png_structp png, png_infop info, float *dpi)
+{
+    II_HIMAGE       hbm;
+    png_uint_32     width, height;
+    int             color_type, depth;
+    png_bytepp      rows;
+
+    ii_png_set_transforms(png, info);
+    png_read_update_info(png, info);
+    png_get_IHDR(png, info, &width, &height, &depth, &color_type,
+                 NULL, NULL, NULL);
+
+    if (dpi)
+        *dpi = ii_png_get_dpi(png, info);
+
+    hbm = ii_create(width, height, depth * png_get_channels(png, info), NULL);
+    if (hbm == NULL)
+        return NULL;
+
+    rows = (png_bytepp)malloc(height * sizeof(png_bytep));
+    if (rows == NULL)
+    {
+        ii_destroy(hbm);
+        return NULL;
+    }
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        free(rows);
+        ii_destroy(hbm);
+        return NULL;
+    }
+
+    ii_png_image_rows(rows, hbm);
+    png_read_image(png, rows);
+    png_read_end(png, NULL);
+
+    free(rows);
+    return hbm;
+}
+
+static void IICAPI
+ii_png_stream_read(png_structp png, png_bytep data, png_size_t length)
+{
+    II_STREAM *stream;
+    assert(png);
+    stream = (II_STREAM *)png_get_io_ptr(png);
+    assert(stream);
+    if (stream->read_proc(stream, data, length) != length)
+        png_error(png, "Read Error");
+}
+
+static void IICAPI
+ii_png_stream_write(png_structp png, png_bytep data, png_size_t length)
+{
+    II_STREAM *stream;
+    assert(png);
+    stream = (II_STREAM *)png_get_io_ptr(png);
+    assert(stream);
+    if (stream->write_proc(stream, data, length) != length)
+        png_error(png, "Write Error");
+}
+
+static void IICAPI
+ii_png_stream_flush(png_structp png)
+{
+    (void)png;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_png_load_stream(II_STREAM *stream, float *dpi)
+{
+    II_HIMAGE       hbm;
+    png_structp     png;
+    png_infop       info;
+
+    assert(stream);
+    if (stream == NULL)
+        return NULL;
+
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info = png_create_info_struct(png);
+    if (png == NULL || info == NULL || setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_read_struct(&png, &info, NULL);
+        return NULL;
+    }
+
+    png_set_read_fn(png, stream, ii_png_stream_read);
+    png_read_info(png, info);
+
+    hbm = ii_png_read_image(png, info, dpi);
+
+    png_destroy_read_struct(&png, &info, NULL);
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_png_load_common(FILE *inf, float *dpi)
+{
+    II_STREAM stream;
+    II_HIMAGE hbm;
+
+    assert(inf);
+    if (inf == NULL)
+        return NULL;
+
+    ii_stream_init_file(&stream, inf);
+    hbm = ii_png_load_stream(&stream, dpi);
+    fclose(inf);
+    return hbm;
+}
+
+/* NOTE: ii_png_load_mapped reads the mapped file without the buffered reads
+ *       of stdio. It unmaps the file. */
+static II_HIMAGE
+ii_png_load_mapped(II_MEMORY *memory, float *dpi)
+{
+    II_STREAM stream;
+    II_HIMAGE hbm;
+
+    ii_stream_init_mem(&stream, memory);
+    hbm = ii_png_load_stream(&stream, dpi);
+    ii_unmap_file(memory);
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_png_load_a(II_CSTR pszFileName, float *dpi)
+{
+    FILE            *inf;
+    II_MEMORY       memory;
+    if (ii_map_file_a(&memory, pszFileName))
+        return ii_png_load_mapped(&memory, dpi);
+    inf = fopen(pszFileName, "rb");
+    if (inf)
+        return ii_png_load_common(inf, dpi);
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_png_load_w(II_CWSTR pszFileName, float *dpi)
+{
+    FILE            *inf;
+    II_MEMORY       memory;
+    if (ii_map_file_w(&memory, pszFileName))
+        return ii_png_load_mapped(&memory, dpi);
+    inf = ii_wfopen(pszFileName, L"rb");
+    if (inf)
+        return ii_png_load_common(inf, dpi);
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_png_load_mem(II_LPCVOID pv, uint32_t cb)
+{
+    II_STREAM stream;
+    II_MEMORY memory;
+
+    memory.m_pb = (const uint8_t *)pv;
+    memory.m_i = 0;
+    memory.m_size = cb;
+
+    ii_stream_init_mem(&stream, &memory);
+    return ii_png_load_stream(&stream, NULL);
+}
+
+static bool
+ii_png_save_view_stream(II_STREAM *stream, const II_VIEW *view, float dpi)
+{
+    png_structp png = NULL;
+    png_infop info = NULL;
+    png_color_8 sBIT;
+    const II_IMGINFO *bm;
+    II_PALETTE *table = NULL;
+    uint32_t *line = NULL;
+    const uint8_t *pbRow;
+    int y, nDepth;
+    bool ok = false;
+
+    assert(stream);
+    assert(view);
+    if (!ii_is_readable_bpp(view->info.bmBitsPixel))
+    {
+        II_VIEW view32;
+        II_HIMAGE hbm32bpp = ii_view_32bpp(&view32, view);
+        if (hbm32bpp == NULL)
+            return false;
+        ok = ii_png_save_view_stream(stream, &view32, dpi);
+        ii_destroy(hbm32bpp);
+        return ok;
+    }
+    bm = &view->info;
+    nDepth = (bm->bmBitsPixel == 32 ? 32 : 24);
+
+    do
+    {
+        /* NOTE: The rows other than 24bpp are read as 32bpp and
+         *       the fourth bytes are dropped by png_set_filler. */
+        if (bm->bmBitsPixel != 24 && bm->bmBitsPixel != 32)
+        {
+            table = ii_get_palette(view->hbm);
+            line = (uint32_t *)ii_alloc(bm->bmWidth * sizeof(uint32_t));
+            if (line == NULL)
+                break;
+        }
+
+        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        info = png_create_info_struct(png);
+        if (png == NULL || info == NULL)
+            break;
+
+        if (setjmp(png_jmpbuf(png)))
+            break;
+
+        png_set_write_fn(png, stream, ii_png_stream_write,
+                         ii_png_stream_flush);
+        png_set_IHDR(png, info, bm->bmWidth, bm->bmHeight, 8,
+            (nDepth == 32 ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB),
+            PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_BASE);
+
+        sBIT.red = 8;
+        sBIT.green = 8;
+        sBIT.blue = 8;
+        sBIT.alpha = (png_byte)(nDepth == 32 ? 8 : 0);
+        png_set_sBIT(png, info, &sBIT);
+
+        if (dpi != 0.0)
+        {
+            png_uint_32 res = (png_uint_32)(dpi * 100 / 2.54 + 0.5);
+            png_set_pHYs(png, info, res, res, PNG_RESOLUTION_METER);
+        }
+
+        png_write_info(png, info);
+        png_set_bgr(png);
+        if (line)
+            png_set_filler(png, 0, PNG_FILLER_AFTER);
+
+        for (y = bm->bmHeight - 1; y >= 0; --y)
+        {
+            pbRow = (const uint8_t *)bm->bmBits + y * bm->bmWidthBytes;
+            if (line)
+            {
+                ii_read_row_32bpp(bm, table, y, line);
+                pbRow = (const uint8_t *)line;
+            }
+            png_write_row(png, (png_bytep)pbRow);
+        }
+
+        png_write_end(png, info);
+        ok = true;
+    } while (0);
+
+    png_destroy_write_struct(&png, &info);
+
+    ii_free(line);
+    ii_palette_destroy(table);
+
+    return ok;
+}
+
+IMAIO_API bool IIAPI
+ii_png_save_view_common(FILE *outf, const II_VIEW *view, float dpi)
+{
+    II_STREAM stream;
+    bool ok;
+
+    assert(outf);
+    if (outf == NULL)
+        return false;
+
+    ii_stream_init_file(&stream, outf);
+    ok = ii_png_save_view_stream(&stream, view, dpi);
+    if (fclose(outf) != 0)
+        ok = false;
+    return ok;
+}
+
+IMAIO_API bool IIAPI
+ii_png_save_stream(II_STREAM *stream, II_HIMAGE hbm, float dpi)
+{
+    II_VIEW view;
+
+    assert(stream);
+    if (!ii_view_create(&view, hbm))
+        return false;
+    return ii_png_save_view_stream(stream, &view, dpi);
+}
+
+IMAIO_API bool IIAPI
+ii_png_save_common(FILE *outf, II_HIMAGE hbm, float dpi)
+{
+    II_VIEW view;
+
+    assert(outf);
+    if (outf == NULL)
+        return false;
+
+    if (!ii_view_create(&view, hbm))
+    {
+        fclose(outf);
+        return false;
+    }
+    return ii_png_save_view_common(outf, &view, dpi);
+}
+
+IMAIO_API bool IIAPI
+ii_png_save_a(II_CSTR pszFileName, II_HIMAGE hbm, float dpi)
+{
+    FILE *outf;
+    outf = fopen(pszFileName, "wb");
+    if (outf)
+    {
+        if (ii_png_save_common(outf, hbm, dpi))
+            return true;
+        remove(pszFileName);
+    }
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_png_save_w(II_CWSTR pszFileName, II_HIMAGE hbm, float dpi)
+{
+    FILE *outf;
+    outf = ii_wfopen(pszFileName, L"wb");
+    if (outf)
+    {
+        if (ii_png_save_common(outf, hbm, dpi))
+            return true;
+        ii_wremove(pszFileName);
+    }
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_png_save_view_a(II_CSTR pszFileName, const II_VIEW *view, float dpi)
+{
+    FILE *outf;
+    outf = fopen(pszFileName, "wb");
+    if (outf)
+    {
+        if (ii_png_save_view_common(outf, view, dpi))
+            return true;
+        remove(pszFileName);
+    }
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_png_save_view_w(II_CWSTR pszFileName, const II_VIEW *view, float dpi)
+{
+    FILE *outf;
+    outf = ii_wfopen(pszFileName, L"wb");
+    if (outf)
+    {
+        if (ii_png_save_view_common(outf, view, dpi))
+            return true;
+        ii_wremove(pszFileName);
+    }
+    return false;
+}
+
+/*****************************************************************************/
+
+#ifdef PNG_APNG_SUPPORTED
+    /* copy a 32bpp image onto another one without blending */
+    static void IIAPI
+    ii_copy_32bpp(II_HIMAGE hbmDest, int x, int y, II_HIMAGE hbmSrc)
+    {
+        II_IMGINFO bm, bmSrc;
+        int x0, x1, y0, y1, yy;
+        uint8_t *pbDest, *pbSrc;
+
+        if (!ii_make_writable(hbmDest) ||
+            !ii_get_info(hbmDest, &bm) || !ii_get_info(hbmSrc, &bmSrc))
+        {
+            return;
+        }
+        assert(bm.bmBitsPixel == 32 && bmSrc.bmBitsPixel == 32);
+
+        x0 = (x < 0) ? 0 : x;
+        y0 = (y < 0) ? 0 : y;
+        x1 = min(x + (int)bmSrc.bmWidth, (int)bm.bmWidth);
+        y1 = min(y + (int)bmSrc.bmHeight, (int)bm.bmHeight);
+        for (yy = y0; yy < y1 && x0 < x1; ++yy)
+        {
+            pbDest = (uint8_t *)bm.bmBits;
+            pbDest += (bm.bmHeight - 1 - yy) * bm.bmWidthBytes + (x0 << 2);
+            pbSrc = (uint8_t *)bmSrc.bmBits;
+            pbSrc += (bmSrc.bmHeight - 1 - (yy - y)) * bmSrc.bmWidthBytes;
+            pbSrc += (x0 - x) << 2;
+            memcpy(pbDest, pbSrc, (x1 - x0) << 2);
+        }
+    }
+
+    IMAIO_API II_HIMAGE IIAPI
+    ii_image_from_32bpp_rows(int width, int height, png_bytepp rows)
+    {
+        II_HIMAGE hbm;
+        uint32_t *pdw, *row;
+        int x, y;
+
+        assert(width > 0);
+        assert(height > 0);
+        assert(rows);
+
+        hbm = ii_create_32bpp(width, height);
+        if (hbm)
+        {
+            pdw = (uint32_t *)ii_get_pixels(hbm);
+            for (y = 0; y < height; ++y)
+            {
+                row = (uint32_t *)rows[height - y - 1 + 0];
+                for (x = 0; x < width; ++x)
+                {
+                    pdw[y * width + x] = row[x];
+                }
+            }
+        }
+        return hbm;
+    }
+
+    IMAIO_API void IIAPI
+    ii_32bpp_rows_from_image(png_bytepp rows, II_HIMAGE hbmImage)
+    {
+        II_IMGINFO bm;
+        int x, y;
+        uint32_t *pdw, *row;
+
+        if (ii_get_info(hbmImage, &bm))
+        {
+            pdw = (uint32_t *)bm.bmBits;
+            for (y = 0; y < bm.bmHeight; ++y)
+            {
+                row = (uint32_t *)rows[bm.bmHeight - y - 1];
+                for (x = 0; x < bm.bmWidth; ++x)
+                {
+                    row[x] = pdw[y * bm.bmWidth + x];
+                }
+            }
+        }
+    }
+
+    IMAIO_API II_APNG * IIAPI
+    ii_apng_from_anigif(II_ANIGIF *anigif)
+    {
+        II_APNG *apng;
+        uint32_t i;
+
+        apng = (II_APNG *)calloc(sizeof(II_APNG), 1);
+        if (apng == NULL)
+            return NULL;
+
+        if (anigif->flags & II_FLAG_USE_SCREEN)
+            apng->flags = II_FLAG_USE_SCREEN;
+        else
+            apng->flags = 0;
+
+        apng->width = anigif->width;
+        apng->height = anigif->height;
+        apng->num_frames = anigif->num_frames;
+        apng->num_plays = anigif->loop_count;
+        apng->frames = calloc(sizeof(II_APNG_FRAME), apng->num_frames);
+        if (apng->frames)
+        {
+            for (i = 0; i < apng->num_frames; ++i)
+            {
+                II_ANIGIF_FRAME *anigif_frame = &anigif->frames[i];
+                II_APNG_FRAME *apng_frame = &apng->frames[i];
+                apng_frame->x_offset = anigif_frame->x;
+                apng_frame->y_offset = anigif_frame->y;
+                apng_frame->width = anigif_frame->width;
+                apng_frame->height = anigif_frame->height;
+                apng_frame->delay = anigif_frame->delay;
+                switch (anigif_frame->disposal)
+                {
+                case 0:
+                case 1:
+                    apng_frame->dispose_op = PNG_DISPOSE_OP_NONE;
+                    break;
+                case 2:
+                    apng_frame->dispose_op = PNG_DISPOSE_OP_BACKGROUND;
+                    break;
+                case 3:
+                    apng_frame->dispose_op = PNG_DISPOSE_OP_PREVIOUS;
+                    break;
+                }
+                apng_frame->blend_op = PNG_BLEND_OP_OVER;
+                if ((apng->flags & II_FLAG_USE_SCREEN) && anigif_frame->hbmScreen)
+                {
+                    apng_frame->x_offset = 0;
+                    apng_frame->y_offset = 0;
+                    apng_frame->width = anigif->width;
+                    apng_frame->height = anigif->height;
+                    apng_frame->hbmScreen = ii_share(anigif_frame->hbmScreen);
+                }
+                if (anigif_frame->hbmPart)
+                {
+                    apng_frame->hbmPart =
+                        ii_32bpp_from_trans_8bpp(
+                            anigif_frame->hbmPart, &anigif_frame->iTransparent);
+                }
+            }
+        }
+        return apng;
+    }
+
+    IMAIO_API II_ANIGIF * IIAPI
+    ii_anigif_from_apng(II_APNG *apng, bool kill_semitrans)
+    {
+        II_ANIGIF *anigif;
+        II_PALETTE_INDEX *index;
+        uint32_t i;
+        int iTransparent;
+
+        iTransparent = -1;
+
+        anigif = (II_ANIGIF *)calloc(sizeof(II_ANIGIF), 1);
+        if (anigif == NULL)
+            return NULL;
+
+        if (apng->flags & II_FLAG_USE_SCREEN)
+            anigif->flags = II_FLAG_USE_SCREEN;
+        else
+            anigif->flags = 0;
+        anigif->width = apng->width;
+        anigif->height = apng->height;
+        anigif->num_frames = apng->num_frames;
+        anigif->loop_count = apng->num_plays;
+        anigif->frames = (II_ANIGIF_FRAME *)
+                calloc(sizeof(II_ANIGIF_FRAME), anigif->num_frames);
+        if (anigif->frames)
+        {
+            for (i = 0; i < apng->num_frames; ++i)
+            {
+                II_APNG_FRAME *apng_frame = &apng->frames[i];
+                II_ANIGIF_FRAME *anigif_frame = &anigif->frames[i];
+
+                anigif_frame->iTransparent = -1;
+                anigif_frame->delay = apng_frame->delay;
+
+                anigif_frame->x = apng_frame->x_offset;
+                anigif_frame->y = apng_frame->y_offset;
+                anigif_frame->width = apng_frame->width;
+                anigif_frame->height = apng_frame->height;
+                anigif_frame->hbmScreen = NULL;
+
+                if ((apng->flags & II_FLAG_USE_SCREEN) && apng_frame->hbmScreen)
+                {
+                    anigif_frame->hbmScreen = ii_share(apng_frame->hbmScreen);
+                    anigif_frame->disposal = 0;
+                }
+                else
+                {
+                    anigif_frame->hbmScreen = ii_share(apng_frame->hbmPart);
+                }
+                if (kill_semitrans)
+                {
+                    ii_erase_semitrans(anigif_frame->hbmScreen);
+                }
+            }
+
+            anigif->global_palette = ii_palette_for_anigif(anigif, 255);
+            if (anigif->global_palette == NULL)
+            {
+                ii_anigif_destroy(anigif);
+                return NULL;
+            }
+            iTransparent = anigif->global_palette->num_colors;
+            anigif->global_palette->num_colors++;
+
+            /* NOTE: A frame without its part is not a valid frame. */
+            index = ii_palette_index_create(anigif->global_palette);
+            if (index == NULL)
+            {
+                ii_anigif_destroy(anigif);
+                return NULL;
+            }
+            /* the opaque pixels don't take the transparent entry */
+            index->num_search = iTransparent;
+            for (i = 0; i < apng->num_frames; ++i)
+            {
+                II_APNG_FRAME *apng_frame = &apng->frames[i];
+                II_ANIGIF_FRAME *anigif_frame = &anigif->frames[i];
+                if ((apng->flags & II_FLAG_USE_SCREEN) == 0 ||
+                    apng_frame->hbmScreen == NULL)
+                {
+                    ii_destroy(anigif_frame->hbmScreen);
+                    anigif_frame->hbmScreen = NULL;
+                }
+                if (apng_frame->hbmPart)
+                {
+                    anigif_frame->hbmPart =
+                        ii_reduce_colors_by_index(
+                            apng_frame->hbmPart, index, &iTransparent, 0);
+                    if (anigif_frame->hbmPart == NULL)
+                    {
+                        ii_palette_index_destroy(index);
+                        ii_anigif_destroy(anigif);
+                        return NULL;
+                    }
+                }
+                anigif_frame->iTransparent = iTransparent;
+            }
+            ii_palette_index_destroy(index);
+        }
+        else
+        {
+            ii_anigif_destroy(anigif);
+            anigif = NULL;
+        }
+
+        return anigif;
+    }
+
+    IMAIO_API void IIAPI
+    ii_apng_destroy(II_APNG *apng)
+    {
+        uint32_t i;
+
+        if (apng)
+        {
+            for (i = 0; i < apng->num_frames; ++i)
+            {
+                II_APNG_FRAME *frame = &apng->frames[i];
+                if (frame->hbmScreen)
+                {
+                    ii_destroy(frame->hbmScreen);
+                    frame->hbmScreen = NULL;
+                }
+                if (frame->hbmPart)
+                {
+                    ii_destroy(frame->hbmPart);
+                    frame->hbmPart = NULL;
+                }
+            }
+            if (apng->hbmDefault)
+            {
+                ii_destroy(apng->hbmDefault);
+                apng->hbmDefault = NULL;
+            }
+            free(apng->frames);
+            free(apng);
+        }
+    }
+
+    IMAIO_API II_APNG * IIAPI
+    ii_apng_load_stream(II_STREAM *stream, II_FLAGS flags)
+    {
+        png_byte sig[8];
+        II_APNG *apng = NULL;
+        png_structp png;
+        png_infop info;
+        png_bytepp rows = NULL;
+        png_uint_32 i, k;
+        bool ok = false;
+        II_HIMAGE hbm, hbmScreen = NULL;
+        II_APNG_FRAME *frame, *old_frame;
+        double gamma;
+
+        assert(stream);
+        if (stream == NULL)
+            return NULL;
+
+        /* check signature */
+        if (stream->read_proc(stream, sig, 8) != 8 || !png_check_sig(sig, 8))
+        {
+            return NULL;
+        }
+
+        png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        info = png_create_info_struct(png);
+        if (png == NULL || info == NULL)
+        {
+            png_destroy_read_struct(&png, &info, NULL);
+            return NULL;
+        }
+
+        png_set_read_fn(png, stream, ii_png_stream_read);
+        png_set_sig_bytes(png, 8);
+
+        png_set_strip_16(png);
+        png_set_gray_to_rgb(png);
+        png_set_palette_to_rgb(png);
+        png_set_bgr(png);
+        png_set_packing(png);
+        png_set_interlace_handling(png);
+        png_set_add_alpha(png, 0xFF, PNG_FILLER_AFTER);
+        if (png_get_gAMA(png, info, &gamma))
+            png_set_gamma(png, 2.2, gamma);
+        else
+            png_set_gamma(png, 2.2, 0.45455);
+
+        do
+        {
+            if (setjmp(png_jmpbuf(png)))
+                break;
+
+            png_read_info(png, info);
+
+            /* is it an APNG? */
+            if (!png_get_valid(png, info, PNG_INFO_acTL))
+            {
+                break;
+            }
+
+            apng = (II_APNG *)calloc(1, sizeof(II_APNG));
+            if (apng == NULL)
+                break;
+
+            /* store info */
+            apng->width = png_get_image_width(png, info);
+            apng->height = png_get_image_height(png, info);
+            apng->num_plays = png_get_num_plays(png, info);
+            if (flags & II_FLAG_USE_SCREEN)
+                apng->flags = II_FLAG_USE_SCREEN;
+            else
+                apng->flags = 0;
+
+            /* get resolution */
+            {
+                png_uint_32 res_x, res_y;
+                int unit_type;
+
+                apng->dpi = 0.0;
+                if (png_get_pHYs(png, info, &res_x, &res_y, &unit_type))
+                {
+                    if (unit_type == PNG_RESOLUTION_METER)
+                        apng->dpi = (float)(res_x * 2.54 / 100.0);
+                }
+            }
+
+            /* create screen */
+            hbmScreen = ii_create_32bpp_trans(apng->width, apng->height);
+            if (hbmScreen == NULL)
+                break;
+
+            /* allocate rows; they point into each decoded image */
+            rows = (png_bytepp)malloc(sizeof(png_bytep) * apng->height);
+            if (rows == NULL)
+                break;
+
+            /* allocate for frames */
+            apng->num_frames = png_get_num_frames(png, info);
+            apng->frames = (II_APNG_FRAME *)
+                calloc(apng->num_frames, sizeof(II_APNG_FRAME));
+            if (apng->frames == NULL)
+                break;
+
+            /* for each frame */
+            k = 0;
+            old_frame = NULL;
+            for (i = 0; i < apng->num_frames; ++i)
+            {
+                frame = &apng->frames[k];
+
+                png_read_frame_head(png, info);
+
+                if (png_get_valid(png, info, PNG_INFO_fcTL))
+                {
+                    /* frame */
+                    uint16_t delay_num, delay_den;
+
+                    png_get_next_frame_fcTL(png, info,
+                                            (png_uint_32 *)&frame->width,
+                                            (png_uint_32 *)&frame->height,
+                                            (png_uint_32 *)&frame->x_offset,
+                                            (png_uint_32 *)&frame->y_offset,
+                                            &delay_num, &delay_den,
+                                            &frame->dispose_op, &frame->blend_op);
+
+                    /* calculate delay time */
+                    if (delay_den == 0)
+                        delay_den = 100;
+                    frame->delay = (delay_num * 1000) / delay_den;
+
+                    /* create a part */
+                    hbm = ii_create_32bpp(frame->width, frame->height);
+                    if (hbm == NULL)
+                        break;
+                    frame->hbmPart = hbm;
+                    ii_png_image_rows(rows, hbm);
+                    png_read_image(png, rows);
+
+                    /* blending */
+                    switch (frame->blend_op)
+                    {
+                    case PNG_BLEND_OP_SOURCE:
+                        ii_copy_32bpp(hbmScreen,
+                            frame->x_offset, frame->y_offset, hbm);
+                        break;
+                    case PNG_BLEND_OP_OVER:
+                        ii_stamp(hbmScreen, frame->x_offset, frame->y_offset,
+                                 hbm, NULL, 255);
+                        break;
+                    }
+
+                    /* create a screen image */
+                    if (flags & II_FLAG_USE_SCREEN)
+                    {
+                        frame->hbmScreen = ii_share(hbmScreen);
+
+                        /* dispose */
+                        switch (frame->dispose_op)
+                        {
+                        case PNG_DISPOSE_OP_BACKGROUND:
+                            ii_destroy(hbmScreen);
+                            hbmScreen = ii_create_32bpp_trans(apng->width, apng->height);
+                            break;
+                        case PNG_DISPOSE_OP_PREVIOUS:
+                            if (old_frame)
+                            {
+                                ii_destroy(hbmScreen);
+                                hbmScreen = ii_share(old_frame->hbmScreen);
+                            }
+                            break;
+                        }
+                    }
+
+                    old_frame = frame;
+                    ++k;
+                }
+                else
+                {
+                    /* default image */
+                    hbm = ii_create_32bpp(apng->width, apng->height);
+                    if (hbm == NULL)
+                        break;
+                    apng->flags |= II_FLAG_DEFAULT_PRESENT;
+                    apng->hbmDefault = hbm;
+                    ii_png_image_rows(rows, hbm);
+                    png_read_image(png, rows);
+                }
+            }
+            if (i < apng->num_frames)
+                break;
+            ok = true;
+            png_read_end(png, info);
+        } while (0);
+
+        png_destroy_read_struct(&png, &info, NULL);
+
+        free(rows);
+
+        if (apng)
+        {
+            if (apng->flags & II_FLAG_DEFAULT_PRESENT)
+                apng->num_frames -= 1;
+
+            if (ok && apng->num_frames > 0)
+            {
+                if (apng->hbmDefault == NULL)
+                {
+                    apng->hbmDefault = ii_share(apng->frames[0].hbmScreen);
+                }
+            }
+            else
+            {
+                ii_apng_destroy(apng);
+                apng = NULL;
+            }
+        }
+
+        if (hbmScreen)
+        {
+            ii_destroy(hbmScreen);
+        }
+
+        return apng;
+    }
+
+    IMAIO_API II_APNG * IIAPI
+    ii_apng_load_fp(FILE *fp, II_FLAGS flags)
+    {
+        II_STREAM stream;
+        II_APNG *apng;
+
+        if (fp == NULL)
+            return NULL;
+
+        ii_stream_init_file(&stream, fp);
+        apng = ii_apng_load_stream(&stream, flags);
+        fclose(fp);
+        return apng;
+    }
+
+    IMAIO_API II_APNG * IIAPI
+    ii_apng_load_mem(II_LPCVOID pv, uint32_t cb, II_FLAGS flags)
+    {
+        II_STREAM stream;
+        II_MEMORY memory;
+
+        memory.m_pb = (const uint8_t *)pv;
+        memory.m_i = 0;
+        memory.m_size = cb;
+
+        ii_stream_init_mem(&stream, &memory);
+        return ii_apng_load_stream(&stream, flags);
+    }
+
+    IMAIO_API II_APNG * IIAPI
+    ii_apng_load_a(II_CSTR pszFileName, II_FLAGS flags)
+    {
+        FILE *fp;
+        fp = fopen(pszFileName, "rb");
+        if (fp)
+            return ii_apng_load_fp(fp, flags);
+        return NULL;
+    }
+
+    IMAIO_API II_APNG * IIAPI
+    ii_apng_load_w(II_CWSTR pszFileName, II_FLAGS flags)
+    {
+        FILE *fp;
+        fp = ii_wfopen(pszFileName, L"rb");
+        if (fp)
+            return ii_apng_load_fp(fp, flags);
+        return NULL;
+    }
+
+    IMAIO_API bool IIAPI
+    ii_apng_save_stream(II_STREAM *stream, II_APNG *apng)
+    {
+        png_structp png;
+        png_infop info;
+        png_bytepp rows = NULL;
+        uint32_t y, i, k;
+        png_color_8 sBIT;
+        bool ok = false;
+        png_uint_32 rowbytes;
+
+        assert(stream);
+        if (apng == NULL)
+        {
+            return false;
+        }
+
+        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        info = png_create_info_struct(png);
+        if (png == NULL || info == NULL)
+        {
+            png_destroy_write_struct(&png, &info);
+            return false;
+        }
+
+        png_set_write_fn(png, stream, ii_png_stream_write,
+                         ii_png_stream_flush);
+
+        do
+        {
+            if (setjmp(png_jmpbuf(png)))
+            {
+                break;
+            }
+
+            png_set_IHDR(png, info, apng->width, apng->height,
+                         8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+                         PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_BASE);
+
+            sBIT.red = 8;
+            sBIT.green = 8;
+            sBIT.blue = 8;
+            sBIT.alpha = 8;
+            png_set_sBIT(png, info, &sBIT);
+
+            if (apng->dpi != 0.0)
+            {
+                png_uint_32 res = (png_uint_32)(apng->dpi * 100 / 2.54 + 0.5);
+                png_set_pHYs(png, info, res, res, PNG_RESOLUTION_METER);
+            }
+
+            png_set_bgr(png);
+            if ((apng->flags & II_FLAG_DEFAULT_PRESENT) && apng->hbmDefault)
+                png_set_acTL(png, info, apng->num_frames + 1, apng->num_plays);
+            else
+                png_set_acTL(png, info, apng->num_frames, apng->num_plays);
+
+            /* allocate rows */
+            rows = (png_bytepp)calloc(sizeof(png_bytep), apng->height);
+            if (rows == NULL)
+                break;
+			rowbytes = (png_uint_32)png_get_rowbytes(png, info);
+            for (y = 0; y < apng->height; ++y)
+            {
+                rows[y] = (png_bytep)malloc(rowbytes);
+                if (rows[y] == NULL)
+                {
+                    for (k = y - 1; k < apng->height; --k)
+                        free(rows[y]);
+                    free(rows);
+                    rows = NULL;
+                    break;
+                }
+            }
+            if (rows == NULL)
+                break;
+
+            if ((apng->flags & II_FLAG_DEFAULT_PRESENT) && apng->hbmDefault)
+            {
+                /* write the default image */
+                png_set_first_frame_is_hidden(png, info, 1);
+
+                png_write_info(png, info);
+
+                ii_32bpp_rows_from_image(rows, apng->hbmDefault);
+                png_write_frame_head(
+                    png, info, rows, 
+                    apng->width, apng->height, 0, 0,
+                    0, 0,
+                    PNG_DISPOSE_OP_NONE,
+                    PNG_BLEND_OP_OVER
+                );
+
+                png_write_image(png, rows);
+                png_write_frame_tail(png, info);
+            }
+
+            for (i = 0; i < apng->num_frames; ++i)
+            {
+                II_APNG_FRAME *frame = &apng->frames[i];
+
+                png_write_info(png, info);
+                if (apng->flags & II_FLAG_USE_SCREEN)
+                {
+                    ii_32bpp_rows_from_image(rows, frame->hbmScreen);
+                    png_write_frame_head(
+                        png, info, rows, 
+                        apng->width, apng->height, 0, 0,
+                        frame->delay, 1000, 
+                        frame->dispose_op,
+                        frame->blend_op
+                    );
+                }
+                else
+                {
+                    ii_32bpp_rows_from_image(rows, frame->hbmPart);
+                    png_write_frame_head(
+                        png, info, rows, 
+                        frame->width, frame->height,
+                        frame->x_offset, frame->y_offset,
+                        frame->delay, 1000, 
+                        frame->dispose_op,
+                        frame->blend_op
+                    );
+                }
+
+                png_write_image(png, rows);
+                png_write_frame_tail(png, info);
+            }
+            ok = true;
+            png_write_end(png, NULL);
+        } while (0);
+
+        if (rows)
+        {
+            for (y = 0; y < apng->height; ++y)
+            {
+                free(rows[y]);
+            }
+            free(rows);
+        }
+
+        png_destroy_write_struct(&png, &info);
+
+        return ok;
+    }
+
+    IMAIO_API bool IIAPI
+    ii_apng_save_fp(FILE *fp, II_APNG *apng)
+    {
+        II_STREAM stream;
+        bool ok;
+
+        if (fp == NULL)
+            return false;
+
+        ii_stream_init_file(&stream, fp);
+        ok = ii_apng_save_stream(&stream, apng);
+        if (fclose(fp) != 0)
+            ok = false;
+        return ok;
+    }
+
+    IMAIO_API bool IIAPI
+    ii_apng_save_a(II_CSTR pszFileName, II_APNG *apng)
+    {
+        FILE *fp;
+        fp = fopen(pszFileName, "wb");
+        if (fp)
+        {
+            if (ii_apng_save_fp(fp, apng))
+                return true;
+        }
+        remove(pszFileName);
+        return false;
+    }
+
+    IMAIO_API bool IIAPI
+    ii_apng_save_w(II_CWSTR pszFileName, II_APNG *apng)
+    {
+        FILE *fp;
+        fp = ii_wfopen(pszFileName, L"wb");
+        if (fp)
+        {
+            if (ii_apng_save_fp(fp, apng))
+                return true;
+        }
+        ii_wremove(pszFileName);
+        return false;
+    }
+#endif  /* def PNG_APNG_SUPPORTED */
+
+/*****************************************************************************/
+
+IMAIO_API II_HIMAGE IIAPI
+ii_tif_load_common(TIFF *tif, float *dpi)
+{
+    II_HIMAGE hbm, hbm32Bpp;
+    uint32_t *pdwBits;
+    uint16_t resunit;
+    uint32_t w, h;
+    bool fOpaque;
+
+    assert(tif);
+    if (tif == NULL)
+        return NULL;
+
+    hbm = NULL;
+
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_RESOLUTIONUNIT, &resunit);
+
+    if (dpi)
+    {
+        if (!TIFFGetField(tif, TIFFTAG_XRESOLUTION, dpi))
+        {
+            *dpi = 0.0f;
+        }
+        else if (resunit == RESUNIT_CENTIMETER)
+        {
+            *dpi *= 2.54f;
+        }
+        else
+        {
+            *dpi = 0.0f;
+        }
+    }
+    hbm32Bpp = ii_create_32bpp(w, h);
+    if (hbm32Bpp)
+    {
+        pdwBits = (uint32_t *)ii_get_pixels(hbm32Bpp);
+        if (TIFFReadRGBAImageOriented(tif, w, h, pdwBits,
+            ORIENTATION_BOTLEFT, 0))
+        {
+            /* NOTE: TIFFReadRGBAImage makes the R, G, B, A bytes. */
+            ii_convert_pixels(II_PIXEL_FORMAT_RGBA32, pdwBits, w * 4,
+                              II_PIXEL_FORMAT_BGRA32, pdwBits, w * 4, w, h);
+            fOpaque = (ii_get_alpha_state(hbm32Bpp) == II_ALPHA_OPAQUE);
+            if (fOpaque)
+            {
+                hbm = ii_24bpp(hbm32Bpp);
+                ii_destroy(hbm32Bpp);
+            }
+            else
+            {
+                hbm = hbm32Bpp;
+            }
+        }
+        else
+        {
+            ii_destroy(hbm32Bpp);
+        }
+    }
+
+    TIFFClose(tif);
+
+    return hbm;
+}
+
+static tmsize_t
+ii_tif_stream_read(thandle_t handle, void *pv, tmsize_t cb)
+{
+    II_STREAM *stream = (II_STREAM *)handle;
+    return (tmsize_t)stream->read_proc(stream, pv, (size_t)cb);
+}
+
+static tmsize_t
+ii_tif_stream_write(thandle_t handle, void *pv, tmsize_t cb)
+{
+    II_STREAM *stream = (II_STREAM *)handle;
+    return (tmsize_t)stream->write_proc(stream, pv, (size_t)cb);
+}
+
+static toff_t
+ii_tif_stream_seek(thandle_t handle, toff_t offset, int origin)
+{
+    II_STREAM *stream = (II_STREAM *)handle;
+    if (!stream->seek_proc(stream, (int64_t)offset, origin))
+        return (toff_t)-1;
+    return (toff_t)stream->tell_proc(stream);
+}
+
+/* NOTE: The caller owns the stream. */
+static int
+ii_tif_stream_close(thandle_t handle)
+{
+    (void)handle;
+    return 0;
+}
+
+static toff_t
+ii_tif_stream_size(thandle_t handle)
+{
+    II_STREAM *stream = (II_STREAM *)handle;
+    return (toff_t)stream->size_proc(stream);
+}
+
+static int
+ii_tif_stream_map(thandle_t handle, void **ppv, toff_t *pcb)
+{
+    II_STREAM *stream = (II_STREAM *)handle;
+    const void *pv;
+    size_t cb;
+
+    if (stream->map_proc == NULL)
+        return 0;
+    pv = stream->map_proc(stream, &cb);
+    if (pv == NULL)
+        return 0;
+    *ppv = (void *)pv;
+    *pcb = (toff_t)cb;
+    return 1;
+}
+
+static void
+ii_tif_stream_unmap(thandle_t handle, void *pv, toff_t cb)
+{
+    (void)handle;
+    (void)pv;
+    (void)cb;
+}
+
+static TIFF *
+ii_tif_stream_open(II_STREAM *stream, const char *pszMode)
+{
+    return TIFFClientOpen("II_STREAM", pszMode, (thandle_t)stream,
+        ii_tif_stream_read, ii_tif_stream_write, ii_tif_stream_seek,
+        ii_tif_stream_close, ii_tif_stream_size,
+        ii_tif_stream_map, ii_tif_stream_unmap);
+}
+
+/* NOTE: ii_tif_load_mapped lets libtiff read the strips straight from the
+ *       mapped file. It unmaps the file. */
+static II_HIMAGE
+ii_tif_load_mapped(II_MEMORY *memory, float *dpi)
+{
+    II_STREAM stream;
+    II_HIMAGE hbm = NULL;
+    TIFF* tif;
+
+    ii_stream_init_mem(&stream, memory);
+    tif = ii_tif_stream_open(&stream, "r");
+    if (tif)
+        hbm = ii_tif_load_common(tif, dpi);
+    ii_unmap_file(memory);
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_tif_load_a(II_CSTR pszFileName, float *dpi)
+{
+    TIFF* tif;
+    II_MEMORY memory;
+    TIFFSetWarningHandler(NULL);
+    TIFFSetWarningHandlerExt(NULL);
+    if (ii_map_file_a(&memory, pszFileName))
+        return ii_tif_load_mapped(&memory, dpi);
+    tif = TIFFOpen(pszFileName, "r");
+    if (tif)
+        return ii_tif_load_common(tif, dpi);
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_tif_load_w(II_CWSTR pszFileName, float *dpi)
+{
+    TIFF* tif;
+    II_MEMORY memory;
+    TIFFSetWarningHandler(NULL);
+    TIFFSetWarningHandlerExt(NULL);
+    if (ii_map_file_w(&memory, pszFileName))
+        return ii_tif_load_mapped(&memory, dpi);
+    tif = ii_tiff_open_w(pszFileName, "r");
+    if (tif)
+        return ii_tif_load_common(tif, dpi);
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_tif_load_stream(II_STREAM *stream, float *dpi)
+{
+    TIFF* tif;
+    assert(stream);
+    TIFFSetWarningHandler(NULL);
+    TIFFSetWarningHandlerExt(NULL);
+    tif = ii_tif_stream_open(stream, "r");
+    if (tif)
+        return ii_tif_load_common(tif, dpi);
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_tif_load_mem(II_LPCVOID pv, uint32_t cb, float *dpi)
+{
+    II_STREAM stream;
+    II_MEMORY memory;
+
+    memory.m_pb = (const uint8_t *)pv;
+    memory.m_i = 0;
+    memory.m_size = cb;
+
+    ii_stream_init_mem(&stream, &memory);
+    return ii_tif_load_stream(&stream, dpi);
+}
+
+static void
+ii_tif_set_fields(TIFF *tif, int width, int height, int samples, float dpi)
+{
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, height);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, samples);
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, 1);
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    TIFFSetField(tif, TIFFTAG_FILLORDER, FILLORDER_MSB2LSB);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+    if (dpi != 0.0)
+    {
+        TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
+        TIFFSetField(tif, TIFFTAG_XRESOLUTION, dpi);
+        TIFFSetField(tif, TIFFTAG_YRESOLUTION, dpi);
+    }
+    TIFFSetField(tif, TIFFTAG_SOFTWARE, "katayama_hirofumi_mz's software");
+}
+
+IMAIO_API bool IIAPI
+ii_tif_save_common(TIFF *tif, II_HIMAGE hbm, float dpi)
+{
+    II_VIEW view;
+    const II_IMGINFO *bm;
+    II_PALETTE *table = NULL;
+    uint32_t *line = NULL;
+    const uint8_t *src;
+    uint8_t *pbLine;
+    bool no_alpha;
+    int y, step;
+    bool f;
+
+    assert(tif);
+    if (tif == NULL)
+        return false;
+
+    if (!ii_view_create(&view, hbm))
+    {
+        TIFFClose(tif);
+        return false;
+    }
+    bm = &view.info;
+    if (!ii_is_readable_bpp(bm->bmBitsPixel))
+    {
+        II_HIMAGE hbm32bpp = ii_32bpp(hbm);
+        if (hbm32bpp == NULL)
+        {
+            TIFFClose(tif);
+            return false;
+        }
+        f = ii_tif_save_common(tif, hbm32bpp, dpi);
+        ii_destroy(hbm32bpp);
+        return f;
+    }
+
+    /* NOTE: The rows other than 24bpp and 32bpp are read as 32bpp. */
+    no_alpha = (bm->bmBitsPixel <= 24 || ii_is_opaque(hbm));
+    if (bm->bmBitsPixel != 24 && bm->bmBitsPixel != 32)
+    {
+        table = ii_get_palette(hbm);
+        line = (uint32_t *)ii_alloc(bm->bmWidth * sizeof(uint32_t));
+    }
+    pbLine = (uint8_t *)ii_alloc(bm->bmWidth * 4);
+    if (pbLine == NULL || (line == NULL && bm->bmBitsPixel != 24 &&
+                           bm->bmBitsPixel != 32))
+    {
+        ii_free(pbLine);
+        ii_free(line);
+        ii_palette_destroy(table);
+        TIFFClose(tif);
+        return false;
+    }
+
+    ii_tif_set_fields(tif, bm->bmWidth, bm->bmHeight, no_alpha ? 3 : 4, dpi);
+    f = true;
+    step = (bm->bmBitsPixel == 24 ? 3 : 4);
+    for (y = 0; y < bm->bmHeight; y++)
+    {
+        src = (const uint8_t *)bm->bmBits +
+              (bm->bmHeight - 1 - y) * bm->bmWidthBytes;
+        if (line)
+        {
+            ii_read_row_32bpp(bm, table, bm->bmHeight - 1 - y, line);
+            src = (const uint8_t *)line;
+        }
+        ii_convert_pixels(step == 3 ? II_PIXEL_FORMAT_BGR24 :
+                                      II_PIXEL_FORMAT_BGRA32, src, 0,
+                          no_alpha ? II_PIXEL_FORMAT_RGB24 :
+                                     II_PIXEL_FORMAT_RGBA32, pbLine, 0,
+                          bm->bmWidth, 1);
+        if (TIFFWriteScanline(tif, pbLine, y, 0) < 0)
+        {
+            f = false;
+            break;
+        }
+    }
+    TIFFClose(tif);
+
+    ii_free(pbLine);
+    ii_free(line);
+    ii_palette_destroy(table);
+    return f;
+}
+
+IMAIO_API bool IIAPI
+ii_tif_save_a(II_CSTR pszFileName, II_HIMAGE hbm, float dpi)
+{
+    TIFF *tif;
+    TIFFSetWarningHandler(NULL);
+    TIFFSetWarningHandlerExt(NULL);
+    tif = TIFFOpen(pszFileName, "w");
+    if (tif)
+    {
+        if (ii_tif_save_common(tif, hbm, dpi))
+            return true;
+        remove(pszFileName);
+    }
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_tif_save_w(II_CWSTR pszFileName, II_HIMAGE hbm, float dpi)
+{
+    TIFF *tif;
+    TIFFSetWarningHandler(NULL);
+    TIFFSetWarningHandlerExt(NULL);
+    tif = ii_tiff_open_w(pszFileName, "w");
+    if (tif)
+    {
+        if (ii_tif_save_common(tif, hbm, dpi))
+            return true;
+        ii_wremove(pszFileName);
+    }
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_tif_save_stream(II_STREAM *stream, II_HIMAGE hbm, float dpi)
+{
+    TIFF *tif;
+    assert(stream);
+    TIFFSetWarningHandler(NULL);
+    TIFFSetWarningHandlerExt(NULL);
+    tif = ii_tif_stream_open(stream, "w");
+    if (tif)
+        return ii_tif_save_common(tif, hbm, dpi);
+    return false;
+}
+
+/*****************************************************************************/
+/* incremental decoding */
+
+typedef enum II_JPG_STATE
+{
+    II_JPG_STATE_HEADER,        /* jpeg_read_header */
+    II_JPG_STATE_START,         /* jpeg_start_decompress */
+    II_JPG_STATE_SCAN_BEGIN,    /* jpeg_start_output (progressive) */
+    II_JPG_STATE_SCANLINES,     /* jpeg_read_scanlines */
+    II_JPG_STATE_SCAN_END,      /* jpeg_finish_output (progressive) */
+    II_JPG_STATE_FINISH         /* jpeg_finish_decompress */
+} II_JPG_STATE;
+
+struct II_DECODER
+{
+    II_IMAGE_TYPE           type;
+    II_DECODER_PROC         proc;
+    void *                  user;
+    II_HIMAGE               hbm;
+    float                   dpi;
+    int                     pass;
+    int                     rows;
+    bool                    done;
+    bool                    failed;
+
+    /* PNG */
+    png_structp             png;
+    png_infop               info;
+
+    /* JPEG */
+    struct jpeg_decompress_struct   decomp;
+    struct jpeg_source_mgr  src;
+    II_JPG_ERROR            jerror;
+    II_JPG_STATE            state;
+    bool                    final_scan;
+    JSAMPARRAY              buffer;
+    uint8_t *               pbInput;    /* the bytes not consumed yet */
+    size_t                  cbInput;
+    size_t                  cbInputMax;
+    size_t                  cbSkip;     /* the bytes to skip of the next feed */
+};
+
+static void IICAPI
+ii_decoder_png_info(png_structp png, png_infop info)
+{
+    II_DECODER *dec;
+    png_uint_32 width, height;
+    int color_type, depth;
+
+    dec = (II_DECODER *)png_get_progressive_ptr(png);
+    assert(dec);
+
+    ii_png_set_transforms(png, info);
+    png_read_update_info(png, info);
+    png_get_IHDR(png, info, &width, &height, &depth, &color_type,
+                 NULL, NULL, NULL);
+
+    dec->dpi = ii_png_get_dpi(png, info);
+    dec->hbm = ii_create(width, height, depth * png_get_channels(png, info),
+                         NULL);
+    if (dec->hbm == NULL)
+        png_error(png, "out of memory");
+}
+
+static void IICAPI
+ii_decoder_png_row(png_structp png, png_bytep new_row, png_uint_32 row_num,
+                   int pass)
+{
+    II_DECODER *dec;
+    II_IMGINFO bm;
+    uint8_t *pb;
+
+    dec = (II_DECODER *)png_get_progressive_ptr(png);
+    assert(dec);
+
+    /* NOTE: new_row is NULL if the interlace pass has no data for the row. */
+    if (new_row == NULL)
+        return;
+
+    ii_get_info(dec->hbm, &bm);
+    pb = (uint8_t *)bm.bmBits + (bm.bmHeight - 1 - row_num) * bm.bmWidthBytes;
+    png_progressive_combine_row(png, pb, new_row);
+
+    dec->pass = pass;
+    dec->rows = row_num + 1;
+    if (dec->proc)
+        dec->proc(dec, row_num, 1, pass, dec->user);
+}
+
+static void IICAPI
+ii_decoder_png_end(png_structp png, png_infop info)
+{
+    II_DECODER *dec;
+
+    dec = (II_DECODER *)png_get_progressive_ptr(png);
+    assert(dec);
+    (void)info;
+
+    dec->done = true;
+}
+
+static void IICAPI
+ii_decoder_jpg_init_source(j_decompress_ptr cinfo)
+{
+    (void)cinfo;
+}
+
+/* NOTE: Returning FALSE suspends libjpeg until the next ii_decoder_feed. */
+static II_JPEG_BOOLEAN IICAPI
+ii_decoder_jpg_fill_input_buffer(j_decompress_ptr cinfo)
+{
+    (void)cinfo;
+    return FALSE;
+}
+
+static void IICAPI
+ii_decoder_jpg_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+    II_DECODER *dec = (II_DECODER *)cinfo->client_data;
+
+    if (num_bytes <= 0)
+        return;
+
+    if ((size_t)num_bytes > dec->src.bytes_in_buffer)
+    {
+        dec->cbSkip += num_bytes - dec->src.bytes_in_buffer;
+        dec->src.next_input_byte += dec->src.bytes_in_buffer;
+        dec->src.bytes_in_buffer = 0;
+    }
+    else
+    {
+        dec->src.next_input_byte += num_bytes;
+        dec->src.bytes_in_buffer -= num_bytes;
+    }
+}
+
+static void IICAPI
+ii_decoder_jpg_term_source(j_decompress_ptr cinfo)
+{
+    (void)cinfo;
+}
+
+/* NOTE: Runs the JPEG states until libjpeg suspends for more input. */
+static bool
+ii_decoder_jpg_run(II_DECODER *dec)
+{
+    j_decompress_ptr decomp = &dec->decomp;
+    II_IMGINFO bm;
+    uint8_t *pb;
+    int ret, y;
+
+    for (;;)
+    {
+        switch (dec->state)
+        {
+        case II_JPG_STATE_HEADER:
+            if (jpeg_read_header(decomp, TRUE) == JPEG_SUSPENDED)
+                return true;
+            dec->dpi = ii_jpg_get_dpi(decomp);
+            decomp->buffered_image = jpeg_has_multiple_scans(decomp);
+            dec->state = II_JPG_STATE_START;
+            break;
+
+        case II_JPG_STATE_START:
+            if (!jpeg_start_decompress(decomp))
+                return true;
+            if (decomp->out_color_components != 1 &&
+                decomp->out_color_components != 3)
+            {
+                return false;
+            }
+            dec->hbm = ii_create_24bpp(decomp->output_width,
+                                       decomp->output_height);
+            if (dec->hbm == NULL)
+                return false;
+            dec->buffer = (*decomp->mem->alloc_sarray)(
+                (j_common_ptr)decomp, JPOOL_IMAGE,
+                decomp->output_width * decomp->out_color_components, 1);
+            if (decomp->buffered_image)
+                dec->state = II_JPG_STATE_SCAN_BEGIN;
+            else
+                dec->state = II_JPG_STATE_SCANLINES;
+            break;
+
+        case II_JPG_STATE_SCAN_BEGIN:
+            /* NOTE: Absorb what has arrived to skip to the latest scan. */
+            do
+            {
+                ret = jpeg_consume_input(decomp);
+            } while (ret != JPEG_SUSPENDED && ret != JPEG_REACHED_EOI);
+
+            dec->final_scan = jpeg_input_complete(decomp);
+            if (!jpeg_start_output(decomp, decomp->input_scan_number))
+                return true;
+            dec->pass = decomp->output_scan_number - 1;
+            dec->rows = 0;
+            dec->state = II_JPG_STATE_SCANLINES;
+            break;
+
+        case II_JPG_STATE_SCANLINES:
+            ii_get_info(dec->hbm, &bm);
+            while (decomp->output_scanline < decomp->output_height)
+            {
+                y = decomp->output_scanline;
+                if (jpeg_read_scanlines(decomp, dec->buffer, 1) == 0)
+                    return true;
+
+                pb = (uint8_t *)bm.bmBits;
+                pb += (bm.bmHeight - 1 - y) * bm.bmWidthBytes;
+                ii_jpg_store_row(pb, dec->buffer[0], decomp->output_width,
+                                 decomp->out_color_components);
+
+                dec->rows = y + 1;
+                if (dec->proc)
+                    dec->proc(dec, y, 1, dec->pass, dec->user);
+            }
+            if (decomp->buffered_image)
+                dec->state = II_JPG_STATE_SCAN_END;
+            else
+                dec->state = II_JPG_STATE_FINISH;
+            break;
+
+        case II_JPG_STATE_SCAN_END:
+            if (!jpeg_finish_output(decomp))
+                return true;
+            if (dec->final_scan)
+                dec->state = II_JPG_STATE_FINISH;
+            else
+                dec->state = II_JPG_STATE_SCAN_BEGIN;
+            break;
+
+        case II_JPG_STATE_FINISH:
+            if (!jpeg_finish_decompress(decomp))
+                return true;
+            dec->done = true;
+            return true;
+        }
+    }
+}
+
+static bool
+ii_decoder_jpg_feed(II_DECODER *dec, const uint8_t *pb, size_t cb)
+{
+    size_t cbSkip, cbNeed, cbMax;
+    uint8_t *pbNew;
+
+    cbSkip = min(dec->cbSkip, cb);
+    dec->cbSkip -= cbSkip;
+    pb += cbSkip;
+    cb -= cbSkip;
+
+    /* NOTE: Only the bytes libjpeg has not consumed yet are kept. */
+    if (dec->src.bytes_in_buffer && dec->src.next_input_byte != dec->pbInput)
+    {
+        memmove(dec->pbInput, dec->src.next_input_byte,
+                dec->src.bytes_in_buffer);
+    }
+    dec->cbInput = dec->src.bytes_in_buffer;
+
+    cbNeed = dec->cbInput + cb;
+    if (cbNeed > dec->cbInputMax)
+    {
+        cbMax = dec->cbInputMax ? dec->cbInputMax : 4096;
+        while (cbMax < cbNeed)
+            cbMax *= 2;
+        pbNew = (uint8_t *)realloc(dec->pbInput, cbMax);
+        if (pbNew == NULL)
+            return false;
+        dec->pbInput = pbNew;
+        dec->cbInputMax = cbMax;
+    }
+    if (cb)
+        memcpy(dec->pbInput + dec->cbInput, pb, cb);
+    dec->cbInput += cb;
+
+    dec->src.next_input_byte = dec->pbInput;
+    dec->src.bytes_in_buffer = dec->cbInput;
+
+    if (setjmp(dec->jerror.jmp))
+        return false;
+
+    return ii_decoder_jpg_run(dec);
+}
+
+IMAIO_API II_DECODER * IIAPI
+ii_decoder_create(II_IMAGE_TYPE type, II_DECODER_PROC proc, void *user)
+{
+    II_DECODER *dec;
+
+    if (type != II_IMAGE_TYPE_PNG && type != II_IMAGE_TYPE_JPG)
+        return NULL;
+
+    dec = (II_DECODER *)calloc(1, sizeof(II_DECODER));
+    if (dec == NULL)
+        return NULL;
+
+    dec->type = type;
+    dec->proc = proc;
+    dec->user = user;
+
+    if (type == II_IMAGE_TYPE_PNG)
+    {
+        dec->png = png_create_read_struct(PNG_LIBPNG_VER_STRING,
+                                          NULL, NULL, NULL);
+        dec->info = png_create_info_struct(dec->png);
+        if (dec->png == NULL || dec->info == NULL)
+        {
+            png_destroy_read_struct(&dec->png, &dec->info, NULL);
+            free(dec);
+            return NULL;
+        }
+        png_set_progressive_read_fn(dec->png, dec, ii_decoder_png_info,
+                                    ii_decoder_png_row, ii_decoder_png_end);
+    }
+    else
+    {
+        dec->decomp.err = jpeg_std_error(&dec->jerror.pub);
+        dec->jerror.pub.error_exit = ii_jpg_error_exit;
+        if (setjmp(dec->jerror.jmp))
+        {
+            jpeg_destroy_decompress(&dec->decomp);
+            free(dec);
+            return NULL;
+        }
+        jpeg_create_decompress(&dec->decomp);
+        dec->decomp.client_data = dec;
+
+        dec->src.init_source = ii_decoder_jpg_init_source;
+        dec->src.fill_input_buffer = ii_decoder_jpg_fill_input_buffer;
+        dec->src.skip_input_data = ii_decoder_jpg_skip_input_data;
+        dec->src.resync_to_restart = jpeg_resync_to_restart;
+        dec->src.term_source = ii_decoder_jpg_term_source;
+        dec->decomp.src = &dec->src;
+        dec->state = II_JPG_STATE_HEADER;
+    }
+
+    return dec;
+}
+
+IMAIO_API bool IIAPI
+ii_decoder_feed(II_DECODER *dec, II_LPCVOID pv, size_t cb)
+{
+    assert(dec);
+    if (dec->failed)
+        return false;
+    if (dec->done)
+        return true;
+
+    if (dec->type == II_IMAGE_TYPE_PNG)
+    {
+        if (setjmp(png_jmpbuf(dec->png)))
+        {
+            dec->failed = true;
+            return false;
+        }
+        png_process_data(dec->png, dec->info, (png_bytep)pv, cb);
+    }
+    else
+    {
+        if (!ii_decoder_jpg_feed(dec, (const uint8_t *)pv, cb))
+        {
+            dec->failed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_decoder_image(II_DECODER *dec)
+{
+    assert(dec);
+    return dec->hbm;
+}
+
+IMAIO_API int IIAPI
+ii_decoder_rows(II_DECODER *dec, int *pass)
+{
+    assert(dec);
+    if (pass)
+        *pass = dec->pass;
+    return dec->rows;
+}
+
+IMAIO_API bool IIAPI
+ii_decoder_done(II_DECODER *dec)
+{
+    assert(dec);
+    return dec->done;
+}
+
+IMAIO_API float IIAPI
+ii_decoder_dpi(II_DECODER *dec)
+{
+    assert(dec);
+    return dec->dpi;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_decoder_detach(II_DECODER *dec)
+{
+    II_HIMAGE hbm;
+
+    assert(dec);
+    hbm = dec->hbm;
+    dec->hbm = NULL;
+    dec->failed = true;     /* no more rows can be stored */
+    return hbm;
+}
+
+IMAIO_API void IIAPI
+ii_decoder_destroy(II_DECODER *dec)
+{
+    if (dec == NULL)
+        return;
+
+    if (dec->type == II_IMAGE_TYPE_PNG)
+        png_destroy_read_struct(&dec->png, &dec->info, NULL);
+    else
+        jpeg_destroy_decompress(&dec->decomp);
+
+    free(dec->pbInput);
+    if (dec->hbm)
+        ii_destroy(dec->hbm);
+    free(dec);
+}
+
+/*****************************************************************************/
+/* streaming encoding */
+
+/* the size of BITMAPFILEHEADER and BITMAPINFOHEADER on disk */
+#define II_BMP_FILEHEADER_SIZE  14
+#define II_BMP_INFOHEADER_SIZE  40
+
+static ii_inline void
+ii_put_le16(uint8_t *pb, uint16_t value)
+{
+    pb[0] = (uint8_t)value;
+    pb[1] = (uint8_t)(value >> 8);
+}
+
+static ii_inline void
+ii_put_le32(uint8_t *pb, uint32_t value)
+{
+    pb[0] = (uint8_t)value;
+    pb[1] = (uint8_t)(value >> 8);
+    pb[2] = (uint8_t)(value >> 16);
+    pb[3] = (uint8_t)(value >> 24);
+}
+
+struct II_ENCODER
+{
+    II_IMAGE_TYPE           type;
+    int                     width;
+    int                     height;
+    int                     bpp;
+    int                     y;          /* the rows written */
+    bool                    failed;
+    char *                  pszFileName;
+    wchar_t *               pszFileNameW;
+    FILE *                  fp;
+    uint8_t *               pbLine;
+
+    /* PNG */
+    png_structp             png;
+    png_infop               info;
+
+    /* JPEG */
+    struct jpeg_compress_struct comp;
+    II_JPG_ERROR            jerror;
+
+    /* TIFF */
+    TIFF *                  tif;
+
+    /* BMP */
+    uint32_t                cbHeaders;
+    int32_t                 widthbytes;
+};
+
+static bool
+ii_encoder_begin_png(II_ENCODER *enc, float dpi)
+{
+    png_color_8 sBIT;
+
+    enc->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+                                       NULL);
+    enc->info = png_create_info_struct(enc->png);
+    if (enc->png == NULL || enc->info == NULL)
+        return false;
+
+    if (setjmp(png_jmpbuf(enc->png)))
+        return false;
+
+    png_init_io(enc->png, enc->fp);
+    png_set_IHDR(enc->png, enc->info, enc->width, enc->height, 8,
+        (enc->bpp == 32 ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB),
+        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_BASE);
+
+    sBIT.red = 8;
+    sBIT.green = 8;
+    sBIT.blue = 8;
+    sBIT.alpha = (png_byte)(enc->bpp == 32 ? 8 : 0);
+    png_set_sBIT(enc->png, enc->info, &sBIT);
+
+    if (dpi != 0.0)
+    {
+        png_uint_32 res = (png_uint_32)(dpi * 100 / 2.54 + 0.5);
+        png_set_pHYs(enc->png, enc->info, res, res, PNG_RESOLUTION_METER);
+    }
+
+    png_write_info(enc->png, enc->info);
+    png_set_bgr(enc->png);
+    return true;
+}
+
+static bool
+ii_encoder_begin_jpg(II_ENCODER *enc, float dpi, int quality,
+                     bool progression)
+{
+    struct jpeg_compress_struct *comp = &enc->comp;
+
+    enc->pbLine = (uint8_t *)ii_alloc(enc->width * 3);
+    if (enc->pbLine == NULL)
+        return false;
+
+    comp->err = jpeg_std_error(&enc->jerror.pub);
+    enc->jerror.pub.error_exit = ii_jpg_error_exit;
+    if (setjmp(enc->jerror.jmp))
+        return false;
+
+    jpeg_create_compress(comp);
+    jpeg_stdio_dest(comp, enc->fp);
+
+    comp->image_width  = enc->width;
+    comp->image_height = enc->height;
+    comp->input_components = 3;
+    comp->in_color_space = JCS_RGB;
+    jpeg_set_defaults(comp);
+    if (dpi != 0.0)
+    {
+        comp->density_unit = 1; /* dots/inch */
+        comp->X_density = (UINT16)(dpi + 0.5);
+        comp->Y_density = (UINT16)(dpi + 0.5);
+    }
+    jpeg_set_quality(comp, quality, true);
+    if (progression)
+        jpeg_simple_progression(comp);
+
+    jpeg_start_compress(comp, true);
+    return true;
+}
+
+static bool
+ii_encoder_begin_tif(II_ENCODER *enc, float dpi)
+{
+    enc->pbLine = (uint8_t *)ii_alloc(enc->width * 4);
+    if (enc->pbLine == NULL)
+        return false;
+
+    TIFFSetWarningHandler(NULL);
+    TIFFSetWarningHandlerExt(NULL);
+    if (enc->pszFileNameW)
+        enc->tif = ii_tiff_open_w(enc->pszFileNameW, "w");
+    else
+        enc->tif = TIFFOpen(enc->pszFileName, "w");
+    if (enc->tif == NULL)
+        return false;
+
+    ii_tif_set_fields(enc->tif, enc->width, enc->height, enc->bpp / 8, dpi);
+    return true;
+}
+
+static bool
+ii_encoder_begin_bmp(II_ENCODER *enc, float dpi)
+{
+    uint8_t bf[II_BMP_FILEHEADER_SIZE], bi[II_BMP_INFOHEADER_SIZE];
+    uint32_t cbImage;
+    int32_t ppm;
+
+    /* NOTE: The rows are stored bottom-up at their own offsets. */
+    enc->widthbytes = II_WIDTHBYTES(enc->width * enc->bpp);
+    enc->pbLine = (uint8_t *)ii_alloc(enc->widthbytes);
+    if (enc->pbLine == NULL)
+        return false;
+    memset(enc->pbLine, 0, enc->widthbytes);
+
+    cbImage = enc->widthbytes * enc->height;
+    enc->cbHeaders = II_BMP_FILEHEADER_SIZE + II_BMP_INFOHEADER_SIZE;
+
+    memset(bf, 0, sizeof(bf));
+    ii_put_le16(&bf[0], 0x4D42);
+    ii_put_le32(&bf[2], enc->cbHeaders + cbImage);
+    ii_put_le32(&bf[10], enc->cbHeaders);
+
+    memset(bi, 0, sizeof(bi));
+    ii_put_le32(&bi[0], II_BMP_INFOHEADER_SIZE);
+    ii_put_le32(&bi[4], enc->width);
+    ii_put_le32(&bi[8], enc->height);
+    ii_put_le16(&bi[12], 1);
+    ii_put_le16(&bi[14], (uint16_t)enc->bpp);
+    ii_put_le32(&bi[20], cbImage);
+    if (dpi != 0.0)
+    {
+        ppm = (int32_t)(dpi * 100 / 2.54 + 0.5);
+        ii_put_le32(&bi[24], ppm);
+        ii_put_le32(&bi[28], ppm);
+    }
+
+    return fwrite(bf, sizeof(bf), 1, enc->fp) == 1 &&
+           fwrite(bi, sizeof(bi), 1, enc->fp) == 1;
+}
+
+static II_ENCODER *
+ii_encoder_begin_common(II_ENCODER *enc, float dpi, int quality,
+                        bool progression)
+{
+    bool f;
+
+    if (enc->type != II_IMAGE_TYPE_TIF)
+    {
+        if (enc->pszFileNameW)
+            enc->fp = ii_wfopen(enc->pszFileNameW, L"wb");
+        else
+            enc->fp = fopen(enc->pszFileName, "wb");
+        if (enc->fp == NULL)
+        {
+            free(enc->pszFileName);
+            free(enc->pszFileNameW);
+            free(enc);
+            return NULL;
+        }
+    }
+
+    switch (enc->type)
+    {
+    case II_IMAGE_TYPE_PNG:
+        f = ii_encoder_begin_png(enc, dpi);
+        break;
+    case II_IMAGE_TYPE_JPG:
+        f = ii_encoder_begin_jpg(enc, dpi, quality, progression);
+        break;
+    case II_IMAGE_TYPE_TIF:
+        f = ii_encoder_begin_tif(enc, dpi);
+        break;
+    default:
+        f = ii_encoder_begin_bmp(enc, dpi);
+        break;
+    }
+
+    if (!f)
+    {
+        enc->failed = true;
+        ii_encoder_end(enc);
+        return NULL;
+    }
+    return enc;
+}
+
+static II_ENCODER *
+ii_encoder_create(II_IMAGE_TYPE type, int width, int height, int bpp)
+{
+    II_ENCODER *enc;
+
+    if (type != II_IMAGE_TYPE_PNG && type != II_IMAGE_TYPE_JPG &&
+        type != II_IMAGE_TYPE_TIF && type != II_IMAGE_TYPE_BMP)
+    {
+        return NULL;
+    }
+    if (width <= 0 || height <= 0 || (bpp != 24 && bpp != 32))
+        return NULL;
+
+    enc = (II_ENCODER *)calloc(1, sizeof(II_ENCODER));
+    if (enc == NULL)
+        return NULL;
+
+    enc->type = type;
+    enc->width = width;
+    enc->height = height;
+    enc->bpp = bpp;
+    return enc;
+}
+
+IMAIO_API II_ENCODER * IIAPI
+ii_encoder_begin_a(II_CSTR pszFileName, II_IMAGE_TYPE type,
+                   int width, int height, int bpp,
+                   float dpi, int quality, bool progression)
+{
+    II_ENCODER *enc;
+
+    assert(pszFileName);
+    enc = ii_encoder_create(type, width, height, bpp);
+    if (enc == NULL)
+        return NULL;
+
+    enc->pszFileName = (char *)malloc(strlen(pszFileName) + 1);
+    if (enc->pszFileName == NULL)
+    {
+        free(enc);
+        return NULL;
+    }
+    strcpy(enc->pszFileName, pszFileName);
+
+    return ii_encoder_begin_common(enc, dpi, quality, progression);
+}
+
+IMAIO_API II_ENCODER * IIAPI
+ii_encoder_begin_w(II_CWSTR pszFileName, II_IMAGE_TYPE type,
+                   int width, int height, int bpp,
+                   float dpi, int quality, bool progression)
+{
+    II_ENCODER *enc;
+
+    assert(pszFileName);
+    enc = ii_encoder_create(type, width, height, bpp);
+    if (enc == NULL)
+        return NULL;
+
+    enc->pszFileNameW = (wchar_t *)
+        malloc((wcslen(pszFileName) + 1) * sizeof(wchar_t));
+    if (enc->pszFileNameW == NULL)
+    {
+        free(enc);
+        return NULL;
+    }
+    wcscpy(enc->pszFileNameW, pszFileName);
+
+    return ii_encoder_begin_common(enc, dpi, quality, progression);
+}
+
+static bool
+ii_encoder_write_row(II_ENCODER *enc, const uint8_t *pbRow)
+{
+    int32_t cb;
+
+    switch (enc->type)
+    {
+    case II_IMAGE_TYPE_PNG:
+        png_write_row(enc->png, (png_bytep)pbRow);
+        return true;
+
+    case II_IMAGE_TYPE_JPG:
+        ii_convert_pixels(enc->bpp == 24 ? II_PIXEL_FORMAT_BGR24 :
+                                           II_PIXEL_FORMAT_BGRA32, pbRow, 0,
+                          II_PIXEL_FORMAT_RGB24, enc->pbLine, 0,
+                          enc->width, 1);
+        jpeg_write_scanlines(&enc->comp, &enc->pbLine, 1);
+        return true;
+
+    case II_IMAGE_TYPE_TIF:
+        if (enc->bpp == 24)
+            ii_convert_pixels(II_PIXEL_FORMAT_BGR24, pbRow, 0,
+                              II_PIXEL_FORMAT_RGB24, enc->pbLine, 0,
+                              enc->width, 1);
+        else
+            ii_convert_pixels(II_PIXEL_FORMAT_BGRA32, pbRow, 0,
+                              II_PIXEL_FORMAT_RGBA32, enc->pbLine, 0,
+                              enc->width, 1);
+        return TIFFWriteScanline(enc->tif, enc->pbLine, enc->y, 0) >= 0;
+
+    default:
+        cb = enc->width * (enc->bpp / 8);
+        memcpy(enc->pbLine, pbRow, cb);
+        return ii_fseek64(enc->fp, enc->cbHeaders +
+                          (int64_t)(enc->height - 1 - enc->y) * enc->widthbytes,
+                          SEEK_SET) == 0 &&
+               fwrite(enc->pbLine, enc->widthbytes, 1, enc->fp) == 1;
+    }
+}
+
+IMAIO_API bool IIAPI
+ii_encoder_write_rows(II_ENCODER *enc, II_LPCVOID pvRows, int stride, int cy)
+{
+    const uint8_t *pbRow = (const uint8_t *)pvRows;
+
+    assert(enc);
+    if (enc->failed || cy < 0 || enc->y + cy > enc->height)
+    {
+        enc->failed = true;
+        return false;
+    }
+
+    if (enc->type == II_IMAGE_TYPE_PNG)
+    {
+        if (setjmp(png_jmpbuf(enc->png)))
+        {
+            enc->failed = true;
+            return false;
+        }
+    }
+    else if (enc->type == II_IMAGE_TYPE_JPG)
+    {
+        if (setjmp(enc->jerror.jmp))
+        {
+            enc->failed = true;
+            return false;
+        }
+    }
+
+    while (cy-- > 0)
+    {
+        if (!ii_encoder_write_row(enc, pbRow))
+        {
+            enc->failed = true;
+            return false;
+        }
+        pbRow += stride;
+        enc->y++;
+    }
+    return true;
+}
+
+IMAIO_API bool IIAPI
+ii_encoder_end(II_ENCODER *enc)
+{
+    bool f;
+
+    if (enc == NULL)
+        return false;
+
+    f = (!enc->failed && enc->y == enc->height);
+    switch (enc->type)
+    {
+    case II_IMAGE_TYPE_PNG:
+        if (f)
+        {
+            if (setjmp(png_jmpbuf(enc->png)))
+                f = false;
+            else
+                png_write_end(enc->png, enc->info);
+        }
+        png_destroy_write_struct(&enc->png, &enc->info);
+        break;
+
+    case II_IMAGE_TYPE_JPG:
+        if (enc->comp.err != NULL)
+        {
+            if (f)
+            {
+                if (setjmp(enc->jerror.jmp))
+                    f = false;
+                else
+                    jpeg_finish_compress(&enc->comp);
+            }
+            jpeg_destroy_compress(&enc->comp);
+        }
+        break;
+
+    case II_IMAGE_TYPE_TIF:
+        if (enc->tif)
+            TIFFClose(enc->tif);
+        break;
+
+    default:
+        break;
+    }
+
+    if (enc->fp && fclose(enc->fp) != 0)
+        f = false;
+
+    if (!f)
+    {
+        if (enc->pszFileNameW)
+            ii_wremove(enc->pszFileNameW);
+        else
+            remove(enc->pszFileName);
+    }
+
+    ii_free(enc->pbLine);
+    free(enc->pszFileName);
+    free(enc->pszFileNameW);
+    free(enc);
+    return f;
+}
+
+/*****************************************************************************/
+/* image types */
+
+IMAIO_API II_IMAGE_TYPE IIAPI
+ii_image_type_from_path_name_a(II_CSTR  pszFileName)
+{
+    II_CSTR pchDotExt = ii_find_dotext_a(pszFileName);
+    return ii_image_type_from_dotext_a(pchDotExt);
+}
+
+IMAIO_API II_IMAGE_TYPE IIAPI
+ii_image_type_from_path_name_w(II_CWSTR pszFileName)
+{
+    II_CWSTR pchDotExt = ii_find_dotext_w(pszFileName);
+    return ii_image_type_from_dotext_w(pchDotExt);
+}
+
+IMAIO_API II_IMAGE_TYPE IIAPI
+ii_image_type_from_dotext_a(II_CSTR  pchDotExt)
+{
+    II_CSTR pch;
+
+    if (pchDotExt == NULL || *pchDotExt == 0)
+        return II_IMAGE_TYPE_INVALID;
+    if (*pchDotExt == '.')
+        pch = pchDotExt + 1;
+    else
+        pch = pchDotExt;
+
+    if (ii_strcmpi_a(pch, "jpg") == 0 || ii_strcmpi_a(pch, "jpe") == 0 ||
+        ii_strcmpi_a(pch, "jpeg") == 0 || ii_strcmpi_a(pch, "jfif") == 0)
+    {
+        return II_IMAGE_TYPE_JPG;
+    }
+    else if (ii_strcmpi_a(pch, "gif") == 0)
+    {
+        return II_IMAGE_TYPE_GIF;
+    }
+    else if (ii_strcmpi_a(pch, "png") == 0)
+    {
+        return II_IMAGE_TYPE_PNG;
+    }
+    else if (ii_strcmpi_a(pch, "apng") == 0)
+    {
+        return II_IMAGE_TYPE_APNG;
+    }
+    else if (ii_strcmpi_a(pch, "tif") == 0 || ii_strcmpi_a(pch, "tiff") == 0)
+    {
+        return II_IMAGE_TYPE_TIF;
+    }
+    else if (ii_strcmpi_a(pch, "bmp") == 0 || ii_strcmpi_a(pch, "dib") == 0)
+    {
+        return II_IMAGE_TYPE_BMP;
+    }
+    return II_IMAGE_TYPE_INVALID;
+}
+
+IMAIO_API II_IMAGE_TYPE IIAPI
+ii_image_type_from_dotext_w(II_CWSTR pchDotExt)
+{
+    II_CWSTR pch;
+
+    if (pchDotExt == NULL || *pchDotExt == 0)
+        return II_IMAGE_TYPE_INVALID;
+    if (*pchDotExt == L'.')
+        pch = pchDotExt + 1;
+    else
+        pch = pchDotExt;
+
+    if (ii_strcmpi_w(pch, L"jpg") == 0 || ii_strcmpi_w(pch, L"jpe") == 0 ||
+        ii_strcmpi_w(pch, L"jpeg") == 0 || ii_strcmpi_w(pch, L"jfif") == 0)
+    {
+        return II_IMAGE_TYPE_JPG;
+    }
+    else if (ii_strcmpi_w(pch, L"gif") == 0)
+    {
+        return II_IMAGE_TYPE_GIF;
+    }
+    else if (ii_strcmpi_w(pch, L"png") == 0)
+    {
+        return II_IMAGE_TYPE_PNG;
+    }
+    else if (ii_strcmpi_w(pch, L"apng") == 0)
+    {
+        return II_IMAGE_TYPE_APNG;
+    }
+    else if (ii_strcmpi_w(pch, L"tif") == 0 || ii_strcmpi_w(pch, L"tiff") == 0)
+    {
+        return II_IMAGE_TYPE_TIF;
+    }
+    else if (ii_strcmpi_w(pch, L"bmp") == 0 || ii_strcmpi_w(pch, L"dib") == 0)
+    {
+        return II_IMAGE_TYPE_BMP;
+    }
+    return II_IMAGE_TYPE_INVALID;
+}
+
+IMAIO_API II_CSTR IIAPI
+ii_wildcards_from_image_type_a(II_IMAGE_TYPE type)
+{
+    switch (type)
+    {
+    case II_IMAGE_TYPE_JPG:
+        return "*.jpg;*.jpe;*.jpeg;*.jfif";
+    case II_IMAGE_TYPE_GIF:
+    case II_IMAGE_TYPE_ANIGIF:
+        return "*.gif";
+    case II_IMAGE_TYPE_PNG:
+        return "*.png";
+    case II_IMAGE_TYPE_APNG:
+        return "*.png;*.apng";
+    case II_IMAGE_TYPE_TIF:
+        return "*.tif;*.tiff";
+    case II_IMAGE_TYPE_BMP:
+        return "*.bmp;*.dib";
+    default:
+        return "";
+    }
+}
+
+IMAIO_API II_CWSTR IIAPI
+ii_wildcards_from_image_type_w(II_IMAGE_TYPE type)
+{
+    switch (type)
+    {
+    case II_IMAGE_TYPE_JPG:
+        return L"*.jpg;*.jpe;*.jpeg;*.jfif";
+    case II_IMAGE_TYPE_GIF:
+    case II_IMAGE_TYPE_ANIGIF:
+        return L"*.gif";
+    case II_IMAGE_TYPE_PNG:
+        return L"*.png";
+    case II_IMAGE_TYPE_APNG:
+        return L"*.png;*.apng";
+    case II_IMAGE_TYPE_TIF:
+        return L"*.tif;*.tiff";
+    case II_IMAGE_TYPE_BMP:
+        return L"*.bmp;*.dib";
+    default:
+        return L"";
+    }
+}
+
+IMAIO_API II_CSTR IIAPI
+ii_mime_from_path_name_a(II_CSTR pszFileName)
+{
+    II_CSTR pchDotExt = ii_find_dotext_a(pszFileName);
+    return ii_mime_from_dotext_a(pchDotExt);
+}
+
+IMAIO_API II_CWSTR IIAPI
+ii_mime_from_path_name_w(II_CWSTR pszFileName)
+{
+    II_CWSTR pchDotExt = ii_find_dotext_w(pszFileName);
+    return ii_mime_from_dotext_w(pchDotExt);
+}
+
+IMAIO_API II_CSTR IIAPI
+ii_mime_from_dotext_a(II_CSTR pchDotExt)
+{
+    II_IMAGE_TYPE type = ii_image_type_from_dotext_a(pchDotExt);
+    switch (type)
+    {
+    case II_IMAGE_TYPE_JPG:
+        return "image/jpeg";
+    case II_IMAGE_TYPE_GIF:
+    case II_IMAGE_TYPE_ANIGIF:
+        return "image/gif";
+    case II_IMAGE_TYPE_PNG:
+    case II_IMAGE_TYPE_APNG:
+        return "image/png";
+    case II_IMAGE_TYPE_TIF:
+        return "image/tiff";
+    case II_IMAGE_TYPE_BMP:
+        return "image/bmp";
+    default:
+        return "";
+    }
+}
+
+IMAIO_API II_CWSTR IIAPI
+ii_mime_from_dotext_w(II_CWSTR pchDotExt)
+{
+    II_IMAGE_TYPE type = ii_image_type_from_dotext_w(pchDotExt);
+    switch (type)
+    {
+    case II_IMAGE_TYPE_JPG:
+        return L"image/jpeg";
+    case II_IMAGE_TYPE_GIF:
+    case II_IMAGE_TYPE_ANIGIF:
+        return L"image/gif";
+    case II_IMAGE_TYPE_PNG:
+    case II_IMAGE_TYPE_APNG:
+        return L"image/png";
+    case II_IMAGE_TYPE_TIF:
+        return L"image/tiff";
+    case II_IMAGE_TYPE_BMP:
+        return L"image/bmp";
+    default:
+        return L"";
+    }
+}
+
+IMAIO_API II_CSTR IIAPI
+ii_dotext_from_mime_a(II_CSTR  pszMIME)
+{
+    if (ii_strcmpi_a(pszMIME, "image/jpeg") == 0)
+        return ".jpg";
+    if (ii_strcmpi_a(pszMIME, "image/gif") == 0)
+        return ".gif";
+    if (ii_strcmpi_a(pszMIME, "image/png") == 0)
+        return ".png";
+    if (ii_strcmpi_a(pszMIME, "image/tiff") == 0)
+        return ".tif";
+    if (ii_strcmpi_a(pszMIME, "image/bmp") == 0)
+        return ".bmp";
+    return "";
+}
+
+IMAIO_API II_CWSTR IIAPI
+ii_dotext_from_mime_w(II_CWSTR pszMIME)
+{
+    if (ii_strcmpi_w(pszMIME, L"image/jpeg") == 0)
+        return L".jpg";
+    if (ii_strcmpi_w(pszMIME, L"image/gif") == 0)
+        return L".gif";
+    if (ii_strcmpi_w(pszMIME, L"image/png") == 0)
+        return L".png";
+    if (ii_strcmpi_w(pszMIME, L"image/tiff") == 0)
+        return L".tif";
+    if (ii_strcmpi_w(pszMIME, L"image/bmp") == 0)
+        return L".bmp";
+    return L"";
+}
+
+IMAIO_API II_CSTR IIAPI
+ii_mime_from_image_type_a(II_IMAGE_TYPE type)
+{
+    switch (type)
+    {
+    case II_IMAGE_TYPE_JPG:
+        return "image/jpeg";
+    case II_IMAGE_TYPE_GIF:
+        return "image/gif";
+    case II_IMAGE_TYPE_PNG:
+    case II_IMAGE_TYPE_APNG:
+        return "image/png";
+    case II_IMAGE_TYPE_TIF:
+        return "image/tiff";
+    case II_IMAGE_TYPE_BMP:
+        return "image/bmp";
+    default:
+        return "";
+    }
+}
+
+IMAIO_API II_CWSTR IIAPI
+ii_mime_from_image_type_w(II_IMAGE_TYPE type)
+{
+    switch (type)
+    {
+    case II_IMAGE_TYPE_JPG:
+        return L"image/jpeg";
+    case II_IMAGE_TYPE_GIF:
+        return L"image/gif";
+    case II_IMAGE_TYPE_PNG:
+    case II_IMAGE_TYPE_APNG:
+        return L"image/png";
+    case II_IMAGE_TYPE_TIF:
+        return L"image/tiff";
+    case II_IMAGE_TYPE_BMP:
+        return L"image/bmp";
+    default:
+        return L"";
+    }
+}
+
+IMAIO_API II_IMAGE_TYPE IIAPI
+ii_image_type_from_mime_a(II_CSTR pszMIME)
+{
+    if (ii_strcmpi_a(pszMIME, "image/jpeg") == 0)
+        return II_IMAGE_TYPE_JPG;
+    if (ii_strcmpi_a(pszMIME, "image/gif") == 0)
+        return II_IMAGE_TYPE_GIF;
+    if (ii_strcmpi_a(pszMIME, "image/png") == 0)
+        return II_IMAGE_TYPE_PNG;
+    if (ii_strcmpi_a(pszMIME, "image/apng") == 0)
+        return II_IMAGE_TYPE_APNG;
+    if (ii_strcmpi_a(pszMIME, "image/tiff") == 0)
+        return II_IMAGE_TYPE_TIF;
+    if (ii_strcmpi_a(pszMIME, "image/bmp") == 0)
+        return II_IMAGE_TYPE_BMP;
+    return II_IMAGE_TYPE_INVALID;
+}
+
+IMAIO_API II_IMAGE_TYPE IIAPI
+ii_image_type_from_mime_w(II_CWSTR pszMIME)
+{
+    if (ii_strcmpi_w(pszMIME, L"image/jpeg") == 0)
+        return II_IMAGE_TYPE_JPG;
+    if (ii_strcmpi_w(pszMIME, L"image/gif") == 0)
+        return II_IMAGE_TYPE_GIF;
+    if (ii_strcmpi_w(pszMIME, L"image/png") == 0)
+        return II_IMAGE_TYPE_PNG;
+    if (ii_strcmpi_w(pszMIME, L"image/apng") == 0)
+        return II_IMAGE_TYPE_APNG;
+    if (ii_strcmpi_w(pszMIME, L"image/tiff") == 0)
+        return II_IMAGE_TYPE_TIF;
+    if (ii_strcmpi_w(pszMIME, L"image/bmp") == 0)
+        return II_IMAGE_TYPE_BMP;
+    return II_IMAGE_TYPE_INVALID;
+}
+
+/*****************************************************************************/
+/* C/C++ switching */
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+/*****************************************************************************/
@@ -0,0 +1,946 @@
+/*****************************************************************************/
+/* imaio_mem.c --- imaio for memory images (no window system)                */
+/* Copyright (C) 2015 katahiromz. All Rights Reserved.                       */
+/*****************************************************************************/
+
+#define IMAIO_BUILDING 1
+
+/* NOTE: The 64-bit off_t of fseeko, ftello and fstat must be chosen before
+ *       the first system header, which imaio.h includes. */
+#if !defined(_WIN32) && !defined(_FILE_OFFSET_BITS)
+    #define _FILE_OFFSET_BITS 64
+#endif
+
+#include "imaio.h"
+
+#include <string.h>
+#include <wchar.h>
+#include <assert.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/*****************************************************************************/
+
+#define II_WIDTHBYTES(i) (((i) + 31) / 32 * 4)
+
+/* the size of BITMAPFILEHEADER and BITMAPINFOHEADER on disk */
+#define II_BMP_FILEHEADER_SIZE  14
+#define II_BMP_INFOHEADER_SIZE  40
+
+#ifndef min
+    #define min(a, b)   (((a) < (b)) ? (a) : (b))
+#endif
+
+/*****************************************************************************/
+/* C/C++ switching */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*****************************************************************************/
+
+/* create an image without the pixels */
+static II_HIMAGE
+ii_create_header(int width, int height, int bpp, const II_PALETTE *table)
+{
+    II_HIMAGE hbmNew;
+    int64_t bits, stride;
+    int i;
+
+    assert(width > 0);
+    assert(height > 0);
+    assert(bpp == 1 || bpp == 4 || bpp == 8 || bpp == 24 || bpp == 32);
+
+    /* NOTE: The sizes come from files, so they are checked in 64 bits. */
+    bits = (int64_t)width * bpp;
+    stride = II_WIDTHBYTES(bits);
+    if (width <= 0 || height <= 0 || bits > INT_MAX ||
+        stride * height > INT_MAX || (uint64_t)stride * height > SIZE_MAX)
+    {
+        return NULL;
+    }
+
+    hbmNew = (II_HIMAGE)calloc(1, sizeof(II_IMAGE));
+    if (hbmNew == NULL)
+        return NULL;
+
+    hbmNew->width = width;
+    hbmNew->height = height;
+    hbmNew->bpp = bpp;
+    hbmNew->stride = (int)stride;
+
+    if (bpp <= 8)
+    {
+        /* NOTE: The color table of a DIB has 2^bpp entries */
+        hbmNew->palette.num_colors = 1 << bpp;
+        if (table)
+        {
+            for (i = 0; i < table->num_colors && i < (1 << bpp); ++i)
+            {
+                hbmNew->palette.colors[i] = table->colors[i];
+                hbmNew->palette.colors[i].value[3] = 0;
+            }
+        }
+    }
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_create(int width, int height, int bpp, const II_PALETTE *table)
+{
+    II_HIMAGE hbmNew;
+
+    hbmNew = ii_create_header(width, height, bpp, table);
+    if (hbmNew == NULL)
+        return NULL;
+
+    hbmNew->data = (uint8_t *)ii_alloc(hbmNew->stride * height);
+    if (hbmNew->data == NULL)
+    {
+        free(hbmNew);
+        return NULL;
+    }
+    /* NOTE: A DIB section is zero-filled */
+    memset(hbmNew->data, 0, hbmNew->stride * height);
+    return hbmNew;
+}
+
+IMAIO_API void IIAPI
+ii_destroy(II_HIMAGE hbm)
+{
+    if (hbm)
+    {
+        /* NOTE: The last image of the shared pixels frees them. */
+        if (hbm->refs == NULL || --*hbm->refs == 0)
+        {
+            ii_free(hbm->data);
+            free(hbm->refs);
+        }
+        free(hbm);
+    }
+}
+
+IMAIO_API bool IIAPI
+ii_get_info(II_HIMAGE hbm, II_IMGINFO *pbm)
+{
+    assert(hbm);
+    assert(pbm);
+    if (hbm == NULL)
+        return false;
+
+    pbm->bmType = 0;
+    pbm->bmWidth = hbm->width;
+    pbm->bmHeight = hbm->height;
+    pbm->bmWidthBytes = hbm->stride;
+    pbm->bmPlanes = 1;
+    pbm->bmBitsPixel = (uint16_t)hbm->bpp;
+    pbm->bmBits = hbm->data;
+    /* NOTE: The pixels may be written through bmBits. */
+    hbm->alpha_state = II_ALPHA_UNKNOWN;
+    return true;
+}
+
+IMAIO_API II_PALETTE * IIAPI
+ii_get_palette(II_HIMAGE hbm)
+{
+    assert(hbm);
+    if (hbm == NULL || hbm->palette.num_colors == 0)
+        return NULL;
+
+    return ii_palette_create(hbm->palette.num_colors, hbm->palette.colors);
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_clone(II_HIMAGE hbm)
+{
+    II_HIMAGE hbmNew;
+
+    assert(hbm);
+    hbmNew = ii_create(hbm->width, hbm->height, hbm->bpp, &hbm->palette);
+    assert(hbmNew);
+    if (hbmNew)
+    {
+        memcpy(hbmNew->data, hbm->data, hbm->stride * hbm->height);
+    }
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_share(II_HIMAGE hbm)
+{
+    II_HIMAGE hbmNew;
+
+    assert(hbm);
+    if (hbm->refs == NULL)
+    {
+        hbm->refs = (int *)malloc(sizeof(int));
+        if (hbm->refs == NULL)
+            return ii_clone(hbm);
+        *hbm->refs = 1;
+    }
+
+    hbmNew = (II_HIMAGE)malloc(sizeof(II_IMAGE));
+    if (hbmNew == NULL)
+        return NULL;
+    *hbmNew = *hbm;
+    ++*hbm->refs;
+    return hbmNew;
+}
+
+IMAIO_API II_ALPHA_STATE IIAPI
+ii_get_alpha_state(II_HIMAGE hbm)
+{
+    II_VIEW view;
+
+    assert(hbm);
+    if (hbm == NULL)
+        return II_ALPHA_UNKNOWN;
+    if (hbm->alpha_state == II_ALPHA_UNKNOWN && ii_view_create(&view, hbm))
+        hbm->alpha_state = ii_view_alpha_state(&view);
+    return (II_ALPHA_STATE)hbm->alpha_state;
+}
+
+IMAIO_API bool IIAPI
+ii_make_writable(II_HIMAGE hbm)
+{
+    uint8_t *data;
+
+    assert(hbm);
+    if (hbm == NULL)
+        return false;
+    /* NOTE: The pixels will be modified. */
+    hbm->alpha_state = II_ALPHA_UNKNOWN;
+    if (hbm->refs == NULL)
+        return true;
+
+    if (*hbm->refs > 1)
+    {
+        /* copy on write */
+        data = (uint8_t *)ii_alloc(hbm->stride * hbm->height);
+        if (data == NULL)
+            return false;
+        memcpy(data, hbm->data, hbm->stride * hbm->height);
+        --*hbm->refs;
+        hbm->data = data;
+    }
+    else
+    {
+        free(hbm->refs);
+    }
+    hbm->refs = NULL;
+    return true;
+}
+
+/*****************************************************************************/
+/* pixel access */
+
+/* get the color of a pixel at the bottom-up row */
+static ii_inline II_COLOR8
+ii_get_pixel_color(II_HIMAGE hbm, const uint8_t *pbRow, int x)
+{
+    II_COLOR8 color;
+    int i;
+
+    switch (hbm->bpp)
+    {
+    case 32:
+        memcpy(color.value, &pbRow[x << 2], 4);
+        return color;
+    case 24:
+        color.value[0] = pbRow[x * 3 + 0];
+        color.value[1] = pbRow[x * 3 + 1];
+        color.value[2] = pbRow[x * 3 + 2];
+        color.value[3] = 0xFF;
+        return color;
+    case 8:
+        i = pbRow[x];
+        break;
+    case 4:
+        i = (pbRow[x >> 1] >> ((x & 1) ? 0 : 4)) & 0x0F;
+        break;
+    case 1:
+        i = (pbRow[x >> 3] >> (7 - (x & 7))) & 0x01;
+        break;
+    default:
+        assert(0);
+        i = 0;
+    }
+    color = hbm->palette.colors[i];
+    color.value[3] = 0xFF;
+    return color;
+}
+
+/* set the index of a pixel of 1, 4 or 8 bpp */
+static ii_inline void
+ii_set_pixel_index(II_HIMAGE hbm, uint8_t *pbRow, int x, int i)
+{
+    switch (hbm->bpp)
+    {
+    case 8:
+        pbRow[x] = (uint8_t)i;
+        break;
+    case 4:
+        if (x & 1)
+            pbRow[x >> 1] = (uint8_t)((pbRow[x >> 1] & 0xF0) | (i & 0x0F));
+        else
+            pbRow[x >> 1] = (uint8_t)((pbRow[x >> 1] & 0x0F) | ((i & 0x0F) << 4));
+        break;
+    case 1:
+        if (i & 1)
+            pbRow[x >> 3] |= (uint8_t)(0x80 >> (x & 7));
+        else
+            pbRow[x >> 3] &= (uint8_t)~(0x80 >> (x & 7));
+        break;
+    default:
+        assert(0);
+    }
+}
+
+/*****************************************************************************/
+
+IMAIO_API II_HIMAGE IIAPI
+ii_stretched_24bpp(II_HIMAGE hbm, int cxNew, int cyNew)
+{
+    II_HIMAGE hbm32bpp, hbmNew;
+
+    assert(cxNew > 0);
+    assert(cyNew > 0);
+    hbm32bpp = ii_stretched_32bpp(hbm, cxNew, cyNew);
+    if (hbm32bpp == NULL)
+        return NULL;
+
+    hbmNew = ii_24bpp(hbm32bpp);
+    ii_destroy(hbm32bpp);
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_24bpp(II_HIMAGE hbm)
+{
+    II_HIMAGE hbmNew;
+    II_COLOR8 color;
+    uint8_t *pbSrc, *pbNew;
+    int x, y;
+
+    assert(hbm);
+    if (hbm == NULL)
+        return NULL;
+
+    if (hbm->bpp == 24)
+        return ii_clone(hbm);
+
+    hbmNew = ii_create_24bpp(hbm->width, hbm->height);
+    if (hbmNew && hbm->bpp == 32)
+    {
+        ii_convert_pixels(II_PIXEL_FORMAT_BGRA32, hbm->data, hbm->stride,
+                          II_PIXEL_FORMAT_BGR24, hbmNew->data, hbmNew->stride,
+                          hbm->width, hbm->height);
+    }
+    else if (hbmNew)
+    {
+        for (y = 0; y < hbm->height; ++y)
+        {
+            pbSrc = &hbm->data[y * hbm->stride];
+            pbNew = &hbmNew->data[y * hbmNew->stride];
+            for (x = 0; x < hbm->width; ++x)
+            {
+                color = ii_get_pixel_color(hbm, pbSrc, x);
+                *pbNew++ = color.value[0];
+                *pbNew++ = color.value[1];
+                *pbNew++ = color.value[2];
+            }
+        }
+    }
+    return hbmNew;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_32bpp(II_HIMAGE hbm)
+{
+    II_HIMAGE hbmNew;
+    II_COLOR8 color;
+    uint8_t *pbSrc, *pbNew;
+    int x, y;
+
+    assert(hbm);
+    if (hbm == NULL)
+        return NULL;
+
+    if (hbm->bpp == 32)
+        return ii_clone(hbm);
+
+    hbmNew = ii_create_32bpp(hbm->width, hbm->height);
+    if (hbmNew && hbm->bpp == 24)
+    {
+        ii_convert_pixels(II_PIXEL_FORMAT_BGR24, hbm->data, hbm->stride,
+                          II_PIXEL_FORMAT_BGRA32, hbmNew->data, hbmNew->stride,
+                          hbm->width, hbm->height);
+    }
+    else if (hbmNew)
+    {
+        for (y = 0; y < hbm->height; ++y)
+        {
+            pbSrc = &hbm->data[y * hbm->stride];
+            pbNew = &hbmNew->data[y * hbmNew->stride];
+            for (x = 0; x < hbm->width; ++x)
+            {
+                color = ii_get_pixel_color(hbm, pbSrc, x);
+                memcpy(pbNew, color.value, 4);
+                pbNew += 4;
+            }
+        }
+    }
+    return hbmNew;
+}
+
+/*****************************************************************************/
+/* drawing */
+
+/* blend a premultiplied 32bpp image as AlphaBlend(AC_SRC_ALPHA) does */
+static void IIAPI
+ii_alpha_blend(
+    II_HIMAGE hbmDest, int x, int y,
+    II_HIMAGE hbmSrc, int xSrc, int ySrc, int cx, int cy, uint8_t bSCA)
+{
+    int xx, yy, i;
+    uint32_t alpha, inv;
+    uint8_t *pbSrc, *pbDest;
+    II_COLOR8 color, src;
+
+    assert(hbmSrc->bpp == 32);
+
+    /* clipping */
+    if (xSrc < 0) { x -= xSrc; cx += xSrc; xSrc = 0; }
+    if (ySrc < 0) { y -= ySrc; cy += ySrc; ySrc = 0; }
+    if (x < 0) { xSrc -= x; cx += x; x = 0; }
+    if (y < 0) { ySrc -= y; cy += y; y = 0; }
+    cx = min(cx, min(hbmSrc->width - xSrc, hbmDest->width - x));
+    cy = min(cy, min(hbmSrc->height - ySrc, hbmDest->height - y));
+    if (cx <= 0 || cy <= 0)
+        return;
+
+    for (yy = 0; yy < cy; ++yy)
+    {
+        pbSrc = &hbmSrc->data[(hbmSrc->height - 1 - (ySrc + yy)) * hbmSrc->stride];
+        pbDest = &hbmDest->data[(hbmDest->height - 1 - (y + yy)) * hbmDest->stride];
+        for (xx = 0; xx < cx; ++xx)
+        {
+            memcpy(src.value, &pbSrc[(xSrc + xx) << 2], 4);
+            if (bSCA != 255)
+            {
+                for (i = 0; i < 4; ++i)
+                    src.value[i] = (uint8_t)(src.value[i] * bSCA / 255);
+            }
+            alpha = src.value[3];
+            inv = 255 - alpha;
+
+            switch (hbmDest->bpp)
+            {
+            case 32:
+                for (i = 0; i < 4; ++i)
+                {
+                    pbDest[((x + xx) << 2) + i] = (uint8_t)(src.value[i] +
+                        pbDest[((x + xx) << 2) + i] * inv / 255);
+                }
+                break;
+            case 24:
+                for (i = 0; i < 3; ++i)
+                {
+                    pbDest[(x + xx) * 3 + i] = (uint8_t)(src.value[i] +
+                        pbDest[(x + xx) * 3 + i] * inv / 255);
+                }
+                break;
+            default:
+                /* paletted: map the blended color to the nearest index */
+                color = ii_get_pixel_color(hbmDest, pbDest, x + xx);
+                for (i = 0; i < 3; ++i)
+                {
+                    color.value[i] = (uint8_t)(src.value[i] +
+                        color.value[i] * inv / 255);
+                }
+                ii_set_pixel_index(hbmDest, pbDest, x + xx,
+                    ii_color_nearest_index(&hbmDest->palette, &color));
+                break;
+            }
+        }
+    }
+}
+
+IMAIO_API void IIAPI
+ii_draw(
+    II_DEVICE hdc, int x, int y,
+    II_HIMAGE hbmSrc, int xSrc, int ySrc, int cxSrc, int cySrc,
+    const int *pi_trans, uint8_t bSCA)
+{
+    II_HIMAGE hbmNewSrc;
+
+    assert(hdc);
+    assert(hbmSrc);
+    if (hdc == NULL || hbmSrc == NULL || !ii_make_writable(hdc))
+        return;
+
+    /* NOTE: The paletted destinations need the nearest colors. */
+    if (ii_composite(hdc, x, y, hbmSrc, xSrc, ySrc, cxSrc, cySrc,
+                     pi_trans, bSCA, 0))
+    {
+        return;
+    }
+
+    if (hbmSrc->bpp >= 24)
+    {
+        assert(pi_trans == NULL || *pi_trans == -1);
+        hbmNewSrc = ii_32bpp(hbmSrc);
+    }
+    else
+    {
+        hbmNewSrc = ii_32bpp_from_trans_8bpp(hbmSrc, pi_trans);
+    }
+    if (hbmNewSrc == NULL)
+        return;
+
+    ii_premultiply(hbmNewSrc);
+    ii_alpha_blend(hdc, x, y, hbmNewSrc, xSrc, ySrc, cxSrc, cySrc, bSCA);
+    ii_destroy(hbmNewSrc);
+}
+
+IMAIO_API void IIAPI
+ii_put(
+    II_HIMAGE hbm, int x, int y,
+    II_HIMAGE hbmSrc, int xSrc, int ySrc, int cxSrc, int cySrc,
+    const int *pi_trans, uint8_t bSCA)
+{
+    /* NOTE: A memory image is its own drawing device. */
+    ii_draw(hbm, x, y, hbmSrc, xSrc, ySrc, cxSrc, cySrc, pi_trans, bSCA);
+}
+
+/*****************************************************************************/
+/* Windows bitmap */
+
+static ii_inline uint16_t
+ii_le16(const uint8_t *pb)
+{
+    return (uint16_t)(pb[0] | (pb[1] << 8));
+}
+
+static ii_inline uint32_t
+ii_le32(const uint8_t *pb)
+{
+    return pb[0] | (pb[1] << 8) | (pb[2] << 16) | ((uint32_t)pb[3] << 24);
+}
+
+static ii_inline void
+ii_put_le16(uint8_t *pb, uint16_t value)
+{
+    pb[0] = (uint8_t)value;
+    pb[1] = (uint8_t)(value >> 8);
+}
+
+static ii_inline void
+ii_put_le32(uint8_t *pb, uint32_t value)
+{
+    pb[0] = (uint8_t)value;
+    pb[1] = (uint8_t)(value >> 8);
+    pb[2] = (uint8_t)(value >> 16);
+    pb[3] = (uint8_t)(value >> 24);
+}
+
+/* NOTE: ii_bmp_read only reads the resolution if hbm is not NULL. */
+static II_HIMAGE
+ii_bmp_read(II_STREAM *stream, II_HIMAGE hbm, float *dpi)
+{
+    uint8_t bf[II_BMP_FILEHEADER_SIZE], bi[II_BMP_INFOHEADER_SIZE];
+    uint8_t quad[4];
+    uint32_t bfOffBits, biSize, biCompression, biClrUsed;
+    int32_t width, height;
+    int bpp, i, y, stride;
+    II_PALETTE table;
+    bool bottom_up;
+    int64_t base;
+
+    assert(stream);
+    base = stream->tell_proc(stream);
+    if (stream->read_proc(stream, bf, sizeof(bf)) != sizeof(bf) ||
+        stream->read_proc(stream, bi, sizeof(bi)) != sizeof(bi))
+    {
+        return hbm;
+    }
+
+    bfOffBits = ii_le32(&bf[10]);
+    biSize = ii_le32(&bi[0]);
+    width = (int32_t)ii_le32(&bi[4]);
+    height = (int32_t)ii_le32(&bi[8]);
+    bpp = ii_le16(&bi[14]);
+    biCompression = ii_le32(&bi[16]);
+    biClrUsed = ii_le32(&bi[32]);
+    if (ii_le16(&bf[0]) != 0x4D42 || biSize < II_BMP_INFOHEADER_SIZE ||
+        bfOffBits < II_BMP_FILEHEADER_SIZE + biSize)
+    {
+        return hbm;
+    }
+
+    if (dpi)
+        *dpi = (float)((int32_t)ii_le32(&bi[24]) * 2.54 / 100.0);
+
+    if (hbm || width <= 0 || height == 0 || height == INT32_MIN ||
+        biCompression != 0 /* BI_RGB */ ||
+        (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24 && bpp != 32))
+    {
+        return hbm;
+    }
+
+    /* color table */
+    memset(&table, 0, sizeof(table));
+    if (bpp <= 8)
+    {
+        table.num_colors = biClrUsed ? (int)min(biClrUsed, 256u) : (1 << bpp);
+        stream->seek_proc(stream, base + II_BMP_FILEHEADER_SIZE + biSize,
+                          SEEK_SET);
+        for (i = 0; i < table.num_colors; ++i)
+        {
+            if (stream->read_proc(stream, quad, 4) != 4)
+                break;
+            memcpy(table.colors[i].value, quad, 4);
+        }
+    }
+
+    bottom_up = (height > 0);
+    height = abs(height);
+
+    hbm = ii_create(width, height, bpp, (bpp <= 8) ? &table : NULL);
+    if (hbm == NULL)
+        return NULL;
+
+    /* pixels */
+    stride = hbm->stride;
+    if (!stream->seek_proc(stream, base + bfOffBits, SEEK_SET))
+    {
+        ii_destroy(hbm);
+        return NULL;
+    }
+    for (y = 0; y < height; ++y)
+    {
+        i = bottom_up ? y : (height - 1 - y);
+        if (stream->read_proc(stream, &hbm->data[i * stride], stride) !=
+            (size_t)stride)
+        {
+            ii_destroy(hbm);
+            hbm = NULL;
+            break;
+        }
+    }
+
+    return hbm;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_bmp_load_stream(II_STREAM *stream, float *dpi)
+{
+    return ii_bmp_read(stream, NULL, dpi);
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_bmp_load_common(II_HFILE hFile, II_HIMAGE hbm, float *dpi)
+{
+    II_STREAM stream;
+
+    assert(hFile);
+    ii_stream_init_file(&stream, hFile);
+    hbm = ii_bmp_read(&stream, hbm, dpi);
+    fclose(hFile);
+    return hbm;
+}
+
+/* NOTE: ii_bmp_load_path reads the file through a read-only mapping. The
+ *       pixels are always copied, so the image does not depend on the file. */
+static II_HIMAGE
+ii_bmp_load_path(const char *pszFileName, float *dpi)
+{
+    FILE *fp;
+    int fd;
+    struct stat st;
+    void *pv = MAP_FAILED;
+    II_STREAM stream;
+    II_MEMORY memory;
+    II_HIMAGE hbm;
+
+    fd = open(pszFileName, O_RDONLY);
+    if (fd != -1)
+    {
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > 0 && (uint64_t)st.st_size <= 0xFFFFFFFF)
+        {
+            pv = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+                      fd, 0);
+        }
+        close(fd);
+    }
+
+    if (pv != MAP_FAILED)
+    {
+        memory.m_pb = (const uint8_t *)pv;
+        memory.m_i = 0;
+        memory.m_size = (uint32_t)st.st_size;
+        ii_stream_init_mem(&stream, &memory);
+
+        hbm = ii_bmp_read(&stream, NULL, dpi);
+        munmap(pv, (size_t)st.st_size);
+        return hbm;
+    }
+
+    fp = fopen(pszFileName, "rb");
+    if (fp)
+        return ii_bmp_load_common(fp, NULL, dpi);
+    return NULL;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_bmp_load_a(II_CSTR pszFileName, float *dpi)
+{
+    return ii_bmp_load_path(pszFileName, dpi);
+}
+
+/* convert a wide string to a malloc'ed multibyte string */
+static char * IIAPI
+ii_ansi_from_wide(II_CWSTR pszWide)
+{
+    size_t len;
+    char *psz;
+
+    len = wcstombs(NULL, pszWide, 0);
+    if (len == (size_t)-1)
+        return NULL;
+    psz = (char *)malloc(len + 1);
+    if (psz)
+        wcstombs(psz, pszWide, len + 1);
+    return psz;
+}
+
+IMAIO_API II_HIMAGE IIAPI
+ii_bmp_load_w(II_CWSTR pszFileName, float *dpi)
+{
+    II_HIMAGE hbm = NULL;
+    char *psz;
+
+    psz = ii_ansi_from_wide(pszFileName);
+    if (psz)
+        hbm = ii_bmp_load_path(psz, dpi);
+    free(psz);
+    return hbm;
+}
+
+IMAIO_API bool IIAPI
+ii_bmp_save_stream(II_STREAM *stream, II_HIMAGE hbm, float dpi)
+{
+    uint8_t bf[II_BMP_FILEHEADER_SIZE], bi[II_BMP_INFOHEADER_SIZE];
+    uint32_t cColors, cbColors, cbImage, cb;
+    int32_t ppm;
+
+    assert(stream);
+    if (hbm == NULL)
+        return false;
+
+    if (hbm->bpp < 16)
+        cColors = 1 << hbm->bpp;
+    else
+        cColors = 0;
+    cbColors = cColors * 4;
+    cbImage = hbm->stride * hbm->height;
+    cb = II_BMP_FILEHEADER_SIZE + II_BMP_INFOHEADER_SIZE + cbColors;
+
+    memset(bf, 0, sizeof(bf));
+    ii_put_le16(&bf[0], 0x4D42);
+    ii_put_le32(&bf[2], cb + cbImage);
+    ii_put_le32(&bf[10], cb);
+
+    memset(bi, 0, sizeof(bi));
+    ii_put_le32(&bi[0], II_BMP_INFOHEADER_SIZE);
+    ii_put_le32(&bi[4], hbm->width);
+    ii_put_le32(&bi[8], hbm->height);
+    ii_put_le16(&bi[12], 1);
+    ii_put_le16(&bi[14], (uint16_t)hbm->bpp);
+    ii_put_le32(&bi[20], cbImage);
+    if (dpi != 0.0)
+    {
+        ppm = (int32_t)(dpi * 100 / 2.54 + 0.5);
+        ii_put_le32(&bi[24], ppm);
+        ii_put_le32(&bi[28], ppm);
+    }
+
+    return stream->write_proc(stream, bf, sizeof(bf)) == sizeof(bf) &&
+           stream->write_proc(stream, bi, sizeof(bi)) == sizeof(bi) &&
+           stream->write_proc(stream, hbm->palette.colors, cbColors) ==
+               cbColors &&
+           stream->write_proc(stream, hbm->data, cbImage) == cbImage;
+}
+
+IMAIO_API bool IIAPI
+ii_bmp_save_common(II_HFILE hFile, II_HIMAGE hbm, float dpi)
+{
+    II_STREAM stream;
+    bool f;
+
+    assert(hFile);
+    ii_stream_init_file(&stream, hFile);
+    f = ii_bmp_save_stream(&stream, hbm, dpi);
+    if (fclose(hFile) != 0)
+        f = false;
+    return f;
+}
+
+IMAIO_API bool IIAPI
+ii_bmp_save_a(II_CSTR pszFileName, II_HIMAGE hbm, float dpi)
+{
+    FILE *fp;
+
+    fp = fopen(pszFileName, "wb");
+    if (fp)
+    {
+        if (ii_bmp_save_common(fp, hbm, dpi))
+        {
+            return true;
+        }
+        remove(pszFileName);
+    }
+    return false;
+}
+
+IMAIO_API bool IIAPI
+ii_bmp_save_w(II_CWSTR pszFileName, II_HIMAGE hbm, float dpi)
+{
+    FILE *fp;
+    char *psz;
+    bool f = false;
+
+    psz = ii_ansi_from_wide(pszFileName);
+    if (psz == NULL)
+        return false;
+    fp = fopen(psz, "wb");
+    if (fp)
+    {
+        f = ii_bmp_save_common(fp, hbm, dpi);
+        if (!f)
+            remove(psz);
+    }
+    free(psz);
+    return f;
+}
+
+/*****************************************************************************/
+/* file names */
+
+IMAIO_API II_CSTR IIAPI
+ii_find_file_title_a(II_CSTR pszPath)
+{
+    II_CSTR pch1, pch2;
+
+    assert(pszPath);
+    pch1 = strrchr(pszPath, '\\');
+    pch2 = strrchr(pszPath, '/');
+    if (pch1 == NULL && pch2 == NULL)
+        return pszPath;
+    if (pch1 == NULL)
+        return pch2 + 1;
+    if (pch2 == NULL)
+        return pch1 + 1;
+    if (pch1 < pch2)
+        return pch2 + 1;
+    else
+        return pch1 + 1;
+}
+
+IMAIO_API II_CWSTR IIAPI
+ii_find_file_title_w(II_CWSTR pszPath)
+{
+    II_CWSTR pch1, pch2;
+
+    assert(pszPath);
+    pch1 = wcsrchr(pszPath, L'\\');
+    pch2 = wcsrchr(pszPath, L'/');
+    if (pch1 == NULL && pch2 == NULL)
+        return pszPath;
+    if (pch1 == NULL)
+        return pch2 + 1;
+    if (pch2 == NULL)
+        return pch1 + 1;
+    if (pch1 < pch2)
+        return pch2 + 1;
+    else
+        return pch1 + 1;
+}
+
+IMAIO_API II_CSTR IIAPI
+ii_find_dotext_a(II_CSTR pszPath)
+{
+    II_CSTR pch;
+
+    assert(pszPath);
+    pszPath = ii_find_file_title_a(pszPath);
+    pch = strrchr(pszPath, '.');
+    if (pch)
+        return pch;
+    else
+        return pszPath + strlen(pszPath);
+}
+
+IMAIO_API II_CWSTR IIAPI
+ii_find_dotext_w(II_CWSTR pszPath)
+{
+    II_CWSTR pch;
+
+    assert(pszPath);
+    pszPath = ii_find_file_title_w(pszPath);
+    pch = wcsrchr(pszPath, L'.');
+    if (pch)
+        return pch;
+    else
+        return pszPath + wcslen(pszPath);
+}
+
+IMAIO_API char * IIAPI
+ii_make_filter_a(char *pszFilter)
+{
+    char *pszSave;
+
+    assert(pszFilter);
+    pszSave = pszFilter;
+    while (*pszFilter)
+    {
+        if (*pszFilter == '|')
+        {
+            *pszFilter = 0;
+        }
+        pszFilter++;
+    }
+    return pszSave;
+}
+
+IMAIO_API wchar_t * IIAPI
+ii_make_filter_w(wchar_t *pszFilter)
+{
+    wchar_t *pszSave;
+
+    assert(pszFilter);
+    pszSave = pszFilter;
+    while (*pszFilter)
+    {
+        if (*pszFilter == L'|')
+        {
+            *pszFilter = 0;
+        }
+        pszFilter++;
+    }
+    return pszSave;
+}
+
+/*****************************************************************************/
+/* C/C++ switching */
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+/*****************************************************************************/
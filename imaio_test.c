@@ -4,15 +4,384 @@
 /*****************************************************************************/
 
 #include "imaio.h"
-#include <tchar.h>
+#ifdef _WIN32
+    #include <tchar.h>
+#else
+    #define _T(x)   x
+#endif
 #include <assert.h>
+#include <string.h>
+#include <time.h>
+
+static int s_failures = 0;
+
+/* print the result of a check */
+static void
+check(const char *what, bool ok)
+{
+    printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+    fflush(stdout);
+    if (!ok)
+        ++s_failures;
+}
+
+/* do the images have the same size, bpp and pixels? */
+static bool
+same_pixels(II_HIMAGE hbm1, II_HIMAGE hbm2)
+{
+    II_IMGINFO bm1, bm2;
+    int y, cb;
+
+    if (!ii_get_info(hbm1, &bm1) || !ii_get_info(hbm2, &bm2))
+        return false;
+    if (bm1.bmWidth != bm2.bmWidth || bm1.bmHeight != bm2.bmHeight ||
+        bm1.bmBitsPixel != bm2.bmBitsPixel)
+    {
+        return false;
+    }
+    cb = (bm1.bmWidth * bm1.bmBitsPixel + 7) / 8;
+    for (y = 0; y < bm1.bmHeight; ++y)
+    {
+        if (memcmp((const uint8_t *)bm1.bmBits + y * bm1.bmWidthBytes,
+                   (const uint8_t *)bm2.bmBits + y * bm2.bmWidthBytes, cb))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* the largest difference of the channels of 32bpp images (256 if the sizes
+   are different) */
+static int
+max_difference(II_HIMAGE hbm1, II_HIMAGE hbm2)
+{
+    II_IMGINFO bm1, bm2;
+    const uint8_t *pb1, *pb2;
+    int x, y, d, d_max;
+
+    if (!ii_get_info(hbm1, &bm1) || !ii_get_info(hbm2, &bm2))
+        return 256;
+    if (bm1.bmWidth != bm2.bmWidth || bm1.bmHeight != bm2.bmHeight ||
+        bm1.bmBitsPixel != 32 || bm2.bmBitsPixel != 32)
+    {
+        return 256;
+    }
+    d_max = 0;
+    for (y = 0; y < bm1.bmHeight; ++y)
+    {
+        pb1 = (const uint8_t *)bm1.bmBits + y * bm1.bmWidthBytes;
+        pb2 = (const uint8_t *)bm2.bmBits + y * bm2.bmWidthBytes;
+        for (x = 0; x < bm1.bmWidth * 4; ++x)
+        {
+            d = (pb1[x] > pb2[x]) ? pb1[x] - pb2[x] : pb2[x] - pb1[x];
+            if (d > d_max)
+                d_max = d;
+        }
+    }
+    return d_max;
+}
+
+/* the BGRA of a pixel of a 32bpp image (y from the top) */
+static uint32_t
+get_pixel32(II_HIMAGE hbm32bpp, int x, int y)
+{
+    II_IMGINFO bm;
+    ii_get_info(hbm32bpp, &bm);
+    return ((const uint32_t *)((const uint8_t *)bm.bmBits +
+            (bm.bmHeight - 1 - y) * bm.bmWidthBytes))[x];
+}
+
+/* fill the pixels with a pattern */
+static void
+fill_pattern(II_HIMAGE hbm, unsigned seed)
+{
+    II_IMGINFO bm;
+    uint8_t *pb;
+    int i, cb;
+
+    ii_get_info(hbm, &bm);
+    pb = (uint8_t *)bm.bmBits;
+    cb = bm.bmWidthBytes * bm.bmHeight;
+    for (i = 0; i < cb; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        pb[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+/* the palettes of the nearest color tests */
+#define NUM_TEST_PALETTES   4
+static II_PALETTE *
+test_palette(int i)
+{
+    II_COLOR8 colors[256];
+    unsigned seed = 7;
+    int k, n;
+
+    memset(colors, 0, sizeof(colors));
+    switch (i)
+    {
+    case 0:
+    case 1:
+        /* random colors (not a multiple of the SIMD width) */
+        n = (i == 0) ? 256 : 21;
+        for (k = 0; k < n * 4; ++k)
+        {
+            seed = seed * 1103515245 + 12345;
+            colors[k / 4].value[k % 4] = (uint8_t)(seed >> 16);
+        }
+        break;
+    case 2:
+        /* NOTE: The cell centers are equidistant from the neighbor grays,
+         *       and each gray is there twice. */
+        n = 64;
+        for (k = 0; k < n; ++k)
+        {
+            colors[k].value[0] = colors[k].value[1] =
+                colors[k].value[2] = (uint8_t)((k % 32) * 8);
+        }
+        break;
+    default:
+        /* few colors in the middle of the cells */
+        n = 5;
+        for (k = 0; k < n; ++k)
+        {
+            colors[k].value[0] = (uint8_t)(k * 64);
+            colors[k].value[1] = (uint8_t)(255 - k * 64);
+            colors[k].value[2] = 128;
+        }
+        break;
+    }
+    return ii_palette_create(n, colors);
+}
+
+/* the colors of the nearest color tests: every cell center and random */
+#define NUM_TEST_COLORS     (32 * 32 * 32 + 10000)
+static void
+test_color(int i, II_COLOR8 *color)
+{
+    unsigned seed;
+
+    if (i < 32 * 32 * 32)
+    {
+        color->value[0] = (uint8_t)((i & 0x1F) * 8 + 4);
+        color->value[1] = (uint8_t)(((i >> 5) & 0x1F) * 8 + 4);
+        color->value[2] = (uint8_t)(((i >> 10) & 0x1F) * 8 + 4);
+    }
+    else
+    {
+        seed = (unsigned)i * 2654435761U;
+        color->value[0] = (uint8_t)(seed >> 8);
+        color->value[1] = (uint8_t)(seed >> 16);
+        color->value[2] = (uint8_t)(seed >> 24);
+    }
+    color->value[3] = 0;
+}
+
+/* store a little-endian 32-bit value */
+static void
+put_dword(uint8_t *pb, uint32_t value)
+{
+    pb[0] = (uint8_t)(value);
+    pb[1] = (uint8_t)(value >> 8);
+    pb[2] = (uint8_t)(value >> 16);
+    pb[3] = (uint8_t)(value >> 24);
+}
+
+/* write a 24bpp BMP whose pixels start at the 4-byte aligned offset 56 */
+static bool
+write_padded_bmp(const char *pszFileName, II_HIMAGE hbm24bpp)
+{
+    II_IMGINFO bm;
+    uint8_t header[56];
+    uint32_t cbBits;
+    FILE *fp;
+    bool ok;
+
+    ii_get_info(hbm24bpp, &bm);
+    cbBits = (uint32_t)(bm.bmWidthBytes * bm.bmHeight);
+
+    memset(header, 0, sizeof(header));
+    header[0] = 'B';
+    header[1] = 'M';
+    put_dword(header + 2, sizeof(header) + cbBits);    /* bfSize */
+    put_dword(header + 10, sizeof(header));            /* bfOffBits */
+    put_dword(header + 14, 40);                        /* biSize */
+    put_dword(header + 18, bm.bmWidth);                /* biWidth */
+    put_dword(header + 22, bm.bmHeight);               /* biHeight */
+    put_dword(header + 26, 0x00180001);                /* biPlanes, biBitCount */
+    put_dword(header + 34, cbBits);                    /* biSizeImage */
+
+    fp = fopen(pszFileName, "wb");
+    if (fp == NULL)
+        return false;
+    ok = (fwrite(header, sizeof(header), 1, fp) == 1 &&
+          fwrite(bm.bmBits, cbBits, 1, fp) == 1);
+    fclose(fp);
+    return ok;
+}
+
+/* decode a file by feeding its bytes in pieces of cbPiece bytes */
+static II_HIMAGE
+decode_in_pieces(const char *pszFileName, II_IMAGE_TYPE type, size_t cbPiece)
+{
+    II_DECODER *dec;
+    II_HIMAGE hbm = NULL;
+    uint8_t buf[4096];
+    FILE *fp;
+    size_t cb;
+    bool ok = true;
+
+    assert(cbPiece <= sizeof(buf));
+    fp = fopen(pszFileName, "rb");
+    if (fp == NULL)
+        return NULL;
+
+    dec = ii_decoder_create(type, NULL, NULL);
+    if (dec)
+    {
+        while (ok && (cb = fread(buf, 1, cbPiece, fp)) > 0)
+            ok = ii_decoder_feed(dec, buf, cb);
+        if (ok && ii_decoder_done(dec))
+            hbm = ii_decoder_detach(dec);
+        ii_decoder_destroy(dec);
+    }
+    fclose(fp);
+    return hbm;
+}
+
+/* encode an image in strips of cyStrip rows from the top */
+static bool
+encode_in_strips(const char *pszFileName, II_IMAGE_TYPE type, II_HIMAGE hbm,
+                 int cyStrip)
+{
+    II_ENCODER *enc;
+    II_IMGINFO bm;
+    const uint8_t *pb;
+    int y, cy;
+
+    ii_get_info(hbm, &bm);
+    enc = ii_encoder_begin_a(pszFileName, type, bm.bmWidth, bm.bmHeight,
+                             bm.bmBitsPixel, 0, 100, false);
+    if (enc == NULL)
+        return false;
+
+    for (y = 0; y < bm.bmHeight; y += cy)
+    {
+        cy = bm.bmHeight - y;
+        if (cy > cyStrip)
+            cy = cyStrip;
+        pb = (const uint8_t *)bm.bmBits +
+             (bm.bmHeight - 1 - y) * bm.bmWidthBytes;
+        if (!ii_encoder_write_rows(enc, pb, -bm.bmWidthBytes, cy))
+            break;
+    }
+    return ii_encoder_end(enc);
+}
+
+/* composite a 32bpp source onto a 32bpp image as ii_composite documents */
+static void
+composite_reference(II_HIMAGE hbm, int x, int y, II_HIMAGE hbmSrc,
+                    uint8_t bSCA)
+{
+    II_IMGINFO bm, bmSrc;
+    const uint8_t *src;
+    uint8_t *dest;
+    uint32_t v[4], inv;
+    int xx, yy, i;
+
+    ii_get_info(hbm, &bm);
+    ii_get_info(hbmSrc, &bmSrc);
+    for (yy = 0; yy < bmSrc.bmHeight; ++yy)
+    {
+        if (y + yy < 0 || y + yy >= bm.bmHeight)
+            continue;
+        for (xx = 0; xx < bmSrc.bmWidth; ++xx)
+        {
+            if (x + xx < 0 || x + xx >= bm.bmWidth)
+                continue;
+            src = (const uint8_t *)bmSrc.bmBits +
+                  (bmSrc.bmHeight - 1 - yy) * bmSrc.bmWidthBytes + xx * 4;
+            dest = (uint8_t *)bm.bmBits +
+                   (bm.bmHeight - 1 - (y + yy)) * bm.bmWidthBytes +
+                   (x + xx) * 4;
+            for (i = 0; i < 4; ++i)
+            {
+                v[i] = (i < 3) ? src[i] * src[3] / 255 : src[3];
+                v[i] = v[i] * bSCA / 255;
+            }
+            inv = 255 - v[3];
+            for (i = 0; i < 4; ++i)
+                dest[i] = (uint8_t)(v[i] + dest[i] * inv / 255);
+        }
+    }
+}
+
+/* the bytes of a pixel of the format */
+static int
+pixel_format_bytes(II_PIXEL_FORMAT fmt)
+{
+    switch (fmt)
+    {
+    case II_PIXEL_FORMAT_GRAY8:
+        return 1;
+    case II_PIXEL_FORMAT_BGR24:
+    case II_PIXEL_FORMAT_RGB24:
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+/* convert a pixel as ii_convert_pixels documents */
+static void
+convert_pixel_reference(II_PIXEL_FORMAT src_fmt, const uint8_t *src,
+                        II_PIXEL_FORMAT dst_fmt, uint8_t *dst)
+{
+    uint8_t b, g, r, a = 0xFF;
+
+    switch (src_fmt)
+    {
+    case II_PIXEL_FORMAT_GRAY8:
+        b = g = r = src[0];
+        break;
+    case II_PIXEL_FORMAT_BGR24:
+    case II_PIXEL_FORMAT_BGRA32:
+        b = src[0]; g = src[1]; r = src[2];
+        break;
+    default:
+        r = src[0]; g = src[1]; b = src[2];
+        break;
+    }
+    if (src_fmt == II_PIXEL_FORMAT_BGRA32 || src_fmt == II_PIXEL_FORMAT_RGBA32)
+        a = src[3];
+
+    switch (dst_fmt)
+    {
+    case II_PIXEL_FORMAT_GRAY8:
+        dst[0] = (uint8_t)((b + g + r) / 3);
+        break;
+    case II_PIXEL_FORMAT_BGR24:
+    case II_PIXEL_FORMAT_BGRA32:
+        dst[0] = b; dst[1] = g; dst[2] = r;
+        break;
+    default:
+        dst[0] = r; dst[1] = g; dst[2] = b;
+        break;
+    }
+    if (dst_fmt == II_PIXEL_FORMAT_BGRA32 || dst_fmt == II_PIXEL_FORMAT_RGBA32)
+        dst[3] = a;
+}
 
 int main(void)
 {
     int i, i_trans;
     II_ANIGIF *anigif;
     II_PALETTE *table;
+#ifdef PNG_APNG_SUPPORTED
     II_APNG *apng;
+#endif
 
     II_HIMAGE ahbm[10] = {NULL};
 
@@ -52,14 +421,17 @@ int main(void)
     anigif->loop_count = 3;
     anigif->flags = II_FLAG_USE_SCREEN;
     ii_anigif_save(_T("new_anime.gif"), anigif);
+#ifdef PNG_APNG_SUPPORTED
     printf("apng from anigif\n");
     fflush(stdout);
     apng = ii_apng_from_anigif(anigif);
     ii_apng_save(_T("new_anime.png"), apng);
     ii_apng_destroy(apng);
+#endif
     ii_anigif_destroy(anigif);
     printf("\n");
 
+#ifdef PNG_APNG_SUPPORTED
     /* apng to png */
     printf("apng to png\n");
     fflush(stdout);
@@ -93,6 +465,7 @@ int main(void)
     ii_anigif_save(_T("new-clock-opt.gif"), anigif);
     ii_anigif_destroy(anigif);
     ii_apng_destroy(apng);
+#endif
 
     /* jpeg to bmp */
     printf("jpeg to bmp\n");
@@ -157,7 +530,7 @@ int main(void)
     /* bmp to jpeg */
     printf("bmp to jpeg\n");
     fflush(stdout);
-    ii_jpg_save(_T("money.jpg"), ahbm[4], 100, FALSE, 0);
+    ii_jpg_save(_T("money.jpg"), ahbm[4], 100, false, 0);
 
     /* bmp to gif */
     printf("bmp to gif\n");
@@ -174,6 +547,779 @@ int main(void)
     fflush(stdout);
     ii_tif_save(_T("money.tif"), ahbm[4], 0);
 
+    /* thumbnail */
+    printf("thumbnail\n");
+    fflush(stdout);
+    {
+        II_HIMAGE hbm = ii_resample(ahbm[4], 64, 64, II_FILTER_BOX);
+        ii_png_save(_T("money_thumb.png"), hbm, 0);
+        ii_destroy(hbm);
+    }
+
+    /* incremental decoding */
+    printf("incremental decoding\n");
+    fflush(stdout);
+    {
+        II_HIMAGE hbm1, hbm2;
+
+        hbm1 = ii_png_load_a("money.png", NULL);
+        hbm2 = decode_in_pieces("money.png", II_IMAGE_TYPE_PNG, 100);
+        check("png in pieces", hbm1 && hbm2 && same_pixels(hbm1, hbm2));
+        ii_destroy(hbm1);
+        ii_destroy(hbm2);
+
+        hbm1 = ii_png_load_a("star.png", NULL);
+        hbm2 = decode_in_pieces("star.png", II_IMAGE_TYPE_PNG, 1);
+        check("png in bytes", hbm1 && hbm2 && same_pixels(hbm1, hbm2));
+        ii_destroy(hbm1);
+        ii_destroy(hbm2);
+
+        hbm1 = ii_jpg_load_a("grad.jpg", NULL);
+        hbm2 = decode_in_pieces("grad.jpg", II_IMAGE_TYPE_JPG, 37);
+        check("jpeg in pieces", hbm1 && hbm2 && same_pixels(hbm1, hbm2));
+        ii_destroy(hbm1);
+        ii_destroy(hbm2);
+    }
+
+    /* streaming encoding */
+    printf("streaming encoding\n");
+    fflush(stdout);
+    {
+        II_HIMAGE hbm, hbm1, hbm2;
+
+        hbm = ii_create_24bpp(45, 30);
+        fill_pattern(hbm, 18);
+
+        ii_bmp_save_a("saved.bmp", hbm, 0);
+        encode_in_strips("encoded.bmp", II_IMAGE_TYPE_BMP, hbm, 7);
+        hbm1 = ii_bmp_load_a("saved.bmp", NULL);
+        hbm2 = ii_bmp_load_a("encoded.bmp", NULL);
+        check("bmp encoder", hbm1 && hbm2 && same_pixels(hbm1, hbm2));
+        ii_destroy(hbm1);
+        ii_destroy(hbm2);
+
+        ii_png_save_a("saved.png", hbm, 0);
+        encode_in_strips("encoded.png", II_IMAGE_TYPE_PNG, hbm, 7);
+        hbm1 = ii_png_load_a("saved.png", NULL);
+        hbm2 = ii_png_load_a("encoded.png", NULL);
+        check("png encoder", hbm1 && hbm2 && same_pixels(hbm1, hbm2));
+        ii_destroy(hbm1);
+        ii_destroy(hbm2);
+
+        ii_tif_save_a("saved.tif", hbm, 0);
+        encode_in_strips("encoded.tif", II_IMAGE_TYPE_TIF, hbm, 7);
+        hbm1 = ii_tif_load_a("saved.tif", NULL);
+        hbm2 = ii_tif_load_a("encoded.tif", NULL);
+        check("tiff encoder", hbm1 && hbm2 && same_pixels(hbm1, hbm2));
+        ii_destroy(hbm1);
+        ii_destroy(hbm2);
+
+        ii_destroy(hbm);
+    }
+
+    /* stretching */
+    printf("stretching\n");
+    fflush(stdout);
+    {
+        static const int asize[][4] =
+        {
+            { 103, 61, 57, 40 }, { 57, 40, 211, 97 }, { 3, 1, 40, 9 }
+        };
+        II_HIMAGE hbm, hbm1, hbm2;
+        clock_t t0, t1, t2;
+
+        /* NOTE: The SIMD code must give the same pixels as the C code. */
+        for (i = 0; i < 3; ++i)
+        {
+            hbm = ii_create_32bpp(asize[i][0], asize[i][1]);
+            fill_pattern(hbm, 2);
+            ii_set_simd(false);
+            hbm1 = ii_stretched_32bpp(hbm, asize[i][2], asize[i][3]);
+            ii_set_simd(true);
+            hbm2 = ii_stretched_32bpp(hbm, asize[i][2], asize[i][3]);
+            check("stretch with and without SIMD",
+                  hbm1 && hbm2 && same_pixels(hbm1, hbm2));
+            ii_destroy(hbm);
+            ii_destroy(hbm1);
+            ii_destroy(hbm2);
+        }
+
+        /* the speed of 1920x1080 to 1280x720 */
+        hbm = ii_create_32bpp(1920, 1080);
+        fill_pattern(hbm, 2);
+        t0 = clock();
+        ii_set_simd(false);
+        for (i = 0; i < 10; ++i)
+            ii_destroy(ii_stretched_32bpp(hbm, 1280, 720));
+        t1 = clock();
+        ii_set_simd(true);
+        for (i = 0; i < 10; ++i)
+            ii_destroy(ii_stretched_32bpp(hbm, 1280, 720));
+        t2 = clock();
+        printf("stretch without SIMD: %.1f ms, with SIMD: %.1f ms\n",
+               (t1 - t0) * 100.0 / CLOCKS_PER_SEC,
+               (t2 - t1) * 100.0 / CLOCKS_PER_SEC);
+        ii_destroy(hbm);
+    }
+
+    /* palette search */
+    printf("palette search\n");
+    fflush(stdout);
+    {
+        II_PALETTE *table;
+        II_PALETTE_PLANES planes;
+        II_PALETTE_INDEX *index;
+        II_COLOR8 color;
+        int k, m, expected;
+        bool ok_planes, ok_index;
+
+        /* NOTE: The faster searches must give the same index as the brute
+         *       force search, even if the distances are tied. */
+        for (i = 0; i < NUM_TEST_PALETTES; ++i)
+        {
+            table = test_palette(i);
+            ok_planes = (table != NULL);
+            for (m = 0; ok_planes && m < 2; ++m)
+            {
+                ii_set_simd(m != 0);
+                ii_palette_planes_init(&planes, table);
+                for (k = 0; k < NUM_TEST_COLORS; ++k)
+                {
+                    test_color(k, &color);
+                    ii_set_simd(false);
+                    expected = ii_color_nearest_index(table, &color);
+                    ii_set_simd(m != 0);
+                    if (ii_palette_planes_nearest(&planes, &color) != expected)
+                        ok_planes = false;
+                }
+            }
+            ii_set_simd(true);
+            check("palette planes", ok_planes);
+
+            index = table ? ii_palette_index_create(table) : NULL;
+            ok_index = (index != NULL);
+            for (k = 0; ok_index && k < NUM_TEST_COLORS; ++k)
+            {
+                test_color(k, &color);
+                ii_set_simd(false);
+                expected = ii_color_nearest_index(table, &color);
+                ii_set_simd(true);
+                if (ii_palette_index_nearest(index, &color) != expected)
+                    ok_index = false;
+            }
+            check("palette index", ok_index);
+            ii_palette_index_destroy(index);
+            ii_palette_destroy(table);
+        }
+    }
+
+    /* dithering */
+    printf("dithering\n");
+    fflush(stdout);
+    {
+        /* NOTE: The expected indexes (from the top) were checked against
+         *       a separate serpentine Floyd-Steinberg and Bayer 8x8. */
+        static const uint8_t abExpected[2][8][8] =
+        {
+            {
+                { 0, 4, 0, 5, 0, 5, 1, 5 }, { 4, 2, 5, 2, 5, 2, 5, 1 },
+                { 0, 4, 0, 5, 0, 5, 1, 5 }, { 6, 0, 7, 0, 7, 0, 7, 1 },
+                { 0, 6, 0, 7, 0, 7, 1, 7 }, { 6, 0, 6, 1, 6, 1, 7, 1 },
+                { 2, 6, 3, 6, 3, 6, 3, 7 }, { 6, 2, 6, 3, 6, 3, 7, 3 }
+            },
+            {
+                { 4, 0, 4, 0, 5, 1, 5, 1 }, { 0, 4, 0, 4, 0, 5, 1, 5 },
+                { 4, 0, 7, 0, 5, 1, 7, 1 }, { 0, 4, 0, 7, 0, 5, 1, 7 },
+                { 6, 2, 6, 0, 7, 3, 7, 1 }, { 2, 6, 0, 6, 2, 7, 1, 7 },
+                { 6, 2, 7, 2, 7, 3, 7, 3 }, { 2, 6, 2, 7, 2, 7, 3, 7 }
+            }
+        };
+        static const II_FLAGS aflags[2] = { 0, II_FLAG_ORDERED_DITHER };
+        II_COLOR8 colors[8];
+        II_PALETTE *table;
+        II_HIMAGE hbm, hbm1, hbm2;
+        II_IMGINFO bm;
+        uint32_t *pdw;
+        const uint8_t *pb;
+        int x, y, k, value, whites, expected;
+        bool ok;
+
+        /* the corners of the RGB cube */
+        for (k = 0; k < 8; ++k)
+        {
+            colors[k].value[0] = (uint8_t)((k & 1) ? 255 : 0);
+            colors[k].value[1] = (uint8_t)((k & 2) ? 255 : 0);
+            colors[k].value[2] = (uint8_t)((k & 4) ? 255 : 0);
+            colors[k].value[3] = 0;
+        }
+        table = ii_palette_create(8, colors);
+
+        /* a blue and green gradient with the half red */
+        hbm = ii_create_32bpp(8, 8);
+        ii_get_info(hbm, &bm);
+        for (y = 0; y < 8; ++y)
+        {
+            pdw = (uint32_t *)((uint8_t *)bm.bmBits +
+                               (7 - y) * bm.bmWidthBytes);
+            for (x = 0; x < 8; ++x)
+                pdw[x] = 0xFF800000 | ((y * 32 + 16) << 8) | (x * 32 + 16);
+        }
+
+        for (i = 0; i < 2; ++i)
+        {
+            ii_set_simd(false);
+            hbm1 = ii_reduce_colors_ex(hbm, table, NULL, aflags[i]);
+            ii_set_simd(true);
+            hbm2 = ii_reduce_colors_ex(hbm, table, NULL, aflags[i]);
+            ok = (hbm1 && hbm2 && same_pixels(hbm1, hbm2));
+            if (ok)
+            {
+                ii_get_info(hbm1, &bm);
+                for (y = 0; y < 8; ++y)
+                {
+                    pb = (const uint8_t *)bm.bmBits +
+                         (7 - y) * bm.bmWidthBytes;
+                    if (memcmp(pb, abExpected[i][y], 8) != 0)
+                        ok = false;
+                }
+            }
+            check(i ? "ordered dither" : "Floyd-Steinberg dither", ok);
+            ii_destroy(hbm1);
+            ii_destroy(hbm2);
+        }
+        ii_destroy(hbm);
+        ii_palette_destroy(table);
+
+        /* NOTE: The saturated ends of a gradient make the largest errors.
+         *       Floyd-Steinberg keeps the mean of each strip of columns
+         *       unless the errors overflow. */
+        memset(colors, 0, sizeof(colors));
+        colors[1].value[0] = colors[1].value[1] = colors[1].value[2] = 255;
+        table = ii_palette_create(2, colors);
+        hbm = ii_create_32bpp(256, 64);
+        ii_get_info(hbm, &bm);
+        for (y = 0; y < bm.bmHeight; ++y)
+        {
+            pdw = (uint32_t *)((uint8_t *)bm.bmBits + y * bm.bmWidthBytes);
+            for (x = 0; x < bm.bmWidth; ++x)
+            {
+                value = (x - 64) * 2;
+                value = (value < 0) ? 0 : ((value > 255) ? 255 : value);
+                pdw[x] = 0xFF000000 | (0x010101 * value);
+            }
+        }
+        for (i = 0; i < 2; ++i)
+        {
+            hbm1 = ii_reduce_colors_ex(hbm, table, NULL, aflags[i]);
+            ok = (hbm1 != NULL && ii_get_info(hbm1, &bm));
+            for (x = 0; ok && x < 256; x += 32)
+            {
+                whites = expected = 0;
+                for (y = 0; y < bm.bmHeight; ++y)
+                {
+                    pb = (const uint8_t *)bm.bmBits + y * bm.bmWidthBytes;
+                    for (k = x; k < x + 32; ++k)
+                        whites += pb[k];
+                }
+                for (k = x; k < x + 32; ++k)
+                {
+                    value = (k - 64) * 2;
+                    expected += (value < 0) ? 0 :
+                                ((value > 255) ? 255 : value);
+                }
+                /* the white pixels of 32 x 64 against the mean */
+                expected = expected * 64 / 255;
+                if (x < 64 || x >= 192)
+                    ok = (whites == expected);
+                else if (i == 0)
+                    ok = (whites - expected <= 32 && expected - whites <= 32);
+            }
+            check(i ? "ordered dither of saturated gradient" :
+                      "Floyd-Steinberg dither of saturated gradient", ok);
+            ii_destroy(hbm1);
+        }
+        ii_destroy(hbm);
+        ii_palette_destroy(table);
+    }
+
+    /* rotation */
+    printf("rotation\n");
+    fflush(stdout);
+    {
+        static const int abpp[] = { 8, 24, 32 };
+        static const double aangle[] =
+        {
+            3.14159265358979323846 / 2, 3.14159265358979323846,
+            -3.14159265358979323846 / 2
+        };
+        II_PALETTE *table;
+        II_HIMAGE hbm, hbm1, hbm2, hbm3;
+
+        /* NOTE: The quarter turns and the transpositions move the pixels
+         *       exactly in every bpp. */
+        table = ii_palette_fixed(false);
+        for (i = 0; i < 3; ++i)
+        {
+            hbm = ii_create(37, 23, abpp[i], table);
+            fill_pattern(hbm, 31);
+
+            hbm1 = ii_rotate90(hbm, 1);
+            hbm2 = ii_rotate90(hbm1, 1);
+            hbm3 = ii_clone(hbm);
+            check("two quarter turns are a flip of both axes",
+                  hbm2 && hbm3 &&
+                  ii_flip_inplace(hbm3, II_FLAG_FLIP_HORIZONTAL |
+                                        II_FLAG_FLIP_VERTICAL) &&
+                  same_pixels(hbm2, hbm3));
+            ii_destroy(hbm1);
+            ii_destroy(hbm2);
+            ii_destroy(hbm3);
+
+            hbm1 = ii_transpose(hbm);
+            hbm2 = ii_transpose(hbm1);
+            check("two transpositions are the identity",
+                  hbm2 && same_pixels(hbm, hbm2));
+            ii_destroy(hbm1);
+            ii_destroy(hbm2);
+            ii_destroy(hbm);
+        }
+        ii_palette_destroy(table);
+
+        /* the fast paths of the multiples of 90 degrees against the
+           general path */
+        hbm = ii_create_32bpp(37, 23);
+        fill_pattern(hbm, 32);
+        for (i = 0; i < 3; ++i)
+        {
+            hbm1 = ii_rotated_32bpp(hbm, aangle[i], true);
+            hbm2 = ii_rotated_32bpp(hbm, aangle[i] + 1e-9, true);
+            check("rotation by 90 degrees against the general path",
+                  hbm1 && hbm2 && max_difference(hbm1, hbm2) <= 1);
+            ii_destroy(hbm1);
+            ii_destroy(hbm2);
+        }
+        ii_destroy(hbm);
+    }
+
+    /* views */
+    printf("views\n");
+    fflush(stdout);
+    {
+        II_HIMAGE hbm, hbm2;
+        II_IMGINFO bm;
+        II_VIEW view, sub, sub2;
+        uint32_t *pdw;
+        int x, y;
+        bool ok;
+
+        hbm = ii_create_32bpp(16, 8);
+        fill_pattern(hbm, 41);
+        ii_get_info(hbm, &bm);
+        for (y = 0; y < bm.bmHeight; ++y)
+        {
+            pdw = (uint32_t *)((uint8_t *)bm.bmBits + y * bm.bmWidthBytes);
+            for (x = 0; x < bm.bmWidth; ++x)
+                pdw[x] |= 0xFF000000;
+        }
+
+        /* NOTE: ii_view_sub rejects the rectangles out of the view. */
+        ok = ii_view_create(&view, hbm) &&
+             ii_view_sub(&sub, &view, 0, 0, 16, 8) &&
+             !ii_view_sub(&sub, &view, -1, 0, 4, 4) &&
+             !ii_view_sub(&sub, &view, 0, -1, 4, 4) &&
+             !ii_view_sub(&sub, &view, 13, 0, 4, 4) &&
+             !ii_view_sub(&sub, &view, 0, 5, 4, 4) &&
+             !ii_view_sub(&sub, &view, 2, 2, 0, 4) &&
+             ii_view_sub(&sub, &view, 5, 3, 4, 2) &&
+             !ii_view_sub(&sub2, &sub, 1, 1, 4, 1) &&
+             ii_view_sub(&sub2, &sub, 1, 1, 3, 1) &&
+             sub2.x == 6 && sub2.y == 4;
+        check("sub-view bounds", ok);
+
+        /* a write to a view is a write to the image */
+        pdw = (uint32_t *)((uint8_t *)sub.info.bmBits +
+                           (sub.info.bmHeight - 1) * sub.info.bmWidthBytes);
+        pdw[0] = 0xFF123456;
+        pdw = (uint32_t *)sub.info.bmBits;
+        pdw[3] = 0xFF654321;
+        check("view writes through to the image",
+              get_pixel32(hbm, 5, 3) == 0xFF123456 &&
+              get_pixel32(hbm, 8, 4) == 0xFF654321);
+
+        /* ii_put_view puts the rectangle of the view */
+        hbm2 = ii_create_32bpp(7, 5);
+        ok = (hbm2 != NULL);
+        if (ok)
+        {
+            ii_get_info(hbm2, &bm);
+            memset(bm.bmBits, 0, bm.bmWidthBytes * bm.bmHeight);
+            ii_put_view(hbm2, 1, 2, &sub, NULL, 255);
+            for (y = 0; y < 5; ++y)
+            {
+                for (x = 0; x < 7; ++x)
+                {
+                    if (1 <= x && x < 5 && 2 <= y && y < 4)
+                        ok = ok && (get_pixel32(hbm2, x, y) ==
+                                    get_pixel32(hbm, x + 4, y + 1));
+                    else
+                        ok = ok && (get_pixel32(hbm2, x, y) == 0);
+                }
+            }
+        }
+        check("ii_put_view", ok);
+        ii_destroy(hbm2);
+        ii_destroy(hbm);
+    }
+
+    /* memory */
+    printf("memory\n");
+    fflush(stdout);
+    {
+        static const size_t asize[] = { 1, 3, 100, 4097, 1 << 20 };
+        static const size_t abig[] =
+        {
+            ((size_t)1 << 26) + 1, (size_t)1 << 27, (size_t)3 << 26
+        };
+        uint8_t *pb, *pb2;
+        bool ok;
+
+        ok = (II_ALIGN == 64);
+        for (i = 0; i < 5; ++i)
+        {
+            pb = (uint8_t *)ii_alloc(asize[i]);
+            ok = ok && pb && ((size_t)pb & (II_ALIGN - 1)) == 0;
+            ii_free(pb);
+        }
+        check("ii_alloc alignment", ok);
+
+        /* NOTE: The sizes of a class share the freed blocks. A block of
+         *       the largest class (2^26 bytes) fits only in an empty pool. */
+        ii_pool_trim();
+        pb = (uint8_t *)ii_alloc(1000);
+        ii_free(pb);
+        pb2 = (uint8_t *)ii_alloc(1010);
+        ok = (pb && pb == pb2);
+        ii_free(pb2);
+        ii_pool_trim();
+        pb = (uint8_t *)ii_alloc((size_t)1 << 26);
+        ii_free(pb);
+        pb2 = (uint8_t *)ii_alloc((size_t)1 << 26);
+        ok = ok && pb && pb == pb2;
+        ii_free(pb2);
+        ii_pool_trim();
+        check("ii_alloc reuses the freed blocks", ok);
+
+        /* the bigger blocks come from the allocator as they are */
+        ok = true;
+        for (i = 0; i < 3; ++i)
+        {
+            pb = (uint8_t *)ii_alloc(abig[i]);
+            ok = ok && pb && ((size_t)pb & (II_ALIGN - 1)) == 0;
+            if (pb)
+            {
+                pb[0] = 1;
+                pb[abig[i] - 1] = 2;
+            }
+            ii_free(pb);
+        }
+        check("ii_alloc of the blocks over 2^26 bytes", ok);
+    }
+
+    /* compositing */
+    printf("compositing\n");
+    fflush(stdout);
+    {
+        II_HIMAGE hbmSrc, hbm1, hbm2;
+        static const uint8_t abSCA[] = { 255, 200 };
+
+        hbmSrc = ii_create_32bpp(29, 19);
+        fill_pattern(hbmSrc, 21);
+        for (i = 0; i < 2; ++i)
+        {
+            hbm1 = ii_create_32bpp(37, 23);
+            fill_pattern(hbm1, 22);
+            hbm2 = ii_clone(hbm1);
+            ii_composite(hbm1, -3, 5, hbmSrc, 0, 0, 29, 19, NULL, abSCA[i], 0);
+            composite_reference(hbm2, -3, 5, hbmSrc, abSCA[i]);
+            check(i ? "composite with SCA" : "composite",
+                  same_pixels(hbm1, hbm2));
+            ii_destroy(hbm1);
+            ii_destroy(hbm2);
+        }
+
+        /* onto a shared image */
+        hbm1 = ii_create_32bpp_black_opaque(4, 4);
+        hbm2 = ii_share(hbm1);
+        {
+            II_HIMAGE hbmWhite = ii_create_32bpp_white(2, 2);
+            ii_composite(hbm2, 0, 0, hbmWhite, 0, 0, 2, 2, NULL, 255, 0);
+            ii_destroy(hbmWhite);
+        }
+        check("composite onto shared image",
+              get_pixel32(hbm1, 0, 0) == 0xFF000000 &&
+              get_pixel32(hbm2, 0, 0) == 0xFFFFFFFF &&
+              get_pixel32(hbm2, 2, 2) == 0xFF000000);
+        ii_destroy(hbm1);
+        ii_destroy(hbm2);
+
+#ifdef _WIN32
+        /* NOTE: Only the DIB sections can be 16bpp. */
+        {
+            II_HIMAGE hbm16 = ii_create(8, 8, 16, NULL);
+            hbm1 = ii_create_32bpp(37, 23);
+            check("composite rejects 16bpp",
+                  hbm16 && !ii_composite(hbm1, 0, 0, hbm16, 0, 0, 8, 8,
+                                         NULL, 255, 0));
+            ii_destroy(hbm1);
+            ii_destroy(hbm16);
+        }
+#endif
+        ii_destroy(hbmSrc);
+    }
+
+    /* premultiplied alpha */
+    printf("premultiplied alpha\n");
+    fflush(stdout);
+    {
+        II_HIMAGE hbm1, hbm2;
+        II_IMGINFO bm;
+        uint8_t *pb;
+        int x, y;
+
+        /* every premultiplied color for every alpha */
+        hbm1 = ii_create_32bpp(256, 256);
+        ii_get_info(hbm1, &bm);
+        for (y = 0; y < 256; ++y)
+        {
+            pb = (uint8_t *)bm.bmBits + y * bm.bmWidthBytes;
+            for (x = 0; x < 256; ++x, pb += 4)
+            {
+                pb[0] = (uint8_t)(x < y ? x : y);
+                pb[1] = (uint8_t)(255 - x < y ? 255 - x : y);
+                pb[2] = (uint8_t)(x / 2 < y ? x / 2 : y);
+                pb[3] = (uint8_t)y;
+            }
+        }
+        hbm2 = ii_clone(hbm1);
+        ii_unpremultiply(hbm2);
+        ii_premultiply(hbm2);
+        check("unpremultiply and premultiply", same_pixels(hbm1, hbm2));
+        ii_destroy(hbm1);
+        ii_destroy(hbm2);
+    }
+
+    /* alpha state */
+    printf("alpha state\n");
+    fflush(stdout);
+    {
+        II_HIMAGE hbm1, hbm2;
+        II_IMGINFO bm;
+
+        hbm1 = ii_create_32bpp_black_opaque(20, 10);
+        hbm2 = ii_share(hbm1);
+        check("opaque", ii_get_alpha_state(hbm1) == II_ALPHA_OPAQUE &&
+                        ii_get_alpha_state(hbm2) == II_ALPHA_OPAQUE);
+
+        /* NOTE: The cached state is dropped by ii_make_writable. */
+        ii_make_writable(hbm2);
+        ii_get_info(hbm2, &bm);
+        ((uint8_t *)bm.bmBits)[3] = 128;
+        check("semi-transparent after writing",
+              ii_get_alpha_state(hbm2) == II_ALPHA_SEMITRANS);
+        check("shared image untouched",
+              ii_get_alpha_state(hbm1) == II_ALPHA_OPAQUE);
+
+        ii_make_writable(hbm2);
+        ii_get_info(hbm2, &bm);
+        ((uint8_t *)bm.bmBits)[3] = 0;
+        check("binary after writing",
+              ii_get_alpha_state(hbm2) == II_ALPHA_BINARY);
+
+        ii_destroy(hbm1);
+        ii_destroy(hbm2);
+
+        /* NOTE: The pixels are written through bmBits after a query. */
+        hbm1 = ii_create_32bpp_black_opaque(20, 10);
+        ii_get_info(hbm1, &bm);
+        check("opaque before writing", ii_is_opaque(hbm1) &&
+              ii_get_alpha_state(hbm1) == II_ALPHA_OPAQUE);
+        ((uint8_t *)bm.bmBits)[3] = 0x80;
+        check("not opaque after writing", !ii_is_opaque(hbm1));
+        ii_tif_save_a("alpha.tif", hbm1, 0);
+        hbm2 = ii_tif_load_a("alpha.tif", NULL);
+        check("tiff keeps the written alpha", hbm2 && same_pixels(hbm1, hbm2));
+        ii_destroy(hbm2);
+        ii_erase_semitrans(hbm1);
+        ii_get_info(hbm1, &bm);
+        check("semi-transparent erased", ((uint8_t *)bm.bmBits)[3] != 0x80);
+        ii_destroy(hbm1);
+    }
+
+    /* alpha channel */
+    printf("alpha channel\n");
+    fflush(stdout);
+    {
+        II_HIMAGE hbm1, hbm2, hbmMask;
+        II_IMGINFO bm, bmMask;
+        static const int ax[] = { -3, 15, 30 }, ay[] = { 7, -2, 0 };
+        const uint8_t *pbMask;
+        uint8_t *pb;
+        int x, y, xx, yy;
+
+        hbmMask = ii_create_24bpp(24, 6);
+        fill_pattern(hbmMask, 24);
+        ii_get_info(hbmMask, &bmMask);
+        for (i = 0; i < 3; ++i)
+        {
+            hbm1 = ii_create_32bpp(20, 10);
+            fill_pattern(hbm1, 23);
+            hbm2 = ii_clone(hbm1);
+            ii_put_alpha_channel(hbm1, ax[i], ay[i], hbmMask);
+
+            /* the average of the mask pixel over each clipped pixel */
+            ii_get_info(hbm2, &bm);
+            for (y = 0; y < bm.bmHeight; ++y)
+            {
+                yy = y - ay[i];
+                if (yy < 0 || yy >= bmMask.bmHeight)
+                    continue;
+                for (x = 0; x < bm.bmWidth; ++x)
+                {
+                    xx = x - ax[i];
+                    if (xx < 0 || xx >= bmMask.bmWidth)
+                        continue;
+                    pbMask = (const uint8_t *)bmMask.bmBits +
+                             (bmMask.bmHeight - 1 - yy) * bmMask.bmWidthBytes +
+                             xx * 3;
+                    pb = (uint8_t *)bm.bmBits +
+                         (bm.bmHeight - 1 - y) * bm.bmWidthBytes + x * 4;
+                    pb[3] = (uint8_t)((pbMask[0] + pbMask[1] + pbMask[2]) / 3);
+                }
+            }
+            check("put alpha channel clipped", same_pixels(hbm1, hbm2));
+            ii_destroy(hbm1);
+            ii_destroy(hbm2);
+        }
+        ii_destroy(hbmMask);
+    }
+
+    /* pixel formats */
+    printf("pixel formats\n");
+    fflush(stdout);
+    {
+        /* NOTE: The width covers the SIMD blocks and the tails. */
+        enum { WIDTH = 67, HEIGHT = 3 };
+        static uint8_t src[WIDTH * HEIGHT * 4], dst[WIDTH * HEIGHT * 4];
+        static uint8_t expected[WIDTH * HEIGHT * 4];
+        II_PIXEL_FORMAT src_fmt, dst_fmt;
+        int cbSrc, cbDst, k;
+        unsigned seed = 25;
+        bool ok = true;
+
+        for (k = 0; k < (int)sizeof(src); ++k)
+        {
+            seed = seed * 1103515245 + 12345;
+            src[k] = (uint8_t)(seed >> 16);
+        }
+        for (src_fmt = II_PIXEL_FORMAT_GRAY8;
+             src_fmt <= II_PIXEL_FORMAT_RGBA32;
+             src_fmt = (II_PIXEL_FORMAT)(src_fmt + 1))
+        {
+            for (dst_fmt = II_PIXEL_FORMAT_GRAY8;
+                 dst_fmt <= II_PIXEL_FORMAT_RGBA32;
+                 dst_fmt = (II_PIXEL_FORMAT)(dst_fmt + 1))
+            {
+                cbSrc = pixel_format_bytes(src_fmt);
+                cbDst = pixel_format_bytes(dst_fmt);
+                for (k = 0; k < WIDTH * HEIGHT; ++k)
+                {
+                    convert_pixel_reference(src_fmt, &src[k * cbSrc],
+                                            dst_fmt, &expected[k * cbDst]);
+                }
+                if (!ii_convert_pixels(src_fmt, src, WIDTH * cbSrc,
+                                       dst_fmt, dst, WIDTH * cbDst,
+                                       WIDTH, HEIGHT) ||
+                    memcmp(dst, expected, WIDTH * HEIGHT * cbDst) != 0)
+                {
+                    printf("%d to %d: FAILED\n", src_fmt, dst_fmt);
+                    ok = false;
+                }
+            }
+        }
+        check("convert pixels", ok);
+    }
+
+    /* streams */
+    printf("streams\n");
+    fflush(stdout);
+    {
+        II_HIMAGE hbm, hbm1 = NULL, hbm2 = NULL;
+        II_STREAM stream;
+        II_MEMORY memory;
+        FILE *fp;
+
+        hbm = ii_create_24bpp(45, 30);
+        fill_pattern(hbm, 19);
+
+        fp = fopen("stream.png", "wb");
+        if (fp)
+        {
+            ii_stream_init_file(&stream, fp);
+            ii_png_save_stream(&stream, hbm, 0);
+            fclose(fp);
+        }
+        if (ii_map_file_a(&memory, "stream.png"))
+        {
+            ii_stream_init_mem(&stream, &memory);
+            hbm1 = ii_png_load_stream(&stream, NULL);
+            ii_unmap_file(&memory);
+        }
+        check("png streams", hbm1 && same_pixels(hbm, hbm1));
+        ii_destroy(hbm1);
+        hbm1 = NULL;
+
+        fp = fopen("stream.jpg", "wb");
+        if (fp)
+        {
+            ii_stream_init_file(&stream, fp);
+            ii_jpg_save_stream(&stream, hbm, 90, true, 0);
+            fclose(fp);
+        }
+        if (ii_map_file_a(&memory, "stream.jpg"))
+        {
+            ii_stream_init_mem(&stream, &memory);
+            hbm1 = ii_jpg_load_stream(&stream, NULL);
+            ii_unmap_file(&memory);
+        }
+        hbm2 = ii_jpg_load_a("stream.jpg", NULL);
+        check("jpeg streams", hbm1 && hbm2 && same_pixels(hbm1, hbm2));
+        ii_destroy(hbm1);
+        ii_destroy(hbm2);
+
+        ii_destroy(hbm);
+    }
+
+    /* load a BMP and save it to the same path */
+    printf("bmp load and save in place\n");
+    fflush(stdout);
+    {
+        II_HIMAGE hbm1 = ii_create_24bpp(33, 17);
+        II_HIMAGE hbm2 = NULL, hbm3 = NULL;
+        fill_pattern(hbm1, 20);
+        if (write_padded_bmp("inplace.bmp", hbm1))
+        {
+            hbm2 = ii_bmp_load_a("inplace.bmp", NULL);
+            if (hbm2 && ii_bmp_save_a("inplace.bmp", hbm2, 0))
+                hbm3 = ii_bmp_load_a("inplace.bmp", NULL);
+        }
+        check("bmp load and save in place",
+              hbm3 && same_pixels(hbm1, hbm2) && same_pixels(hbm1, hbm3));
+        ii_destroy(hbm1);
+        ii_destroy(hbm2);
+        ii_destroy(hbm3);
+    }
+
+#ifdef _WIN32
     /* loading from resource */
     printf("res gif to file bmp\n");
     fflush(stdout);
@@ -192,6 +1338,7 @@ int main(void)
     fflush(stdout);
     ahbm[6] = ii_bmp_load_res(GetModuleHandle(NULL), MAKEINTRESOURCE(1));
     ii_bmp_save(_T("money_res.bmp"), ahbm[6], 0);
+#endif
 
     ahbm[7] = ii_create_32bpp(400, 400);
     #if 1
@@ -204,7 +1351,7 @@ int main(void)
         ii_destroy(ahbm[7]);
         ahbm[7] = ii_flipped_vertical(ahbm[2]);
     #elif 1
-        ahbm[9] = ii_rotated_32bpp(ahbm[3], 3.14159 / 2, TRUE);
+        ahbm[9] = ii_rotated_32bpp(ahbm[3], 3.14159 / 2, true);
         ii_put_center(ahbm[7], 50, 50, ahbm[9], NULL);
         ahbm[8] = ii_32bpp_from_trans_8bpp(ahbm[1], &i_trans);
         ii_put(ahbm[7], 100, 20, ahbm[8], NULL);
@@ -220,5 +1367,5 @@ int main(void)
         ahbm[i] = NULL;
     }
 
-    return 0;
+    return s_failures ? 1 : 0;
 }